@@ -0,0 +1,316 @@
+//! Scaling benchmarks for the post-build phase (file collection, hierarchy building,
+//! selection propagation, cleanup and selection persistence).
+//!
+//! Synthetic preprocessed trees are generated at several sizes and depths. By default
+//! sizes up to 100k files are exercised; set `C2RUST_BENCH_MAX_FILES=1000000` to include
+//! the 1M-file runs. Besides the timings reported by criterion, every benchmark prints
+//! the number of allocations and allocated bytes of a single run to stderr.
+
+#[allow(dead_code)]
+#[path = "../src/error.rs"]
+mod error;
+#[allow(dead_code, unused_imports)]
+#[path = "../src/file_selector.rs"]
+mod file_selector;
+#[allow(dead_code, unused_imports)]
+#[path = "../src/heap_profile.rs"]
+mod heap_profile;
+#[allow(dead_code, unused_imports)]
+#[path = "../src/lock.rs"]
+mod lock;
+#[allow(dead_code, unused_imports)]
+#[path = "../src/store.rs"]
+mod store;
+#[allow(dead_code, unused_imports)]
+#[path = "../src/target_selector.rs"]
+mod target_selector;
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use file_selector::{PreprocessedFileInfo, SelectableItem};
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use tempfile::TempDir;
+
+/// Global allocator that counts allocations so each benchmark can report them
+struct CountingAlloc;
+
+static ALLOC_COUNT: AtomicUsize = AtomicUsize::new(0);
+static ALLOC_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOC_COUNT.fetch_add(1, Ordering::Relaxed);
+        ALLOC_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOC_COUNT.fetch_add(1, Ordering::Relaxed);
+        ALLOC_BYTES.fetch_add(new_size, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+const SIZES: [usize; 4] = [1_000, 10_000, 100_000, 1_000_000];
+const DEPTHS: [usize; 2] = [2, 6];
+const FEATURE: &str = "bench";
+
+/// Largest tree size to benchmark, from C2RUST_BENCH_MAX_FILES (default: 100k)
+fn max_files() -> usize {
+    std::env::var("C2RUST_BENCH_MAX_FILES")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(100_000)
+}
+
+fn sizes() -> impl Iterator<Item = usize> {
+    let max = max_files();
+    SIZES.into_iter().filter(move |&n| n <= max)
+}
+
+/// Run `f` once and print how many allocations it performed
+fn report_allocations<R>(name: &str, f: impl FnOnce() -> R) -> R {
+    let count_before = ALLOC_COUNT.load(Ordering::Relaxed);
+    let bytes_before = ALLOC_BYTES.load(Ordering::Relaxed);
+    let result = f();
+    let count = ALLOC_COUNT.load(Ordering::Relaxed) - count_before;
+    let bytes = ALLOC_BYTES.load(Ordering::Relaxed) - bytes_before;
+    eprintln!(
+        "allocations {}: {} allocation(s), {:.2} MiB",
+        name,
+        count,
+        bytes as f64 / (1024.0 * 1024.0)
+    );
+    result
+}
+
+/// Generate `n` preprocessed file paths below `c_dir`, spread over `depth` directory levels
+fn synthetic_files(c_dir: &Path, n: usize, depth: usize) -> Vec<PreprocessedFileInfo> {
+    let fanout = ((n as f64).powf(1.0 / (depth as f64 + 1.0)).ceil() as usize).max(2);
+    let mut files: Vec<PreprocessedFileInfo> = (0..n)
+        .map(|i| {
+            let mut relative = PathBuf::new();
+            let mut rest = i / fanout;
+            for level in 0..depth {
+                relative.push(format!("d{}_{}", level, rest % fanout));
+                rest /= fanout;
+            }
+            relative.push(format!("file{}.c.c2rust", i));
+            PreprocessedFileInfo {
+                path: c_dir.join(&relative),
+                display_name: relative.display().to_string(),
+            }
+        })
+        .collect();
+    files.sort_by(|a, b| a.display_name.cmp(&b.display_name));
+    files
+}
+
+/// Materialize the synthetic files on disk
+fn write_tree(files: &[PreprocessedFileInfo]) {
+    for file in files {
+        if let Some(parent) = file.path.parent() {
+            fs::create_dir_all(parent).unwrap();
+        }
+        fs::write(&file.path, "int x;\n").unwrap();
+    }
+}
+
+/// Selection that mimics a user picking every other top-level folder plus a few loose files
+fn synthetic_selection(items: &[SelectableItem]) -> Vec<usize> {
+    let mut selections = Vec::new();
+    let mut top_level_dirs = 0;
+    for (idx, item) in items.iter().enumerate() {
+        match item {
+            SelectableItem::Directory { depth: 0, .. } => {
+                if top_level_dirs % 2 == 0 {
+                    selections.push(idx);
+                }
+                top_level_dirs += 1;
+            }
+            SelectableItem::File { .. } if idx % 97 == 0 => selections.push(idx),
+            _ => {}
+        }
+    }
+    selections
+}
+
+fn bench_collect_preprocessed_files(c: &mut Criterion) {
+    let mut group = c.benchmark_group("collect_preprocessed_files");
+    group.sample_size(10);
+    for n in sizes() {
+        for depth in DEPTHS {
+            let temp_dir = TempDir::new().unwrap();
+            let c_dir = temp_dir.path().join("c");
+            write_tree(&synthetic_files(&c_dir, n, depth));
+
+            let id = format!("depth{}/{}", depth, n);
+            report_allocations(&format!("collect_preprocessed_files/{}", id), || {
+                file_selector::collect_preprocessed_files(&c_dir).unwrap()
+            });
+            group.throughput(Throughput::Elements(n as u64));
+            group.bench_function(BenchmarkId::from_parameter(&id), |b| {
+                b.iter(|| file_selector::collect_preprocessed_files(&c_dir).unwrap())
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_build_hierarchical_items(c: &mut Criterion) {
+    let mut group = c.benchmark_group("build_hierarchical_items");
+    group.sample_size(10);
+    let c_dir = PathBuf::from("/c2rust-bench/c");
+    for n in sizes() {
+        for depth in DEPTHS {
+            let files = synthetic_files(&c_dir, n, depth);
+
+            let id = format!("depth{}/{}", depth, n);
+            report_allocations(&format!("build_hierarchical_items/{}", id), || {
+                file_selector::build_hierarchical_items(&files, &c_dir)
+            });
+            group.throughput(Throughput::Elements(n as u64));
+            group.bench_function(BenchmarkId::from_parameter(&id), |b| {
+                b.iter(|| file_selector::build_hierarchical_items(&files, &c_dir))
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_resolve_selection(c: &mut Criterion) {
+    let mut group = c.benchmark_group("resolve_selection");
+    group.sample_size(10);
+    let c_dir = PathBuf::from("/c2rust-bench/c");
+    for n in sizes() {
+        for depth in DEPTHS {
+            let files = synthetic_files(&c_dir, n, depth);
+            let items = file_selector::build_hierarchical_items(&files, &c_dir);
+            let selections = synthetic_selection(&items);
+
+            let id = format!("depth{}/{}", depth, n);
+            report_allocations(&format!("resolve_selection/{}", id), || {
+                file_selector::resolve_selection(&items, selections.clone())
+            });
+            group.throughput(Throughput::Elements(n as u64));
+            group.bench_function(BenchmarkId::from_parameter(&id), |b| {
+                b.iter_batched(
+                    || selections.clone(),
+                    |selections| file_selector::resolve_selection(&items, selections),
+                    BatchSize::SmallInput,
+                )
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_cleanup_unselected_files(c: &mut Criterion) {
+    let mut group = c.benchmark_group("cleanup_unselected_files");
+    group.sample_size(10);
+    for n in sizes() {
+        for depth in DEPTHS {
+            // Every run deletes files, so each iteration gets a freshly written tree
+            let setup = || {
+                let temp_dir = TempDir::new().unwrap();
+                let c_dir = temp_dir.path().join("c");
+                let files = synthetic_files(&c_dir, n, depth);
+                write_tree(&files);
+                let items = file_selector::build_hierarchical_items(&files, &c_dir);
+                let selected = file_selector::resolve_selection(&items, synthetic_selection(&items));
+                (temp_dir, c_dir, files, selected)
+            };
+
+            let id = format!("depth{}/{}", depth, n);
+            let (_temp_dir, c_dir, files, selected) = setup();
+            report_allocations(&format!("cleanup_unselected_files/{}", id), || {
+                file_selector::cleanup_unselected_files(&files, &selected, &c_dir).unwrap()
+            });
+            group.throughput(Throughput::Elements(n as u64));
+            group.bench_function(BenchmarkId::from_parameter(&id), |b| {
+                b.iter_batched(
+                    setup,
+                    |(temp_dir, c_dir, files, selected)| {
+                        file_selector::cleanup_unselected_files(&files, &selected, &c_dir).unwrap();
+                        temp_dir
+                    },
+                    BatchSize::PerIteration,
+                )
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_save_selected_files(c: &mut Criterion) {
+    let mut group = c.benchmark_group("save_selected_files");
+    group.sample_size(10);
+    for n in sizes() {
+        let temp_dir = TempDir::new().unwrap();
+        let project_root = temp_dir.path();
+        let c_dir = project_root.join(".c2rust").join(FEATURE).join("c");
+        let selected: Vec<PathBuf> = synthetic_files(&c_dir, n, DEPTHS[0])
+            .into_iter()
+            .map(|f| f.path)
+            .collect();
+
+        report_allocations(&format!("save_selected_files/{}", n), || {
+            file_selector::save_selected_files(&selected, FEATURE, project_root).unwrap()
+        });
+        group.throughput(Throughput::Elements(n as u64));
+        // Each run starts from an empty store, as a tracking run does
+        let store_log = project_root.join(".c2rust").join(FEATURE).join(store::STORE_FILE);
+        group.bench_function(BenchmarkId::from_parameter(n), |b| {
+            b.iter_batched(
+                || {
+                    let _ = fs::remove_file(&store_log);
+                },
+                |_| file_selector::save_selected_files(&selected, FEATURE, project_root).unwrap(),
+                BatchSize::PerIteration,
+            )
+        });
+    }
+    group.finish();
+}
+
+fn bench_read_targets_list(c: &mut Criterion) {
+    let mut group = c.benchmark_group("read_targets_list");
+    group.sample_size(10);
+    for n in sizes() {
+        let temp_dir = TempDir::new().unwrap();
+        let project_root = temp_dir.path();
+        let c_dir = project_root.join(".c2rust").join(FEATURE).join("c");
+        fs::create_dir_all(&c_dir).unwrap();
+        let content: String = (0..n).map(|i| format!("libtarget{}.a\n", i)).collect();
+        fs::write(c_dir.join("targets.list"), content).unwrap();
+
+        report_allocations(&format!("read_targets_list/{}", n), || {
+            target_selector::read_targets_list(project_root, FEATURE).unwrap()
+        });
+        group.throughput(Throughput::Elements(n as u64));
+        group.bench_function(BenchmarkId::from_parameter(n), |b| {
+            b.iter(|| target_selector::read_targets_list(project_root, FEATURE).unwrap())
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_collect_preprocessed_files,
+    bench_build_hierarchical_items,
+    bench_resolve_selection,
+    bench_cleanup_unselected_files,
+    bench_save_selected_files,
+    bench_read_targets_list
+);
+criterion_main!(benches);
@@ -3,22 +3,33 @@
  * 1. C2RUST_PROJECT_ROOT: 工程的根目录，必须存在.
  * 2. C2RUST_FEATURE_ROOT: 构建的每个target都对应一个Feature, 必须存在
  * 3. C2RUST_CC: 编译程序的名字，如果不指定，则为gcc/clang/cc之一.
+ * 4. C2RUST_OVERHEAD_BUDGET: 允许的追踪额外开销(相对编译耗时的百分比), 超出后自动降级, 可选.
+ * 5. C2RUST_STAGING_DIR: tmpfs上的暂存目录, 预处理文件先写到这里再由c2rust-build批量搬运到特性目录, 可选.
+ * 6. C2RUST_PROJECT_ROOTS: 多工程表, 一次构建追踪多个各自带.c2rust的工程(monorepo), 可选.
+ * 7. C2RUST_CHUNK_INDEX: 预处理结果不小于该字节数时, 在旁边写<输出>.chunks记录顶层声明的边界, 可选.
+ * 8. C2RUST_EVENTS: 每个预处理结果完成后发布一行JSON事件的位置(追加写的日志文件, FIFO或Unix socket), 可选.
 */
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/file.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #define MAX_PATH_LEN 8192
-#define MAX_CMD_LEN 16384
 
 static const char* C2RUST_PROJECT_ROOT = "C2RUST_PROJECT_ROOT";
 static const char* C2RUST_FEATURE_ROOT = "C2RUST_FEATURE_ROOT";
@@ -26,9 +37,15 @@ static const char* C2RUST_CC = "C2RUST_CC";
 static const char* C2RUST_LD = "C2RUST_LD";
 static const char* C2RUST_CC_SKIP = "C2RUST_CC_SKIP";
 static const char* C2RUST_LD_SKIP = "C2RUST_LD_SKIP";
+static const char* C2RUST_OVERHEAD_BUDGET = "C2RUST_OVERHEAD_BUDGET";
+static const char* C2RUST_STAGING_DIR = "C2RUST_STAGING_DIR";
+static const char* C2RUST_PROJECT_ROOTS = "C2RUST_PROJECT_ROOTS";
+static const char* C2RUST_CHUNK_INDEX = "C2RUST_CHUNK_INDEX";
+static const char* C2RUST_EVENTS = "C2RUST_EVENTS";
 
 static const char* cc_names[] = {"gcc", "clang", "cc"};
-static const char* ld_names[] = {"ld", "lld"};
+// 按名字识别直接执行的链接器; 经由编译器驱动的链接在驱动进程中记录(见is_link_step), 与-fuse-ld无关.
+static const char* ld_names[] = {"ld", "ld.bfd", "lld", "ld.lld", "gold", "ld.gold", "mold", "ld.mold"};
 
 static inline int is_matched(const char* name, const char** names, int len) {
         for (int i = 0; i < len; ++i) {
@@ -70,7 +87,7 @@ static inline int is_cfile(const char* file) {
         return len > 2 && strcmp(&file[len - 2], ".c") == 0;
 }
 
-// 提取-I, -D, -U, -include参数, 和工程目录下的C文件.
+// 提取-I, -D, -U, -include参数, 语言、目标和ABI选项, 和工程目录下的C文件.
 // 输入保证extracted, cfiles最少可以保存argc个输入参数.
 static int parse_args(int argc, char* argv[], char* extracted[], char* cfiles[]) {
     int cnt = 0;
@@ -100,7 +117,22 @@ static int parse_args(int argc, char* argv[], char* extracted[], char* cfiles[])
                 if (i < argc) {
                     extracted[cnt++] = argv[i];
                 }
-        } else if (strncmp(&arg[1], "std=", 4) == 0 || strcmp(&arg[1], "fshort-enums") == 0) {
+        } else if (strcmp(arg, "-target") == 0 || strcmp(arg, "--target") == 0 || strcmp(arg, "-isysroot") == 0 ||
+                   strcmp(arg, "--sysroot") == 0 || strcmp(arg, "-mllvm") == 0) {
+                // 目标和ABI决定类型大小和预定义宏, 带单独的参数值
+                extracted[cnt++] = arg;
+                ++i;
+                if (i < argc) {
+                    extracted[cnt++] = argv[i];
+                }
+        } else if (strncmp(&arg[1], "std=", 4) == 0 || arg[1] == 'm' || strncmp(arg, "--target=", 9) == 0 ||
+                   strncmp(arg, "-isysroot", 9) == 0 || strncmp(arg, "--sysroot=", 10) == 0) {
+                // -m32, -march=, -mabi=等同样决定类型大小和预定义宏
+                extracted[cnt++] = arg;
+        } else if (arg[1] == 'f' && strncmp(arg, "-fplugin", 8) != 0 && strncmp(arg, "-fdump-", 7) != 0 &&
+                   strcmp(arg, "-fsyntax-only") != 0) {
+                // 语言方言(-funsigned-char, -fms-extensions等)和影响预定义宏的选项(-fPIC, -fopenmp等);
+                // 不带加载插件, 输出额外文件或者改变运行模式的选项
                 extracted[cnt++] = arg;
         }
     }
@@ -121,72 +153,924 @@ static const char* strip_prefix(const char* path, const char* prefix) {
         }
 }
 
-static void save_options(const char* path, int argc, char* argv[]) {
-        int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+// 多工程(monorepo): C2RUST_PROJECT_ROOTS指向c2rust-build写在.c2rust/.locks下的工程表(普通文件, 换了用户或者PID命名空间
+// 也能按路径打开), 每行为"工程根目录\t特性目录",
+// 按根目录长度从长到短排列, 第一个匹配的前缀就是最内层的工程. 每个C文件和链接目标写入所在工程的特性目录.
+struct project {
+        const char* root;
+        const char* feature_root;
+};
+
+static struct project* projects = 0;
+static int project_count = 0;
+
+// 工程表在进程生命周期内一直使用, 不释放. 读取失败时所有文件都会记到顶层工程, 因此报告到stderr.
+static void load_projects(void) {
+        const char* path = getenv(C2RUST_PROJECT_ROOTS);
+        if (!path || !*path) return;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
         if (fd == -1) {
+                fprintf(stderr, "libhook.so: cannot open project table %s: %s; subprojects are not tracked\n", path,
+                        strerror(errno));
                 return;
         }
+        struct stat st;
+        char* table = 0;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                table = malloc(st.st_size + 1);
+        }
+        if (!table || pread(fd, table, st.st_size, 0) != st.st_size) {
+                fprintf(stderr, "libhook.so: cannot read project table %s; subprojects are not tracked\n", path);
+                free(table);
+                close(fd);
+                return;
+        }
+        close(fd);
+        table[st.st_size] = 0;
+
+        int lines = 0;
+        for (const char* p = table; *p; ++p) {
+                lines += *p == '\n';
+        }
+        projects = calloc(lines, sizeof(struct project));
+        if (!projects) return;
+
+        char* line = table;
+        char* end;
+        while (project_count < lines && (end = strchr(line, '\n'))) {
+                *end = 0;
+                char* tab = strchr(line, '\t');
+                if (tab) {
+                        *tab = 0;
+                        projects[project_count].root = line;
+                        projects[project_count].feature_root = tab + 1;
+                        ++project_count;
+                }
+                line = end + 1;
+        }
+}
+
+// path是工程根目录本身或者在其下.
+static const struct project* find_project(const char* path) {
+        for (int i = 0; i < project_count; ++i) {
+                const char* root = projects[i].root;
+                if (strip_prefix(path, root) || strcmp(path, root) == 0) return &projects[i];
+        }
+        return 0;
+}
+
+// 特性状态存储: C2RUST_FEATURE_ROOT/state.log, 由c2rust-build和所有hook进程共同写入的只追加事务日志.
+// 记录格式(小端): magic(4) 负载长度(4) crc32(4) 负载; 负载由若干操作组成: 类型(1) 键长(4) 键 值长(4) 值.
+// 写入方持有flock(LOCK_EX)并用一次write追加整条记录, 读取方不加锁. 写入方被杀死或磁盘已满时留下的半条记录
+// 不影响之后追加的记录: 读取方跳过损坏的字节, 从下一条magic和crc32都正确的记录继续, 因此这里直接追加.
+// 格式与src/store.rs保持一致, targets.list和.opts文件由c2rust-build从中导出.
+#define STORE_MAGIC 0x53523243u /* "C2RS" */
+#define STORE_HEADER_LEN 12
+#define STORE_OP_PUT 1
+
+struct store_txn {
+        unsigned char* buf;
+        size_t len;
+        size_t cap;
+};
+
+static void put_u32le(unsigned char* p, uint32_t v) {
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        p[3] = v >> 24;
+}
+
+static uint32_t store_crc32(const unsigned char* p, size_t n) {
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = 0; i < n; ++i) {
+                crc ^= p[i];
+                for (int k = 0; k < 8; ++k) {
+                        crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+                }
+        }
+        return ~crc;
+}
+
+static int txn_reserve(struct store_txn* txn, size_t n) {
+        if (txn->len + n <= txn->cap) return 0;
+        size_t cap = txn->cap ? txn->cap : 256;
+        while (cap < txn->len + n) cap *= 2;
+        unsigned char* buf = realloc(txn->buf, cap);
+        if (!buf) return -1;
+        txn->buf = buf;
+        txn->cap = cap;
+        return 0;
+}
+
+// 记录头在提交时填写, 这里先预留.
+static int txn_put(struct store_txn* txn, const char* key, const char* value, size_t value_len) {
+        size_t key_len = strlen(key);
+        if (txn->len == 0) {
+                if (txn_reserve(txn, STORE_HEADER_LEN)) return -1;
+                txn->len = STORE_HEADER_LEN;
+        }
+        if (txn_reserve(txn, 9 + key_len + value_len)) return -1;
+        unsigned char* p = &txn->buf[txn->len];
+        *p++ = STORE_OP_PUT;
+        put_u32le(p, key_len);
+        memcpy(p + 4, key, key_len);
+        p += 4 + key_len;
+        put_u32le(p, value_len);
+        memcpy(p + 4, value, value_len);
+        txn->len += 9 + key_len + value_len;
+        return 0;
+}
+
+static void store_commit(struct store_txn* txn, const char* feature_root) {
+        char path[MAX_PATH_LEN];
+        if (txn->len <= STORE_HEADER_LEN) goto out;
+        if (snprintf(path, sizeof(path), "%s/state.log", feature_root) >= sizeof(path)) goto out;
+
+        uint32_t payload_len = txn->len - STORE_HEADER_LEN;
+        put_u32le(txn->buf, STORE_MAGIC);
+        put_u32le(&txn->buf[4], payload_len);
+        put_u32le(&txn->buf[8], store_crc32(&txn->buf[STORE_HEADER_LEN], payload_len));
+
+        // 等锁期间日志可能被c2rust-build压缩后替换, 此时重新打开.
+        for (int retry = 0; retry < 8; ++retry) {
+                int fd = open(path, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+                if (fd == -1) break;
+                struct stat locked, current;
+                if (flock(fd, LOCK_EX) == 0 && fstat(fd, &locked) == 0 &&
+                    stat(path, &current) == 0 && locked.st_ino == current.st_ino) {
+                        const unsigned char* p = txn->buf;
+                        size_t left = txn->len;
+                        while (left > 0) {
+                                ssize_t n = write(fd, p, left);
+                                if (n == -1) {
+                                        if (errno == EINTR) continue;
+                                        dprintf(2, "failed to write file: %s, errno = %d\n", path, errno);
+                                        break;
+                                }
+                                p += n;
+                                left -= n;
+                        }
+                        close(fd);
+                        break;
+                }
+                close(fd);
+        }
+out:
+        free(txn->buf);
+        txn->buf = 0;
+        txn->len = txn->cap = 0;
+}
+
+// 记录编译单元: 键为tu/<相对工程目录的C文件>, 值为"工作目录\t编译器\tC文件\t编译选项".
+// 编译选项在bindgen的时候会用上, c2rust-build将其导出为.c2rust.opts文件.
+static void record_tu(const char* cc, int argc, char* argv[], const char* cfile, const char* path, const char* feature_root) {
+        char cwd[MAX_PATH_LEN];
+        if (!getcwd(cwd, sizeof(cwd))) return;
+
+        char key[MAX_PATH_LEN];
+        if (snprintf(key, sizeof(key), "tu/%s", path) >= sizeof(key)) return;
+
+        char* value = 0;
+        size_t value_len = 0;
+        FILE* stream = open_memstream(&value, &value_len);
+        if (!stream) return;
+        fprintf(stream, "%s\t%s\t%s\t", cwd, cc, cfile);
         for (int i = 0; i < argc; ++i) {
-            dprintf(fd, "\"%s\" ", argv[i]);
+                fprintf(stream, "\"%s\" ", argv[i]);
+        }
+        fclose(stream);
+
+        struct store_txn txn = {0};
+        if (txn_put(&txn, key, value, value_len) == 0) {
+                store_commit(&txn, feature_root);
+        } else {
+                free(txn.buf);
+        }
+        free(value);
+}
+
+// 额外开销预算: 每个编译进程统计自身预处理耗时和编译耗时, 累加到C2RUST_FEATURE_ROOT/overhead.state.
+// 累计的预处理耗时超过编译耗时的C2RUST_OVERHEAD_BUDGET%时逐级降级, 每次降级追加到degradations.log.
+// 级别只升不降, 下一级别基于重新统计的数据判断; 整个构建的累计值另外保存, 供性能记录使用.
+enum {
+        LEVEL_FULL = 0,         // 同步预处理, 保留注释(-C)
+        LEVEL_NO_COMMENTS,      // 同步预处理, 不保留注释
+        LEVEL_BOUNDED,          // 限制同时进行的预处理数量, 超出的部分延迟处理
+        LEVEL_DEFERRED,         // 只记录编译命令到deferred.list, 构建结束后由c2rust-build预处理
+};
+
+#define OVERHEAD_MIN_SAMPLES 8
+
+struct overhead_state {
+        // 当前级别的统计窗口, 降级时清零
+        uint64_t preprocess_ns;
+        uint64_t compile_ns;
+        uint32_t samples;
+        uint32_t level;
+        // 整个构建的累计值, 格式与src/perf.rs一致
+        uint64_t total_preprocess_ns;
+        uint64_t total_compile_ns;
+};
+
+static int overhead_budget = -1;        // -1表示不限制
+static int overhead_level = LEVEL_FULL;
+static int overhead_report = 0;         // 当前进程做了预处理(或延迟记录), 退出时需要统计
+static uint64_t overhead_start_ns;
+static uint64_t overhead_preprocess_ns;
+static char overhead_feature_root[MAX_PATH_LEN];
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int open_overhead_state(void) {
+        char path[MAX_PATH_LEN];
+        int len = snprintf(path, sizeof(path), "%s/overhead.state", overhead_feature_root);
+        if (len >= sizeof(path)) return -1;
+        return open(path, O_CREAT | O_RDWR, 0644);
+}
+
+static void overhead_init(const char* feature_root) {
+        const char* budget = getenv(C2RUST_OVERHEAD_BUDGET);
+        if (!budget || !*budget) return;
+
+        int len = snprintf(overhead_feature_root, sizeof(overhead_feature_root), "%s", feature_root);
+        if (len >= sizeof(overhead_feature_root)) return;
+        overhead_budget = atoi(budget);
+
+        int fd = open_overhead_state();
+        if (fd == -1) return;
+        struct overhead_state state;
+        if (flock(fd, LOCK_SH) == 0 && pread(fd, &state, sizeof(state), 0) == sizeof(state)) {
+                overhead_level = state.level;
         }
         close(fd);
 }
 
-static void preprocess_cfile(const char* cc, int argc, char* argv[], const char* cfile, const char* project_root, const char* feature_root) {
-        const char* path = strip_prefix(cfile, project_root); 
-        if (!path) return;
+static void log_degradation(int from, int to, uint64_t preprocess_ns, uint64_t compile_ns) {
+        char path[MAX_PATH_LEN];
+        int len = snprintf(path, sizeof(path), "%s/degradations.log", overhead_feature_root);
+        if (len >= sizeof(path)) return;
+        int fd = open(path, O_CREAT | O_WRONLY | O_APPEND, 0644);
+        if (fd == -1) return;
+        // 时间戳 原级别 新级别 开销百分比
+        dprintf(fd, "%ld\t%d\t%d\t%.1f\n", (long)time(0), from, to, preprocess_ns * 100.0 / compile_ns);
+        close(fd);
+}
 
-        // 获取预处理文件名, 后缀从.c修改为.c2rust
-        char full_path[MAX_PATH_LEN];
-        int full_path_len = snprintf(full_path, sizeof(full_path), "%s/c/%s2rust", feature_root, path);
-        if (full_path_len >= sizeof(full_path)) return;
+static void overhead_update(void) {
+        uint64_t total_ns = now_ns() - overhead_start_ns;
+        uint64_t compile_ns = total_ns > overhead_preprocess_ns ? total_ns - overhead_preprocess_ns : 0;
+
+        int fd = open_overhead_state();
+        if (fd == -1) return;
+        if (flock(fd, LOCK_EX) != 0) goto fail;
+
+        struct overhead_state state;
+        if (pread(fd, &state, sizeof(state), 0) != sizeof(state)) {
+                memset(&state, 0, sizeof(state));
+        }
+        state.preprocess_ns += overhead_preprocess_ns;
+        state.compile_ns += compile_ns;
+        state.samples += 1;
+        state.total_preprocess_ns += overhead_preprocess_ns;
+        state.total_compile_ns += compile_ns;
+
+        if (state.level < LEVEL_DEFERRED && state.samples >= OVERHEAD_MIN_SAMPLES && state.compile_ns > 0
+            && state.preprocess_ns * 100 > (uint64_t)overhead_budget * state.compile_ns) {
+                log_degradation(state.level, state.level + 1, state.preprocess_ns, state.compile_ns);
+                state.level += 1;
+                state.preprocess_ns = 0;
+                state.compile_ns = 0;
+                state.samples = 0;
+        }
+        pwrite(fd, &state, sizeof(state), 0);
+fail:
+        close(fd);
+}
+
+// 获取一个预处理槽位(最多CPU数/4个预处理同时进行), 返回持有锁的fd, 没有空闲槽位返回-1.
+static int acquire_preprocess_slot(const char* feature_root) {
+        long slots = sysconf(_SC_NPROCESSORS_ONLN) / 4;
+        if (slots < 1) slots = 1;
+        for (long i = 0; i < slots; ++i) {
+                char path[MAX_PATH_LEN];
+                int len = snprintf(path, sizeof(path), "%s/overhead.slot.%ld", feature_root, i);
+                if (len >= sizeof(path)) return -1;
+                int fd = open(path, O_CREAT | O_RDWR, 0644);
+                if (fd == -1) continue;
+                if (flock(fd, LOCK_EX | LOCK_NB) == 0) return fd;
+                close(fd);
+        }
+        return -1;
+}
+
+// 记录延迟预处理的编译: 工作目录 编译器 C文件 预处理文件, 编译选项已经记录在状态存储中.
+static void record_deferred(const char* cc, const char* cfile, const char* output, const char* feature_root) {
+        char cwd[MAX_PATH_LEN];
+        if (!getcwd(cwd, sizeof(cwd))) return;
+
+        char path[MAX_PATH_LEN];
+        int len = snprintf(path, sizeof(path), "%s/deferred.list", feature_root);
+        if (len >= sizeof(path)) return;
+        int fd = open(path, O_CREAT | O_WRONLY | O_APPEND, 0644);
+        if (fd == -1) return;
+        if (flock(fd, LOCK_EX) == 0) {
+                dprintf(fd, "%s\t%s\t%s\t%s\n", cwd, cc, cfile, output);
+        }
+        close(fd);
+}
+
+// 创建path的所有父目录, 等价于mkdir -p $(dirname path), 避免每次预处理都启动shell.
+static int mkdir_parents(char* path) {
+        for (char* p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+                *p = 0;
+                int ret = mkdir(path, 0755);
+                *p = '/';
+                if (ret == -1 && errno != EEXIST) return -1;
+        }
+        return 0;
+}
+
+// 输出内容的哈希: 64位FNV-1a, 与c2rust-build的src/outputs.rs一致.
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+                hash = (hash ^ p[i]) * FNV_PRIME;
+        }
+        return hash;
+}
+
+// 顶层声明边界扫描, 与c2rust-build的src/chunks.rs逐字节一致, 在读取编译器输出时顺带完成.
+// 声明结束于不在任何花括号, 圆括号和方括号内的';', 或者函数体(紧跟在')'之后的顶层'{')的'}'.
+// 跳过注释, 字符串, 字符常量以及预处理后剩下的指令行(如#pragma).
+enum chunk_state { CHUNK_CODE, CHUNK_SLASH, CHUNK_LINE_COMMENT, CHUNK_BLOCK_COMMENT, CHUNK_BLOCK_STAR,
+                   CHUNK_STRING, CHUNK_CHAR, CHUNK_DIRECTIVE };
+
+struct chunk_scanner {
+        enum chunk_state state;
+        int escape;
+        int line_start;
+        uint64_t depth;
+        uint64_t parens;
+        unsigned char last; // 上一个有效字符, 区分函数体和初始化列表
+        int body;
+        uint64_t offset;
+        uint64_t* ends;     // 每个顶层声明之后的偏移
+        size_t len;
+        size_t cap;
+        int failed;         // 内存不足, 不写索引
+};
+
+static void chunk_reset(struct chunk_scanner* s) {
+        free(s->ends);
+        memset(s, 0, sizeof(*s));
+        s->line_start = 1;
+}
+
+static void chunk_end(struct chunk_scanner* s) {
+        if (s->failed) return;
+        if (s->len == s->cap) {
+                size_t cap = s->cap ? s->cap * 2 : 1024;
+                uint64_t* ends = realloc(s->ends, cap * sizeof(uint64_t));
+                if (!ends) {
+                        s->failed = 1;
+                        return;
+                }
+                s->ends = ends;
+                s->cap = cap;
+        }
+        s->ends[s->len++] = s->offset + 1;
+}
+
+static void chunk_code(struct chunk_scanner* s, unsigned char c) {
+        if (c == '\n') {
+                s->line_start = 1;
+                return;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') return;
+        int line_start = s->line_start;
+        s->line_start = 0;
+        switch (c) {
+        case '#':
+                if (line_start) {
+                        s->state = CHUNK_DIRECTIVE;
+                        return;
+                }
+                break;
+        case '/':
+                s->state = CHUNK_SLASH;
+                return;
+        case '"':
+                s->state = CHUNK_STRING;
+                break;
+        case '\'':
+                s->state = CHUNK_CHAR;
+                break;
+        case '(':
+        case '[':
+                ++s->parens;
+                break;
+        case ')':
+        case ']':
+                if (s->parens > 0) --s->parens;
+                break;
+        case '{':
+                if (s->depth == 0) s->body = s->parens == 0 && s->last == ')';
+                ++s->depth;
+                break;
+        case '}':
+                if (s->depth > 0) --s->depth;
+                if (s->depth == 0 && s->body) {
+                        s->body = 0;
+                        chunk_end(s);
+                }
+                break;
+        case ';':
+                if (s->depth == 0 && s->parens == 0) chunk_end(s);
+                break;
+        }
+        s->last = c;
+}
 
-        char* filename = strrchr(full_path, '/');
-        if (!filename) return; //绝对路径一定存在.
+static void chunk_update(struct chunk_scanner* s, const unsigned char* p, size_t n) {
+        for (size_t i = 0; i < n; ++i, ++s->offset) {
+                unsigned char c = p[i];
+                switch (s->state) {
+                case CHUNK_CODE:
+                        chunk_code(s, c);
+                        break;
+                case CHUNK_SLASH:
+                        if (c == '*') {
+                                s->state = CHUNK_BLOCK_COMMENT;
+                        } else if (c == '/') {
+                                s->state = CHUNK_LINE_COMMENT;
+                        } else {
+                                s->state = CHUNK_CODE;
+                                s->last = '/';
+                                chunk_code(s, c);
+                        }
+                        break;
+                case CHUNK_LINE_COMMENT:
+                case CHUNK_DIRECTIVE:
+                        if (c == '\n') {
+                                s->state = CHUNK_CODE;
+                                s->line_start = 1;
+                        }
+                        break;
+                case CHUNK_BLOCK_COMMENT:
+                        if (c == '*') s->state = CHUNK_BLOCK_STAR;
+                        break;
+                case CHUNK_BLOCK_STAR:
+                        if (c == '/') {
+                                s->state = CHUNK_CODE;
+                        } else if (c != '*') {
+                                s->state = CHUNK_BLOCK_COMMENT;
+                        }
+                        break;
+                case CHUNK_STRING:
+                case CHUNK_CHAR:
+                        if (s->escape) {
+                                s->escape = 0;
+                        } else if (c == '\\') {
+                                s->escape = 1;
+                        } else if (c == (s->state == CHUNK_STRING ? '"' : '\'')) {
+                                s->state = CHUNK_CODE;
+                        } else if (c == '\n') {
+                                // 未结束的字面量, 不能吞掉文件剩下的部分.
+                                s->state = CHUNK_CODE;
+                                s->line_start = 1;
+                        }
+                        break;
+                }
+        }
+}
 
-        // 创建预处理后文件存储路径
-        *filename = 0; //忽略文件名
-        char cmd[MAX_CMD_LEN];
-        int cmd_len = snprintf(cmd, sizeof(cmd), "mkdir -p \"%s\"", full_path);
-        if (cmd_len >= sizeof(cmd)) return;
-        system(cmd);
-        *filename = '/'; //恢复文件名.
+// 写<输出>.chunks: 第一行"c2rust-chunks v1 <大小> <哈希>", 之后每行一个声明结束的偏移.
+// 先写临时文件再改名. 结果小于C2RUST_CHUNK_INDEX字节时删除旧索引.
+static void write_chunk_index(const char* output, const struct chunk_scanner* s, uint64_t hash, uint64_t min_bytes) {
+        char path[MAX_PATH_LEN];
+        char tmp[MAX_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s.chunks", output) >= sizeof(path)) return;
+        if (s->failed || s->offset < min_bytes) {
+                unlink(path);
+                return;
+        }
+        if (snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= sizeof(tmp)) return;
+        FILE* f = fopen(tmp, "we");
+        if (!f) return;
+        fprintf(f, "c2rust-chunks v1 %llu %016llx\n", (unsigned long long)s->offset, (unsigned long long)hash);
+        for (size_t i = 0; i < s->len; ++i) {
+                fprintf(f, "%llu\n", (unsigned long long)s->ends[i]);
+        }
+        if (fclose(f) != 0 || rename(tmp, path) == -1) {
+                unlink(tmp);
+                unlink(path);
+        }
+}
 
-        // 需要存储编译选项，bindgen的时候会用上, 存储的文件名后缀为.c2rust.opts
-        int len = snprintf(&full_path[full_path_len], sizeof(full_path) - full_path_len, ".opts");
-        if (len < sizeof(full_path) - full_path_len) {
-                // 如果没有生成这个文件，也继续.
-                save_options(full_path, argc, argv);
+static int write_all(int fd, const char* p, size_t n) {
+        while (n > 0) {
+                ssize_t written = write(fd, p, n);
+                if (written == -1) {
+                        if (errno == EINTR) continue;
+                        return -1;
+                }
+                p += written;
+                n -= written;
         }
-        full_path[full_path_len] = 0;
+        return 0;
+}
 
-        // 预处理命令, gcc和clang有差异. 不能强制用clang来替代，如果当前是gcc会导致混合构建的时候出错.
-        // clang解析gcc生成的文件可能出现错误，但是仍然能够生成json文件, 具有一定容错性.
-        // -P避免生成行号信息,混合构建时定位信息指向新生成的文件.
+// 按JSON字符串的规则写出s(不含引号), 转义引号, 反斜杠和控制字符.
+static void json_chars(FILE* f, const char* s) {
+        for (; *s; ++s) {
+                unsigned char c = *s;
+                if (c == '"' || c == '\\') {
+                        fputc('\\', f);
+                        fputc(c, f);
+                } else if (c < 0x20) {
+                        fprintf(f, "\\u%04x", c);
+                } else {
+                        fputc(c, f);
+                }
+        }
+}
+
+// 向FIFO或socket写入时屏蔽SIGPIPE: 读端中途退出只丢弃事件, 不能杀死编译进程.
+static int write_event(int fd, const char* line, size_t n) {
+        sigset_t pipe_set, old_set;
+        sigemptyset(&pipe_set);
+        sigaddset(&pipe_set, SIGPIPE);
+        sigprocmask(SIG_BLOCK, &pipe_set, &old_set);
+        int ret = write_all(fd, line, n);
+        if (ret == -1 && errno == EPIPE && !sigismember(&old_set, SIGPIPE)) {
+                // 丢弃屏蔽期间产生的SIGPIPE, 恢复屏蔽字后不再递送
+                struct timespec zero = {0, 0};
+                sigtimedwait(&pipe_set, 0, &zero);
+        }
+        sigprocmask(SIG_SETMASK, &old_set, 0);
+        return ret;
+}
+
+// 发布事件时消费者要能读到编译选项: 记录编译单元后立即写出<输出>.opts(先写临时文件再改名),
+// 格式与state.log中的记录相同, 构建结束后c2rust-build以相同内容重新导出. 只在设置了C2RUST_EVENTS时写.
+static void write_opts(int argc, char* argv[], const char* full_path) {
+        const char* events = getenv(C2RUST_EVENTS);
+        if (!events || !*events) return;
+
+        char opts[MAX_PATH_LEN];
+        char part[MAX_PATH_LEN];
+        if (snprintf(opts, sizeof(opts), "%s.opts", full_path) >= sizeof(opts)) return;
+        if (snprintf(part, sizeof(part), "%s.%d.part", opts, (int)getpid()) >= sizeof(part)) return;
+        if (mkdir_parents(part) == -1) return;
+
+        FILE* f = fopen(part, "we");
+        if (!f) return;
+        for (int i = 0; i < argc; ++i) {
+                fprintf(f, "\"%s\" ", argv[i]);
+        }
+        if (fclose(f) != 0 || rename(part, opts) == -1) {
+                unlink(part);
+        }
+}
+
+// 输出已经完整地出现在特性目录中(改名完成), 向C2RUST_EVENTS发布一行事件, 格式与src/events.rs一致:
+// {"event":"tu","feature_dir":...,"key":<C文件>,"output":...,"hash":<16位十六进制>,"flags":"<输出>.opts"}
+// 编译进程从不等待消费者: socket和FIFO都以非阻塞方式打开和写入, 没有监听者/读者或者缓冲区已满(EAGAIN)时
+// 丢弃事件; socket每个事件一个连接; 普通文件加锁追加. 失败不影响构建.
+static void publish_event(const char* feature_root, const char* path, const char* full_path, uint64_t hash) {
+        const char* events = getenv(C2RUST_EVENTS);
+        if (!events || !*events) return;
+
+        char* line = 0;
+        size_t n = 0;
+        FILE* f = open_memstream(&line, &n);
+        if (!f) return;
+        fputs("{\"event\":\"tu\",\"feature_dir\":\"", f);
+        json_chars(f, feature_root);
+        fputs("\",\"key\":\"", f);
+        json_chars(f, path);
+        fputs("\",\"output\":\"", f);
+        json_chars(f, full_path);
+        fprintf(f, "\",\"hash\":\"%016llx\",\"flags\":\"", (unsigned long long)hash);
+        json_chars(f, full_path);
+        fputs(".opts\"}\n", f);
+        if (fclose(f) != 0) {
+                free(line);
+                return;
+        }
+
+        struct stat st;
+        if (stat(events, &st) == 0 && S_ISSOCK(st.st_mode)) {
+                struct sockaddr_un addr = {.sun_family = AF_UNIX};
+                // 非阻塞connect: 监听队列已满时返回EAGAIN, 不等待
+                int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+                if (fd != -1 && strlen(events) < sizeof(addr.sun_path)) {
+                        strcpy(addr.sun_path, events);
+                        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                                write_event(fd, line, n);
+                        }
+                }
+                if (fd != -1) close(fd);
+                free(line);
+                return;
+        }
+
+        // 没有读者时打开FIFO会失败而不是阻塞; 写入同样保持非阻塞, 读者跟不上时丢弃事件.
+        int fd = open(events, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+        if (fd != -1) {
+                if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+                        // 不超过PIPE_BUF的行非阻塞写入时要么整行写入, 要么EAGAIN; 更长的行可能和其他进程交错, 不写
+                        if (n <= PIPE_BUF) write_event(fd, line, n);
+                } else if (flock(fd, LOCK_EX) == 0) {
+                        write_all(fd, line, n);
+                }
+                close(fd);
+        }
+        free(line);
+}
+
+// 执行预处理命令, 返回是否成功.
+// 预处理命令, gcc和clang有差异. 不能强制用clang来替代，如果当前是gcc会导致混合构建的时候出错.
+// clang解析gcc生成的文件可能出现错误，但是仍然能够生成json文件, 具有一定容错性.
+// -P避免生成行号信息,混合构建时定位信息指向新生成的文件.
+// 编译器把结果写到管道, 这里边读边计算哈希(*hash)边写入output, 不需要再读一遍文件.
+// chunks不为空时同时扫描顶层声明的边界.
+static int run_preprocess(const char* cc, int argc, char* argv[], const char* cfile, const char* output, uint64_t* hash,
+                          struct chunk_scanner* chunks) {
+        int out = open(output, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        if (out == -1) return 0;
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+                close(out);
+                return 0;
+        }
 
         pid_t pid = fork();
         if (pid == 0) {
             const char* new_argv[argc + 8];
             int pos = 0;
+            dup2(fds[1], 1);
             new_argv[pos++] = cc;
             new_argv[pos++] = "-E";
-            new_argv[pos++] = "-C";
+            if (overhead_level == LEVEL_FULL) {
+                    new_argv[pos++] = "-C";
+            }
             new_argv[pos++] = cfile;
             new_argv[pos++] = "-o";
-            new_argv[pos++] = full_path;
+            new_argv[pos++] = "-";
             new_argv[pos++] = "-P";
             for (int i = 0; i < argc; ++i) {
                     new_argv[pos++] = argv[i];
             }
             new_argv[pos++] = 0;
             execvp(cc, (char**)new_argv);
-        } else if (pid != -1) {
-                waitpid(pid, 0, 0);
+            _exit(127);
+        } else if (pid == -1) {
+                close(fds[0]);
+                close(fds[1]);
+                close(out);
+                return 0;
+        }
+        close(fds[1]);
+        if (chunks) chunk_reset(chunks);
+
+        char buf[65536];
+        uint64_t h = FNV_OFFSET;
+        int ok = 1;
+        for (;;) {
+                ssize_t n = read(fds[0], buf, sizeof(buf));
+                if (n == 0) break;
+                if (n == -1) {
+                        if (errno == EINTR) continue;
+                        ok = 0;
+                        break;
+                }
+                h = fnv1a(h, (const unsigned char*)buf, n);
+                if (chunks) chunk_update(chunks, (const unsigned char*)buf, n);
+                // 写失败也要读完, 避免编译器阻塞在管道上.
+                if (ok && write_all(out, buf, n) == -1) ok = 0;
+        }
+        close(fds[0]);
+        if (close(out) == -1) ok = 0;
+
+        int status = 0;
+        if (waitpid(pid, &status, 0) == -1) return 0;
+        *hash = h;
+        return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// 在上次运行的输出清单中二分查找key, 返回该行key之后(哈希字段起)的位置, 找不到返回0.
+// 清单由c2rust-build按key排序写入, 每行"key\t哈希\t修改时间(ns)", 开头可能有一行"# pipeline ...".
+static const char* manifest_find(const char* data, size_t size, const char* key) {
+        size_t key_len = strlen(key);
+        size_t lo = 0;
+        size_t hi = size;
+        if (size > 0 && data[0] == '#') {
+                const char* nl = memchr(data, '\n', size);
+                lo = nl ? nl - data + 1 : size;
+        }
+        // 不变式: 目标行若存在, 则起始于[lo, hi)之内.
+        while (lo < hi) {
+                size_t start = lo + (hi - lo) / 2;
+                while (start > lo && data[start - 1] != '\n') --start;
+                const char* line = data + start;
+                const char* tab = memchr(line, '\t', size - start);
+                if (!tab) return 0;
+                size_t len = tab - line;
+                int cmp = memcmp(line, key, len < key_len ? len : key_len);
+                if (cmp == 0) cmp = (len > key_len) - (len < key_len);
+                if (cmp == 0) return tab + 1;
+                if (cmp > 0) {
+                        hi = start;
+                } else {
+                        const char* nl = memchr(line, '\n', size - start);
+                        if (!nl) return 0;
+                        lo = nl - data + 1;
+                }
+        }
+        return 0;
+}
+
+// 预处理结果与上次运行发布的一致(哈希相同, 且输出文件此后没有被改动过)时返回1,
+// 这时保留原输出和它的修改时间, 下游的增量处理不会把它当作变化. 清单是c2rust-build写入的outputs.list.
+static int output_unchanged(const char* feature_root, const char* path, uint64_t hash, const char* output) {
+        char manifest[MAX_PATH_LEN];
+        if (snprintf(manifest, sizeof(manifest), "%s/outputs.list", feature_root) >= sizeof(manifest)) return 0;
+        struct stat st;
+        if (stat(output, &st) == -1) return 0;
+        int fd = open(manifest, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return 0;
+
+        int unchanged = 0;
+        struct stat manifest_st;
+        if (fstat(fd, &manifest_st) == 0 && manifest_st.st_size > 0) {
+                char* data = mmap(0, manifest_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                        const char* entry = manifest_find(data, manifest_st.st_size, path);
+                        if (entry) {
+                                // 复制到以0结尾的缓冲区再解析, 不越过映射的末尾.
+                                char fields[64];
+                                size_t n = 0;
+                                const char* end = data + manifest_st.st_size;
+                                while (entry + n < end && entry[n] != '\n' && n < sizeof(fields) - 1) {
+                                        fields[n] = entry[n];
+                                        ++n;
+                                }
+                                fields[n] = 0;
+                                char* next = 0;
+                                uint64_t recorded_hash = strtoull(fields, &next, 16);
+                                int64_t recorded_mtime = next && *next == '\t' ? strtoll(next + 1, 0, 10) : -1;
+                                int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+                                unchanged = recorded_hash == hash && recorded_mtime == mtime;
+                        }
+                        munmap(data, manifest_st.st_size);
+                }
+        }
+        close(fd);
+        return unchanged;
+}
+
+// 记录预处理结果的哈希: 键为hash/<相对工程目录的C文件>, 值为16位十六进制数.
+// c2rust-build据此判断哪些输出没有变化, 并生成本次运行的changes.
+static void record_hash(const char* path, uint64_t hash, const char* feature_root) {
+        char key[MAX_PATH_LEN];
+        char value[17];
+        if (snprintf(key, sizeof(key), "hash/%s", path) >= sizeof(key)) return;
+        snprintf(value, sizeof(value), "%016llx", (unsigned long long)hash);
+
+        struct store_txn txn = {0};
+        if (txn_put(&txn, key, value, 16) == 0) {
+                store_commit(&txn, feature_root);
+        } else {
+                free(txn.buf);
+        }
+}
+
+// 预处理到暂存区: 先写<暂存目录>/c/<文件>.part, 完成后改名, c2rust-build只搬运改名后的文件.
+// 暂存区未启用, 已满(c2rust-build创建了FULL标记)或者不可写时返回-1, 由调用者直接写特性目录.
+// 预处理本身失败时不重试, 和直接写特性目录的行为一致, 返回0. 结果与特性目录中的输出相同时不暂存, 返回1.
+// 结果留在暂存区时返回2, 由c2rust-build搬运到特性目录后发布事件.
+static int preprocess_staged(const char* cc, int argc, char* argv[], const char* cfile, const char* path,
+                             const char* full_path, const char* feature_root, uint64_t* hash,
+                             struct chunk_scanner* chunks) {
+        // 暂存区只对应一个特性目录, 多工程时直接写.
+        const char* staging = getenv(C2RUST_STAGING_DIR);
+        if (!staging || !*staging || project_count) return -1;
+
+        char marker[MAX_PATH_LEN];
+        int len = snprintf(marker, sizeof(marker), "%s/FULL", staging);
+        if (len >= sizeof(marker) || access(marker, F_OK) == 0) return -1;
+
+        char staged[MAX_PATH_LEN];
+        char part[MAX_PATH_LEN];
+        len = snprintf(staged, sizeof(staged), "%s/c/%s2rust", staging, path);
+        if (len >= sizeof(staged)) return -1;
+        len = snprintf(part, sizeof(part), "%s.part", staged);
+        if (len >= sizeof(part)) return -1;
+
+        if (mkdir_parents(part) == -1) return -1;
+        if (!run_preprocess(cc, argc, argv, cfile, part, hash, chunks)) {
+                unlink(part);
+                return 0;
+        }
+        if (output_unchanged(feature_root, path, *hash, full_path)) {
+                unlink(part);
+                return 1;
+        }
+        if (rename(part, staged) == -1) {
+                unlink(part);
+                return -1;
+        }
+        return 2;
+}
+
+// 直接写特性目录: 先写<输出>.<pid>.part再改名, 输出不会出现写了一半的内容. 结果没有变化时保留原输出.
+static int preprocess_direct(const char* cc, int argc, char* argv[], const char* cfile, const char* path,
+                             const char* full_path, const char* feature_root, uint64_t* hash,
+                             struct chunk_scanner* chunks) {
+        char part[MAX_PATH_LEN];
+        if (snprintf(part, sizeof(part), "%s.%d.part", full_path, (int)getpid()) >= sizeof(part)) return 0;
+
+        // 创建预处理后文件存储路径.
+        if (mkdir_parents(part) == -1) return 0;
+        if (!run_preprocess(cc, argc, argv, cfile, part, hash, chunks)) {
+                unlink(part);
+                return 0;
+        }
+        if (output_unchanged(feature_root, path, *hash, full_path)) {
+                unlink(part);
+                return 1;
+        }
+        if (rename(part, full_path) == -1) {
+                unlink(part);
+                return 0;
+        }
+        return 1;
+}
+
+static void preprocess_cfile(const char* cc, int argc, char* argv[], const char* cfile, const char* project_root, const char* feature_root) {
+        const char* path = strip_prefix(cfile, project_root); 
+        if (!path) return;
+
+        // 获取预处理文件名, 后缀从.c修改为.c2rust
+        char full_path[MAX_PATH_LEN];
+        int full_path_len = snprintf(full_path, sizeof(full_path), "%s/c/%s2rust", feature_root, path);
+        if (full_path_len >= sizeof(full_path)) return;
+
+        // 需要存储编译选项，bindgen的时候会用上. 如果记录失败，也继续.
+        record_tu(cc, argc, argv, cfile, path, feature_root);
+        write_opts(argc, argv, full_path);
+
+        // 超出开销预算时, 没有空闲槽位或者已经完全降级的编译只记录, 构建结束后再预处理.
+        int slot = -1;
+        if (overhead_level >= LEVEL_BOUNDED) {
+                if (overhead_level == LEVEL_BOUNDED) {
+                        slot = acquire_preprocess_slot(feature_root);
+                }
+                if (slot == -1) {
+                        mkdir_parents(full_path);
+                        record_deferred(cc, cfile, full_path, feature_root);
+                        return;
+                }
+        }
+
+        // 需要时扫描顶层声明的边界, 索引直接写到特性目录, 暂存的输出搬运过去后与之对应.
+        const char* chunk_index = getenv(C2RUST_CHUNK_INDEX);
+        struct chunk_scanner scanner = {0};
+        struct chunk_scanner* chunks = chunk_index && *chunk_index ? &scanner : 0;
+
+        uint64_t start_ns = now_ns();
+        uint64_t hash = 0;
+        int ok = preprocess_staged(cc, argc, argv, cfile, path, full_path, feature_root, &hash, chunks);
+        if (ok == -1) {
+                ok = preprocess_direct(cc, argc, argv, cfile, path, full_path, feature_root, &hash, chunks);
+        }
+        if (ok) {
+                record_hash(path, hash, feature_root);
+                if (chunks) write_chunk_index(full_path, chunks, hash, strtoull(chunk_index, 0, 10));
+                if (ok == 1) publish_event(feature_root, path, full_path, hash);
+        } else {
+                // 预处理失败时不能留下上次运行的旧结果.
+                unlink(full_path);
+        }
+        overhead_preprocess_ns += now_ns() - start_ns;
+        free(scanner.ends);
+
+        if (slot != -1) {
+                close(slot);
         }
 }
 
 static void discover_cfile(int argc, char* argv[], const char* project_root, const char* feature_root) {
-        char* cflags[argc]; // 保存-I, -D, -U, -include
+        char* cflags[argc]; // 保存-I, -D, -U, -include, 语言、目标和ABI选项
         char* cfiles[argc]; // 保存当前编译的C文件.
 
 
@@ -201,11 +1085,19 @@ static void discover_cfile(int argc, char* argv[], const char* project_root, con
         }
 
         setenv(C2RUST_CC_SKIP, "1", 0);
+        overhead_report = overhead_budget >= 0;
 
         for (int i = 0; i < argc; ++i) {
                 const char* file = cfiles[i];
                 if (!file) break;
-                preprocess_cfile(argv[0], cnt, cflags, file, project_root, feature_root);
+                if (project_count) {
+                        const struct project* project = find_project(file);
+                        if (project) {
+                                preprocess_cfile(argv[0], cnt, cflags, file, project->root, project->feature_root);
+                        }
+                } else {
+                        preprocess_cfile(argv[0], cnt, cflags, file, project_root, feature_root);
+                }
         }
 fail:
         for (char** cfile = cfiles; *cfile; ++cfile) {
@@ -217,7 +1109,7 @@ fail:
 // 用户翻译的文件内容应该只包含在其中的一个库内，这样混合构建的时候，Rust的代码只作用于用户选择的库.
 // 如果选择的是静态库，则Rust静态库总是和被选择的静态库一起使用.
 // 如果选择的非静态库，则Rust静态库只在被选择的非静态库构建时使用.
-// 这里提取的所有库都保存在C2RUST_FEATURE_ROOT/c/targets.list文件中，用户选择之后简单的将选择结果覆盖此文件即可.
+// 这里提取的所有库都记录在状态存储中(键为target/<名字>)，由c2rust-build导出为C2RUST_FEATURE_ROOT/c/targets.list.
 char* get_file(char* path) {
         char* deli = strrchr(path, '/');
         return deli ? deli + 1 : path;
@@ -244,80 +1136,148 @@ static void target_save(char* libs[], int cnt, const char* feature_root) {
 
         setenv(C2RUST_LD_SKIP, "1", 0);
 
-        char buf[MAX_CMD_LEN];
-        int len = snprintf(buf, MAX_CMD_LEN, "mkdir -p %s/c", feature_root);
-        if (len >= MAX_CMD_LEN) {
-                dprintf(2, "command is too long: %s...\n", buf);
-                return;
-        }
-        system(buf);
-
-        len = snprintf(buf, MAX_CMD_LEN, "%s/c/targets.list", feature_root);
-        if (len >= MAX_CMD_LEN) {
-                dprintf(2, "path is too long: %s...\n", buf);
-                return;
-        }
-
-        int fd = open(buf, O_CREAT | O_RDWR, 0666);
-        if (fd == -1) {
-                dprintf(2, "failed to open file: %s...\n", buf);
-                return;
-        }
-
-        if (flock(fd, LOCK_EX) != 0) {
-                dprintf(2, "failed to lock file: %s, errno = %d\n", buf, errno);
-                goto fail;
-        }
-
-        char* content = &buf[len + 1];
-        ssize_t content_len = read(fd, content, MAX_CMD_LEN - len - 1);
-        if (content_len == -1) {
-                dprintf(2, "failed to read file: %s, errno = %d\n", buf, errno);
-                goto fail;
-        }
-        if (content_len > 0) {
-            content[content_len - 1] = 0; //最后总是写入换行符.
+        // 键唯一, 重复链接同一个目标不会产生重复记录.
+        struct store_txn txn = {0};
+        char key[MAX_PATH_LEN];
+        for (int i = 0; i < cnt; ++i) {
+                if (snprintf(key, sizeof(key), "target/%s", libs[i]) >= sizeof(key)) {
+                        dprintf(2, "target name is too long: %s...\n", key);
+                        continue;
+                }
+                if (txn_put(&txn, key, "", 0)) break;
         }
+        store_commit(&txn, feature_root);
+}
 
-        off_t off = lseek(fd, 0, SEEK_END);
-        if (off == -1) {
-                dprintf(2, "failed to access file: %s, errno = %d\n", buf, errno);
-                goto fail;
+// 按-L目录解析-l<name>(或-l:<file>), 返回找到的库文件路径(需free), 找不到返回0.
+// 与链接器一致: 动态链接时同一目录下的lib<name>.so优先于lib<name>.a. 系统目录中的库不属于工程, 无需解析.
+static char* find_library(const char* name, char* dirs[], int ndirs, int static_only) {
+        char path[MAX_PATH_LEN];
+        for (int i = 0; i < ndirs; ++i) {
+                if (name[0] == ':') {
+                        snprintf(path, sizeof(path), "%s/%s", dirs[i], name + 1);
+                        if (access(path, F_OK) == 0) return strdup(path);
+                        continue;
+                }
+                if (!static_only) {
+                        snprintf(path, sizeof(path), "%s/lib%s.so", dirs[i], name);
+                        if (access(path, F_OK) == 0) return strdup(path);
+                }
+                snprintf(path, sizeof(path), "%s/lib%s.a", dirs[i], name);
+                if (access(path, F_OK) == 0) return strdup(path);
         }
+        return 0;
+}
 
-        for (int i = 0; i < cnt; ++i) {
-            if (content > 0 && !strstr(content, libs[i])) {
-                dprintf(fd, "%s\n", libs[i]);
-            }
-        }
-fail:
-        close(fd);
+// -Bstatic/-Bdynamic既可以直接传给链接器, 也可以经由驱动的-Wl,传递. 返回1(静态), 0(动态), -1(无关参数).
+static int link_mode(const char* arg) {
+        if (strncmp(arg, "-Wl,", 4) == 0) arg += 4;
+        if (strcmp(arg, "-Bstatic") == 0 || strcmp(arg, "-static") == 0 || strcmp(arg, "-dn") == 0) return 1;
+        if (strcmp(arg, "-Bdynamic") == 0 || strcmp(arg, "-dy") == 0) return 0;
+        return -1;
 }
 
 static void discover_target(int argc, char* argv[], const char* project_root, const char* feature_root) {
         char* libs[argc];
+        char* found[argc]; // -l解析出的库路径, libs中的名字指向这里.
+        char* dirs[argc];
         int pos = 0;
+        int nfound = 0;
+        int ndirs = 0;
+        int static_only = 0;
 
         if (getenv(C2RUST_LD_SKIP)) return;
 
+        // -L对所有-l生效, 与出现的先后无关.
         for (int i = 1; i < argc; ++i) {
-                char* static_lib = get_static_lib(argv[i], project_root);
-                if (static_lib) {
-                        libs[pos++] = static_lib;
+                if (strncmp(argv[i], "-L", 2) == 0) {
+                        if (argv[i][2]) {
+                                dirs[ndirs++] = &argv[i][2];
+                        } else if (i < argc - 1) {
+                                dirs[ndirs++] = argv[++i];
+                        }
+                }
+        }
+
+        for (int i = 1; i < argc; ++i) {
+                char* input = argv[i];
+                int mode = link_mode(argv[i]);
+                if (mode >= 0) {
+                        static_only = mode;
+                        continue;
+                } else if (strcmp(argv[i], "-L") == 0) {
+                        ++i;
+                        continue;
+                } else if (strncmp(argv[i], "-l", 2) == 0) {
+                        const char* name = argv[i][2] ? &argv[i][2] : (i < argc - 1 ? argv[++i] : 0);
+                        input = name ? find_library(name, dirs, ndirs, static_only) : 0;
+                        if (!input) continue;
+                        found[nfound++] = input;
                 } else if (strncmp(argv[i], "-o", 2) == 0) {
                         if (argv[i][2] == 0 && i < argc - 1) {
                             libs[pos++] = get_file(argv[i + 1]);
                         } else if (argv[i][2]) {
                             libs[pos++] = get_file(&argv[i][2]);
                         }
+                        continue;
+                }
+                // 多工程时, 其他工程的静态库记录到静态库所在的工程.
+                if (project_count && input[0] != '-') {
+                        char* real_path = realpath(input, 0);
+                        const struct project* owner = real_path ? find_project(real_path) : 0;
+                        free(real_path);
+                        if (owner && strcmp(owner->feature_root, feature_root) != 0) {
+                                char* lib = get_static_lib(input, owner->root);
+                                if (lib) {
+                                        target_save(&lib, 1, owner->feature_root);
+                                }
+                                continue;
+                        }
+                }
+                char* static_lib = get_static_lib(input, project_root);
+                if (static_lib) {
+                        libs[pos++] = static_lib;
                 }
         }
         target_save(libs, pos, feature_root);
+        for (int i = 0; i < nfound; ++i) {
+                free(found[i]);
+        }
+}
+
+// 编译器驱动的这次调用是否包含链接: 没有只编译/只预处理的参数, 且至少有一个输入.
+// 在驱动中记录链接目标, 不依赖把hook加载进实际的链接器进程(mold, ld.lld, collect2之后的任何链接器).
+static int is_link_step(int argc, char* argv[]) {
+        static const char* no_link[] = {"-c", "-S", "-E", "-M", "-MM", "-fsyntax-only", "-###"};
+        int inputs = 0;
+        for (int i = 1; i < argc; ++i) {
+                if (is_matched(argv[i], no_link, sizeof(no_link) / sizeof(no_link[0]))) {
+                        return 0;
+                }
+                if (argv[i][0] != '-' || strncmp(argv[i], "-l", 2) == 0) {
+                        ++inputs;
+                }
+        }
+        return inputs > 0;
+}
+
+// 链接目标属于链接时工作目录所在的工程.
+static void discover_link(int argc, char* argv[], const char* project_root, const char* feature_root) {
+        if (project_count) {
+                char cwd[MAX_PATH_LEN];
+                const struct project* project = getcwd(cwd, sizeof(cwd)) ? find_project(cwd) : 0;
+                if (project) {
+                        discover_target(argc, argv, project->root, project->feature_root);
+                }
+        } else {
+                discover_target(argc, argv, project_root, feature_root);
+        }
 }
 
 __attribute__((constructor)) static void c2rust_hook(int argc, char* argv[]) {
         char* project_root = 0;
         char* feature_root = 0;
+        overhead_start_ns = now_ns();
         project_root = path_from(C2RUST_PROJECT_ROOT);
         if (!project_root) {
                 return;
@@ -328,12 +1288,25 @@ __attribute__((constructor)) static void c2rust_hook(int argc, char* argv[]) {
                 goto fail;
         }
         
+        load_projects();
         if (is_compiler(program_invocation_short_name)) {
+               overhead_init(feature_root);
                discover_cfile(argc, argv, project_root, feature_root);
+               if (is_link_step(argc, argv)) {
+                       // 记录后设置C2RUST_LD_SKIP, 驱动启动的链接器不再重复记录.
+                       discover_link(argc, argv, project_root, feature_root);
+               }
         } else if (is_linker(program_invocation_short_name)) {
-               discover_target(argc, argv, project_root, feature_root);
+               discover_link(argc, argv, project_root, feature_root);
         }
 fail:
         if (project_root) free(project_root);
         if (feature_root) free(feature_root);
 }
+
+// 编译进程退出时统计本次编译和预处理的耗时.
+__attribute__((destructor)) static void c2rust_hook_exit(void) {
+        if (overhead_report) {
+                overhead_update();
+        }
+}
@@ -0,0 +1,544 @@
+use crate::error::{Error, Result};
+use crate::objects;
+use crate::parallel;
+use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
+use std::collections::BTreeSet;
+use std::fs::{self, File};
+use std::io::{BufWriter, Write};
+use std::os::unix::fs::FileExt;
+use std::path::{Component, Path, PathBuf};
+
+/// File extension of feature bundles
+pub const BUNDLE_EXTENSION: &str = "c2rb";
+
+const FORMAT_VERSION: u32 = 1;
+/// zstd skippable frame magic used for the index, so the bundle stays a valid zstd stream
+const INDEX_FRAME_MAGIC: u32 = 0x184D_2A5B;
+const FOOTER_MAGIC: &[u8; 8] = b"C2RBNDL1";
+/// Footer: index length (u64 LE) followed by FOOTER_MAGIC
+const FOOTER_LEN: u64 = 16;
+/// Files compressed per batch during export, bounding the memory held at once
+const EXPORT_BATCH: usize = 256;
+/// Upper bound of the zstd expansion ratio (a 4-byte RLE block yields 128 KiB), used
+/// to reject index sizes that no frame of the recorded length can decompress to
+const MAX_EXPANSION: u64 = 1 << 16;
+
+/// One file of a bundle, stored as an independent zstd frame
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq)]
+pub struct BundleEntry {
+    /// Path relative to the feature directory, '/'-separated
+    pub path: String,
+    pub offset: u64,
+    pub compressed_size: u64,
+    pub size: u64,
+    pub sha256: String,
+}
+
+/// Trailing index of a bundle, sorted by path
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq)]
+pub struct BundleIndex {
+    pub version: u32,
+    pub feature: String,
+    pub entries: Vec<BundleEntry>,
+}
+
+/// A feature bundle opened for random access.
+///
+/// Layout: one zstd frame per file, then a skippable frame holding the JSON index
+/// and a fixed-size footer. Only the footer and index are read on open; entries are
+/// read with positioned reads, so a bundle can be shared between threads.
+pub struct Bundle {
+    file: File,
+    index: BundleIndex,
+}
+
+impl Bundle {
+    pub fn open(path: &Path) -> Result<Bundle> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len();
+        let invalid = |msg: &str| Error::BundleInvalid(format!("{}: {}", path.display(), msg));
+
+        if len < FOOTER_LEN + 8 {
+            return Err(invalid("file too short"));
+        }
+        let mut footer = [0u8; FOOTER_LEN as usize];
+        file.read_exact_at(&mut footer, len - FOOTER_LEN)?;
+        if &footer[8..] != FOOTER_MAGIC {
+            return Err(invalid("not a c2rust-build bundle"));
+        }
+
+        let index_len = u64::from_le_bytes(footer[..8].try_into().unwrap());
+        if index_len > len - FOOTER_LEN - 8 {
+            return Err(invalid("index length out of range"));
+        }
+        let mut json = vec![0u8; index_len as usize];
+        file.read_exact_at(&mut json, len - FOOTER_LEN - index_len)?;
+        let index: BundleIndex = serde_json::from_slice(&json)?;
+
+        if index.version != FORMAT_VERSION {
+            return Err(invalid(&format!("unsupported version {}", index.version)));
+        }
+        let data_end = len - FOOTER_LEN - index_len - 8;
+        for entry in &index.entries {
+            if !is_safe_relative_path(&entry.path) {
+                return Err(invalid(&format!("unsafe entry path '{}'", entry.path)));
+            }
+            match entry.offset.checked_add(entry.compressed_size) {
+                Some(end) if end <= data_end => {}
+                _ => return Err(invalid(&format!("entry '{}' out of range", entry.path))),
+            }
+            if entry.size > entry.compressed_size.saturating_mul(MAX_EXPANSION) {
+                return Err(invalid(&format!("entry '{}' too large", entry.path)));
+            }
+        }
+
+        Ok(Bundle { file, index })
+    }
+
+    pub fn feature(&self) -> &str {
+        &self.index.feature
+    }
+
+    pub fn entries(&self) -> &[BundleEntry] {
+        &self.index.entries
+    }
+
+    /// Look up an entry by its path relative to the feature directory
+    pub fn find(&self, path: &str) -> Option<&BundleEntry> {
+        self.index
+            .entries
+            .binary_search_by(|e| e.path.as_str().cmp(path))
+            .ok()
+            .map(|i| &self.index.entries[i])
+    }
+
+    /// Read and verify a single entry without touching the rest of the bundle.
+    /// Sizes were range-checked by `open`; the frame header must also agree with the
+    /// index before the output buffer is allocated.
+    pub fn read_entry(&self, entry: &BundleEntry) -> Result<Vec<u8>> {
+        let mut compressed = vec![0u8; entry.compressed_size as usize];
+        self.file.read_exact_at(&mut compressed, entry.offset)?;
+
+        let frame_size = zstd::zstd_safe::get_frame_content_size(&compressed);
+        if !matches!(frame_size, Ok(Some(size)) if size == entry.size) {
+            return Err(Error::BundleInvalid(format!(
+                "size mismatch for '{}'",
+                entry.path
+            )));
+        }
+        let data = zstd::bulk::decompress(&compressed, entry.size as usize).map_err(|e| {
+            Error::BundleInvalid(format!("failed to decompress '{}': {}", entry.path, e))
+        })?;
+        if data.len() as u64 != entry.size || sha256_hex(&data) != entry.sha256 {
+            return Err(Error::BundleInvalid(format!(
+                "checksum mismatch for '{}'",
+                entry.path
+            )));
+        }
+        Ok(data)
+    }
+}
+
+/// Pack every regular file below `feature_dir` into a bundle at `output`.
+/// Files are hashed and compressed in parallel; the bundle is written to a temporary
+/// file and renamed into place once complete. Pointer files of a checked-out
+/// generation are packed with the content they point to in `objects_dir`.
+pub fn export(
+    feature_dir: &Path,
+    feature: &str,
+    objects_dir: &Path,
+    output: &Path,
+) -> Result<BundleIndex> {
+    let mut files = Vec::new();
+    collect_files(feature_dir, Path::new(""), &mut files)?;
+    files.sort();
+
+    let tmp_path = output.with_extension(format!("{}.tmp", BUNDLE_EXTENSION));
+    let mut writer = BufWriter::new(File::create(&tmp_path)?);
+    let mut offset = 0u64;
+    let mut entries = Vec::with_capacity(files.len());
+
+    for batch in files.chunks(EXPORT_BATCH) {
+        let compressed = parallel::map(batch, parallel::default_jobs(), |relative| {
+            let data = objects::read(objects_dir, &feature_dir.join(relative))?;
+            let frame = zstd::bulk::compress(&data, zstd::DEFAULT_COMPRESSION_LEVEL)?;
+            Ok::<_, Error>((frame, data.len() as u64, sha256_hex(&data)))
+        });
+
+        for (relative, result) in batch.iter().zip(compressed) {
+            let (frame, size, sha256) = result?;
+            writer.write_all(&frame)?;
+            entries.push(BundleEntry {
+                path: relative.clone(),
+                offset,
+                compressed_size: frame.len() as u64,
+                size,
+                sha256,
+            });
+            offset += frame.len() as u64;
+        }
+    }
+
+    let index = BundleIndex {
+        version: FORMAT_VERSION,
+        feature: feature.to_string(),
+        entries,
+    };
+    let json = serde_json::to_vec(&index)?;
+    let frame_size = u32::try_from(json.len() as u64 + FOOTER_LEN)
+        .map_err(|_| Error::BundleInvalid("bundle index exceeds 4 GiB".to_string()))?;
+
+    writer.write_all(&INDEX_FRAME_MAGIC.to_le_bytes())?;
+    writer.write_all(&frame_size.to_le_bytes())?;
+    writer.write_all(&json)?;
+    writer.write_all(&(json.len() as u64).to_le_bytes())?;
+    writer.write_all(FOOTER_MAGIC)?;
+    writer.into_inner().map_err(|e| e.into_error())?.sync_all()?;
+
+    fs::rename(&tmp_path, output)?;
+    Ok(index)
+}
+
+/// Verify and write every entry of `bundle` below `feature_dir` in parallel.
+/// Returns the number of files written.
+pub fn import(bundle: &Bundle, feature_dir: &Path) -> Result<usize> {
+    let entries = bundle.entries();
+
+    let parents: BTreeSet<PathBuf> = entries
+        .iter()
+        .filter_map(|e| feature_dir.join(&e.path).parent().map(Path::to_path_buf))
+        .collect();
+    for parent in &parents {
+        fs::create_dir_all(parent)?;
+    }
+
+    let results = parallel::map(entries, parallel::default_jobs(), |entry| {
+        let data = bundle.read_entry(entry)?;
+        fs::write(feature_dir.join(&entry.path), data)?;
+        Ok::<_, Error>(())
+    });
+    for result in results {
+        result?;
+    }
+
+    Ok(entries.len())
+}
+
+/// Unpack `bundle` into a sibling of `feature_dir` and swap it in with a rename once
+/// every entry is verified, so a corrupt or truncated bundle leaves the current
+/// feature untouched. Returns the number of files written.
+pub fn import_replacing(bundle: &Bundle, feature_dir: &Path) -> Result<usize> {
+    let parent = feature_dir
+        .parent()
+        .expect("the feature directory is below .c2rust");
+    let name = feature_dir
+        .file_name()
+        .expect("the feature directory has a name")
+        .to_string_lossy();
+    fs::create_dir_all(parent)?;
+    // Dot-prefixed like .cache and .locks, so no feature name can collide with them
+    let staged = parent.join(format!(".{}.import-{}", name, std::process::id()));
+    let replaced = parent.join(format!(".{}.replaced-{}", name, std::process::id()));
+
+    let count = match import(bundle, &staged) {
+        Ok(count) => count,
+        Err(e) => {
+            let _ = fs::remove_dir_all(&staged);
+            return Err(e);
+        }
+    };
+    let had_feature = match fs::rename(feature_dir, &replaced) {
+        Ok(()) => true,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => false,
+        Err(e) => {
+            let _ = fs::remove_dir_all(&staged);
+            return Err(e.into());
+        }
+    };
+    if let Err(e) = fs::rename(&staged, feature_dir) {
+        if had_feature {
+            let _ = fs::rename(&replaced, feature_dir);
+        }
+        let _ = fs::remove_dir_all(&staged);
+        return Err(e.into());
+    }
+    if had_feature {
+        fs::remove_dir_all(&replaced)?;
+    }
+    Ok(count)
+}
+
+/// A feature name becomes a directory below `.c2rust`, and a bundle's feature comes
+/// from another machine: only plain relative names are accepted, and no component may
+/// start with a dot, which would reach `.git`, `.cache`, `.locks` and the like
+pub fn is_safe_feature(feature: &str) -> bool {
+    is_safe_relative_path(feature)
+        && !feature.contains("..")
+        && feature.split('/').all(|component| !component.starts_with('.'))
+}
+
+/// Default bundle file name for a feature
+pub fn default_bundle_name(feature: &str) -> String {
+    format!("{}.{}", feature.replace('/', "-"), BUNDLE_EXTENSION)
+}
+
+fn collect_files(dir: &Path, relative: &Path, files: &mut Vec<String>) -> Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        let relative = relative.join(entry.file_name());
+
+        // Skip symbolic links, as elsewhere when walking feature directories
+        if file_type.is_symlink() {
+            continue;
+        }
+        if file_type.is_dir() {
+            collect_files(&entry.path(), &relative, files)?;
+        } else if file_type.is_file() {
+            let path = relative.to_str().ok_or_else(|| {
+                Error::BundleInvalid(format!("non UTF-8 path: {}", relative.display()))
+            })?;
+            files.push(path.to_string());
+        }
+    }
+    Ok(())
+}
+
+/// Entry paths come from another machine: only plain relative paths are accepted
+fn is_safe_relative_path(path: &str) -> bool {
+    !path.is_empty()
+        && Path::new(path)
+            .components()
+            .all(|c| matches!(c, Component::Normal(_)))
+}
+
+fn sha256_hex(data: &[u8]) -> String {
+    Sha256::digest(data)
+        .iter()
+        .map(|b| format!("{:02x}", b))
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    fn objects_dir(temp_dir: &TempDir) -> PathBuf {
+        temp_dir.path().join(objects::OBJECTS_DIR)
+    }
+
+    fn create_feature(dir: &Path) {
+        fs::create_dir_all(dir.join("c").join("src").join("sub")).unwrap();
+        fs::write(dir.join("c").join("targets.list"), "app\n").unwrap();
+        fs::write(dir.join("c").join("src").join("a.c.c2rust"), "int a;\n".repeat(100)).unwrap();
+        fs::write(dir.join("c").join("src").join("sub").join("b.c.c2rust"), "int b;\n").unwrap();
+        fs::write(dir.join("selected_files.json"), "[]").unwrap();
+    }
+
+    #[test]
+    fn test_export_import_roundtrip() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+
+        let index = export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+        assert_eq!(index.entries.len(), 4);
+
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        assert_eq!(bundle.feature(), "default");
+        let target_dir = temp_dir.path().join("imported");
+        assert_eq!(import(&bundle, &target_dir).unwrap(), 4);
+
+        for entry in bundle.entries() {
+            assert_eq!(
+                fs::read(feature_dir.join(&entry.path)).unwrap(),
+                fs::read(target_dir.join(&entry.path)).unwrap()
+            );
+        }
+    }
+
+    #[test]
+    fn test_read_single_entry() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+        export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        let entry = bundle.find("c/src/sub/b.c.c2rust").unwrap();
+        assert_eq!(bundle.read_entry(entry).unwrap(), b"int b;\n");
+        assert!(bundle.find("c/src/missing.c.c2rust").is_none());
+    }
+
+    #[test]
+    fn test_bundle_is_valid_zstd_stream() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+        export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+
+        // Entry frames decompress to the concatenated files; the index frame is skipped
+        let decoded = zstd::stream::decode_all(File::open(&bundle_path).unwrap()).unwrap();
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        let total: u64 = bundle.entries().iter().map(|e| e.size).sum();
+        assert_eq!(decoded.len() as u64, total);
+    }
+
+    #[test]
+    fn test_corrupted_entry_is_detected() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+        export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+
+        let entry = Bundle::open(&bundle_path)
+            .unwrap()
+            .find("c/src/a.c.c2rust")
+            .unwrap()
+            .clone();
+        let mut bytes = fs::read(&bundle_path).unwrap();
+        bytes[(entry.offset + entry.compressed_size - 1) as usize] ^= 0xff;
+        fs::write(&bundle_path, bytes).unwrap();
+
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        assert!(matches!(
+            bundle.read_entry(&entry),
+            Err(Error::BundleInvalid(_))
+        ));
+        assert!(import(&bundle, &temp_dir.path().join("imported")).is_err());
+    }
+
+    /// Rewrite the index of an exported bundle in place, keeping the entry frames
+    fn rewrite_index(path: &Path, edit: impl FnOnce(&mut BundleIndex)) {
+        let bytes = fs::read(path).unwrap();
+        let len = bytes.len();
+        let index_len = u64::from_le_bytes(bytes[len - 16..len - 8].try_into().unwrap()) as usize;
+        let data_end = len - FOOTER_LEN as usize - index_len - 8;
+        let mut index: BundleIndex =
+            serde_json::from_slice(&bytes[len - FOOTER_LEN as usize - index_len..len - 16]).unwrap();
+        edit(&mut index);
+
+        let json = serde_json::to_vec(&index).unwrap();
+        let mut out = bytes[..data_end].to_vec();
+        out.extend_from_slice(&INDEX_FRAME_MAGIC.to_le_bytes());
+        out.extend_from_slice(&(json.len() as u32 + FOOTER_LEN as u32).to_le_bytes());
+        out.extend_from_slice(&json);
+        out.extend_from_slice(&(json.len() as u64).to_le_bytes());
+        out.extend_from_slice(FOOTER_MAGIC);
+        fs::write(path, out).unwrap();
+    }
+
+    #[test]
+    fn test_corrupted_index_is_rejected() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+        export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+        let pristine = fs::read(&bundle_path).unwrap();
+
+        let edits: [fn(&mut BundleEntry); 4] = [
+            |e| e.compressed_size = u64::MAX,
+            |e| e.offset = u64::MAX - 1,
+            |e| e.size = u64::MAX,
+            |e| e.compressed_size += 1 << 40,
+        ];
+        for edit in edits {
+            fs::write(&bundle_path, &pristine).unwrap();
+            rewrite_index(&bundle_path, |index| edit(&mut index.entries[0]));
+            assert!(matches!(
+                Bundle::open(&bundle_path),
+                Err(Error::BundleInvalid(_))
+            ));
+        }
+
+        // Within the expansion bound but not what the frame holds: rejected before
+        // the output buffer is allocated
+        fs::write(&bundle_path, &pristine).unwrap();
+        rewrite_index(&bundle_path, |index| {
+            let entry = &mut index.entries[0];
+            entry.size = entry.compressed_size * MAX_EXPANSION;
+        });
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        assert!(matches!(
+            bundle.read_entry(&bundle.entries()[0]),
+            Err(Error::BundleInvalid(_))
+        ));
+        assert!(matches!(
+            import(&bundle, &temp_dir.path().join("imported")),
+            Err(Error::BundleInvalid(_))
+        ));
+    }
+
+    #[test]
+    fn test_open_rejects_non_bundle() {
+        let temp_dir = TempDir::new().unwrap();
+        let path = temp_dir.path().join("not-a-bundle");
+        fs::write(&path, "just some text that is long enough").unwrap();
+        assert!(matches!(Bundle::open(&path), Err(Error::BundleInvalid(_))));
+    }
+
+    #[test]
+    fn test_is_safe_relative_path() {
+        assert!(is_safe_relative_path("c/src/a.c.c2rust"));
+        assert!(!is_safe_relative_path("../escape"));
+        assert!(!is_safe_relative_path("/etc/passwd"));
+        assert!(!is_safe_relative_path("./c/a"));
+        assert!(!is_safe_relative_path(""));
+    }
+
+    #[test]
+    fn test_import_replacing_keeps_feature_on_corrupt_bundle() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        create_feature(&feature_dir);
+        let bundle_path = temp_dir.path().join("default.c2rb");
+        export(&feature_dir, "default", &objects_dir(&temp_dir), &bundle_path).unwrap();
+
+        let target_dir = temp_dir.path().join("target");
+        fs::create_dir_all(&target_dir).unwrap();
+        fs::write(target_dir.join("old"), "old").unwrap();
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        assert_eq!(import_replacing(&bundle, &target_dir).unwrap(), 4);
+        assert!(!target_dir.join("old").exists());
+        assert!(target_dir.join("c").join("targets.list").exists());
+
+        let entry = bundle.find("c/src/a.c.c2rust").unwrap().clone();
+        let mut bytes = fs::read(&bundle_path).unwrap();
+        bytes[(entry.offset + entry.compressed_size - 1) as usize] ^= 0xff;
+        fs::write(&bundle_path, bytes).unwrap();
+        fs::write(target_dir.join("current"), "current").unwrap();
+        let bundle = Bundle::open(&bundle_path).unwrap();
+        assert!(import_replacing(&bundle, &target_dir).is_err());
+        assert!(target_dir.join("current").exists());
+        let leftovers = fs::read_dir(temp_dir.path())
+            .unwrap()
+            .filter(|e| e.as_ref().unwrap().file_name().to_string_lossy().starts_with('.'))
+            .count();
+        assert_eq!(leftovers, 0);
+    }
+
+    #[test]
+    fn test_is_safe_feature() {
+        assert!(is_safe_feature("default"));
+        assert!(is_safe_feature("arm/debug"));
+        assert!(!is_safe_feature("../.."));
+        assert!(!is_safe_feature("a..b"));
+        assert!(!is_safe_feature("/tmp"));
+        assert!(!is_safe_feature(".git"));
+        assert!(!is_safe_feature("a/.locks"));
+        assert!(!is_safe_feature(""));
+    }
+
+    #[test]
+    fn test_default_bundle_name() {
+        assert_eq!(default_bundle_name("default"), "default.c2rb");
+        assert_eq!(default_bundle_name("arm/debug"), "arm-debug.c2rb");
+    }
+}
@@ -0,0 +1,334 @@
+use crate::error::Result;
+use crate::lock::{self, FileLock};
+use crate::transform;
+use std::collections::HashMap;
+use std::fs::{self, OpenOptions};
+use std::io::Write;
+use std::os::unix::process::CommandExt;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+/// Default size budget of the transform cache in MiB
+pub const DEFAULT_CACHE_SIZE_MB: u64 = 2048;
+
+/// Default number of days an unused transform cache entry is kept
+pub const DEFAULT_CACHE_MAX_AGE_DAYS: u64 = 30;
+
+/// Log of the last background gc, in `.c2rust/.locks`
+pub const GC_LOG: &str = "gc.log";
+
+/// Access stamps of the cache entries: one `<unix seconds>\t<key>` line per use,
+/// appended by every run and compacted by gc. File times are not used, since
+/// atime is commonly disabled or coarse (noatime, relatime).
+const INDEX_FILE: &str = "index";
+
+/// Written by every gc; a run that added no entries starts a background gc at
+/// most once per `GC_INTERVAL`, so age eviction happens on idle caches too
+const GC_STAMP_FILE: &str = "gc.stamp";
+const GC_INTERVAL: Duration = Duration::from_secs(24 * 60 * 60);
+
+/// Size and age budget of the transform cache
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Budget {
+    pub max_bytes: u64,
+    /// Entries not used for longer are evicted regardless of size
+    pub max_age: Duration,
+}
+
+impl Budget {
+    pub fn new(size_mb: u64, max_age_days: u64) -> Budget {
+        Budget {
+            max_bytes: size_mb * 1024 * 1024,
+            max_age: Duration::from_secs(max_age_days * 24 * 60 * 60),
+        }
+    }
+}
+
+/// Outcome of a gc
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct GcStats {
+    /// Entries and bytes left in the cache
+    pub entries: usize,
+    pub bytes: u64,
+    /// Entries removed for exceeding the age budget
+    pub expired: usize,
+    /// Least recently used entries removed for exceeding the size budget
+    pub evicted: usize,
+    pub freed_bytes: u64,
+}
+
+/// Take the cache lock shared for reading or inserting entries. gc waits until
+/// every holder is done, so an entry is never removed while a run copies it.
+pub fn read_lock(project_root: &Path) -> Result<FileLock> {
+    FileLock::acquire_shared(&lock::cache_lock_path(project_root), "transform cache")
+}
+
+/// Path of a cache entry below `cache_dir`
+pub fn entry_path(cache_dir: &Path, key: &str) -> PathBuf {
+    cache_dir.join(&key[..2]).join(key)
+}
+
+/// Stamp `keys` as used now. Called with the read lock held, once per pass.
+pub fn record_access(cache_dir: &Path, keys: &[String]) -> Result<()> {
+    if keys.is_empty() {
+        return Ok(());
+    }
+    let now = unix_seconds(SystemTime::now());
+    let mut lines = String::new();
+    for key in keys {
+        lines.push_str(&format!("{}\t{}\n", now, key));
+    }
+
+    let path = cache_dir.join(INDEX_FILE);
+    let mut index = OpenOptions::new().create(true).append(true).open(&path)?;
+    // Concurrent runs append under the shared cache lock; keep their lines whole
+    lock::flock(&index, libc::LOCK_EX, &path)?;
+    index.write_all(lines.as_bytes())?;
+    Ok(())
+}
+
+/// Evict cache entries beyond the budget: first those unused for longer than
+/// `max_age`, then the least recently used until the cache fits `max_bytes`.
+/// Compacts the access index to one stamp per remaining entry. Waits for runs
+/// reading the cache.
+pub fn gc(project_root: &Path, budget: &Budget, now: SystemTime) -> Result<GcStats> {
+    let cache_dir = transform::cache_dir(project_root);
+    let mut stats = GcStats::default();
+    if !cache_dir.is_dir() {
+        return Ok(stats);
+    }
+    let _lock = FileLock::acquire(&lock::cache_lock_path(project_root), "transform cache")?;
+
+    let stamps = read_index(&cache_dir.join(INDEX_FILE))?;
+    let mut entries = Vec::new();
+    for shard in fs::read_dir(&cache_dir)? {
+        let shard = shard?;
+        if !shard.file_type()?.is_dir() {
+            continue;
+        }
+        for entry in fs::read_dir(shard.path())? {
+            let entry = entry?;
+            let name = entry.file_name().to_string_lossy().into_owned();
+            let metadata = entry.metadata()?;
+            if name.contains('.') {
+                // Insert interrupted before its rename; no run is inserting now
+                fs::remove_file(entry.path())?;
+                continue;
+            }
+            // Entries inserted before stamps were recorded count from their insertion
+            let stamp = match stamps.get(&name) {
+                Some(&stamp) => stamp,
+                None => unix_seconds(metadata.modified()?),
+            };
+            entries.push((stamp, name, entry.path(), metadata.len()));
+        }
+    }
+
+    entries.sort();
+    let cutoff = unix_seconds(now).saturating_sub(budget.max_age.as_secs());
+    let mut total: u64 = entries.iter().map(|(_, _, _, size)| size).sum();
+    let mut kept = Vec::new();
+    for (stamp, key, path, size) in entries {
+        let expired = stamp < cutoff;
+        if expired || total > budget.max_bytes {
+            fs::remove_file(&path)?;
+            total -= size;
+            stats.freed_bytes += size;
+            if expired {
+                stats.expired += 1;
+            } else {
+                stats.evicted += 1;
+            }
+        } else {
+            kept.push((stamp, key));
+        }
+    }
+    stats.entries = kept.len();
+    stats.bytes = total;
+
+    let mut index = String::new();
+    for (stamp, key) in &kept {
+        index.push_str(&format!("{}\t{}\n", stamp, key));
+    }
+    let index_path = cache_dir.join(INDEX_FILE);
+    let tmp = cache_dir.join(format!("{}.tmp", INDEX_FILE));
+    fs::write(&tmp, index)?;
+    fs::rename(&tmp, &index_path)?;
+
+    for shard in fs::read_dir(&cache_dir)? {
+        let shard = shard?;
+        if shard.file_type()?.is_dir() {
+            // Only succeeds on empty shards
+            let _ = fs::remove_dir(shard.path());
+        }
+    }
+    fs::write(cache_dir.join(GC_STAMP_FILE), unix_seconds(now).to_string())?;
+    Ok(stats)
+}
+
+/// Whether a finished run should start a background gc: when it added entries, or
+/// when no gc ran for a day
+pub fn gc_due(project_root: &Path, added_entries: bool) -> bool {
+    let cache_dir = transform::cache_dir(project_root);
+    if !cache_dir.is_dir() {
+        return false;
+    }
+    if added_entries {
+        return true;
+    }
+    match fs::metadata(cache_dir.join(GC_STAMP_FILE)).and_then(|m| m.modified()) {
+        Ok(last) => last.elapsed().map_or(true, |age| age >= GC_INTERVAL),
+        Err(_) => true,
+    }
+}
+
+/// Start `c2rust-build gc --auto` detached in the background. It waits for runs
+/// still reading the cache and logs to `.c2rust/.locks/gc.log`.
+pub fn spawn_gc(project_root: &Path, size_mb: u64, max_age_days: u64) {
+    let spawned = (|| -> Result<()> {
+        let log_path = lock::locks_dir(project_root).join(GC_LOG);
+        let log = OpenOptions::new()
+            .create(true)
+            .write(true)
+            .truncate(true)
+            .open(&log_path)?;
+        Command::new(std::env::current_exe()?)
+            .arg("gc")
+            .arg("--auto")
+            .arg("--cache-size")
+            .arg(size_mb.to_string())
+            .arg("--cache-max-age")
+            .arg(max_age_days.to_string())
+            .current_dir(project_root)
+            .stdin(Stdio::null())
+            .stdout(log.try_clone()?)
+            .stderr(log)
+            // Own process group: a Ctrl-C at the terminal does not interrupt eviction
+            .process_group(0)
+            .spawn()?;
+        Ok(())
+    })();
+    if let Err(e) = spawned {
+        eprintln!("Warning: Failed to start transform cache gc: {}", e);
+    }
+}
+
+/// Latest access stamp of every key in the index; malformed lines are skipped
+fn read_index(path: &Path) -> Result<HashMap<String, u64>> {
+    let content = match fs::read_to_string(path) {
+        Ok(content) => content,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(HashMap::new()),
+        Err(e) => return Err(e.into()),
+    };
+    let mut stamps = HashMap::new();
+    for line in content.lines() {
+        let Some((stamp, key)) = line.split_once('\t') else {
+            continue;
+        };
+        let Ok(stamp) = stamp.parse::<u64>() else {
+            continue;
+        };
+        let latest = stamps.entry(key.to_string()).or_insert(stamp);
+        *latest = (*latest).max(stamp);
+    }
+    Ok(stamps)
+}
+
+fn unix_seconds(time: SystemTime) -> u64 {
+    time.duration_since(UNIX_EPOCH).map_or(0, |d| d.as_secs())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    fn insert(cache_dir: &Path, key: &str, size: usize) {
+        let path = entry_path(cache_dir, key);
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        fs::write(path, vec![b'x'; size]).unwrap();
+    }
+
+    fn stamp(cache_dir: &Path, key: &str, at: u64) {
+        let mut index = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(cache_dir.join(INDEX_FILE))
+            .unwrap();
+        writeln!(index, "{}\t{}", at, key).unwrap();
+    }
+
+    #[test]
+    fn test_gc_evicts_least_recently_used() {
+        let temp_dir = TempDir::new().unwrap();
+        let cache_dir = transform::cache_dir(temp_dir.path());
+        let now = UNIX_EPOCH + Duration::from_secs(100 * 24 * 60 * 60);
+        let day = 24 * 60 * 60;
+        let today = unix_seconds(now);
+        for key in ["aa01", "bb02", "cc03"] {
+            insert(&cache_dir, key, 1024);
+        }
+        // aa01 was inserted first but used last
+        stamp(&cache_dir, "aa01", today - 3 * day);
+        stamp(&cache_dir, "bb02", today - 2 * day);
+        stamp(&cache_dir, "cc03", today - day);
+        stamp(&cache_dir, "aa01", today);
+        insert(&cache_dir, "dd04.tmp123", 10);
+
+        let budget = Budget {
+            max_bytes: 2048,
+            max_age: Duration::from_secs(30 * day),
+        };
+        let stats = gc(temp_dir.path(), &budget, now).unwrap();
+        assert_eq!(stats.evicted, 1);
+        assert_eq!(stats.entries, 2);
+        assert_eq!(stats.bytes, 2048);
+        assert!(!entry_path(&cache_dir, "bb02").exists());
+        assert!(entry_path(&cache_dir, "aa01").exists());
+        assert!(!cache_dir.join("dd").exists());
+
+        // The index is compacted to one stamp per remaining entry
+        let index = fs::read_to_string(cache_dir.join(INDEX_FILE)).unwrap();
+        assert_eq!(index.lines().count(), 2);
+        assert!(!gc_due(temp_dir.path(), false));
+        assert!(gc_due(temp_dir.path(), true));
+    }
+
+    #[test]
+    fn test_gc_expires_unused_entries() {
+        let temp_dir = TempDir::new().unwrap();
+        let cache_dir = transform::cache_dir(temp_dir.path());
+        insert(&cache_dir, "aa01", 10);
+        insert(&cache_dir, "bb02", 10);
+        let now = SystemTime::now();
+        stamp(&cache_dir, "aa01", unix_seconds(now) - 31 * 24 * 60 * 60);
+        record_access(&cache_dir, &["bb02".to_string()]).unwrap();
+
+        let stats = gc(temp_dir.path(), &Budget::new(DEFAULT_CACHE_SIZE_MB, 30), now).unwrap();
+        assert_eq!(stats.expired, 1);
+        assert_eq!(stats.evicted, 0);
+        assert!(entry_path(&cache_dir, "bb02").exists());
+        assert!(!entry_path(&cache_dir, "aa01").exists());
+    }
+
+    #[test]
+    fn test_gc_waits_for_readers() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path().to_path_buf();
+        let cache_dir = transform::cache_dir(&root);
+        insert(&cache_dir, "aa01", 10);
+
+        let reader = read_lock(&root).unwrap();
+        let gc_root = root.clone();
+        let evictor = std::thread::spawn(move || {
+            gc(&gc_root, &Budget::new(0, 30), SystemTime::now()).unwrap()
+        });
+        std::thread::sleep(Duration::from_millis(200));
+        assert!(entry_path(&cache_dir, "aa01").exists());
+
+        drop(reader);
+        assert_eq!(evictor.join().unwrap().evicted, 1);
+        assert!(!entry_path(&cache_dir, "aa01").exists());
+    }
+}
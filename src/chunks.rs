@@ -0,0 +1,408 @@
+use crate::error::Result;
+use crate::file_selector;
+use crate::outputs::{self, ContentHash};
+use crate::store::Store;
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io::{self, Read};
+use std::path::{Path, PathBuf};
+
+/// Environment variable telling libhook.so to index outputs of at least this many bytes
+pub const CHUNK_INDEX_ENV: &str = "C2RUST_CHUNK_INDEX";
+/// Default minimum output size in KiB for `--chunk-index`
+pub const DEFAULT_CHUNK_INDEX_KIB: &str = "1024";
+/// Suffix of the index written next to an output
+pub const INDEX_SUFFIX: &str = ".chunks";
+
+/// First word of an index file, followed by the size and hash of the indexed output
+const HEADER: &str = "c2rust-chunks v1";
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum State {
+    Code,
+    /// A `/` that may start a comment
+    Slash,
+    LineComment,
+    BlockComment,
+    /// A `*` inside a block comment that may end it
+    BlockStar,
+    Str,
+    Char,
+    /// A `#pragma` or other directive line left after preprocessing
+    Directive,
+}
+
+/// Finds the ends of top-level declarations in preprocessed C, byte by byte, the
+/// same way libhook.so does while the compiler writes its output. A declaration
+/// ends at a `;` outside any braces, parentheses and brackets, or at the `}`
+/// closing a function body (a top-level `{` right after `)`). Comments, string and
+/// character literals and directive lines are skipped.
+#[derive(Debug)]
+pub struct Scanner {
+    state: State,
+    escape: bool,
+    line_start: bool,
+    depth: u64,
+    parens: u64,
+    /// Last significant byte of code, to tell function bodies from initializers
+    last: u8,
+    body: bool,
+    offset: u64,
+    ends: Vec<u64>,
+}
+
+impl Default for Scanner {
+    fn default() -> Self {
+        Scanner {
+            state: State::Code,
+            escape: false,
+            line_start: true,
+            depth: 0,
+            parens: 0,
+            last: 0,
+            body: false,
+            offset: 0,
+            ends: Vec::new(),
+        }
+    }
+}
+
+impl Scanner {
+    pub fn update(&mut self, data: &[u8]) {
+        for &c in data {
+            self.byte(c);
+            self.offset += 1;
+        }
+    }
+
+    /// Offsets just past each top-level declaration
+    pub fn finish(self) -> Vec<u64> {
+        self.ends
+    }
+
+    fn byte(&mut self, c: u8) {
+        match self.state {
+            State::Code => self.code(c),
+            State::Slash => match c {
+                b'*' => self.state = State::BlockComment,
+                b'/' => self.state = State::LineComment,
+                _ => {
+                    self.state = State::Code;
+                    self.last = b'/';
+                    self.code(c);
+                }
+            },
+            State::LineComment | State::Directive => {
+                if c == b'\n' {
+                    self.state = State::Code;
+                    self.line_start = true;
+                }
+            }
+            State::BlockComment => {
+                if c == b'*' {
+                    self.state = State::BlockStar;
+                }
+            }
+            State::BlockStar => match c {
+                b'/' => self.state = State::Code,
+                b'*' => {}
+                _ => self.state = State::BlockComment,
+            },
+            State::Str | State::Char => {
+                let quote = if self.state == State::Str {
+                    b'"'
+                } else {
+                    b'\''
+                };
+                if self.escape {
+                    self.escape = false;
+                } else if c == b'\\' {
+                    self.escape = true;
+                } else if c == quote {
+                    self.state = State::Code;
+                } else if c == b'\n' {
+                    // Unterminated literal; do not let it swallow the rest of the file
+                    self.state = State::Code;
+                    self.line_start = true;
+                }
+            }
+        }
+    }
+
+    fn code(&mut self, c: u8) {
+        if c == b'\n' {
+            self.line_start = true;
+            return;
+        }
+        // Vertical tab included, as in libhook.so (is_ascii_whitespace leaves it out)
+        if c.is_ascii_whitespace() || c == b'\x0b' {
+            return;
+        }
+        let line_start = std::mem::replace(&mut self.line_start, false);
+        match c {
+            b'#' if line_start => {
+                self.state = State::Directive;
+                return;
+            }
+            b'/' => {
+                self.state = State::Slash;
+                return;
+            }
+            b'"' => self.state = State::Str,
+            b'\'' => self.state = State::Char,
+            b'(' | b'[' => self.parens += 1,
+            b')' | b']' => self.parens = self.parens.saturating_sub(1),
+            b'{' => {
+                if self.depth == 0 {
+                    self.body = self.parens == 0 && self.last == b')';
+                }
+                self.depth += 1;
+            }
+            b'}' => {
+                self.depth = self.depth.saturating_sub(1);
+                if self.depth == 0 && self.body {
+                    self.body = false;
+                    self.ends.push(self.offset + 1);
+                }
+            }
+            b';' if self.depth == 0 && self.parens == 0 => self.ends.push(self.offset + 1),
+            _ => {}
+        }
+        self.last = c;
+    }
+}
+
+/// Declaration boundaries of one output: `<output>.chunks` holds a
+/// `c2rust-chunks v1 <size> <hash>` line, then the offset just past each top-level
+/// declaration, one per line. Consumers check the size (and hash) against the
+/// output and split it into ranges at these offsets.
+#[derive(Debug, Clone, PartialEq)]
+pub struct ChunkIndex {
+    pub size: u64,
+    /// 64-bit FNV-1a of the output, as in `outputs.list`
+    pub hash: u64,
+    pub ends: Vec<u64>,
+}
+
+impl ChunkIndex {
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut content = format!("{} {} {:016x}\n", HEADER, self.size, self.hash);
+        for end in &self.ends {
+            content.push_str(&format!("{}\n", end));
+        }
+        content.into_bytes()
+    }
+}
+
+/// `<output>.chunks`
+pub fn index_path(output: &Path) -> PathBuf {
+    let mut path = output.as_os_str().to_owned();
+    path.push(INDEX_SUFFIX);
+    PathBuf::from(path)
+}
+
+/// Size and hash an index was written for; `None` without a readable index
+fn read_header(index: &Path) -> Option<(u64, u64)> {
+    let mut header = [0; 64];
+    let n = File::open(index).ok()?.read(&mut header).ok()?;
+    let line = std::str::from_utf8(&header[..n]).ok()?.lines().next()?;
+    let mut fields = line.strip_prefix(HEADER)?.split_whitespace();
+    let size = fields.next()?.parse().ok()?;
+    let hash = u64::from_str_radix(fields.next()?, 16).ok()?;
+    Some((size, hash))
+}
+
+/// Scan an output file and hash it in the same pass
+pub fn index_file(path: &Path) -> Result<ChunkIndex> {
+    let mut file = File::open(path)?;
+    let mut scanner = Scanner::default();
+    let mut hash = ContentHash::default();
+    let mut size = 0;
+    let mut buf = vec![0; 64 * 1024];
+    loop {
+        let n = file.read(&mut buf)?;
+        if n == 0 {
+            break;
+        }
+        scanner.update(&buf[..n]);
+        hash.update(&buf[..n]);
+        size += n as u64;
+    }
+    Ok(ChunkIndex {
+        size,
+        hash: hash.finish(),
+        ends: scanner.finish(),
+    })
+}
+
+/// Index `output` and write `<output>.chunks` through a temporary file
+pub fn write_index(output: &Path) -> Result<()> {
+    let index = index_file(output)?;
+    let path = index_path(output);
+    let mut tmp = path.as_os_str().to_owned();
+    tmp.push(".tmp");
+    let tmp = PathBuf::from(tmp);
+    fs::write(&tmp, index.to_bytes())?;
+    fs::rename(&tmp, &path)?;
+    Ok(())
+}
+
+/// Rewrite the index of `output` if it has one; used where an output is replaced
+/// outside a tracked build
+pub fn update_existing(output: &Path) -> Result<()> {
+    if index_path(output).exists() {
+        write_index(output)?;
+    }
+    Ok(())
+}
+
+/// Bring the indexes below `c_dir` in line with the outputs of a finished run.
+/// Outputs of at least `min_bytes` keep an index libhook.so wrote for exactly the
+/// recorded content, or an index kept with an `unchanged` output; all others are
+/// indexed here (deferred preprocessing, transform plugins). Smaller outputs, and
+/// with `min_bytes` unset all outputs, lose their index, as do removed outputs.
+/// Returns the number of outputs indexed here.
+pub fn refresh(
+    c_dir: &Path,
+    min_bytes: Option<u64>,
+    store: &Store,
+    unchanged: &HashSet<PathBuf>,
+    transformed: bool,
+) -> Result<usize> {
+    let hashes = outputs::recorded_hashes(store);
+    let mut indexed = 0;
+    for file in file_selector::collect_preprocessed_files(c_dir)? {
+        let index = index_path(&file.path);
+        let size = fs::metadata(&file.path)?.len();
+        if !min_bytes.is_some_and(|min| size >= min) {
+            remove_if_exists(&index)?;
+            continue;
+        }
+        let current = match read_header(&index) {
+            Some((indexed_size, _)) if unchanged.contains(&file.path) => indexed_size == size,
+            Some((indexed_size, hash)) if !transformed => {
+                let key = outputs::output_key(c_dir, &file.path);
+                indexed_size == size
+                    && key.is_some_and(|key| hashes.get(key.as_str()) == Some(&hash))
+            }
+            _ => false,
+        };
+        if !current {
+            write_index(&file.path)?;
+            indexed += 1;
+        }
+    }
+    remove_orphans(c_dir)?;
+    Ok(indexed)
+}
+
+fn remove_if_exists(path: &Path) -> io::Result<()> {
+    match fs::remove_file(path) {
+        Err(e) if e.kind() != io::ErrorKind::NotFound => Err(e),
+        _ => Ok(()),
+    }
+}
+
+/// Remove indexes whose output is gone
+fn remove_orphans(dir: &Path) -> Result<()> {
+    let entries = match fs::read_dir(dir) {
+        Ok(entries) => entries,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e.into()),
+    };
+    for entry in entries {
+        let entry = entry?;
+        let path = entry.path();
+        if entry.file_type()?.is_dir() {
+            remove_orphans(&path)?;
+        } else if let Some(output) = path.to_str().and_then(|p| p.strip_suffix(INDEX_SUFFIX)) {
+            if !Path::new(output).exists() {
+                fs::remove_file(&path)?;
+            }
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    const SOURCE: &str = "int a; /* ; { */ struct s { int x; };\n\
+                          int f(void) { if (a) { return \"};\"[0]; } }\n\
+                          char c = ';'; // }\n\
+                          #pragma pack(1);\n\
+                          int (*g(int n))(void) { return 0; }\n\
+                          int t[] = { 1, 2 };\n";
+
+    fn ends(source: &str) -> Vec<u64> {
+        let mut scanner = Scanner::default();
+        scanner.update(source.as_bytes());
+        scanner.finish()
+    }
+
+    #[test]
+    fn test_scanner_finds_top_level_declarations() {
+        let found: Vec<&str> = ends(SOURCE)
+            .iter()
+            .map(|&end| SOURCE[..end as usize].rsplit('\n').next().unwrap())
+            .collect();
+        assert_eq!(
+            found,
+            [
+                "int a;",
+                "int a; /* ; { */ struct s { int x; };",
+                "int f(void) { if (a) { return \"};\"[0]; } }",
+                "char c = ';';",
+                "int (*g(int n))(void) { return 0; }",
+                "int t[] = { 1, 2 };",
+            ]
+        );
+    }
+
+    #[test]
+    fn test_scanner_state_spans_buffers() {
+        let mut scanner = Scanner::default();
+        for chunk in SOURCE.as_bytes().chunks(3) {
+            scanner.update(chunk);
+        }
+        assert_eq!(scanner.finish(), ends(SOURCE));
+    }
+
+    #[test]
+    fn test_scanner_skips_vertical_tab() {
+        assert_eq!(ends("int a;\n\x0b#pragma pack(1);\n"), [6]);
+    }
+
+    #[test]
+    fn test_refresh_indexes_large_outputs() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path();
+        let c_dir = feature_dir.join("c");
+        fs::create_dir_all(&c_dir).unwrap();
+        let large = c_dir.join("large.c2rust");
+        let small = c_dir.join("small.c2rust");
+        fs::write(&large, SOURCE).unwrap();
+        fs::write(&small, "int s;\n").unwrap();
+        fs::write(c_dir.join("gone.c2rust.chunks"), "").unwrap();
+        fs::write(index_path(&small), "").unwrap();
+        let store = Store::open(feature_dir).unwrap();
+        let unchanged = HashSet::new();
+
+        let min = Some(SOURCE.len() as u64);
+        assert_eq!(refresh(&c_dir, min, &store, &unchanged, false).unwrap(), 1);
+        let index = fs::read_to_string(index_path(&large)).unwrap();
+        let hash = outputs::hash_file(&large).unwrap();
+        assert!(index.starts_with(&format!("{} {} {:016x}\n", HEADER, SOURCE.len(), hash)));
+        assert_eq!(index.lines().count(), 7);
+        assert!(!index_path(&small).exists());
+        assert!(!c_dir.join("gone.c2rust.chunks").exists());
+
+        // Kept with an unchanged output; dropped when indexing is off
+        let unchanged = [large.clone()].into();
+        assert_eq!(refresh(&c_dir, min, &store, &unchanged, true).unwrap(), 0);
+        assert_eq!(refresh(&c_dir, None, &store, &unchanged, true).unwrap(), 0);
+        assert!(!index_path(&large).exists());
+    }
+}
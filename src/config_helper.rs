@@ -1,4 +1,5 @@
 use crate::error::{Error, Result};
+use crate::lock::{self, FileLock};
 use std::path::Path;
 use std::process::Command;
 
@@ -19,6 +20,17 @@ pub fn check_c2rust_config_exists() -> Result<()> {
         .ok_or(Error::ConfigToolNotFound)
 }
 
+/// Run a group of c2rust-config writes as one transaction.
+/// Every c2rust-config call is a read-modify-write of the project configuration, so
+/// concurrent runs for different features are serialized on the project's config lock.
+pub fn transaction<T>(project_root: &Path, f: impl FnOnce() -> Result<T>) -> Result<T> {
+    let _lock = FileLock::acquire(
+        &lock::config_lock_path(project_root),
+        "configuration lock",
+    )?;
+    f()
+}
+
 /// Save build configuration using c2rust-config
 pub fn save_config(
     dir: &str,
@@ -117,6 +129,20 @@ mod tests {
         let _ = check_c2rust_config_exists();
     }
 
+    #[test]
+    fn test_transaction_holds_config_lock() {
+        let temp_dir = tempfile::TempDir::new().unwrap();
+        let project_root = temp_dir.path();
+        let lock_path = lock::config_lock_path(project_root);
+
+        let result = transaction(project_root, || {
+            assert!(FileLock::try_acquire(&lock_path).unwrap().is_none());
+            Ok(42)
+        });
+        assert_eq!(result.unwrap(), 42);
+        assert!(FileLock::try_acquire(&lock_path).unwrap().is_some());
+    }
+
     #[test]
     #[serial]
     fn test_get_c2rust_config_path_with_env() {
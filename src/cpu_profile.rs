@@ -0,0 +1,416 @@
+use serde::Serialize;
+use std::collections::{BTreeMap, HashMap};
+use std::fs;
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+/// How often the build's process tree is sampled
+const SAMPLE_INTERVAL: Duration = Duration::from_millis(100);
+
+/// Role of a process in the build, used to attribute CPU time
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Role {
+    /// The real compile (compiler drivers, cc1, as)
+    Compile,
+    /// Extra preprocessing started by libhook.so (`cc -E ...`)
+    HookPreprocess,
+    /// Linkers and archivers
+    Link,
+    /// make, ninja, cmake and the shells they spawn
+    BuildTool,
+    /// Everything else
+    Other,
+}
+
+impl Role {
+    pub fn as_str(self) -> &'static str {
+        match self {
+            Role::Compile => "compile",
+            Role::HookPreprocess => "hook-preprocess",
+            Role::Link => "link",
+            Role::BuildTool => "build-tool",
+            Role::Other => "other",
+        }
+    }
+}
+
+/// One point of the concurrency-over-time series
+#[derive(Debug, Serialize)]
+pub struct ConcurrencySample {
+    /// Milliseconds since the sampler started
+    pub t_ms: u64,
+    /// Number of running processes per role
+    pub running: BTreeMap<&'static str, usize>,
+}
+
+/// CPU breakdown of a tracked build
+#[derive(Debug, Serialize)]
+pub struct CpuProfile {
+    pub interval_ms: u64,
+    pub wall_secs: f64,
+    /// CPU seconds attributed to each role by sampling
+    pub cpu_secs: BTreeMap<&'static str, f64>,
+    /// CPU seconds of all waited-for descendants, as reported by the kernel (0 if unknown)
+    pub total_cpu_secs: f64,
+    /// CPU time of short-lived processes that exited between two samples
+    pub unattributed_cpu_secs: f64,
+    pub samples: Vec<ConcurrencySample>,
+}
+
+/// Fields of /proc/<pid>/stat used by the sampler
+#[derive(Debug, PartialEq)]
+struct ProcStat {
+    pid: u32,
+    comm: String,
+    state: char,
+    ppid: u32,
+    /// utime + stime in clock ticks
+    cpu_ticks: u64,
+    starttime: u64,
+}
+
+/// Last observation of a live descendant, keyed by (pid, starttime) to survive pid reuse
+struct Tracked {
+    comm: String,
+    role: Role,
+    cpu_ticks: u64,
+}
+
+/// Background thread sampling the CPU usage of a process tree
+pub struct CpuSampler {
+    stop: Arc<AtomicBool>,
+    handle: JoinHandle<(Duration, HashMap<Role, u64>, Vec<ConcurrencySample>)>,
+}
+
+impl CpuSampler {
+    /// Start sampling `root_pid` and all of its descendants
+    pub fn start(root_pid: u32) -> CpuSampler {
+        let stop = Arc::new(AtomicBool::new(false));
+        let thread_stop = Arc::clone(&stop);
+        let handle = std::thread::spawn(move || sample_loop(root_pid, &thread_stop));
+        CpuSampler { stop, handle }
+    }
+
+    /// Stop sampling and build the profile.
+    /// Must be called after the root process was waited for so that the kernel's
+    /// cumulative children CPU time includes the whole build.
+    pub fn finish(self) -> CpuProfile {
+        self.stop.store(true, Ordering::Relaxed);
+        let (wall, role_ticks, samples) = self.handle.join().unwrap_or_default();
+
+        let tick = clock_tick();
+        let cpu_secs: BTreeMap<&'static str, f64> = role_ticks
+            .iter()
+            .map(|(role, ticks)| (role.as_str(), *ticks as f64 / tick))
+            .collect();
+        let attributed: f64 = cpu_secs.values().sum();
+        let total_cpu_secs = children_cpu_ticks().map_or(0.0, |t| t as f64 / tick);
+
+        CpuProfile {
+            interval_ms: SAMPLE_INTERVAL.as_millis() as u64,
+            wall_secs: wall.as_secs_f64(),
+            cpu_secs,
+            total_cpu_secs,
+            unattributed_cpu_secs: (total_cpu_secs - attributed).max(0.0),
+            samples,
+        }
+    }
+}
+
+fn sample_loop(
+    root_pid: u32,
+    stop: &AtomicBool,
+) -> (Duration, HashMap<Role, u64>, Vec<ConcurrencySample>) {
+    let start = Instant::now();
+    let mut tracked: HashMap<(u32, u64), Tracked> = HashMap::new();
+    let mut role_ticks: HashMap<Role, u64> = HashMap::new();
+    let mut samples = Vec::new();
+
+    loop {
+        let finished = stop.load(Ordering::Relaxed);
+        let stats = read_all_stats();
+        let mut running: BTreeMap<&'static str, usize> = BTreeMap::new();
+
+        for stat in descendants(root_pid, &stats) {
+            let key = (stat.pid, stat.starttime);
+            let entry = tracked.entry(key).or_insert_with(|| Tracked {
+                comm: String::new(),
+                role: Role::Other,
+                cpu_ticks: 0,
+            });
+            // A process changes role when it execs (e.g. sh -> gcc), re-classify then
+            if entry.comm != stat.comm {
+                entry.role = classify(&stat.comm, &read_cmdline(stat.pid));
+                entry.comm = stat.comm.clone();
+            }
+            let delta = stat.cpu_ticks.saturating_sub(entry.cpu_ticks);
+            entry.cpu_ticks = stat.cpu_ticks;
+            *role_ticks.entry(entry.role).or_insert(0) += delta;
+
+            if stat.state == 'R' {
+                *running.entry(entry.role.as_str()).or_insert(0) += 1;
+            }
+        }
+
+        samples.push(ConcurrencySample {
+            t_ms: start.elapsed().as_millis() as u64,
+            running,
+        });
+
+        if finished {
+            break;
+        }
+        std::thread::sleep(SAMPLE_INTERVAL);
+    }
+
+    (start.elapsed(), role_ticks, samples)
+}
+
+/// Collect `root_pid` and its descendants from a full /proc snapshot
+fn descendants(root_pid: u32, stats: &[ProcStat]) -> Vec<&ProcStat> {
+    let mut children: HashMap<u32, Vec<&ProcStat>> = HashMap::new();
+    let mut root = None;
+    for stat in stats {
+        children.entry(stat.ppid).or_default().push(stat);
+        if stat.pid == root_pid {
+            root = Some(stat);
+        }
+    }
+
+    let mut result: Vec<&ProcStat> = root.into_iter().collect();
+    let mut pending = vec![root_pid];
+    while let Some(pid) = pending.pop() {
+        if let Some(kids) = children.get(&pid) {
+            for kid in kids {
+                pending.push(kid.pid);
+                result.push(kid);
+            }
+        }
+    }
+    result
+}
+
+/// Read /proc/<pid>/stat of every process; processes vanishing mid-scan are skipped
+fn read_all_stats() -> Vec<ProcStat> {
+    let Ok(entries) = fs::read_dir("/proc") else {
+        return Vec::new();
+    };
+    entries
+        .filter_map(|entry| entry.ok())
+        .filter(|entry| entry.file_name().to_string_lossy().bytes().all(|b| b.is_ascii_digit()))
+        .filter_map(|entry| fs::read_to_string(entry.path().join("stat")).ok())
+        .filter_map(|content| parse_stat(&content))
+        .collect()
+}
+
+/// Parse the content of /proc/<pid>/stat.
+/// The command name is enclosed in parentheses and may itself contain spaces or ')',
+/// so the remaining fields are located after the last ')'.
+fn parse_stat(content: &str) -> Option<ProcStat> {
+    let open = content.find('(')?;
+    let close = content.rfind(')')?;
+    let pid = content[..open].trim().parse().ok()?;
+    let comm = content[open + 1..close].to_string();
+    let fields: Vec<&str> = content[close + 1..].split_whitespace().collect();
+    // fields[0] is field 3 (state) of proc(5)
+    let field = |n: usize| fields.get(n - 3).and_then(|f| f.parse::<u64>().ok());
+
+    Some(ProcStat {
+        pid,
+        comm,
+        state: fields.first()?.chars().next()?,
+        ppid: field(4)? as u32,
+        cpu_ticks: field(14)? + field(15)?,
+        starttime: field(22)?,
+    })
+}
+
+fn read_cmdline(pid: u32) -> Vec<String> {
+    fs::read(format!("/proc/{}/cmdline", pid))
+        .map(|bytes| {
+            bytes
+                .split(|&b| b == 0)
+                .filter(|arg| !arg.is_empty())
+                .map(|arg| String::from_utf8_lossy(arg).into_owned())
+                .collect()
+        })
+        .unwrap_or_default()
+}
+
+/// Reduce argv[0] to a bare tool name: `/usr/bin/x86_64-linux-gnu-gcc-12` -> `gcc`
+fn tool_name(program: &str) -> &str {
+    let mut name = program.rsplit('/').next().unwrap_or(program);
+    if let Some((base, version)) = name.rsplit_once('-') {
+        if !version.is_empty() && version.bytes().all(|b| b.is_ascii_digit() || b == b'.') {
+            name = base;
+        }
+    }
+    name.rsplit('-').next().unwrap_or(name)
+}
+
+/// Classify a process by its command name and arguments
+fn classify(comm: &str, cmdline: &[String]) -> Role {
+    let name = cmdline.first().map_or(comm, |argv0| tool_name(argv0));
+    let is_compiler = matches!(
+        name,
+        "gcc" | "g++" | "cc" | "c++" | "clang" | "clang++" | "cc1" | "cc1plus" | "cc1obj" | "cpp"
+    );
+
+    if is_compiler && cmdline.iter().skip(1).any(|arg| arg == "-E") {
+        return Role::HookPreprocess;
+    }
+    if is_compiler || name == "as" {
+        return Role::Compile;
+    }
+    match name {
+        "ld" | "ld.bfd" | "ld.gold" | "ld.lld" | "lld" | "mold" | "ld.mold" | "gold"
+        | "collect2" | "ar" | "ranlib" => Role::Link,
+        "make" | "gmake" | "ninja" | "cmake" | "sh" | "bash" | "dash" => Role::BuildTool,
+        _ => Role::Other,
+    }
+}
+
+/// Clock ticks per second used by /proc/<pid>/stat
+fn clock_tick() -> f64 {
+    // SAFETY: sysconf has no preconditions
+    let ticks = unsafe { libc::sysconf(libc::_SC_CLK_TCK) };
+    if ticks > 0 {
+        ticks as f64
+    } else {
+        100.0
+    }
+}
+
+/// cutime + cstime of the current process: CPU of all waited-for descendants
+fn children_cpu_ticks() -> Option<u64> {
+    let content = fs::read_to_string("/proc/self/stat").ok()?;
+    let close = content.rfind(')')?;
+    let fields: Vec<&str> = content[close + 1..].split_whitespace().collect();
+    let cutime: u64 = fields.get(16 - 3)?.parse().ok()?;
+    let cstime: u64 = fields.get(17 - 3)?.parse().ok()?;
+    Some(cutime + cstime)
+}
+
+/// Print a CPU breakdown and save it as JSON to `<feature_dir>/cpu_profile.json`
+pub fn report(profile: &CpuProfile, feature_dir: &Path) {
+    println!("\n=== Build CPU profile ===");
+    println!("Wall time: {:.1}s", profile.wall_secs);
+    let total = profile.total_cpu_secs.max(profile.cpu_secs.values().sum());
+    for (role, secs) in &profile.cpu_secs {
+        let share = if total > 0.0 { secs / total * 100.0 } else { 0.0 };
+        println!("  {:<16} {:>10.1} CPU-s  {:>5.1}%", role, secs, share);
+    }
+    println!(
+        "  {:<16} {:>10.1} CPU-s  (processes shorter than {}ms)",
+        "unattributed", profile.unattributed_cpu_secs, profile.interval_ms
+    );
+    let peak = profile
+        .samples
+        .iter()
+        .map(|s| s.running.values().sum::<usize>())
+        .max()
+        .unwrap_or(0);
+    println!("Peak concurrency: {} running process(es)", peak);
+
+    let path = feature_dir.join("cpu_profile.json");
+    match serde_json::to_string_pretty(profile) {
+        Ok(json) => match fs::write(&path, json) {
+            Ok(_) => println!("CPU profile saved to: {}", path.display()),
+            Err(e) => eprintln!("Warning: Failed to save CPU profile: {}", e),
+        },
+        Err(e) => eprintln!("Warning: Failed to serialize CPU profile: {}", e),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn args(list: &[&str]) -> Vec<String> {
+        list.iter().map(|s| s.to_string()).collect()
+    }
+
+    #[test]
+    fn test_parse_stat_with_spaces_and_parens_in_comm() {
+        let content = "1234 (cc1 (x) y) R 1200 1234 1200 0 -1 4194304 100 0 0 0 \
+                       250 50 0 0 20 0 1 0 98765 1000 100";
+        let stat = parse_stat(content).unwrap();
+        assert_eq!(
+            stat,
+            ProcStat {
+                pid: 1234,
+                comm: "cc1 (x) y".to_string(),
+                state: 'R',
+                ppid: 1200,
+                cpu_ticks: 300,
+                starttime: 98765,
+            }
+        );
+    }
+
+    #[test]
+    fn test_parse_stat_truncated() {
+        assert!(parse_stat("1234 (make) S 1").is_none());
+        assert!(parse_stat("garbage").is_none());
+    }
+
+    #[test]
+    fn test_tool_name() {
+        assert_eq!(tool_name("/usr/bin/x86_64-linux-gnu-gcc-12"), "gcc");
+        assert_eq!(tool_name("clang-17"), "clang");
+        assert_eq!(tool_name("/usr/lib/gcc/x86_64-linux-gnu/12/cc1"), "cc1");
+        assert_eq!(tool_name("ld.lld"), "ld.lld");
+        assert_eq!(tool_name("make"), "make");
+    }
+
+    #[test]
+    fn test_classify_roles() {
+        assert_eq!(classify("cc1", &args(&["/usr/lib/cc1", "-quiet", "a.c"])), Role::Compile);
+        assert_eq!(
+            classify("gcc", &args(&["gcc", "-E", "-C", "a.c", "-o", "a.c2rust", "-P"])),
+            Role::HookPreprocess
+        );
+        assert_eq!(classify("cc1", &args(&["cc1", "-E", "-quiet", "a.c"])), Role::HookPreprocess);
+        assert_eq!(classify("as", &args(&["as", "-o", "a.o"])), Role::Compile);
+        assert_eq!(classify("ld", &args(&["/usr/bin/ld", "-o", "prog"])), Role::Link);
+        assert_eq!(classify("mold", &args(&["mold"])), Role::Link);
+        assert_eq!(classify("make", &args(&["make", "-j8"])), Role::BuildTool);
+        assert_eq!(classify("python3", &args(&["python3", "gen.py"])), Role::Other);
+        // Without a readable cmdline the kernel's comm is used
+        assert_eq!(classify("ninja", &[]), Role::BuildTool);
+    }
+
+    #[test]
+    fn test_descendants_walks_whole_tree() {
+        let stat = |pid, ppid| ProcStat {
+            pid,
+            comm: String::new(),
+            state: 'S',
+            ppid,
+            cpu_ticks: 0,
+            starttime: 0,
+        };
+        let stats = vec![stat(1, 0), stat(10, 1), stat(11, 10), stat(12, 11), stat(20, 1)];
+        let mut pids: Vec<u32> = descendants(10, &stats).iter().map(|s| s.pid).collect();
+        pids.sort();
+        assert_eq!(pids, vec![10, 11, 12]);
+    }
+
+    #[test]
+    fn test_sampler_observes_child_process() {
+        let mut child = std::process::Command::new("sh")
+            .args(["-c", "sleep 0.3"])
+            .spawn()
+            .unwrap();
+        let sampler = CpuSampler::start(child.id());
+        child.wait().unwrap();
+        let profile = sampler.finish();
+
+        assert!(!profile.samples.is_empty());
+        assert!(profile.wall_secs > 0.0);
+        assert!(profile.total_cpu_secs >= 0.0);
+    }
+}
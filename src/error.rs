@@ -10,6 +10,12 @@ pub enum Error {
     HookLibraryNotFound,
     FileSelectionCancelled(String),
     TargetSelectionCancelled(String),
+    LockFailed(String),
+    BundleInvalid(String),
+    TransformFailed(String),
+    PerfRegression(String),
+    ObjectMissing(String),
+    ValidationFailed(String),
 }
 
 impl fmt::Display for Error {
@@ -42,6 +48,24 @@ impl fmt::Display for Error {
             Error::TargetSelectionCancelled(msg) => {
                 write!(f, "Target selection cancelled: {}", msg)
             }
+            Error::LockFailed(msg) => {
+                write!(f, "Failed to acquire lock: {}", msg)
+            }
+            Error::BundleInvalid(msg) => {
+                write!(f, "Invalid bundle: {}", msg)
+            }
+            Error::TransformFailed(msg) => {
+                write!(f, "Transform failed: {}", msg)
+            }
+            Error::PerfRegression(msg) => {
+                write!(f, "Performance regression: {}", msg)
+            }
+            Error::ObjectMissing(msg) => {
+                write!(f, "Large output not in .c2rust/.objects: {}", msg)
+            }
+            Error::ValidationFailed(msg) => {
+                write!(f, "Validation failed: {}", msg)
+            }
         }
     }
 }
@@ -0,0 +1,217 @@
+use crate::lock;
+use serde::Serialize;
+use std::fs::OpenOptions;
+use std::io::{self, Write};
+use std::os::fd::FromRawFd;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::{FileTypeExt, OpenOptionsExt};
+use std::os::unix::net::UnixStream;
+use std::path::{Path, PathBuf};
+
+/// Environment variable naming the event sink for libhook.so
+pub const EVENTS_ENV: &str = "C2RUST_EVENTS";
+
+/// A translation unit whose output is complete in the feature directory
+#[derive(Debug, Serialize)]
+struct TuEvent<'a> {
+    event: &'static str,
+    feature_dir: &'a Path,
+    key: &'a str,
+    output: &'a Path,
+    /// 64-bit FNV-1a of the output's content
+    hash: String,
+    /// `<output>.opts`, the options of the compilation; written by libhook.so as it
+    /// records the compilation, before any event for it
+    flags: PathBuf,
+}
+
+/// The run has finished with a feature: no more `tu` events for it
+#[derive(Debug, Serialize)]
+struct DoneEvent<'a> {
+    event: &'static str,
+    feature_dir: &'a Path,
+    /// Outputs left after file selection
+    outputs: usize,
+    changes: PathBuf,
+    selected_files: PathBuf,
+}
+
+/// Where completion events go: one JSON object per line, written by libhook.so,
+/// the staging drainer and c2rust-build as soon as an output is in place, so
+/// downstream workers can start on early translation units while the build runs.
+///
+/// The sink is an append-only log file (created if missing), a FIFO or a
+/// listening Unix stream socket (one connection per event). Events are best
+/// effort: FIFOs and sockets are opened and written without blocking, so events
+/// are dropped without a reader or listener, or while the consumer lags behind,
+/// and the build never waits for a consumer.
+#[derive(Debug, Clone)]
+pub struct EventSink {
+    path: PathBuf,
+}
+
+impl EventSink {
+    /// `path` must be absolute, since hooked compilers run in other directories
+    pub fn new(path: PathBuf) -> EventSink {
+        EventSink { path }
+    }
+
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+
+    pub fn tu(&self, feature_dir: &Path, key: &str, output: &Path, hash: u64) {
+        self.send(&TuEvent {
+            event: "tu",
+            feature_dir,
+            key,
+            output,
+            hash: format!("{:016x}", hash),
+            flags: {
+                let mut opts = output.as_os_str().to_owned();
+                opts.push(".opts");
+                PathBuf::from(opts)
+            },
+        });
+    }
+
+    pub fn done(&self, feature_dir: &Path, outputs: usize) {
+        self.send(&DoneEvent {
+            event: "done",
+            feature_dir,
+            outputs,
+            changes: feature_dir.join(crate::outputs::CHANGES_FILE),
+            selected_files: feature_dir.join("selected_files.json"),
+        });
+    }
+
+    fn send(&self, event: &impl Serialize) {
+        let mut line = serde_json::to_string(event).expect("events serialize");
+        line.push('\n');
+        if let Err(e) = self.write_line(line.as_bytes()) {
+            eprintln!(
+                "Warning: Failed to publish event to {}: {}",
+                self.path.display(),
+                e
+            );
+        }
+    }
+
+    fn write_line(&self, line: &[u8]) -> io::Result<()> {
+        let is_socket =
+            std::fs::metadata(&self.path).is_ok_and(|meta| meta.file_type().is_socket());
+        if is_socket {
+            return connect_nonblocking(&self.path)?.write_all(line);
+        }
+
+        // Opening a FIFO without a reader fails instead of blocking, and writes to
+        // a full FIFO fail as well, like libhook.so's
+        let mut file = OpenOptions::new()
+            .append(true)
+            .create(true)
+            .custom_flags(libc::O_NONBLOCK)
+            .open(&self.path)?;
+        if file.metadata()?.file_type().is_fifo() {
+            // Lines up to PIPE_BUF are written whole or not at all; longer ones
+            // could interleave with the hook's
+            if line.len() > libc::PIPE_BUF {
+                return Err(io::Error::other("event longer than PIPE_BUF"));
+            }
+            return file.write_all(line);
+        }
+        lock::flock(&file, libc::LOCK_EX, &self.path).map_err(io::Error::other)?;
+        file.write_all(line)
+    }
+}
+
+/// Connect to a Unix stream socket without waiting: a listener whose backlog is
+/// full refuses with `WouldBlock`, and writes to the stream never block
+fn connect_nonblocking(path: &Path) -> io::Result<UnixStream> {
+    // SAFETY: sockaddr_un is plain data; the descriptor is owned by the stream
+    // right after it is created
+    unsafe {
+        let mut addr: libc::sockaddr_un = std::mem::zeroed();
+        let bytes = path.as_os_str().as_bytes();
+        if bytes.len() >= addr.sun_path.len() {
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, "socket path too long"));
+        }
+        addr.sun_family = libc::AF_UNIX as libc::sa_family_t;
+        for (dst, &src) in addr.sun_path.iter_mut().zip(bytes) {
+            *dst = src as libc::c_char;
+        }
+        let fd = libc::socket(
+            libc::AF_UNIX,
+            libc::SOCK_STREAM | libc::SOCK_NONBLOCK | libc::SOCK_CLOEXEC,
+            0,
+        );
+        if fd == -1 {
+            return Err(io::Error::last_os_error());
+        }
+        let stream = UnixStream::from_raw_fd(fd);
+        let len = std::mem::size_of::<libc::sockaddr_un>() as libc::socklen_t;
+        if libc::connect(fd, &addr as *const _ as *const libc::sockaddr, len) == -1 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(stream)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::{BufRead, BufReader};
+    use std::os::unix::net::UnixListener;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_events_are_appended_as_json_lines() {
+        let temp_dir = TempDir::new().unwrap();
+        let sink = EventSink::new(temp_dir.path().join("events.jsonl"));
+        let feature_dir = temp_dir.path().join(".c2rust").join("default");
+        let output = feature_dir.join("c").join("src").join("a.c2rust");
+        sink.tu(&feature_dir, "src/a.c", &output, 0xabc);
+        sink.done(&feature_dir, 1);
+
+        let content = std::fs::read_to_string(sink.path()).unwrap();
+        let events: Vec<serde_json::Value> = content
+            .lines()
+            .map(|line| serde_json::from_str(line).unwrap())
+            .collect();
+        assert_eq!(events.len(), 2);
+        assert_eq!(events[0]["event"], "tu");
+        assert_eq!(events[0]["key"], "src/a.c");
+        assert_eq!(events[0]["hash"], "0000000000000abc");
+        assert_eq!(events[0]["flags"], format!("{}.opts", output.display()));
+        assert_eq!(events[1]["event"], "done");
+        assert_eq!(events[1]["outputs"], 1);
+    }
+
+    #[test]
+    fn test_events_to_socket_and_fifo_without_reader() {
+        let temp_dir = TempDir::new().unwrap();
+        let socket = temp_dir.path().join("events.sock");
+        let listener = UnixListener::bind(&socket).unwrap();
+        EventSink::new(socket).tu(temp_dir.path(), "a.c", Path::new("/a.c2rust"), 1);
+        let (stream, _) = listener.accept().unwrap();
+        let mut line = String::new();
+        BufReader::new(stream).read_line(&mut line).unwrap();
+        assert!(line.contains("\"key\":\"a.c\""));
+
+        // Nobody reads the FIFO: the event is dropped instead of blocking
+        let fifo = temp_dir.path().join("events.fifo");
+        let path = std::ffi::CString::new(fifo.to_str().unwrap()).unwrap();
+        assert_eq!(unsafe { libc::mkfifo(path.as_ptr(), 0o644) }, 0);
+        let sink = EventSink::new(fifo.clone());
+        assert!(sink.write_line(b"{}\n").is_err());
+
+        // A reader that falls behind: once the FIFO is full, events are dropped too
+        let _reader = OpenOptions::new()
+            .read(true)
+            .custom_flags(libc::O_NONBLOCK)
+            .open(&fifo)
+            .unwrap();
+        let line = [b'x'; 1024];
+        let written = (0..1024).take_while(|_| sink.write_line(&line).is_ok()).count();
+        assert!(written > 0 && written < 1024);
+    }
+}
@@ -1,4 +1,7 @@
+use crate::chunks;
 use crate::error::{Error, Result};
+use crate::heap_profile;
+use crate::store::{Store, Transaction, SELECTED_PREFIX};
 use dialoguer::{theme::ColorfulTheme, MultiSelect};
 use std::collections::{HashMap, HashSet};
 use std::fs;
@@ -19,7 +22,7 @@ pub struct PreprocessedFileInfo {
 
 /// Represents an item that can be selected (either a file or a directory)
 #[derive(Debug, Clone)]
-enum SelectableItem {
+pub(crate) enum SelectableItem {
     /// A file item
     File {
         info: PreprocessedFileInfo,
@@ -85,7 +88,7 @@ fn collect_files_recursive(
 /// Build a hierarchical tree structure from collected files
 /// Returns a list of SelectableItems with proper depth and parent-child relationships
 /// Items are returned in preorder (parent -> children) for proper tree display
-fn build_hierarchical_items(
+pub(crate) fn build_hierarchical_items(
     files: &[PreprocessedFileInfo],
     base_dir: &Path,
 ) -> Vec<SelectableItem> {
@@ -330,6 +333,7 @@ pub fn select_files_interactive(
     c_dir: &Path,
     no_interactive: bool,
     selected_target: Option<&str>,
+    preselected: &HashSet<PathBuf>,
 ) -> Result<Vec<PathBuf>> {
     if files.is_empty() {
         println!("No preprocessed files found.");
@@ -373,8 +377,11 @@ pub fn select_files_interactive(
         .map(format_item_display)
         .collect();
 
-    // No items are selected by default
-    let defaults: Vec<bool> = vec![false; selectable_items.len()];
+    // Only files of an earlier selection are checked by default
+    let defaults: Vec<bool> = selectable_items
+        .iter()
+        .map(|item| matches!(item, SelectableItem::File { info, .. } if preselected.contains(&info.path)))
+        .collect();
 
     let prompt_text = if let Some(target) = selected_target {
         format!(
@@ -403,10 +410,27 @@ pub fn select_files_interactive(
             Error::FileSelectionCancelled(format!("{}", e))
         })?;
 
-    // Process selections: folder-level selections propagate to all contained files.
-    // Checking a folder includes ALL files within it (folder selection wins).
-    // A deselected folder excludes its descendants only when no ancestor folder is selected.
-    let total_items = selectable_items.len();
+    let selected_files = resolve_selection(&selectable_items, selections);
+
+    if let Some(target) = selected_target {
+        println!(
+            "\nSelected {} file(s) that participate in building target '{}'",
+            selected_files.len(),
+            target
+        );
+    } else {
+        println!("\nSelected {} file(s)", selected_files.len());
+    }
+
+    Ok(selected_files)
+}
+
+/// Resolve the raw item indices chosen in the UI into the final list of selected files.
+/// Folder-level selections propagate to all contained files (folder selection wins);
+/// a deselected folder excludes its descendants only when no ancestor folder is selected.
+/// Files are returned in item order, which is deterministic.
+pub(crate) fn resolve_selection(items: &[SelectableItem], selections: Vec<usize>) -> Vec<PathBuf> {
+    let total_items = items.len();
     let selected_set: HashSet<usize> = selections.into_iter().collect();
     
     // Compute indices not in the user's selection
@@ -418,7 +442,7 @@ pub fn select_files_interactive(
     
     // Build parent map for ancestor relationship checks (used for expansion and cascade removal)
     let mut parent_of: Vec<Option<usize>> = vec![None; total_items];
-    for (idx, item) in selectable_items.iter().enumerate() {
+    for (idx, item) in items.iter().enumerate() {
         if let SelectableItem::Directory { child_indices, .. } = item {
             for &child_idx in child_indices {
                 if child_idx < total_items {
@@ -445,14 +469,14 @@ pub fn select_files_interactive(
     // Only expand topmost selected directories (no selected ancestor) to avoid redundant work.
     if selected_set.len() < total_items {
         for &idx in &selected_set {
-            if let SelectableItem::Directory { child_indices, .. } = &selectable_items[idx] {
+            if let SelectableItem::Directory { child_indices, .. } = &items[idx] {
                 // Skip if this directory has a selected ancestor (will be expanded by ancestor)
                 if has_selected_ancestor(idx) {
                     continue;
                 }
                 
                 let mut descendants = Vec::new();
-                collect_all_descendants(&selectable_items, child_indices, &mut descendants);
+                collect_all_descendants(&items, child_indices, &mut descendants);
                 
                 // Add ALL descendants — folder selection overrides individual file states
                 for desc_idx in descendants {
@@ -466,12 +490,12 @@ pub fn select_files_interactive(
     // Skip directories whose ancestor is selected — the ancestor's selection takes priority.
     // Also skip individual files that were explicitly selected by the user.
     for &idx in &deselected_indices {
-        if let SelectableItem::Directory { child_indices, .. } = &selectable_items[idx] {
+        if let SelectableItem::Directory { child_indices, .. } = &items[idx] {
             if has_selected_ancestor(idx) {
                 continue;
             }
             let mut descendants = Vec::new();
-            collect_all_descendants(&selectable_items, child_indices, &mut descendants);
+            collect_all_descendants(&items, child_indices, &mut descendants);
 
             for desc_idx in descendants {
                 // Don't remove files that were explicitly selected by the user
@@ -484,7 +508,7 @@ pub fn select_files_interactive(
     
     // Extract file paths from selected items in deterministic order (by index)
     let mut selected_files: Vec<PathBuf> = Vec::new();
-    for (idx, item) in selectable_items.iter().enumerate() {
+    for (idx, item) in items.iter().enumerate() {
         if final_selected.contains(&idx) {
             if let SelectableItem::File { info, .. } = item {
                 selected_files.push(info.path.clone());
@@ -492,17 +516,7 @@ pub fn select_files_interactive(
         }
     }
 
-    if let Some(target) = selected_target {
-        println!(
-            "\nSelected {} file(s) that participate in building target '{}'",
-            selected_files.len(),
-            target
-        );
-    } else {
-        println!("\nSelected {} file(s)", selected_files.len());
-    }
-
-    Ok(selected_files)
+    selected_files
 }
 
 /// Recursively collect all descendant indices from a list of child indices
@@ -536,19 +550,20 @@ pub fn save_selected_files(
         .join(feature)
         .join("selected_files.json");
 
-    // Create parent directory if needed
-    if let Some(parent) = selection_file.parent() {
-        fs::create_dir_all(parent)?;
+    // The selection is committed to the feature's store as one transaction replacing
+    // the previous one; selected_files.json is exported from it
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    fs::create_dir_all(&feature_dir)?;
+    let mut store = Store::open(&feature_dir)?;
+    let mut txn = Transaction::default();
+    for (previous, _) in store.scan(SELECTED_PREFIX) {
+        txn.delete(format!("{}{}", SELECTED_PREFIX, previous));
     }
-
-    // Convert paths to strings for serialization
-    let file_strings: Vec<String> = selected_files
-        .iter()
-        .map(|p| p.display().to_string())
-        .collect();
-
-    let json = serde_json::to_string_pretty(&file_strings)?;
-    fs::write(&selection_file, json)?;
+    for path in selected_files {
+        txn.put(format!("{}{}", SELECTED_PREFIX, path.display()), Vec::new());
+    }
+    store.commit(txn)?;
+    store.export_selected_files(&feature_dir)?;
 
     println!("Selection saved to: {}", selection_file.display());
 
@@ -592,6 +607,8 @@ pub fn cleanup_unselected_files(
         match fs::remove_file(&file_info.path) {
             Ok(_) => {
                 removed_count += 1;
+                // Its chunk index, if any, would keep the directory from emptying
+                let _ = fs::remove_file(chunks::index_path(&file_info.path));
                 // Collect parent directory for cleanup
                 if let Some(parent) = file_info.path.parent() {
                     parent_dirs.insert(parent.to_path_buf());
@@ -741,6 +758,7 @@ pub fn process_and_select_files(
 ) -> Result<usize> {
     println!("\nCollecting preprocessed files from: {}", c_dir.display());
 
+    heap_profile::enter("select.collect");
     let preprocessed_files = collect_preprocessed_files(c_dir)?;
 
     if preprocessed_files.is_empty() {
@@ -752,11 +770,19 @@ pub fn process_and_select_files(
         return Ok(0);
     }
 
+    heap_profile::enter("select.choose");
     let selected_files =
-        select_files_interactive(preprocessed_files.clone(), c_dir, no_interactive, selected_target)?;
+        select_files_interactive(
+            preprocessed_files.clone(),
+            c_dir,
+            no_interactive,
+            selected_target,
+            &HashSet::new(),
+        )?;
 
     if !selected_files.is_empty() {
         // First save the selection
+        heap_profile::enter("select.save");
         save_selected_files(&selected_files, feature, project_root)?;
         let count = selected_files.len();
         if let Some(target) = selected_target {
@@ -769,6 +795,7 @@ pub fn process_and_select_files(
         }
 
         // Then cleanup unselected files
+        heap_profile::enter("select.cleanup");
         cleanup_unselected_files(&preprocessed_files, &selected_files, c_dir)?;
 
         Ok(count)
@@ -1022,6 +1049,8 @@ mod tests {
 
         fs::write(&file1, "content1").unwrap();
         fs::write(&file2, "content2").unwrap();
+        // A chunk index goes with its file
+        fs::write(chunks::index_path(&file2), "").unwrap();
 
         let all_files = vec![
             PreprocessedFileInfo {
@@ -2025,4 +2054,64 @@ mod tests {
         // src directory itself was not selected
         assert!(!final_selected.contains(&src_idx), "Unselected parent directory should not be included");
     }
+
+    #[test]
+    fn test_resolve_selection_folder_includes_all_files() {
+        let c_dir = PathBuf::from("/tmp/c");
+        let files = vec![
+            PreprocessedFileInfo {
+                path: c_dir.join("root.c.c2rust"),
+                display_name: "root.c.c2rust".to_string(),
+            },
+            PreprocessedFileInfo {
+                path: c_dir.join("src/a.c.c2rust"),
+                display_name: "src/a.c.c2rust".to_string(),
+            },
+            PreprocessedFileInfo {
+                path: c_dir.join("src/sub/b.c.c2rust"),
+                display_name: "src/sub/b.c.c2rust".to_string(),
+            },
+        ];
+
+        let items = build_hierarchical_items(&files, &c_dir);
+        let src_idx = items
+            .iter()
+            .position(|item| {
+                matches!(item, SelectableItem::Directory { display_name, .. } if display_name == "src")
+            })
+            .expect("Should find src directory");
+
+        let selected = resolve_selection(&items, vec![src_idx]);
+
+        assert_eq!(
+            selected,
+            vec![c_dir.join("src/a.c.c2rust"), c_dir.join("src/sub/b.c.c2rust")]
+        );
+    }
+
+    #[test]
+    fn test_resolve_selection_individual_file_survives_deselected_parent() {
+        let c_dir = PathBuf::from("/tmp/c");
+        let keep = c_dir.join("src/keep.c.c2rust");
+        let files = vec![
+            PreprocessedFileInfo {
+                path: keep.clone(),
+                display_name: "src/keep.c.c2rust".to_string(),
+            },
+            PreprocessedFileInfo {
+                path: c_dir.join("src/other.c.c2rust"),
+                display_name: "src/other.c.c2rust".to_string(),
+            },
+        ];
+
+        let items = build_hierarchical_items(&files, &c_dir);
+        let keep_idx = items
+            .iter()
+            .position(|item| matches!(item, SelectableItem::File { info, .. } if info.path == keep))
+            .expect("Should find keep file");
+
+        let selected = resolve_selection(&items, vec![keep_idx]);
+
+        assert_eq!(selected, vec![keep]);
+    }
 }
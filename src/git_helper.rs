@@ -1,23 +1,100 @@
 use crate::error::Result;
-use std::path::Path;
+use crate::lock::{self, FileLock};
+use crate::objects;
+use crate::transform;
+use std::collections::{HashMap, HashSet};
+use std::fs::{self, OpenOptions};
+use std::os::fd::{AsRawFd, RawFd};
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::MetadataExt;
+use std::os::unix::process::CommandExt;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+
+/// Output of the last background commit, in `.c2rust/.locks` of the project
+pub const COMMIT_LOG: &str = "commit.log";
+
+/// Generations of each feature kept in the `.c2rust` history by default: all of
+/// them, dropping old generations is opt-in
+pub const DEFAULT_HISTORY: usize = 0;
+
+/// Settings applied once to the `.c2rust` repository for its background
+/// maintenance. Successive generations of a preprocessed file differ little, so a
+/// wide delta window pays off; the window memory bounds repacking of large files.
+/// Objects left unreachable by dropping old generations are pruned after an hour
+/// (not immediately, so a concurrent commit never loses its fresh objects).
+const MAINTENANCE_CONFIG: &[(&str, &str)] = &[
+    ("pack.window", "250"),
+    ("pack.depth", "50"),
+    ("pack.windowMemory", "256m"),
+    ("gc.auto", "2000"),
+    ("gc.autoPackLimit", "20"),
+    ("gc.pruneExpire", "1.hour.ago"),
+    ("gc.reflogExpireUnreachable", "now"),
+];
+/// Bumped whenever `MAINTENANCE_CONFIG` changes
+const MAINTENANCE_CONFIG_VERSION: i32 = 1;
+const MAINTENANCE_CONFIG_KEY: &str = "c2rust.maintenanceVersion";
+
+/// Repository setting: files larger than this many KiB are committed as pointer
+/// files and their content kept in `.c2rust/.objects` (unset or 0: disabled)
+const OBJECT_THRESHOLD_KEY: &str = "c2rust.objectThreshold";
+
+/// Marker in the objects directory: old generations were dropped, prune objects
+const PRUNE_PENDING: &str = "prune-pending";
+
+/// Set the size above which auto-commits of the project keep files in the
+/// `.c2rust/.objects` side store instead of the git history, in KiB (0 disables).
+/// Stored in the repository's config, so every later commit honours it, including
+/// those of `select`, `import` and background commits. Best effort, like commits.
+pub fn set_object_threshold(project_root: &Path, kib: u32) {
+    let c2rust_dir = project_root.join(".c2rust");
+    if !c2rust_dir.join(".git").is_dir() {
+        return;
+    }
+    let kib = i32::try_from(kib).unwrap_or(i32::MAX);
+    let result = git2::Repository::open(&c2rust_dir)
+        .and_then(|repo| repo.config())
+        .and_then(|mut config| config.set_i32(OBJECT_THRESHOLD_KEY, kib));
+    if let Err(e) = result {
+        eprintln!("Warning: Failed to set the large-object threshold: {}", e);
+    }
+}
+
+fn object_threshold(repo: &git2::Repository) -> Option<u64> {
+    let kib = repo.config().ok()?.get_i32(OBJECT_THRESHOLD_KEY).ok()?;
+    (kib > 0).then(|| kib as u64 * 1024)
+}
 
 /// Check if there are any modifications in the .c2rust directory and auto-commit if needed.
 ///
 /// This function checks the git repository located at <project_root>/.c2rust/.git
 /// for any changes in the .c2rust directory and commits them if changes exist.
 ///
+/// Commits are serialized on the project's git lock, which is only held for the
+/// duration of the commit. Directories of features still being tracked by another
+/// c2rust-build process are left out; that process commits them when it finishes.
+///
 /// This is a best-effort operation - any errors are logged but do not fail the overall
 /// workflow, since auto-commit is a final-stage convenience feature.
 ///
+/// After a commit, history beyond the last `history` generations of every feature
+/// is dropped (0 keeps everything), and `git gc` is started in the background:
+/// `--auto` normally, so loose objects are packed incrementally, and a full run
+/// after old generations were dropped, so their objects are pruned. libgit2 never
+/// runs either on its own.
+///
 /// # Arguments
 ///
 /// * `project_root` - The absolute path to the project root directory
+/// * `feature` - The feature tracked by this run
+/// * `history` - Generations of each feature to keep
 ///
 /// # Returns
 ///
 /// Returns `Ok(())` in all cases. Git operation errors are logged to stderr but not propagated.
 /// This ensures that auto-commit failures never cause the overall build process to fail.
-pub fn auto_commit_if_modified(project_root: &Path) -> Result<()> {
+pub fn auto_commit_if_modified(project_root: &Path, feature: &str, history: usize) -> Result<()> {
     let c2rust_dir = project_root.join(".c2rust");
     let git_dir = c2rust_dir.join(".git");
 
@@ -27,18 +104,431 @@ pub fn auto_commit_if_modified(project_root: &Path) -> Result<()> {
         return Ok(());
     }
 
+    let _lock = FileLock::acquire(&lock::git_lock_path(project_root), "git lock")?;
+    commit_locked(project_root, feature, history);
+    Ok(())
+}
+
+/// Commit in a detached child process (`c2rust-build commit`) instead of waiting
+/// for it, for every root in `roots` that has a `.c2rust/.git` repository.
+///
+/// The git locks of those roots are taken here, and they and `feature_locks` are
+/// handed over to the child, which holds them until it is done. A later run of the
+/// same feature therefore waits for the commit before changing the feature
+/// directory, and later commits of other features are ordered after it;
+/// `c2rust-build wait` waits for it explicitly. The child's output goes to
+/// `.c2rust/.locks/commit.log` of the first root. Returns whether a child was
+/// started; if not, the feature locks are released as usual.
+pub fn spawn_auto_commit(
+    roots: &[PathBuf],
+    feature: &str,
+    history: usize,
+    feature_locks: Vec<FileLock>,
+) -> Result<bool> {
+    let roots: Vec<&PathBuf> = roots
+        .iter()
+        .filter(|root| root.join(".c2rust").join(".git").is_dir())
+        .collect();
+    if roots.is_empty() {
+        return Ok(false);
+    }
+
+    let git_locks = roots
+        .iter()
+        .map(|root| FileLock::acquire(&lock::git_lock_path(root), "git lock"))
+        .collect::<Result<Vec<_>>>()?;
+    let inherited: Vec<RawFd> = git_locks
+        .iter()
+        .chain(&feature_locks)
+        .map(AsRawFd::as_raw_fd)
+        .collect();
+
+    let log = OpenOptions::new()
+        .create(true)
+        .write(true)
+        .truncate(true)
+        .open(lock::locks_dir(roots[0]).join(COMMIT_LOG))?;
+    let mut child = Command::new(std::env::current_exe()?);
+    child
+        .arg("commit")
+        .arg("--feature")
+        .arg(feature)
+        .arg("--history")
+        .arg(history.to_string())
+        .arg("--lock-fds")
+        .arg(
+            inherited
+                .iter()
+                .map(|fd| fd.to_string())
+                .collect::<Vec<_>>()
+                .join(","),
+        )
+        .args(&roots)
+        .stdin(Stdio::null())
+        .stdout(log.try_clone()?)
+        .stderr(log)
+        // Own process group: a Ctrl-C at the terminal does not interrupt the commit
+        .process_group(0);
+    // SAFETY: only async-signal-safe fcntl calls between fork and exec
+    unsafe {
+        child.pre_exec(move || {
+            for &fd in &inherited {
+                if libc::fcntl(fd, libc::F_SETFD, 0) < 0 {
+                    return Err(std::io::Error::last_os_error());
+                }
+            }
+            Ok(())
+        });
+    }
+    child.spawn()?;
+
+    for lock in git_locks.into_iter().chain(feature_locks) {
+        lock.hand_over();
+    }
+    Ok(true)
+}
+
+/// Keep the lock descriptors handed over by `spawn_auto_commit` open in this
+/// process only, so that processes it starts (`git gc`) do not hold the locks
+pub fn keep_handed_over_locks(fds: &[RawFd]) {
+    for &fd in fds {
+        // SAFETY: fcntl on a descriptor number; an invalid one only fails
+        unsafe { libc::fcntl(fd, libc::F_SETFD, libc::FD_CLOEXEC) };
+    }
+}
+
+/// Auto-commit with the project's git lock already held, by this process or
+/// handed over by `spawn_auto_commit`
+pub fn commit_locked(project_root: &Path, feature: &str, history: usize) {
+    let c2rust_dir = project_root.join(".c2rust");
+    let in_use = lock::features_in_use(project_root, feature);
+
     // All git operations are best-effort - log errors but don't fail
-    if let Err(e) = try_auto_commit(&c2rust_dir) {
-        eprintln!("Warning: Auto-commit failed: {}", e);
-        eprintln!("Continuing without auto-commit.");
+    match try_auto_commit(&c2rust_dir, feature, &in_use) {
+        Ok(true) => {
+            let pruned = if history > 0 {
+                enforce_history(&c2rust_dir, history).unwrap_or_else(|e| {
+                    eprintln!("Warning: Failed to drop old history: {}", e);
+                    false
+                })
+            } else {
+                false
+            };
+            // Dropped commits stay in the reflogs until the full `git gc` started
+            // below expires them, so their objects are pruned by the next commit
+            let objects_dir = c2rust_dir.join(objects::OBJECTS_DIR);
+            let pending = objects_dir.join(PRUNE_PENDING);
+            if pruned {
+                if objects_dir.is_dir() {
+                    if let Err(e) = fs::write(&pending, "") {
+                        eprintln!("Warning: Failed to schedule pruning .c2rust/.objects: {}", e);
+                    }
+                }
+            } else if pending.exists() {
+                match prune_objects(&c2rust_dir) {
+                    Ok(_) => {
+                        let _ = fs::remove_file(&pending);
+                    }
+                    Err(e) => eprintln!("Warning: Failed to prune .c2rust/.objects: {}", e),
+                }
+            }
+            start_maintenance(&c2rust_dir, pruned);
+        }
+        Ok(false) => {}
+        Err(e) => {
+            eprintln!("Warning: Auto-commit failed: {}", e);
+            eprintln!("Continuing without auto-commit.");
+        }
+    }
+}
+
+/// Feature named in an auto-commit message
+fn commit_feature(message: &str) -> Option<&str> {
+    message
+        .trim_end()
+        .rsplit_once("(feature: ")?
+        .1
+        .strip_suffix(')')
+}
+
+/// Index of the oldest commit to keep in a first-parent history listed newest
+/// first, so that the last `history` commits of every feature for which `exists`
+/// holds are kept. Commits of other features and foreign commits only survive when
+/// they are newer. The newest commit is always kept.
+fn history_boundary(
+    features: &[Option<&str>],
+    history: usize,
+    exists: impl Fn(&str) -> bool,
+) -> usize {
+    let mut counts: HashMap<&str, usize> = HashMap::new();
+    let mut boundary = 0;
+    for (i, feature) in features.iter().enumerate() {
+        let Some(feature) = feature.filter(|f| exists(f)) else {
+            continue;
+        };
+        let count = counts.entry(feature).or_default();
+        *count += 1;
+        if *count <= history {
+            boundary = i;
+        }
+    }
+    boundary
+}
+
+/// Drop the commits older than the last `history` generations of each feature
+/// still present at HEAD, by re-creating the kept commits (same trees, authors
+/// and messages) on a new root. Runs only once at least `history` commits can go,
+/// so the history stays between `history` and twice that many generations per
+/// feature without being rewritten on every run. History holding commits that
+/// auto-commit did not create (manual commits, merges) is never rewritten, since
+/// the dropped commits could not be recovered. Returns whether it rewrote.
+fn enforce_history(c2rust_dir: &Path, history: usize) -> std::result::Result<bool, String> {
+    let repo = git2::Repository::open(c2rust_dir)
+        .map_err(|e| format!("Failed to open git repository: {}", e))?;
+    let head = repo
+        .head()
+        .map_err(|e| format!("Failed to get HEAD: {}", e))?;
+    // Leave a detached HEAD or anything else set up by hand alone
+    let Some(branch) = head.name().filter(|_| head.is_branch()).map(str::to_string) else {
+        return Ok(false);
+    };
+    let head_tree = head
+        .peel_to_commit()
+        .and_then(|commit| commit.tree())
+        .map_err(|e| format!("Failed to get HEAD tree: {}", e))?;
+
+    let mut walk = repo
+        .revwalk()
+        .map_err(|e| format!("Failed to walk history: {}", e))?;
+    walk.push_head()
+        .and_then(|()| walk.simplify_first_parent())
+        .map_err(|e| format!("Failed to walk history: {}", e))?;
+    let commits = walk
+        .map(|id| id.and_then(|id| repo.find_commit(id)))
+        .collect::<std::result::Result<Vec<_>, _>>()
+        .map_err(|e| format!("Failed to read history: {}", e))?;
+
+    let features: Vec<Option<&str>> = commits
+        .iter()
+        .map(|commit| commit.message().and_then(commit_feature))
+        .collect();
+    let boundary = history_boundary(&features, history, |feature| {
+        head_tree.get_path(Path::new(feature)).is_ok()
+    });
+    if commits.len() - boundary - 1 < history {
+        return Ok(false);
     }
+    if let Some(commit) = commits
+        .iter()
+        .zip(&features)
+        .find(|(commit, feature)| feature.is_none() || commit.parent_count() > 1)
+        .map(|(commit, _)| commit)
+    {
+        eprintln!(
+            "Warning: Not dropping old .c2rust history: commit {} was not made by c2rust-build",
+            commit.id()
+        );
+        return Ok(false);
+    }
+
+    let mut parent: Option<git2::Commit> = None;
+    for commit in commits[..=boundary].iter().rev() {
+        let tree = commit
+            .tree()
+            .map_err(|e| format!("Failed to get tree: {}", e))?;
+        let parents: Vec<&git2::Commit> = parent.iter().collect();
+        let id = repo
+            .commit(
+                None,
+                &commit.author(),
+                &commit.committer(),
+                commit.message().unwrap_or_default(),
+                &tree,
+                &parents,
+            )
+            .and_then(|id| repo.find_commit(id))
+            .map_err(|e| format!("Failed to rewrite commit: {}", e))?;
+        parent = Some(id);
+    }
+    if let Some(tip) = parent {
+        repo.reference(
+            &branch,
+            tip.id(),
+            true,
+            &format!("c2rust-build: keep the last {} generations", history),
+        )
+        .map_err(|e| format!("Failed to update {}: {}", branch, e))?;
+    }
+    Ok(true)
+}
+
+/// Configure the repository for maintenance (once) and start `git gc` detached
+/// from this process. Best effort: without a `git` executable, the history is
+/// still bounded but never repacked.
+fn start_maintenance(c2rust_dir: &Path, full: bool) {
+    if let Err(e) = configure_maintenance(c2rust_dir) {
+        eprintln!("Warning: Failed to configure git maintenance: {}", e);
+    }
+
+    let mut gc = Command::new("git");
+    gc.arg("-C").arg(c2rust_dir).arg("gc").arg("--quiet");
+    if !full {
+        gc.arg("--auto");
+    }
+    // Own process group: a Ctrl-C at the terminal does not interrupt a repack
+    gc.stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .stderr(Stdio::null())
+        .process_group(0);
+    if let Err(e) = gc.spawn() {
+        eprintln!("Warning: Failed to start git maintenance: {}", e);
+    }
+}
+
+fn configure_maintenance(c2rust_dir: &Path) -> std::result::Result<(), git2::Error> {
+    let repo = git2::Repository::open(c2rust_dir)?;
+    let mut config = repo.config()?;
+    if config.get_i32(MAINTENANCE_CONFIG_KEY).ok() == Some(MAINTENANCE_CONFIG_VERSION) {
+        return Ok(());
+    }
+    for (key, value) in MAINTENANCE_CONFIG {
+        config.set_str(key, value)?;
+    }
+    config.set_i32(MAINTENANCE_CONFIG_KEY, MAINTENANCE_CONFIG_VERSION)
+}
 
+/// Whether a path relative to .c2rust belongs in an auto-commit
+fn is_committable(path: &Path, in_use: &[String]) -> bool {
+    !path.starts_with(lock::LOCKS_DIR)
+        && !path.starts_with(transform::CACHE_DIR)
+        && !path.starts_with(objects::OBJECTS_DIR)
+        && !in_use.iter().any(|f| path.starts_with(f))
+}
+
+/// Move a large file's content to the side store and stage a pointer to it. The
+/// index entry keeps the file's own stat data, so `git status` in `.c2rust` sees the
+/// file as unchanged without reading it.
+fn stage_pointer(
+    index: &mut git2::Index,
+    c2rust_dir: &Path,
+    objects_dir: &Path,
+    path: &Path,
+) -> std::result::Result<(), String> {
+    let file = c2rust_dir.join(path);
+    let pointer = objects::store(objects_dir, &file)
+        .map_err(|e| format!("Failed to store {} in .c2rust/.objects: {}", path.display(), e))?;
+    let metadata =
+        fs::metadata(&file).map_err(|e| format!("Failed to stat {}: {}", path.display(), e))?;
+
+    let mut entry = git2::IndexEntry {
+        ctime: git2::IndexTime::new(metadata.ctime() as i32, metadata.ctime_nsec() as u32),
+        mtime: git2::IndexTime::new(metadata.mtime() as i32, metadata.mtime_nsec() as u32),
+        dev: metadata.dev() as u32,
+        ino: metadata.ino() as u32,
+        mode: 0o100644,
+        uid: metadata.uid(),
+        gid: metadata.gid(),
+        file_size: metadata.len() as u32,
+        id: git2::Oid::zero(),
+        flags: 0,
+        flags_extended: 0,
+        path: path.as_os_str().as_bytes().to_vec(),
+    };
+    index
+        .add_frombuffer(&entry, &pointer.to_bytes())
+        .map_err(|e| format!("Failed to stage pointer for {}: {}", path.display(), e))?;
+    // add_frombuffer records the pointer's size; restore the file's
+    if let Some(staged) = index.get_path(path, 0) {
+        entry.id = staged.id;
+        index
+            .add(&entry)
+            .map_err(|e| format!("Failed to stage pointer for {}: {}", path.display(), e))?;
+    }
     Ok(())
 }
 
-/// Internal helper that performs the actual git operations.
-/// Errors are returned to the caller for logging.
-fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
+/// Remove objects of the side store that no commit points to any more, after old
+/// generations were dropped. Only small blobs are read: pointers never exceed a
+/// few hundred bytes, and trees shared between commits are visited once.
+fn prune_objects(c2rust_dir: &Path) -> std::result::Result<usize, String> {
+    let objects_dir = c2rust_dir.join(objects::OBJECTS_DIR);
+    if !objects_dir.is_dir() {
+        return Ok(0);
+    }
+    let repo = git2::Repository::open(c2rust_dir)
+        .map_err(|e| format!("Failed to open git repository: {}", e))?;
+    let odb = repo
+        .odb()
+        .map_err(|e| format!("Failed to open object database: {}", e))?;
+    let mut walk = repo
+        .revwalk()
+        .map_err(|e| format!("Failed to walk history: {}", e))?;
+    // Everything git itself keeps alive: HEAD, every ref and their reflogs
+    walk.push_head()
+        .and_then(|()| walk.push_glob("refs/*"))
+        .map_err(|e| format!("Failed to walk history: {}", e))?;
+    let mut logged = vec!["HEAD".to_string()];
+    for reference in repo
+        .references()
+        .map_err(|e| format!("Failed to list references: {}", e))?
+    {
+        let reference = reference.map_err(|e| format!("Failed to list references: {}", e))?;
+        logged.extend(reference.name().map(str::to_string));
+    }
+    for name in &logged {
+        let Ok(reflog) = repo.reflog(name) else {
+            continue;
+        };
+        for entry in reflog.iter() {
+            for id in [entry.id_old(), entry.id_new()] {
+                // Entries may name commits git has already collected
+                if !id.is_zero() {
+                    let _ = walk.push(id);
+                }
+            }
+        }
+    }
+
+    let mut seen = HashSet::new();
+    let mut referenced = HashSet::new();
+    for id in walk {
+        let tree = id
+            .and_then(|id| repo.find_commit(id))
+            .and_then(|commit| commit.tree())
+            .map_err(|e| format!("Failed to read history: {}", e))?;
+        if !seen.insert(tree.id()) {
+            continue;
+        }
+        tree.walk(git2::TreeWalkMode::PreOrder, |_, entry| {
+            if !seen.insert(entry.id()) {
+                return git2::TreeWalkResult::Skip;
+            }
+            if entry.kind() == Some(git2::ObjectType::Blob) {
+                let small = odb
+                    .read_header(entry.id())
+                    .is_ok_and(|(size, _)| size as u64 <= objects::MAX_POINTER_LEN);
+                if let Some(pointer) = small
+                    .then(|| repo.find_blob(entry.id()).ok())
+                    .flatten()
+                    .and_then(|blob| objects::Pointer::parse(blob.content()))
+                {
+                    referenced.insert(pointer.sha256);
+                }
+            }
+            git2::TreeWalkResult::Ok
+        })
+        .map_err(|e| format!("Failed to walk tree: {}", e))?;
+    }
+    objects::prune(&objects_dir, &referenced).map_err(|e| e.to_string())
+}
+
+/// Internal helper that performs the actual git operations; returns whether a
+/// commit was created. Errors are returned to the caller for logging.
+fn try_auto_commit(
+    c2rust_dir: &Path,
+    feature: &str,
+    in_use: &[String],
+) -> std::result::Result<bool, String> {
     // Open the repository
     let repo = git2::Repository::open(c2rust_dir).map_err(|e| {
         format!(
@@ -53,15 +543,54 @@ fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
         .index()
         .map_err(|e| format!("Failed to get git index: {}", e))?;
 
-    // Add all changes to the index
+    // Stage additions, modifications and removals, skipping lock files, caches and
+    // the half-written output of features that are still being tracked. Files above
+    // the object threshold are set aside (without being hashed into git) and staged
+    // as pointers below.
+    let threshold = object_threshold(&repo);
+    let mut large = Vec::new();
+    let mut filter = |path: &Path, _spec: &[u8]| -> i32 {
+        if !is_committable(path, in_use) {
+            return 1;
+        }
+        let is_large = threshold.is_some_and(|threshold| {
+            fs::symlink_metadata(c2rust_dir.join(path))
+                .is_ok_and(|m| m.is_file() && m.len() > threshold)
+        });
+        if is_large {
+            large.push(path.to_path_buf());
+            1
+        } else {
+            0
+        }
+    };
     index
-        .add_all(["."].iter(), git2::IndexAddOption::DEFAULT, None)
+        .add_all(
+            ["."].iter(),
+            git2::IndexAddOption::DEFAULT,
+            Some(&mut filter as &mut git2::IndexMatchedPath),
+        )
         .map_err(|e| format!("Failed to add files to git index: {}", e))?;
+    index
+        .update_all(
+            ["."].iter(),
+            Some(&mut filter as &mut git2::IndexMatchedPath),
+        )
+        .map_err(|e| format!("Failed to update git index: {}", e))?;
+
+    large.sort();
+    large.dedup();
+    let objects_dir = c2rust_dir.join(objects::OBJECTS_DIR);
+    for path in &large {
+        stage_pointer(&mut index, c2rust_dir, &objects_dir, path)?;
+    }
 
     index
         .write()
         .map_err(|e| format!("Failed to write git index: {}", e))?;
 
+    let message = format!("Auto-commit: c2rust-build changes (feature: {})", feature);
+
     // Get the tree for the index
     let tree_id = index
         .write_tree()
@@ -84,7 +613,7 @@ fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
             // If there are no changes, return early
             // Note: Using len() == 0 because Deltas::is_empty() is nightly-only
             if diff.deltas().len() == 0 {
-                return Ok(());
+                return Ok(false);
             }
 
             // Create an initial commit
@@ -95,13 +624,13 @@ fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
                 Some("HEAD"),
                 &sig,
                 &sig,
-                "Auto-commit: c2rust-build changes",
+                &message,
                 &tree,
                 &[],
             )
             .map_err(|e| format!("Failed to create initial commit: {}", e))?;
 
-            return Ok(());
+            return Ok(true);
         }
     };
 
@@ -121,7 +650,7 @@ fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
     // If there are no changes, return early
     // Note: Using len() == 0 because Deltas::is_empty() is nightly-only
     if diff.deltas().len() == 0 {
-        return Ok(());
+        return Ok(false);
     }
 
     // Create the commit
@@ -136,13 +665,13 @@ fn try_auto_commit(c2rust_dir: &Path) -> std::result::Result<(), String> {
         Some("HEAD"),
         &sig,
         &sig,
-        "Auto-commit: c2rust-build changes",
+        &message,
         &tree,
         &[&parent_commit],
     )
     .map_err(|e| format!("Failed to create commit: {}", e))?;
 
-    Ok(())
+    Ok(true)
 }
 
 #[cfg(test)]
@@ -155,7 +684,7 @@ mod tests {
     fn test_auto_commit_no_git_dir() {
         // Test that when .c2rust/.git doesn't exist, function returns Ok
         let temp_dir = TempDir::new().unwrap();
-        let result = auto_commit_if_modified(temp_dir.path());
+        let result = auto_commit_if_modified(temp_dir.path(), "default", DEFAULT_HISTORY);
         assert!(result.is_ok());
     }
 
@@ -179,7 +708,7 @@ mod tests {
         fs::write(&test_file, "test content").unwrap();
 
         // Run auto_commit_if_modified
-        let result = auto_commit_if_modified(temp_dir.path());
+        let result = auto_commit_if_modified(temp_dir.path(), "default", DEFAULT_HISTORY);
         assert!(
             result.is_ok(),
             "Expected auto_commit to succeed, got: {:?}",
@@ -194,7 +723,7 @@ mod tests {
         let first_commit_id = commit.id();
 
         // Run auto_commit_if_modified again without any changes
-        let result2 = auto_commit_if_modified(temp_dir.path());
+        let result2 = auto_commit_if_modified(temp_dir.path(), "default", DEFAULT_HISTORY);
         assert!(
             result2.is_ok(),
             "Expected second auto_commit to succeed, got: {:?}",
@@ -228,7 +757,7 @@ mod tests {
         fs::write(&test_file, "test content").unwrap();
 
         // Run auto_commit_if_modified - it should succeed despite git config errors
-        let result = auto_commit_if_modified(temp_dir.path());
+        let result = auto_commit_if_modified(temp_dir.path(), "default", DEFAULT_HISTORY);
 
         // The function should return Ok(()) even though git operations failed
         assert!(
@@ -240,4 +769,181 @@ mod tests {
         // Note: The warning message would be printed to stderr but we can't easily capture it in unit tests
         // Integration tests can verify the warning output
     }
+
+    #[test]
+    fn test_auto_commit_skips_features_in_use() {
+        let temp_dir = TempDir::new().unwrap();
+        let project_root = temp_dir.path();
+        let c2rust_dir = project_root.join(".c2rust");
+        fs::create_dir_all(c2rust_dir.join("a")).unwrap();
+        fs::create_dir_all(c2rust_dir.join("b")).unwrap();
+
+        let repo = git2::Repository::init(&c2rust_dir).unwrap();
+        let mut config = repo.config().unwrap();
+        config.set_str("user.name", "Test User").unwrap();
+        config.set_str("user.email", "test@example.com").unwrap();
+
+        fs::write(c2rust_dir.join("a").join("done.txt"), "a").unwrap();
+        fs::write(c2rust_dir.join("b").join("partial.txt"), "b").unwrap();
+
+        // Feature "b" is still being tracked by another run
+        let _busy = FileLock::acquire(&lock::feature_lock_path(project_root, "b"), "feature")
+            .unwrap();
+        let _own = FileLock::acquire(&lock::feature_lock_path(project_root, "a"), "feature")
+            .unwrap();
+
+        auto_commit_if_modified(project_root, "a", DEFAULT_HISTORY).unwrap();
+
+        let commit = repo.head().unwrap().peel_to_commit().unwrap();
+        assert!(commit.message().unwrap().contains("feature: a"));
+        let tree = commit.tree().unwrap();
+        assert!(tree.get_path(Path::new("a/done.txt")).is_ok());
+        assert!(tree.get_path(Path::new("b/partial.txt")).is_err());
+        assert!(tree.get_path(Path::new(".locks")).is_err());
+    }
+
+    #[test]
+    fn test_auto_commit_records_removed_files() {
+        let temp_dir = TempDir::new().unwrap();
+        let c2rust_dir = temp_dir.path().join(".c2rust");
+        fs::create_dir_all(c2rust_dir.join("a")).unwrap();
+
+        let repo = git2::Repository::init(&c2rust_dir).unwrap();
+        let mut config = repo.config().unwrap();
+        config.set_str("user.name", "Test User").unwrap();
+        config.set_str("user.email", "test@example.com").unwrap();
+
+        let stale = c2rust_dir.join("a").join("stale.txt");
+        fs::write(&stale, "old").unwrap();
+        auto_commit_if_modified(temp_dir.path(), "a", DEFAULT_HISTORY).unwrap();
+
+        fs::remove_file(&stale).unwrap();
+        auto_commit_if_modified(temp_dir.path(), "a", DEFAULT_HISTORY).unwrap();
+
+        let tree = repo.head().unwrap().peel_to_commit().unwrap().tree().unwrap();
+        assert!(tree.get_path(Path::new("a/stale.txt")).is_err());
+    }
+
+    #[test]
+    fn test_auto_commit_stores_large_files_as_pointers() {
+        let temp_dir = TempDir::new().unwrap();
+        let c2rust_dir = temp_dir.path().join(".c2rust");
+        fs::create_dir_all(c2rust_dir.join("a")).unwrap();
+
+        let repo = git2::Repository::init(&c2rust_dir).unwrap();
+        let mut config = repo.config().unwrap();
+        config.set_str("user.name", "Test User").unwrap();
+        config.set_str("user.email", "test@example.com").unwrap();
+        set_object_threshold(temp_dir.path(), 1);
+
+        let large = "int table[] = {0};\n".repeat(100);
+        fs::write(c2rust_dir.join("a").join("large.c2rust"), &large).unwrap();
+        fs::write(c2rust_dir.join("a").join("small.c2rust"), "int a;\n").unwrap();
+        auto_commit_if_modified(temp_dir.path(), "a", DEFAULT_HISTORY).unwrap();
+
+        let tree = repo.head().unwrap().peel_to_commit().unwrap().tree().unwrap();
+        let blob = |path: &str| {
+            let entry = tree.get_path(Path::new(path)).unwrap();
+            repo.find_blob(entry.id()).unwrap().content().to_vec()
+        };
+        assert_eq!(blob("a/small.c2rust"), b"int a;\n");
+        let pointer = objects::Pointer::parse(&blob("a/large.c2rust")).unwrap();
+        assert_eq!(pointer.size, large.len() as u64);
+        let objects_dir = c2rust_dir.join(objects::OBJECTS_DIR);
+        assert_eq!(fs::read_to_string(pointer.object_path(&objects_dir)).unwrap(), large);
+        assert!(tree.get_path(Path::new(objects::OBJECTS_DIR)).is_err());
+    }
+
+    #[test]
+    fn test_commit_feature() {
+        assert_eq!(
+            commit_feature("Auto-commit: c2rust-build changes (feature: arm/debug)\n"),
+            Some("arm/debug")
+        );
+        assert_eq!(commit_feature("Initial import"), None);
+    }
+
+    #[test]
+    fn test_history_boundary() {
+        let features = [
+            Some("a"),
+            Some("b"),
+            Some("a"),
+            None,
+            Some("a"),
+            Some("gone"),
+            Some("b"),
+            Some("a"),
+        ];
+        let exists = |feature: &str| feature != "gone";
+        // The second generation of "b" is the oldest one needed
+        assert_eq!(history_boundary(&features, 2, exists), 6);
+        assert_eq!(history_boundary(&features, 1, exists), 1);
+        assert_eq!(history_boundary(&features, 10, exists), 7);
+        assert_eq!(history_boundary(&[None, None], 1, exists), 0);
+    }
+
+    #[test]
+    fn test_auto_commit_bounds_history() {
+        let temp_dir = TempDir::new().unwrap();
+        let c2rust_dir = temp_dir.path().join(".c2rust");
+        fs::create_dir_all(c2rust_dir.join("a")).unwrap();
+
+        let repo = git2::Repository::init(&c2rust_dir).unwrap();
+        let mut config = repo.config().unwrap();
+        config.set_str("user.name", "Test User").unwrap();
+        config.set_str("user.email", "test@example.com").unwrap();
+
+        for generation in 0..5 {
+            fs::write(c2rust_dir.join("a").join("out.c2rust"), generation.to_string()).unwrap();
+            auto_commit_if_modified(temp_dir.path(), "a", 2).unwrap();
+        }
+
+        // Rewritten after the fourth generation, then one more was added
+        let mut walk = repo.revwalk().unwrap();
+        walk.push_head().unwrap();
+        let commits: Vec<git2::Oid> = walk.map(|id| id.unwrap()).collect();
+        assert_eq!(commits.len(), 3);
+        let oldest = repo.find_commit(commits[2]).unwrap();
+        assert_eq!(oldest.parent_count(), 0);
+
+        let tree = repo.head().unwrap().peel_to_commit().unwrap().tree().unwrap();
+        let entry = tree.get_path(Path::new("a/out.c2rust")).unwrap();
+        assert_eq!(repo.find_blob(entry.id()).unwrap().content(), b"4");
+        assert_eq!(
+            config.get_i32(MAINTENANCE_CONFIG_KEY).unwrap(),
+            MAINTENANCE_CONFIG_VERSION
+        );
+    }
+
+    #[test]
+    fn test_history_with_manual_commit_is_kept() {
+        let temp_dir = TempDir::new().unwrap();
+        let c2rust_dir = temp_dir.path().join(".c2rust");
+        fs::create_dir_all(c2rust_dir.join("a")).unwrap();
+
+        let repo = git2::Repository::init(&c2rust_dir).unwrap();
+        let mut config = repo.config().unwrap();
+        config.set_str("user.name", "Test User").unwrap();
+        config.set_str("user.email", "test@example.com").unwrap();
+
+        fs::write(c2rust_dir.join("notes.txt"), "by hand").unwrap();
+        let mut index = repo.index().unwrap();
+        index
+            .add_all(["notes.txt"].iter(), git2::IndexAddOption::DEFAULT, None)
+            .unwrap();
+        let tree = repo.find_tree(index.write_tree().unwrap()).unwrap();
+        let signature = repo.signature().unwrap();
+        repo.commit(Some("HEAD"), &signature, &signature, "Manual notes", &tree, &[])
+            .unwrap();
+
+        for generation in 0..5 {
+            fs::write(c2rust_dir.join("a").join("out.c2rust"), generation.to_string()).unwrap();
+            auto_commit_if_modified(temp_dir.path(), "a", 2).unwrap();
+        }
+
+        let mut walk = repo.revwalk().unwrap();
+        walk.push_head().unwrap();
+        assert_eq!(walk.count(), 6);
+    }
 }
@@ -0,0 +1,280 @@
+//! Opt-in heap profiling of the driver.
+//!
+//! With `C2RUST_HEAP_PROFILE` set, the global allocator counts allocations, allocated
+//! bytes and the peak of live bytes per phase of the run, and samples a backtrace
+//! about once per `SAMPLE_BYTES` allocated to attribute memory to call sites. A
+//! report is printed to stderr at exit. Disabled, the allocator costs one relaxed
+//! atomic load per allocation.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::backtrace::Backtrace;
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicI64, AtomicU64, AtomicUsize, Ordering};
+use std::sync::Mutex;
+
+/// Environment variable enabling the profile
+pub const HEAP_PROFILE_ENV: &str = "C2RUST_HEAP_PROFILE";
+
+const MAX_PHASES: usize = 64;
+/// Average number of allocated bytes between two backtrace samples
+const SAMPLE_BYTES: u64 = 1 << 20;
+const TOP_SITES: usize = 5;
+
+struct PhaseCounters {
+    allocs: AtomicU64,
+    bytes: AtomicU64,
+    /// Highest number of live bytes (across all phases) seen during this phase
+    peak: AtomicI64,
+}
+
+impl PhaseCounters {
+    const fn new() -> PhaseCounters {
+        PhaseCounters {
+            allocs: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            peak: AtomicI64::new(0),
+        }
+    }
+}
+
+struct Sample {
+    phase: usize,
+    /// Bytes allocated by this thread since its previous sample
+    bytes: u64,
+    backtrace: Backtrace,
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static CURRENT: AtomicUsize = AtomicUsize::new(0);
+static LIVE: AtomicI64 = AtomicI64::new(0);
+static PHASES: [PhaseCounters; MAX_PHASES] = [const { PhaseCounters::new() }; MAX_PHASES];
+static PHASE_NAMES: Mutex<Vec<&'static str>> = Mutex::new(Vec::new());
+static SAMPLES: Mutex<Vec<Sample>> = Mutex::new(Vec::new());
+
+thread_local! {
+    static SINCE_SAMPLE: Cell<u64> = const { Cell::new(0) };
+    /// Set while this thread records a sample; its own allocations are not sampled
+    static SAMPLING: Cell<bool> = const { Cell::new(false) };
+}
+
+/// The driver's global allocator: the system allocator plus the counters above
+pub struct ProfilingAllocator;
+
+unsafe impl GlobalAlloc for ProfilingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc(layout);
+        if !ptr.is_null() && ENABLED.load(Ordering::Relaxed) {
+            record_alloc(layout.size() as u64);
+        }
+        ptr
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc_zeroed(layout);
+        if !ptr.is_null() && ENABLED.load(Ordering::Relaxed) {
+            record_alloc(layout.size() as u64);
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout);
+        if ENABLED.load(Ordering::Relaxed) {
+            LIVE.fetch_sub(layout.size() as i64, Ordering::Relaxed);
+        }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_ptr = System.realloc(ptr, layout, new_size);
+        if !new_ptr.is_null() && ENABLED.load(Ordering::Relaxed) {
+            LIVE.fetch_sub(layout.size() as i64, Ordering::Relaxed);
+            record_alloc(new_size as u64);
+        }
+        new_ptr
+    }
+}
+
+fn record_alloc(size: u64) {
+    let phase = CURRENT.load(Ordering::Relaxed);
+    let counters = &PHASES[phase];
+    counters.allocs.fetch_add(1, Ordering::Relaxed);
+    counters.bytes.fetch_add(size, Ordering::Relaxed);
+    let live = LIVE.fetch_add(size as i64, Ordering::Relaxed) + size as i64;
+    counters.peak.fetch_max(live, Ordering::Relaxed);
+
+    // try_with: the thread-locals are gone while a thread is being torn down
+    let _ = SINCE_SAMPLE.try_with(|since| {
+        let bytes = since.get() + size;
+        if bytes < SAMPLE_BYTES {
+            since.set(bytes);
+            return;
+        }
+        since.set(0);
+        let _ = SAMPLING.try_with(|sampling| {
+            if sampling.replace(true) {
+                return;
+            }
+            let backtrace = Backtrace::force_capture();
+            SAMPLES
+                .lock()
+                .unwrap_or_else(|e| e.into_inner())
+                .push(Sample {
+                    phase,
+                    bytes,
+                    backtrace,
+                });
+            sampling.set(false);
+        });
+    });
+}
+
+/// Enable the profile if `C2RUST_HEAP_PROFILE` is set; call first thing in `main`
+pub fn init() {
+    if std::env::var_os(HEAP_PROFILE_ENV).is_some_and(|v| !v.is_empty()) {
+        enter("startup");
+        ENABLED.store(true, Ordering::Relaxed);
+    }
+}
+
+/// Attribute the allocations from now on to phase `name`
+pub fn enter(name: &'static str) {
+    let mut names = PHASE_NAMES.lock().unwrap_or_else(|e| e.into_inner());
+    let index = match names.iter().position(|n| *n == name) {
+        Some(index) => index,
+        None if names.len() < MAX_PHASES => {
+            names.push(name);
+            names.len() - 1
+        }
+        // Out of slots: keep counting in the current phase
+        None => return,
+    };
+    CURRENT.store(index, Ordering::Relaxed);
+}
+
+/// Print the profile to stderr and stop counting; does nothing unless enabled
+pub fn report() {
+    if !ENABLED.swap(false, Ordering::Relaxed) {
+        return;
+    }
+    let names = PHASE_NAMES.lock().unwrap_or_else(|e| e.into_inner()).clone();
+    let samples = std::mem::take(&mut *SAMPLES.lock().unwrap_or_else(|e| e.into_inner()));
+    let mib = |bytes: f64| bytes / (1024.0 * 1024.0);
+
+    eprintln!();
+    eprintln!("Heap profile ({}):", HEAP_PROFILE_ENV);
+    eprintln!(
+        "  {:<24} {:>12} {:>14} {:>14}",
+        "phase", "allocs", "allocated MiB", "peak live MiB"
+    );
+    for (index, name) in names.iter().enumerate() {
+        let counters = &PHASES[index];
+        let allocs = counters.allocs.load(Ordering::Relaxed);
+        if allocs == 0 {
+            continue;
+        }
+        eprintln!(
+            "  {:<24} {:>12} {:>14.1} {:>14.1}",
+            name,
+            allocs,
+            mib(counters.bytes.load(Ordering::Relaxed) as f64),
+            mib(counters.peak.load(Ordering::Relaxed).max(0) as f64)
+        );
+    }
+
+    if samples.is_empty() {
+        return;
+    }
+    eprintln!(
+        "  Top allocation sites (one backtrace per ~{} MiB allocated):",
+        SAMPLE_BYTES >> 20
+    );
+    let mut sites: HashMap<(usize, String), u64> = HashMap::new();
+    for sample in &samples {
+        let site = call_site(&sample.backtrace.to_string());
+        *sites.entry((sample.phase, site)).or_default() += sample.bytes;
+    }
+    for (index, name) in names.iter().enumerate() {
+        let mut top: Vec<(&str, u64)> = sites
+            .iter()
+            .filter(|((phase, _), _)| *phase == index)
+            .map(|((_, site), bytes)| (site.as_str(), *bytes))
+            .collect();
+        if top.is_empty() {
+            continue;
+        }
+        top.sort_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(b.0)));
+        eprintln!("    {}:", name);
+        for (site, bytes) in top.into_iter().take(TOP_SITES) {
+            eprintln!("      {:>10.1} MiB  {}", mib(bytes as f64), site);
+        }
+    }
+}
+
+/// The innermost frame of this crate outside the profiler in a formatted backtrace,
+/// with its source location when debug info is available
+fn call_site(backtrace: &str) -> String {
+    let krate = module_path!().split("::").next().unwrap_or_default();
+    let own_prefix = format!("{}::", krate);
+    let lines: Vec<&str> = backtrace.lines().map(str::trim).collect();
+
+    for (i, line) in lines.iter().enumerate() {
+        let Some((_, function)) = line.split_once(": ") else {
+            continue;
+        };
+        if !function.starts_with(&own_prefix) || function.contains("heap_profile::") {
+            continue;
+        }
+        // Strip the symbol hash, e.g. `::h0123456789abcdef`
+        let function = match function.rsplit_once("::h") {
+            Some((name, hash)) if hash.len() == 16 => name,
+            _ => function,
+        };
+        return match lines.get(i + 1).and_then(|next| next.strip_prefix("at ")) {
+            Some(location) => format!("{} ({})", function, location),
+            None => function.to_string(),
+        };
+    }
+    "<unknown>".to_string()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_call_site_skips_std_and_profiler_frames() {
+        let backtrace = "   0: std::backtrace::Backtrace::force_capture
+             at /rustc/library/std/src/backtrace.rs:312:9
+   1: c2rust_build::heap_profile::record_alloc
+             at ./src/heap_profile.rs:120:29
+   2: alloc::raw_vec::finish_grow
+   3: c2rust_build::file_selector::build_hierarchical_items::h0123456789abcdef
+             at ./src/file_selector.rs:210:13
+   4: c2rust_build::main
+             at ./src/main.rs:500:5";
+        assert_eq!(
+            call_site(backtrace),
+            "c2rust_build::file_selector::build_hierarchical_items (./src/file_selector.rs:210:13)"
+        );
+        assert_eq!(call_site("   0: std::rt::lang_start"), "<unknown>");
+    }
+
+    #[test]
+    #[serial_test::serial]
+    fn test_profile_counts_and_samples() {
+        enter("test.heap_profile");
+        ENABLED.store(true, Ordering::Relaxed);
+
+        let buffer = vec![1u8; 4 << 20];
+        std::hint::black_box(&buffer);
+        drop(buffer);
+
+        ENABLED.store(false, Ordering::Relaxed);
+        // Other tests may allocate concurrently, and may switch phases
+        let allocated: u64 = PHASES.iter().map(|c| c.bytes.load(Ordering::Relaxed)).sum();
+        assert!(allocated >= 4 << 20);
+        assert!(!SAMPLES.lock().unwrap().is_empty());
+        SAMPLES.lock().unwrap().clear();
+    }
+}
@@ -0,0 +1,247 @@
+use crate::error::{Error, Result};
+use std::fs::{self, File, OpenOptions};
+use std::os::unix::io::{AsRawFd, RawFd};
+use std::path::{Path, PathBuf};
+
+/// Directory holding the lock files of a project
+pub const LOCKS_DIR: &str = ".locks";
+
+const FEATURE_LOCK_PREFIX: &str = "feature-";
+const LOCK_SUFFIX: &str = ".lock";
+
+/// An advisory lock (flock) on a file, released when dropped. Exclusive unless
+/// acquired with `acquire_shared`.
+#[derive(Debug)]
+pub struct FileLock {
+    file: File,
+}
+
+impl FileLock {
+    /// Acquire the lock, waiting for other c2rust-build processes holding it.
+    /// `what` describes the protected resource in the waiting message.
+    pub fn acquire(path: &Path, what: &str) -> Result<FileLock> {
+        if let Some(lock) = Self::try_acquire(path)? {
+            return Ok(lock);
+        }
+
+        println!(
+            "Waiting for another c2rust-build process to release the {}...",
+            what
+        );
+        let file = open_lock_file(path)?;
+        flock(&file, libc::LOCK_EX, path)?;
+        Ok(FileLock { file })
+    }
+
+    /// Acquire the lock shared with other readers, waiting while a process holds it
+    /// exclusively
+    pub fn acquire_shared(path: &Path, what: &str) -> Result<FileLock> {
+        let file = open_lock_file(path)?;
+        // SAFETY: flock on a valid, owned file descriptor
+        if unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_SH | libc::LOCK_NB) } != 0 {
+            println!(
+                "Waiting for another c2rust-build process to release the {}...",
+                what
+            );
+            flock(&file, libc::LOCK_SH, path)?;
+        }
+        Ok(FileLock { file })
+    }
+
+    /// Acquire the lock without waiting; returns `None` if another process holds it
+    pub fn try_acquire(path: &Path) -> Result<Option<FileLock>> {
+        let file = open_lock_file(path)?;
+        // SAFETY: flock on a valid, owned file descriptor
+        let ret = unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) };
+        if ret == 0 {
+            return Ok(Some(FileLock { file }));
+        }
+
+        let err = std::io::Error::last_os_error();
+        if err.raw_os_error() == Some(libc::EWOULDBLOCK) {
+            Ok(None)
+        } else {
+            Err(Error::LockFailed(format!("{}: {}", path.display(), err)))
+        }
+    }
+
+    /// Hand the lock over to child processes that inherited its descriptor. This
+    /// process closes its descriptor without unlocking, so the lock is released
+    /// when the last process holding the descriptor exits.
+    pub fn hand_over(self) {
+        let lock = std::mem::ManuallyDrop::new(self);
+        // SAFETY: `lock` is neither used nor dropped afterwards
+        drop(unsafe { std::ptr::read(&lock.file) });
+    }
+}
+
+impl AsRawFd for FileLock {
+    fn as_raw_fd(&self) -> RawFd {
+        self.file.as_raw_fd()
+    }
+}
+
+impl Drop for FileLock {
+    fn drop(&mut self) {
+        // SAFETY: flock on a valid, owned file descriptor; closing would release it too
+        unsafe {
+            libc::flock(self.file.as_raw_fd(), libc::LOCK_UN);
+        }
+    }
+}
+
+fn open_lock_file(path: &Path) -> Result<File> {
+    if let Some(parent) = path.parent() {
+        fs::create_dir_all(parent)?;
+    }
+    OpenOptions::new()
+        .create(true)
+        .truncate(false)
+        .write(true)
+        .open(path)
+        .map_err(|e| Error::LockFailed(format!("{}: {}", path.display(), e)))
+}
+
+/// flock(2) on an open file, retrying when interrupted
+pub fn flock(file: &File, operation: libc::c_int, path: &Path) -> Result<()> {
+    loop {
+        // SAFETY: flock on a valid, owned file descriptor
+        if unsafe { libc::flock(file.as_raw_fd(), operation) } == 0 {
+            return Ok(());
+        }
+        let err = std::io::Error::last_os_error();
+        if err.kind() != std::io::ErrorKind::Interrupted {
+            return Err(Error::LockFailed(format!("{}: {}", path.display(), err)));
+        }
+    }
+}
+
+/// `.c2rust/.locks` of a project
+pub fn locks_dir(project_root: &Path) -> PathBuf {
+    project_root.join(".c2rust").join(LOCKS_DIR)
+}
+
+/// Lock serializing commits to the `.c2rust` git repository
+pub fn git_lock_path(project_root: &Path) -> PathBuf {
+    locks_dir(project_root).join("git.lock")
+}
+
+/// Lock serializing c2rust-config writes of a project
+pub fn config_lock_path(project_root: &Path) -> PathBuf {
+    locks_dir(project_root).join("config.lock")
+}
+
+/// Lock on the transform cache: shared while entries are read or inserted,
+/// exclusive while `c2rust-build gc` evicts entries
+pub fn cache_lock_path(project_root: &Path) -> PathBuf {
+    locks_dir(project_root).join("cache.lock")
+}
+
+/// Lock held while a feature is being tracked.
+/// Feature names may contain '/', which is escaped to keep one flat lock directory.
+pub fn feature_lock_path(project_root: &Path, feature: &str) -> PathBuf {
+    locks_dir(project_root).join(format!(
+        "{}{}{}",
+        FEATURE_LOCK_PREFIX,
+        feature.replace('%', "%25").replace('/', "%2F"),
+        LOCK_SUFFIX
+    ))
+}
+
+/// Features whose lock is currently held by another c2rust-build process
+pub fn features_in_use(project_root: &Path, own_feature: &str) -> Vec<String> {
+    let Ok(entries) = fs::read_dir(locks_dir(project_root)) else {
+        return Vec::new();
+    };
+
+    entries
+        .filter_map(|entry| entry.ok())
+        .filter_map(|entry| {
+            let name = entry.file_name().to_string_lossy().into_owned();
+            let escaped = name
+                .strip_prefix(FEATURE_LOCK_PREFIX)?
+                .strip_suffix(LOCK_SUFFIX)?;
+            Some(escaped.replace("%2F", "/").replace("%25", "%"))
+        })
+        .filter(|feature| feature != own_feature)
+        .filter(|feature| {
+            // Busy if the lock cannot be taken right now
+            matches!(
+                FileLock::try_acquire(&feature_lock_path(project_root, feature)),
+                Ok(None)
+            )
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_try_acquire_is_exclusive() {
+        let temp_dir = TempDir::new().unwrap();
+        let path = temp_dir.path().join("locks").join("test.lock");
+
+        let lock = FileLock::try_acquire(&path).unwrap();
+        assert!(lock.is_some());
+        assert!(FileLock::try_acquire(&path).unwrap().is_none());
+
+        drop(lock);
+        assert!(FileLock::try_acquire(&path).unwrap().is_some());
+    }
+
+    #[test]
+    fn test_hand_over_keeps_lock_for_other_holders() {
+        let temp_dir = TempDir::new().unwrap();
+        let path = temp_dir.path().join("test.lock");
+
+        let lock = FileLock::try_acquire(&path).unwrap().unwrap();
+        // Stands in for the descriptor inherited by a child process
+        let inherited = unsafe { libc::dup(lock.as_raw_fd()) };
+        assert!(inherited >= 0);
+
+        lock.hand_over();
+        assert!(FileLock::try_acquire(&path).unwrap().is_none());
+
+        unsafe { libc::close(inherited) };
+        assert!(FileLock::try_acquire(&path).unwrap().is_some());
+    }
+
+    #[test]
+    fn test_shared_locks_exclude_exclusive() {
+        let temp_dir = TempDir::new().unwrap();
+        let path = temp_dir.path().join("test.lock");
+
+        let first = FileLock::acquire_shared(&path, "test").unwrap();
+        let second = FileLock::acquire_shared(&path, "test").unwrap();
+        assert!(FileLock::try_acquire(&path).unwrap().is_none());
+
+        drop(first);
+        assert!(FileLock::try_acquire(&path).unwrap().is_none());
+        drop(second);
+        assert!(FileLock::try_acquire(&path).unwrap().is_some());
+    }
+
+    #[test]
+    fn test_feature_lock_path_escapes_separators() {
+        let root = Path::new("/proj");
+        assert_eq!(
+            feature_lock_path(root, "arm/debug"),
+            PathBuf::from("/proj/.c2rust/.locks/feature-arm%2Fdebug.lock")
+        );
+    }
+
+    #[test]
+    fn test_features_in_use() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path();
+
+        let _own = FileLock::acquire(&feature_lock_path(root, "own"), "feature").unwrap();
+        let _busy = FileLock::acquire(&feature_lock_path(root, "arm/busy"), "feature").unwrap();
+        drop(FileLock::acquire(&feature_lock_path(root, "idle"), "feature").unwrap());
+
+        assert_eq!(features_in_use(root, "own"), vec!["arm/busy".to_string()]);
+    }
+}
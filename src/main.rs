@@ -1,9 +1,30 @@
+mod bundle;
+mod cache;
+mod chunks;
 mod config_helper;
+mod cpu_profile;
 mod error;
+mod events;
 mod file_selector;
 mod git_helper;
+mod heap_profile;
+mod lock;
+mod manifest;
+mod objects;
+mod outputs;
+mod parallel;
+mod perf;
+mod preprocess;
+mod priority;
+mod select;
+mod shadow;
+mod staging;
+mod store;
 mod target_selector;
 mod tracker;
+mod transform;
+mod validate;
+mod watch;
 
 use clap::{Args, Parser, Subcommand};
 use error::Result;
@@ -22,6 +43,134 @@ struct Cli {
 enum Commands {
     /// Execute build command and save configuration
     Build(CommandArgs),
+    /// Pack a tracked feature into a single bundle file
+    Export(ExportArgs),
+    /// Verify and unpack a feature bundle into this project
+    Import(ImportArgs),
+    /// Inspect the performance history of tracking runs
+    #[command(subcommand)]
+    Perf(PerfCommand),
+    /// Keep the preprocessed files of a tracked feature up to date while sources
+    /// and headers are edited
+    Watch(WatchArgs),
+    /// Change the target and file selection of a tracked feature without rebuilding
+    Select(SelectArgs),
+    /// Evict transform cache entries beyond the size and age budget and compact
+    /// the cache index
+    Gc(GcArgs),
+    /// Wait until a background commit started by `build --async-commit` is done
+    Wait,
+    /// Commit the tracked output of a finished run (started by `build --async-commit`)
+    #[command(hide = true)]
+    Commit(CommitArgs),
+}
+
+#[derive(Subcommand)]
+enum PerfCommand {
+    /// Compare the latest run against the runs before it; exits non-zero on a
+    /// significant regression
+    Check(PerfCheckArgs),
+}
+
+#[derive(Args)]
+struct PerfCheckArgs {
+    /// Feature to check (default: "default")
+    #[arg(long)]
+    feature: Option<String>,
+
+    /// Number of earlier runs forming the baseline
+    #[arg(long, default_value_t = perf::DEFAULT_WINDOW)]
+    window: usize,
+
+    /// Slowdown factor over the baseline median that counts as a regression
+    #[arg(long, default_value_t = perf::DEFAULT_THRESHOLD)]
+    threshold: f64,
+}
+
+#[derive(Args)]
+struct CacheArgs {
+    /// Size budget of the transform cache in MiB; least recently used entries
+    /// beyond it are evicted
+    #[arg(long, value_name = "MIB", default_value_t = cache::DEFAULT_CACHE_SIZE_MB)]
+    cache_size: u64,
+
+    /// Days a transform cache entry is kept without being used
+    #[arg(long, value_name = "DAYS", default_value_t = cache::DEFAULT_CACHE_MAX_AGE_DAYS)]
+    cache_max_age: u64,
+}
+
+#[derive(Args)]
+struct GcArgs {
+    #[command(flatten)]
+    cache: CacheArgs,
+
+    /// Started in the background by a finished build
+    #[arg(long, hide = true)]
+    auto: bool,
+}
+
+#[derive(Args)]
+struct CommitArgs {
+    #[arg(long)]
+    feature: String,
+
+    #[arg(long)]
+    history: usize,
+
+    /// Lock descriptors handed over by the parent process
+    #[arg(long, value_delimiter = ',')]
+    lock_fds: Vec<i32>,
+
+    /// Project roots to commit
+    roots: Vec<PathBuf>,
+}
+
+#[derive(Args)]
+struct WatchArgs {
+    /// Feature to watch (default: "default")
+    #[arg(long)]
+    feature: Option<String>,
+
+    /// Refresh the files that changed since the build, then exit
+    #[arg(long)]
+    once: bool,
+}
+
+#[derive(Args)]
+struct SelectArgs {
+    /// Feature to re-select (default: "default")
+    #[arg(long)]
+    feature: Option<String>,
+
+    /// Skip interactive selection and select all files of the first target
+    #[arg(long)]
+    no_interactive: bool,
+}
+
+#[derive(Args)]
+struct ExportArgs {
+    /// Feature to export (default: "default")
+    #[arg(long)]
+    feature: Option<String>,
+
+    /// Bundle file to write (default: <feature>.c2rb in the current directory)
+    #[arg(short, long, value_name = "FILE")]
+    output: Option<PathBuf>,
+}
+
+#[derive(Args)]
+struct ImportArgs {
+    /// Bundle file created by `c2rust-build export`
+    #[arg(value_name = "BUNDLE")]
+    bundle: PathBuf,
+
+    /// Feature to import into (default: the feature recorded in the bundle)
+    #[arg(long)]
+    feature: Option<String>,
+
+    /// Only list the bundle's entries without importing
+    #[arg(long)]
+    list: bool,
 }
 
 #[derive(Args)]
@@ -34,6 +183,122 @@ struct CommandArgs {
     #[arg(long)]
     no_interactive: bool,
 
+    /// Sample CPU usage of the build's process tree and report a breakdown per process role
+    #[arg(long)]
+    cpu_profile: bool,
+
+    /// Maximum acceptable tracking overhead in percent of compile time (e.g. 20).
+    /// When exceeded, libhook.so degrades: it drops comments (-C), bounds concurrent
+    /// preprocessing and finally defers preprocessing until after the build
+    #[arg(long, value_name = "PERCENT")]
+    overhead_budget: Option<u32>,
+
+    /// Let hooked processes write preprocessed files to a staging directory on tmpfs
+    /// (default: /dev/shm); they are moved to the feature directory in batches
+    #[arg(
+        long,
+        value_name = "DIR",
+        num_args = 0..=1,
+        default_missing_value = staging::DEFAULT_STAGING_DIR
+    )]
+    staging_dir: Option<PathBuf>,
+
+    /// Memory cap of the staging directory in MiB; beyond it libhook.so writes
+    /// directly to the feature directory until the backlog has drained
+    #[arg(long, value_name = "MIB", default_value_t = staging::DEFAULT_STAGING_CAP_MB)]
+    staging_cap: u64,
+
+    /// Nice level of preprocessing off the build's critical path (e.g. 19): deferred
+    /// compilations and the staging drainer. The preprocessing libhook.so runs next
+    /// to each compilation keeps the compiler's priority, as the compilation waits
+    /// for it
+    #[arg(
+        long,
+        value_name = "N",
+        allow_negative_numbers = true,
+        value_parser = clap::value_parser!(i32).range(-20..=19)
+    )]
+    preprocess_nice: Option<i32>,
+
+    /// CPU scheduling policy of preprocessing: idle runs it only on otherwise idle
+    /// CPUs, batch keeps it from preempting compilations
+    #[arg(long, value_name = "POLICY")]
+    preprocess_sched: Option<priority::Sched>,
+
+    /// I/O scheduling class of preprocessing: idle, or the lowest best-effort level
+    #[arg(long, value_name = "CLASS")]
+    preprocess_io: Option<priority::IoClass>,
+
+    /// Confine preprocessing to these CPUs, as for taskset -c (e.g. 0-3,6)
+    #[arg(long, value_name = "LIST")]
+    preprocess_cpus: Option<priority::CpuList>,
+
+    /// Run the tracked build in a copy-on-write clone of the project (reflinks where
+    /// supported) without object files, leaving the working tree's build untouched
+    #[arg(long, conflicts_with = "subprojects")]
+    shadow: bool,
+
+    /// Also track every subproject below the project root that has its own .c2rust
+    /// directory (monorepos): each compiled file and link target is recorded in the
+    /// feature directory of its innermost project, all from this one build
+    #[arg(long, conflicts_with = "staging_dir")]
+    subprojects: bool,
+
+    /// Generations of each feature kept in the .c2rust git history; older commits
+    /// are dropped and their objects pruned in the background. The default, 0, keeps
+    /// everything; history with commits not made by c2rust-build is never rewritten
+    #[arg(long, value_name = "N", default_value_t = git_helper::DEFAULT_HISTORY)]
+    history: usize,
+
+    /// Return as soon as the output is complete and auto-commit it in a detached
+    /// background process; the next run of the feature, or `c2rust-build wait`,
+    /// waits for the commit
+    #[arg(long)]
+    async_commit: bool,
+
+    /// Keep files larger than KIB out of the .c2rust git history: auto-commits store
+    /// their content in .c2rust/.objects by hash and commit small pointer files. The
+    /// setting is kept in the .c2rust repository for later commits (0 turns it off)
+    #[arg(long, value_name = "KIB")]
+    object_threshold: Option<u32>,
+
+    /// Write a chunk index next to each preprocessed file of at least KIB (default:
+    /// 1024): <file>.chunks lists the byte offsets where top-level declarations end,
+    /// so downstream tools can parse a large translation unit in parallel or load
+    /// only the ranges they need. libhook.so scans outputs while it streams them
+    #[arg(
+        long,
+        value_name = "KIB",
+        num_args = 0..=1,
+        default_missing_value = chunks::DEFAULT_CHUNK_INDEX_KIB
+    )]
+    chunk_index: Option<u64>,
+
+    /// Check every selected preprocessed file with `<compiler> -fsyntax-only` right
+    /// after the build, using the compiler and language options of its original
+    /// compilation, on a parallel pool. Any failure fails the run before the
+    /// configuration is saved and committed; files that passed are not checked again
+    /// while their content and compiler stay the same
+    #[arg(long)]
+    validate: bool,
+
+    /// Publish a JSON line per translation unit to PATH as soon as its preprocessed
+    /// file is complete, while the build is still running, and a final `done` line
+    /// per feature: an append-only log file, a FIFO or a listening Unix socket.
+    /// Events nobody reads are dropped; the build never waits for a consumer
+    #[arg(long, value_name = "PATH")]
+    events: Option<PathBuf>,
+
+    /// Transform plugin run on every preprocessed file after the build: an executable
+    /// (plus arguments) reading the file on stdin and writing the result to stdout.
+    /// Repeat to build an ordered pipeline; results are cached by content and plugin
+    #[arg(long = "transform", value_name = "PLUGIN")]
+    transforms: Vec<String>,
+
+    /// Budget of the transform cache, enforced by a background gc when the run finishes
+    #[command(flatten)]
+    cache: CacheArgs,
+
     /// Build command to execute - use after '--' separator
     /// Example: c2rust-build build -- make CFLAGS="-O2" target
     #[arg(
@@ -45,36 +310,6 @@ struct CommandArgs {
     build_cmd: Vec<String>,
 }
 
-/// Clean the feature directory before build to ensure a clean working environment
-/// Removes and recreates the .c2rust/<feature> directory
-fn clean_feature_directory(project_root: &Path, feature: &str) -> Result<()> {
-    let feature_dir = project_root.join(".c2rust").join(feature);
-    
-    // Remove existing directory if it exists to ensure a clean state
-    if feature_dir.exists() {
-        fs::remove_dir_all(&feature_dir).map_err(|e| {
-            error::Error::CommandExecutionFailed(format!(
-                "Failed to remove feature directory {}: {}",
-                feature_dir.display(),
-                e
-            ))
-        })?;
-    }
-    
-    // Create fresh feature directory
-    fs::create_dir_all(&feature_dir).map_err(|e| {
-        error::Error::CommandExecutionFailed(format!(
-            "Failed to create feature directory {}: {}",
-            feature_dir.display(),
-            e
-        ))
-    })?;
-    
-    println!("Cleaned and recreated feature directory: {}", feature_dir.display());
-    
-    Ok(())
-}
-
 /// Count preprocessed files recursively in directory
 fn count_preprocessed_files(dir: &Path) -> Result<usize> {
     let mut count = 0;
@@ -117,13 +352,41 @@ fn run(args: CommandArgs) -> Result<()> {
     config_helper::check_c2rust_config_exists()?;
 
     let feature = args.feature.as_deref().unwrap_or("default");
-    let command = args.build_cmd;
+    let command = &args.build_cmd;
+    let plugins = args
+        .transforms
+        .iter()
+        .map(|spec| transform::Plugin::parse(spec))
+        .collect::<Result<Vec<_>>>()?;
 
     let current_dir = std::env::current_dir().map_err(|e| {
         error::Error::CommandExecutionFailed(format!("Failed to get current directory: {}", e))
     })?;
 
     let project_root = find_project_root(&current_dir)?;
+    let subprojects = if args.subprojects {
+        discover_subprojects(&project_root)?
+    } else {
+        Vec::new()
+    };
+
+    // Hold the feature lock for the whole run: a second run of the same feature waits,
+    // runs of other features proceed in parallel. Taking it also creates .c2rust, so
+    // concurrent first runs from subdirectories resolve the same project root.
+    let feature_lock = lock::FileLock::acquire(
+        &lock::feature_lock_path(&project_root, feature),
+        &format!("feature '{}'", feature),
+    )?;
+    // Subprojects are locked in path order after the main project
+    let subproject_locks = subprojects
+        .iter()
+        .map(|root| {
+            lock::FileLock::acquire(
+                &lock::feature_lock_path(root, feature),
+                &format!("feature '{}' of {}", feature, root.display()),
+            )
+        })
+        .collect::<Result<Vec<_>>>()?;
 
     // Calculate build directory relative to project root, falling back to "." if needed
     let build_dir_relative = current_dir.strip_prefix(&project_root)
@@ -144,16 +407,226 @@ fn run(args: CommandArgs) -> Result<()> {
     println!("Build directory (relative): {}", build_dir_relative);
     println!("Feature: {}", feature);
     println!("Command: {}", command.join(" "));
+    if !subprojects.is_empty() {
+        println!("Subprojects: {}", subprojects.len());
+        for root in &subprojects {
+            println!("  {}", root.display());
+        }
+    }
     println!();
 
-    // Clean the feature directory before build to ensure a clean working environment
-    clean_feature_directory(&project_root, feature)?;
+    let mut timer = perf::RunTimer::start(feature);
+
+    // Clean the feature directory before build to ensure a clean working environment,
+    // keeping the last run's outputs so unchanged ones are not rewritten
+    timer.enter("clean");
+    let pipeline = transform::pipeline_id(&plugins);
+    for root in std::iter::once(&project_root).chain(&subprojects) {
+        let feature_dir = root.join(".c2rust").join(feature);
+        let kept = outputs::clean_keeping_outputs(&feature_dir, &pipeline)?;
+        println!(
+            "Cleaned feature directory: {} (kept {} output(s) of the last run)",
+            feature_dir.display(),
+            kept
+        );
+    }
 
     println!("Tracking build process...");
-    let compilers = tracker::track_build(&current_dir, &command, &project_root, feature)?;
+    timer.enter("build");
+    let track_options = tracker::TrackOptions {
+        cpu_profile: args.cpu_profile,
+        overhead_budget: args.overhead_budget,
+        staging: args
+            .staging_dir
+            .clone()
+            .map(|dir| (dir, args.staging_cap * 1024 * 1024)),
+        shadow: args.shadow,
+        subprojects: subprojects.clone(),
+        priority: priority::Priority {
+            nice: args.preprocess_nice,
+            sched: args.preprocess_sched,
+            io: args.preprocess_io,
+            cpus: args.preprocess_cpus.clone(),
+        },
+        // Transform plugins and the shadow tree remapping rewrite the outputs, so
+        // those are indexed afterwards
+        chunk_index: args
+            .chunk_index
+            .filter(|_| plugins.is_empty() && !args.shadow)
+            .map(|kib| kib * 1024),
+        // Likewise, outputs are only final once the plugins have run, and in a shadow
+        // build once paths into the shadow tree have been mapped back
+        events: event_sink(&args)?.filter(|_| plugins.is_empty() && !args.shadow),
+    };
+    let compilers = tracker::track_build(
+        &current_dir,
+        command,
+        &project_root,
+        feature,
+        &track_options,
+    )?;
+
+    let mut transform_stats = transform::TransformStats::default();
+    let mut grown_caches = Vec::new();
+    for root in std::iter::once(&project_root).chain(&subprojects) {
+        if root != &project_root {
+            println!("\n=== Subproject {} ===", root.display());
+        }
+        let build_dir = if root == &project_root {
+            build_dir_relative.clone()
+        } else {
+            relative_build_dir(root, &current_dir)
+        };
+        let stats = finish_project(root, &build_dir, feature, &args, &plugins, &compilers, &mut timer)?;
+        transform_stats.cached += stats.cached;
+        transform_stats.executed += stats.executed;
+        grown_caches.push(stats.executed > 0);
+    }
+
+    if transform_stats.cached + transform_stats.executed > 0 {
+        timer.record.transform_cache_hit_rate = Some(
+            transform_stats.cached as f64 / (transform_stats.cached + transform_stats.executed) as f64,
+        );
+    }
+    timer.record.hook_overhead_percent =
+        perf::read_hook_overhead(&project_root.join(".c2rust").join(feature));
+    perf::append(&project_root, &timer.finish())?;
+
+    // Enforce the transform cache budget without delaying this run
+    for (root, grown) in std::iter::once(&project_root).chain(&subprojects).zip(grown_caches) {
+        if cache::gc_due(root, grown) {
+            cache::spawn_gc(root, args.cache.cache_size, args.cache.cache_max_age);
+        }
+    }
+
+    // Auto-commit changes in .c2rust directory if any
+    let roots: Vec<PathBuf> = std::iter::once(project_root.clone())
+        .chain(subprojects.iter().cloned())
+        .collect();
+    if let Some(kib) = args.object_threshold {
+        for root in &roots {
+            git_helper::set_object_threshold(root, kib);
+        }
+    }
+    if args.async_commit {
+        let feature_locks = std::iter::once(feature_lock).chain(subproject_locks).collect();
+        if git_helper::spawn_auto_commit(&roots, feature, args.history, feature_locks)? {
+            println!("\nCommitting .c2rust in the background; `c2rust-build wait` waits for it");
+        }
+    } else {
+        for root in &roots {
+            git_helper::auto_commit_if_modified(root, feature, args.history)?;
+        }
+    }
+
+    println!("\n✓ Build tracking completed successfully!");
+    println!("✓ Configuration saved.");
+    println!("\nOutput structure:");
+    println!("  .c2rust/");
+    println!("    └── {}/", feature);
+    println!("        ├── c/");
+    println!("        │   ├── targets.list        # List of discovered binary targets");
+    println!("        │   └── <path>/");
+    println!("        │       └── *.c2rust (or *.i)");
+    println!("        ├── manifest.json");
+    println!("        ├── outputs.list            # Published outputs and their hashes");
+    println!("        ├── changes                 # Translation units added, modified, removed");
+    println!("        ├── state.log               # Feature state store");
+    println!("        └── selected_files.json");
+    Ok(())
+}
+
+/// Sink of `--events`, made absolute since hooked compilers run in other directories
+fn event_sink(args: &CommandArgs) -> Result<Option<events::EventSink>> {
+    match &args.events {
+        Some(path) => Ok(Some(events::EventSink::new(std::env::current_dir()?.join(path)))),
+        None => Ok(None),
+    }
+}
+
+/// Publish every output of the feature, once transform plugins or the shadow tree
+/// remapping have rewritten them
+fn publish_outputs(events: &events::EventSink, feature_dir: &Path, store: &store::Store) -> Result<()> {
+    let feature_dir = feature_dir.canonicalize()?;
+    let c_dir = feature_dir.join("c");
+    for (key, _) in store.scan(store::TU_PREFIX) {
+        let output = outputs::output_path(&c_dir, key);
+        if output.is_file() {
+            events.tu(&feature_dir, key, &output, outputs::hash_file(&output)?);
+        }
+    }
+    Ok(())
+}
+
+/// Post-build steps of one tracked project: manifest, transforms, target and file
+/// selection and configuration. Adds the project's volume to the run's perf record.
+fn finish_project(
+    project_root: &Path,
+    build_dir_relative: &str,
+    feature: &str,
+    args: &CommandArgs,
+    plugins: &[transform::Plugin],
+    compilers: &[String],
+    timer: &mut perf::RunTimer,
+) -> Result<transform::TransformStats> {
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    let run_manifest = manifest::Manifest {
+        feature: feature.to_string(),
+        build_cmd: args.build_cmd.join(" "),
+        overhead_budget: args.overhead_budget,
+        degradations: manifest::read_degradations(&feature_dir)?,
+        deferred_files: preprocess::read_deferred(&feature_dir)?.len(),
+        chunk_index: args.chunk_index.map(|kib| kib * 1024),
+        transforms: args.transforms.clone(),
+        refreshed_files: 0,
+        last_refresh: None,
+    };
+    for degradation in &run_manifest.degradations {
+        println!(
+            "Warning: tracking degraded from '{}' to '{}' (preprocessing overhead {:.1}%)",
+            degradation.from, degradation.to, degradation.overhead_percent
+        );
+    }
+    run_manifest.save(&feature_dir)?;
 
     // Check for preprocessed files instead of compile_entries
-    let c_dir = project_root.join(".c2rust").join(feature).join("c");
+    let c_dir = feature_dir.join("c");
+
+    // Outputs kept from the last run whose translation unit was not compiled again
+    let store = store::Store::open(&feature_dir)?;
+    outputs::remove_stale(&store, &c_dir)?;
+    let unchanged = outputs::unchanged(&feature_dir, &store)?;
+    if !unchanged.is_empty() {
+        println!("{} output(s) unchanged since the last run", unchanged.len());
+    }
+
+    timer.enter("transform");
+    let mut transform_stats = transform::TransformStats::default();
+    if !plugins.is_empty() {
+        println!("Running {} transform plugin(s)...", plugins.len());
+        transform_stats = transform::run_pipeline(project_root, &c_dir, plugins, &unchanged)?;
+        println!(
+            "Transformed {} file(s): {} plugin run(s), {} cached, {} failed",
+            transform_stats.files,
+            transform_stats.executed,
+            transform_stats.cached,
+            transform_stats.failed
+        );
+    }
+    let indexed = chunks::refresh(
+        &c_dir,
+        run_manifest.chunk_index,
+        &store,
+        &unchanged,
+        !plugins.is_empty() || args.shadow,
+    )?;
+    if indexed > 0 {
+        println!("Wrote the chunk index of {} file(s)", indexed);
+    }
+    let events = event_sink(args)?;
+    if let Some(events) = events.as_ref().filter(|_| !plugins.is_empty() || args.shadow) {
+        publish_outputs(events, &feature_dir, &store)?;
+    }
     let preprocessed_count = count_preprocessed_files(&c_dir)?;
 
     println!("Generated {} preprocessed file(s)", preprocessed_count);
@@ -167,51 +640,172 @@ fn run(args: CommandArgs) -> Result<()> {
     println!("Files are located at: .c2rust/{}/c/", feature);
 
     // Target artifact selection step (do this first)
+    timer.enter("select");
     let selected_target =
-        target_selector::process_and_select_target(&project_root, feature, args.no_interactive)?;
+        target_selector::process_and_select_target(project_root, feature, args.no_interactive)?;
 
     // File selection step (select files that participate in building the target)
     if preprocessed_count > 0 {
         file_selector::process_and_select_files(
             &c_dir,
             feature,
-            &project_root,
+            project_root,
             args.no_interactive,
             selected_target.as_deref(),
         )?;
     }
+    let changes = outputs::finish(&feature_dir, &transform::pipeline_id(plugins))?;
+    println!(
+        "Changes since the last run: {} added, {} modified, {} removed (see .c2rust/{}/{})",
+        changes.added.len(),
+        changes.modified.len(),
+        changes.removed.len(),
+        feature,
+        outputs::CHANGES_FILE
+    );
+
+    if args.validate {
+        timer.enter("validate");
+        let stats = validate::validate(project_root, feature, parallel::default_jobs())?;
+        println!(
+            "Validated {} file(s) with -fsyntax-only: {} cached, {} failed",
+            stats.checked,
+            stats.cached,
+            stats.failures.len()
+        );
+        validate::report(feature, &stats);
+        if !stats.failures.is_empty() {
+            return Err(error::Error::ValidationFailed(format!(
+                "{} preprocessed file(s) rejected by their compiler",
+                stats.failures.len()
+            )));
+        }
+    }
+    if let Some(events) = &events {
+        events.done(&feature_dir.canonicalize()?, count_preprocessed_files(&c_dir)?);
+    }
+    timer.enter("config");
+    let command_str = args.build_cmd.join(" ");
+    config_helper::transaction(project_root, || {
+        config_helper::save_config(
+            build_dir_relative,
+            &command_str,
+            Some(feature),
+            project_root,
+        )?;
 
-    let command_str = command.join(" ");
-    config_helper::save_config(
-        &build_dir_relative,
-        &command_str,
-        Some(feature),
-        &project_root,
-    )?;
+        // Save selected target if one was chosen
+        if let Some(target) = &selected_target {
+            config_helper::save_target(target, Some(feature), project_root)?;
+        }
+
+        if !compilers.is_empty() {
+            println!("\nSaving detected compilers...");
+            config_helper::save_compilers(compilers, project_root)?;
+        }
+        Ok(())
+    })?;
+
+    // Mirror what was written to c2rust-config in the feature's store
+    let mut config_txn = store::Transaction::default();
+    config_txn
+        .put(format!("{}build.dir", store::CONFIG_PREFIX), build_dir_relative)
+        .put(format!("{}build.cmd", store::CONFIG_PREFIX), command_str.as_str());
+    if let Some(target) = &selected_target {
+        config_txn.put(format!("{}build.target", store::CONFIG_PREFIX), target.as_str());
+    }
+    store::Store::open(&feature_dir)?.commit(config_txn)?;
+
+    timer.record.translation_units += preprocessed_count;
+    timer.record.preprocessed_bytes += perf::preprocessed_bytes(&c_dir)?;
+    timer.record.deferred_files += run_manifest.deferred_files;
+    Ok(transform_stats)
+}
 
-    // Save selected target if one was chosen
-    if let Some(target) = selected_target {
-        config_helper::save_target(&target, Some(feature), &project_root)?;
+fn run_export(args: ExportArgs) -> Result<()> {
+    let feature = args.feature.as_deref().unwrap_or("default");
+    let current_dir = std::env::current_dir()?;
+    let project_root = find_project_root(&current_dir)?;
+    let feature_dir = project_root.join(".c2rust").join(feature);
+
+    if !feature_dir.is_dir() {
+        return Err(error::Error::CommandExecutionFailed(format!(
+            "Feature '{}' has not been tracked: {} does not exist",
+            feature,
+            feature_dir.display()
+        )));
     }
 
-    if !compilers.is_empty() {
-        println!("\nSaving detected compilers...");
-        config_helper::save_compilers(&compilers, &project_root)?;
+    // Keep a concurrent build of the same feature from changing files mid-export
+    let _feature_lock = lock::FileLock::acquire(
+        &lock::feature_lock_path(&project_root, feature),
+        &format!("feature '{}'", feature),
+    )?;
+
+    let output = args
+        .output
+        .unwrap_or_else(|| current_dir.join(bundle::default_bundle_name(feature)));
+    let index = bundle::export(&feature_dir, feature, &objects::objects_dir(&project_root), &output)?;
+
+    let size: u64 = index.entries.iter().map(|e| e.size).sum();
+    let compressed: u64 = index.entries.iter().map(|e| e.compressed_size).sum();
+    println!(
+        "Exported {} file(s) of feature '{}' to {} ({:.1} MiB -> {:.1} MiB)",
+        index.entries.len(),
+        feature,
+        output.display(),
+        size as f64 / (1024.0 * 1024.0),
+        compressed as f64 / (1024.0 * 1024.0)
+    );
+    Ok(())
+}
+
+fn run_import(args: ImportArgs) -> Result<()> {
+    let bundle = bundle::Bundle::open(&args.bundle)?;
+
+    if args.list {
+        for entry in bundle.entries() {
+            println!("{:>12}  {}", entry.size, entry.path);
+        }
+        return Ok(());
     }
 
-    // Auto-commit changes in .c2rust directory if any
-    git_helper::auto_commit_if_modified(&project_root)?;
+    let feature = match args.feature.as_deref() {
+        Some(feature) if !bundle::is_safe_feature(feature) => {
+            return Err(error::Error::CommandExecutionFailed(format!(
+                "invalid feature name '{}'",
+                feature
+            )));
+        }
+        Some(feature) => feature,
+        None if !bundle::is_safe_feature(bundle.feature()) => {
+            return Err(error::Error::BundleInvalid(format!(
+                "{}: unsafe feature name '{}'",
+                args.bundle.display(),
+                bundle.feature()
+            )));
+        }
+        None => bundle.feature(),
+    };
+    let current_dir = std::env::current_dir()?;
+    let project_root = find_project_root(&current_dir)?;
 
-    println!("\n✓ Build tracking completed successfully!");
-    println!("✓ Configuration saved.");
-    println!("\nOutput structure:");
-    println!("  .c2rust/");
-    println!("    └── {}/", feature);
-    println!("        ├── c/");
-    println!("        │   ├── targets.list        # List of discovered binary targets");
-    println!("        │   └── <path>/");
-    println!("        │       └── *.c2rust (or *.i)");
-    println!("        └── selected_files.json");
+    let _feature_lock = lock::FileLock::acquire(
+        &lock::feature_lock_path(&project_root, feature),
+        &format!("feature '{}'", feature),
+    )?;
+
+    // The current feature is only replaced once the whole bundle has been verified
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    let count = bundle::import_replacing(&bundle, &feature_dir)?;
+    println!(
+        "Imported {} file(s) into feature '{}' from {}",
+        count,
+        feature,
+        args.bundle.display()
+    );
+
+    git_helper::auto_commit_if_modified(&project_root, feature, git_helper::DEFAULT_HISTORY)?;
     Ok(())
 }
 
@@ -268,12 +862,180 @@ fn find_project_root(start_dir: &Path) -> Result<PathBuf> {
     }
 }
 
+/// Project roots below `project_root` with their own `.c2rust` directory, in path
+/// order, for tracking the subprojects of a monorepo in one build. `.c2rust` and
+/// `.git` directories and symlinks are not descended into.
+fn discover_subprojects(project_root: &Path) -> Result<Vec<PathBuf>> {
+    fn visit(dir: &Path, roots: &mut Vec<PathBuf>) -> Result<()> {
+        let entries = match fs::read_dir(dir) {
+            Ok(entries) => entries,
+            Err(e) if e.kind() == std::io::ErrorKind::PermissionDenied => {
+                eprintln!("Warning: Permission denied reading {}, skipping", dir.display());
+                return Ok(());
+            }
+            Err(e) => return Err(e.into()),
+        };
+        let mut dirs = Vec::new();
+        for entry in entries {
+            let entry = entry?;
+            let name = entry.file_name();
+            if entry.file_type()?.is_dir() && name != ".c2rust" && name != ".git" {
+                dirs.push(entry.path());
+            }
+        }
+        dirs.sort();
+        for dir in dirs {
+            if dir.join(".c2rust").is_dir() {
+                roots.push(dir.clone());
+            }
+            visit(&dir, roots)?;
+        }
+        Ok(())
+    }
+
+    let mut roots = Vec::new();
+    visit(project_root, &mut roots)?;
+    Ok(roots)
+}
+
+/// Path of `dir` relative to `project_root`, going up with `..` where needed
+fn relative_build_dir(project_root: &Path, dir: &Path) -> String {
+    let root: Vec<_> = project_root.components().collect();
+    let dir: Vec<_> = dir.components().collect();
+    let common = root.iter().zip(&dir).take_while(|(a, b)| a == b).count();
+
+    let mut relative = PathBuf::new();
+    for _ in common..root.len() {
+        relative.push("..");
+    }
+    for component in &dir[common..] {
+        relative.push(component);
+    }
+    if relative.as_os_str().is_empty() {
+        ".".to_string()
+    } else {
+        relative.display().to_string()
+    }
+}
+
+fn run_perf_check(args: PerfCheckArgs) -> Result<()> {
+    let feature = args.feature.as_deref().unwrap_or("default");
+    let project_root = find_project_root(&std::env::current_dir()?)?;
+    perf::run_check(&project_root, feature, args.window, args.threshold)
+}
+
+fn run_gc(args: GcArgs) -> Result<()> {
+    let project_root = find_project_root(&std::env::current_dir()?)?;
+    let budget = cache::Budget::new(args.cache.cache_size, args.cache.cache_max_age);
+    let stats = cache::gc(&project_root, &budget, std::time::SystemTime::now())?;
+
+    const MIB: f64 = 1024.0 * 1024.0;
+    if !args.auto || stats.expired + stats.evicted > 0 {
+        println!(
+            "Transform cache: removed {} expired and {} least recently used entries ({:.1} MiB); {} entries ({:.1} MiB) left",
+            stats.expired,
+            stats.evicted,
+            stats.freed_bytes as f64 / MIB,
+            stats.entries,
+            stats.bytes as f64 / MIB
+        );
+    }
+    Ok(())
+}
+
+fn run_commit(args: CommitArgs) -> Result<()> {
+    git_helper::keep_handed_over_locks(&args.lock_fds);
+    for root in &args.roots {
+        git_helper::commit_locked(root, &args.feature, args.history);
+    }
+    Ok(())
+}
+
+fn run_wait() -> Result<()> {
+    let project_root = find_project_root(&std::env::current_dir()?)?;
+    // A background commit holds the git lock until it is done
+    drop(lock::FileLock::acquire(
+        &lock::git_lock_path(&project_root),
+        "git lock",
+    )?);
+
+    let log_path = lock::locks_dir(&project_root).join(git_helper::COMMIT_LOG);
+    match fs::read_to_string(&log_path) {
+        Ok(log) => {
+            print!("{}", log);
+            fs::remove_file(&log_path)?;
+        }
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => {}
+        Err(e) => return Err(e.into()),
+    }
+    Ok(())
+}
+
+fn run_watch(args: WatchArgs) -> Result<()> {
+    let feature = args.feature.as_deref().unwrap_or("default");
+    let project_root = find_project_root(&std::env::current_dir()?)?;
+    let feature_dir = project_root.join(".c2rust").join(feature);
+
+    if !feature_dir.is_dir() {
+        return Err(error::Error::CommandExecutionFailed(format!(
+            "Feature '{}' has not been tracked: {} does not exist",
+            feature,
+            feature_dir.display()
+        )));
+    }
+
+    watch::run(&project_root, feature, args.once)
+}
+
+fn run_select(args: SelectArgs) -> Result<()> {
+    config_helper::check_c2rust_config_exists()?;
+
+    let feature = args.feature.as_deref().unwrap_or("default");
+    let project_root = find_project_root(&std::env::current_dir()?)?;
+    let feature_dir = project_root.join(".c2rust").join(feature);
+
+    if !feature_dir.is_dir() {
+        return Err(error::Error::CommandExecutionFailed(format!(
+            "Feature '{}' has not been tracked: {} does not exist",
+            feature,
+            feature_dir.display()
+        )));
+    }
+
+    let feature_lock = lock::FileLock::acquire(
+        &lock::feature_lock_path(&project_root, feature),
+        &format!("feature '{}'", feature),
+    )?;
+    let stats = select::run(&project_root, feature, args.no_interactive)?;
+    drop(feature_lock);
+
+    println!(
+        "Selection updated: {} added, {} removed ({} failed)",
+        stats.added, stats.removed, stats.failed
+    );
+    git_helper::auto_commit_if_modified(&project_root, feature, git_helper::DEFAULT_HISTORY)?;
+    Ok(())
+}
+
+#[global_allocator]
+static GLOBAL: heap_profile::ProfilingAllocator = heap_profile::ProfilingAllocator;
+
 fn main() {
+    heap_profile::init();
     let cli = Cli::parse();
 
     let result = match cli.command {
         Commands::Build(args) => run(args),
+        Commands::Export(args) => run_export(args),
+        Commands::Import(args) => run_import(args),
+        Commands::Perf(PerfCommand::Check(args)) => run_perf_check(args),
+        Commands::Watch(args) => run_watch(args),
+        Commands::Select(args) => run_select(args),
+        Commands::Gc(args) => run_gc(args),
+        Commands::Wait => run_wait(),
+        Commands::Commit(args) => run_commit(args),
     };
+    heap_profile::report();
 
     if let Err(e) = result {
         eprintln!("Error: {}", e);
@@ -344,6 +1106,44 @@ mod tests {
         assert_eq!(result, subdir);
     }
 
+    #[test]
+    fn test_discover_subprojects() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path();
+        for dir in [
+            ".c2rust/default",
+            "libs/a/.c2rust",
+            "libs/a/nested/.c2rust",
+            "app/.c2rust",
+            "app/src",
+            "docs",
+            ".git/modules/x/.c2rust",
+        ] {
+            fs::create_dir_all(root.join(dir)).unwrap();
+        }
+
+        let roots = discover_subprojects(root).unwrap();
+        assert_eq!(
+            roots,
+            vec![
+                root.join("app"),
+                root.join("libs").join("a"),
+                root.join("libs").join("a").join("nested"),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_relative_build_dir() {
+        assert_eq!(relative_build_dir(Path::new("/mono/app"), Path::new("/mono")), "..");
+        assert_eq!(
+            relative_build_dir(Path::new("/mono/libs/a"), Path::new("/mono/build")),
+            "../../build"
+        );
+        assert_eq!(relative_build_dir(Path::new("/mono/app"), Path::new("/mono/app/src")), "src");
+        assert_eq!(relative_build_dir(Path::new("/mono"), Path::new("/mono")), ".");
+    }
+
     #[test]
     fn test_find_project_root_c2rust_as_file_not_directory() {
         let temp_dir = TempDir::new().unwrap();
@@ -494,180 +1294,4 @@ mod tests {
             assert_eq!(count, 1);
         }
     }
-
-    #[test]
-    fn test_clean_feature_directory_nonexistent() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-
-        // Clean a non-existent directory - should create it
-        let result = clean_feature_directory(project_root, "test_feature");
-        assert!(result.is_ok());
-
-        // Verify the directory was created
-        let feature_dir = project_root.join(".c2rust").join("test_feature");
-        assert!(feature_dir.exists());
-        assert!(feature_dir.is_dir());
-    }
-
-    #[test]
-    fn test_clean_feature_directory_existing_empty() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-        let feature_dir = project_root.join(".c2rust").join("test_feature");
-
-        // Create an existing empty directory
-        fs::create_dir_all(&feature_dir).unwrap();
-        assert!(feature_dir.exists());
-
-        // Clean the directory
-        let result = clean_feature_directory(project_root, "test_feature");
-        assert!(result.is_ok());
-
-        // Verify the directory still exists and is empty
-        assert!(feature_dir.exists());
-        assert!(feature_dir.is_dir());
-    }
-
-    #[test]
-    fn test_clean_feature_directory_existing_with_files() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-        let feature_dir = project_root.join(".c2rust").join("test_feature");
-        let c_dir = feature_dir.join("c");
-
-        // Create directory with some files
-        fs::create_dir_all(&c_dir).unwrap();
-        let test_file = c_dir.join("test.c2rust");
-        fs::write(&test_file, "old content").unwrap();
-        assert!(test_file.exists());
-
-        // Clean the directory
-        let result = clean_feature_directory(project_root, "test_feature");
-        assert!(result.is_ok());
-
-        // Verify the directory exists but the old file is gone
-        assert!(feature_dir.exists());
-        assert!(!test_file.exists());
-    }
-
-    #[test]
-    fn test_clean_feature_directory_nested_structure() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-        let feature_dir = project_root.join(".c2rust").join("test_feature");
-
-        // Create a nested structure
-        let nested_dir = feature_dir.join("c").join("src").join("subdir");
-        fs::create_dir_all(&nested_dir).unwrap();
-        fs::write(nested_dir.join("file1.c2rust"), "content1").unwrap();
-        fs::write(feature_dir.join("c").join("file2.c2rust"), "content2").unwrap();
-        fs::write(feature_dir.join("config.json"), "config").unwrap();
-
-        // Verify files exist
-        assert!(nested_dir.join("file1.c2rust").exists());
-        assert!(feature_dir.join("c").join("file2.c2rust").exists());
-        assert!(feature_dir.join("config.json").exists());
-
-        // Clean the directory
-        let result = clean_feature_directory(project_root, "test_feature");
-        assert!(result.is_ok());
-
-        // Verify all old files are gone
-        assert!(feature_dir.exists());
-        assert!(!nested_dir.join("file1.c2rust").exists());
-        assert!(!feature_dir.join("c").join("file2.c2rust").exists());
-        assert!(!feature_dir.join("config.json").exists());
-    }
-
-    #[test]
-    fn test_clean_feature_directory_preserves_other_features() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-
-        // Create multiple feature directories
-        let feature1_dir = project_root.join(".c2rust").join("feature1");
-        let feature2_dir = project_root.join(".c2rust").join("feature2");
-
-        fs::create_dir_all(&feature1_dir).unwrap();
-        fs::create_dir_all(&feature2_dir).unwrap();
-
-        let file1 = feature1_dir.join("test1.txt");
-        let file2 = feature2_dir.join("test2.txt");
-
-        fs::write(&file1, "content1").unwrap();
-        fs::write(&file2, "content2").unwrap();
-
-        // Clean only feature1
-        let result = clean_feature_directory(project_root, "feature1");
-        assert!(result.is_ok());
-
-        // Verify feature1 exists but file1 is gone
-        assert!(feature1_dir.exists());
-        assert!(!file1.exists());
-
-        // Verify feature2 and file2 are untouched
-        assert!(feature2_dir.exists());
-        assert!(file2.exists());
-    }
-
-    #[test]
-    #[cfg(unix)]
-    fn test_clean_feature_directory_creation_fails() {
-        use std::os::unix::fs::PermissionsExt;
-
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-        
-        // Create .c2rust directory with no write permissions
-        let c2rust_dir = project_root.join(".c2rust");
-        fs::create_dir_all(&c2rust_dir).unwrap();
-        
-        // Remove write permissions from .c2rust directory
-        let mut perms = fs::metadata(&c2rust_dir).unwrap().permissions();
-        perms.set_mode(0o444); // Read-only
-        fs::set_permissions(&c2rust_dir, perms).unwrap();
-        
-        // Attempt to clean feature directory should fail
-        let result = clean_feature_directory(project_root, "test_feature");
-        assert!(result.is_err());
-        
-        // Restore permissions for cleanup
-        let mut perms = fs::metadata(&c2rust_dir).unwrap().permissions();
-        perms.set_mode(0o755);
-        fs::set_permissions(&c2rust_dir, perms).unwrap();
-    }
-
-    #[test]
-    fn test_clean_feature_directory_removal_fails() {
-        let temp_dir = TempDir::new().unwrap();
-        let project_root = temp_dir.path();
-        let feature_dir = project_root.join(".c2rust").join("test_feature");
-
-        // Create a feature directory with a file
-        fs::create_dir_all(&feature_dir).unwrap();
-        let test_file = feature_dir.join("test.txt");
-        fs::write(&test_file, "content").unwrap();
-
-        // On Unix systems, we can test removal failure by removing write permissions
-        #[cfg(unix)]
-        {
-            use std::os::unix::fs::PermissionsExt;
-            
-            // Remove write permissions from parent directory
-            let c2rust_dir = project_root.join(".c2rust");
-            let mut perms = fs::metadata(&c2rust_dir).unwrap().permissions();
-            perms.set_mode(0o444); // Read-only
-            fs::set_permissions(&c2rust_dir, perms).unwrap();
-            
-            // Attempt to clean should fail because we can't remove the directory
-            let result = clean_feature_directory(project_root, "test_feature");
-            assert!(result.is_err());
-            
-            // Restore permissions for cleanup
-            let mut perms = fs::metadata(&c2rust_dir).unwrap().permissions();
-            perms.set_mode(0o755);
-            fs::set_permissions(&c2rust_dir, perms).unwrap();
-        }
-    }
 }
@@ -0,0 +1,168 @@
+use crate::error::Result;
+use serde::{Deserialize, Serialize};
+use std::fs;
+use std::path::Path;
+
+/// File name of the manifest inside `.c2rust/<feature>/`
+pub const MANIFEST_FILE: &str = "manifest.json";
+
+/// Summary of a tracking run, saved to `.c2rust/<feature>/manifest.json`
+#[derive(Debug, Default, Serialize, Deserialize, PartialEq)]
+pub struct Manifest {
+    pub feature: String,
+    pub build_cmd: String,
+    /// Overhead budget in percent, if one was set
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub overhead_budget: Option<u32>,
+    /// Fidelity reductions applied by libhook.so to stay within the overhead budget
+    #[serde(default)]
+    pub degradations: Vec<Degradation>,
+    /// Number of files whose preprocessing was deferred until after the build
+    #[serde(default)]
+    pub deferred_files: usize,
+    /// Size in bytes from which outputs get a chunk index, if `--chunk-index` was set
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub chunk_index: Option<u64>,
+    /// Transform plugins applied to the preprocessed files, in order
+    #[serde(default, skip_serializing_if = "Vec::is_empty")]
+    pub transforms: Vec<String>,
+    /// Translation units re-preprocessed by `c2rust-build watch` since the build
+    #[serde(default)]
+    pub refreshed_files: usize,
+    /// Unix timestamp of the last refresh by `c2rust-build watch`
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub last_refresh: Option<u64>,
+}
+
+/// One escalation of the hook's degradation level
+#[derive(Debug, Serialize, Deserialize, PartialEq)]
+pub struct Degradation {
+    /// Unix timestamp of the escalation
+    pub timestamp: u64,
+    pub from: String,
+    pub to: String,
+    /// Measured preprocessing overhead relative to compile time, in percent
+    pub overhead_percent: f64,
+}
+
+/// Name of a degradation level as numbered by libhook.so
+pub fn level_name(level: u32) -> &'static str {
+    match level {
+        0 => "full",
+        1 => "no-comments",
+        2 => "bounded-concurrency",
+        3 => "deferred",
+        _ => "unknown",
+    }
+}
+
+/// Read the degradations logged by libhook.so to `<feature_dir>/degradations.log`.
+/// Each line is `<timestamp>\t<from level>\t<to level>\t<overhead percent>`.
+pub fn read_degradations(feature_dir: &Path) -> Result<Vec<Degradation>> {
+    let content = match fs::read_to_string(feature_dir.join("degradations.log")) {
+        Ok(content) => content,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(Vec::new()),
+        Err(e) => return Err(e.into()),
+    };
+
+    let degradations = content
+        .lines()
+        .filter_map(|line| {
+            let fields: Vec<&str> = line.split('\t').collect();
+            if fields.len() != 4 {
+                return None;
+            }
+            Some(Degradation {
+                timestamp: fields[0].parse().ok()?,
+                from: level_name(fields[1].parse().ok()?).to_string(),
+                to: level_name(fields[2].parse().ok()?).to_string(),
+                overhead_percent: fields[3].parse().ok()?,
+            })
+        })
+        .collect();
+
+    Ok(degradations)
+}
+
+impl Manifest {
+    /// Load the manifest of a feature, if one exists
+    pub fn load(feature_dir: &Path) -> Result<Option<Manifest>> {
+        match fs::read_to_string(feature_dir.join(MANIFEST_FILE)) {
+            Ok(content) => Ok(Some(serde_json::from_str(&content)?)),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => Ok(None),
+            Err(e) => Err(e.into()),
+        }
+    }
+
+    /// Save the manifest atomically (write to a temporary file, then rename)
+    pub fn save(&self, feature_dir: &Path) -> Result<()> {
+        let path = feature_dir.join(MANIFEST_FILE);
+        let tmp_path = feature_dir.join(format!("{}.tmp", MANIFEST_FILE));
+        fs::write(&tmp_path, serde_json::to_string_pretty(self)?)?;
+        fs::rename(&tmp_path, &path)?;
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_read_degradations() {
+        let temp_dir = TempDir::new().unwrap();
+        fs::write(
+            temp_dir.path().join("degradations.log"),
+            "1700000000\t0\t1\t35.2\n1700000100\t1\t2\t28.0\nbroken\n",
+        )
+        .unwrap();
+
+        let degradations = read_degradations(temp_dir.path()).unwrap();
+        assert_eq!(
+            degradations,
+            vec![
+                Degradation {
+                    timestamp: 1700000000,
+                    from: "full".to_string(),
+                    to: "no-comments".to_string(),
+                    overhead_percent: 35.2,
+                },
+                Degradation {
+                    timestamp: 1700000100,
+                    from: "no-comments".to_string(),
+                    to: "bounded-concurrency".to_string(),
+                    overhead_percent: 28.0,
+                },
+            ]
+        );
+    }
+
+    #[test]
+    fn test_read_degradations_missing_log() {
+        let temp_dir = TempDir::new().unwrap();
+        assert!(read_degradations(temp_dir.path()).unwrap().is_empty());
+    }
+
+    #[test]
+    fn test_manifest_save_and_load() {
+        let temp_dir = TempDir::new().unwrap();
+        assert!(Manifest::load(temp_dir.path()).unwrap().is_none());
+
+        let manifest = Manifest {
+            feature: "default".to_string(),
+            build_cmd: "make -j8".to_string(),
+            overhead_budget: Some(20),
+            degradations: Vec::new(),
+            deferred_files: 3,
+            chunk_index: Some(64 * 1024),
+            transforms: vec!["strip-pragmas".to_string()],
+            refreshed_files: 2,
+            last_refresh: Some(1700000000),
+        };
+        manifest.save(temp_dir.path()).unwrap();
+
+        assert_eq!(Manifest::load(temp_dir.path()).unwrap(), Some(manifest));
+        assert!(!temp_dir.path().join("manifest.json.tmp").exists());
+    }
+}
@@ -0,0 +1,235 @@
+use crate::error::{Error, Result};
+use sha2::{Digest, Sha256};
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io::{self, Read};
+use std::path::{Path, PathBuf};
+
+/// Side store below `.c2rust` holding the content of large outputs by SHA-256;
+/// never committed. Auto-commits record these outputs as pointer files.
+pub const OBJECTS_DIR: &str = ".objects";
+
+/// First line of a pointer file
+const POINTER_MAGIC: &str = "c2rust-build object v1";
+
+/// Pointer files are far smaller; larger files are never parsed as pointers
+pub const MAX_POINTER_LEN: u64 = 256;
+
+/// A committed stand-in for a large output: the hash and size of its content
+#[derive(Debug, Clone, PartialEq)]
+pub struct Pointer {
+    pub sha256: String,
+    pub size: u64,
+}
+
+impl Pointer {
+    /// Parse pointer file content; `None` for anything else
+    pub fn parse(data: &[u8]) -> Option<Pointer> {
+        if data.len() as u64 > MAX_POINTER_LEN {
+            return None;
+        }
+        let text = std::str::from_utf8(data).ok()?;
+        let mut lines = text.lines();
+        if lines.next()? != POINTER_MAGIC {
+            return None;
+        }
+        let sha256 = lines.next()?.strip_prefix("sha256 ")?;
+        let size = lines.next()?.strip_prefix("size ")?.parse().ok()?;
+        let valid = sha256.len() == 64 && sha256.bytes().all(|b| b.is_ascii_hexdigit());
+        valid.then(|| Pointer {
+            sha256: sha256.to_string(),
+            size,
+        })
+    }
+
+    /// Content of the pointer file
+    pub fn to_bytes(&self) -> Vec<u8> {
+        format!("{}\nsha256 {}\nsize {}\n", POINTER_MAGIC, self.sha256, self.size).into_bytes()
+    }
+
+    /// Path of the pointed-to content in the side store
+    pub fn object_path(&self, objects_dir: &Path) -> PathBuf {
+        objects_dir.join(&self.sha256[..2]).join(&self.sha256)
+    }
+}
+
+/// `.c2rust/.objects` of a project
+pub fn objects_dir(project_root: &Path) -> PathBuf {
+    project_root.join(".c2rust").join(OBJECTS_DIR)
+}
+
+/// Put the content of `file` into the side store and return its pointer. Content
+/// already stored is only hashed, not copied again. Objects are copied to a
+/// temporary file and renamed, so readers never see a partial object.
+pub fn store(objects_dir: &Path, file: &Path) -> Result<Pointer> {
+    let mut hasher = Sha256::new();
+    let size = io::copy(&mut File::open(file)?, &mut hasher)?;
+    let pointer = Pointer {
+        sha256: hex(&hasher.finalize()),
+        size,
+    };
+
+    let object = pointer.object_path(objects_dir);
+    if !object.exists() {
+        let parent = object.parent().expect("objects have a shard directory");
+        fs::create_dir_all(parent)?;
+        let tmp = parent.join(format!("{}.tmp{}", pointer.sha256, std::process::id()));
+        // fs::copy uses copy_file_range, which shares extents where supported
+        let copied = fs::copy(file, &tmp).and_then(|_| fs::rename(&tmp, &object));
+        if let Err(e) = copied {
+            let _ = fs::remove_file(&tmp);
+            return Err(e.into());
+        }
+    }
+    Ok(pointer)
+}
+
+/// Read an output of a feature: the file itself, or the stored content if the file
+/// is a pointer (after checking out an older generation of `.c2rust`)
+pub fn read(objects_dir: &Path, path: &Path) -> Result<Vec<u8>> {
+    let data = fs::read(path)?;
+    match Pointer::parse(&data) {
+        Some(pointer) => read_object(objects_dir, &pointer, path),
+        None => Ok(data),
+    }
+}
+
+/// Replace every pointer file below `dir` by the content it points to, in place.
+/// Pointers whose object is missing are reported and left alone. Returns the
+/// number of files hydrated.
+pub fn hydrate(objects_dir: &Path, dir: &Path) -> Result<usize> {
+    let mut pointers = Vec::new();
+    find_pointers(dir, &mut pointers)?;
+
+    let mut hydrated = 0;
+    for (path, pointer) in pointers {
+        let data = match read_object(objects_dir, &pointer, &path) {
+            Ok(data) => data,
+            Err(e) => {
+                eprintln!("Warning: {}", e);
+                continue;
+            }
+        };
+        let mut tmp = path.as_os_str().to_owned();
+        tmp.push(".hydrate");
+        let tmp = PathBuf::from(tmp);
+        fs::write(&tmp, data)?;
+        fs::rename(&tmp, &path)?;
+        hydrated += 1;
+    }
+    Ok(hydrated)
+}
+
+/// Remove objects not in `referenced` (SHA-256 hex). Returns the number removed.
+pub fn prune(objects_dir: &Path, referenced: &HashSet<String>) -> Result<usize> {
+    let mut removed = 0;
+    for shard in fs::read_dir(objects_dir)? {
+        let shard = shard?;
+        if !shard.file_type()?.is_dir() {
+            continue;
+        }
+        for object in fs::read_dir(shard.path())? {
+            let object = object?;
+            let name = object.file_name().to_string_lossy().into_owned();
+            if !referenced.contains(&name) {
+                fs::remove_file(object.path())?;
+                removed += 1;
+            }
+        }
+        // Only succeeds on empty shards
+        let _ = fs::remove_dir(shard.path());
+    }
+    Ok(removed)
+}
+
+fn read_object(objects_dir: &Path, pointer: &Pointer, path: &Path) -> Result<Vec<u8>> {
+    let object = pointer.object_path(objects_dir);
+    let mut data = Vec::with_capacity(pointer.size as usize);
+    match File::open(&object) {
+        Ok(mut file) => file.read_to_end(&mut data)?,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => {
+            return Err(Error::ObjectMissing(format!(
+                "{} points to {}",
+                path.display(),
+                pointer.sha256
+            )))
+        }
+        Err(e) => return Err(e.into()),
+    };
+    if data.len() as u64 != pointer.size || hex(&Sha256::digest(&data)) != pointer.sha256 {
+        return Err(Error::ObjectMissing(format!(
+            "{} points to {}, which is corrupted",
+            path.display(),
+            pointer.sha256
+        )));
+    }
+    Ok(data)
+}
+
+fn find_pointers(dir: &Path, pointers: &mut Vec<(PathBuf, Pointer)>) -> Result<()> {
+    let entries = match fs::read_dir(dir) {
+        Ok(entries) => entries,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e.into()),
+    };
+    for entry in entries {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        if file_type.is_dir() {
+            find_pointers(&entry.path(), pointers)?;
+        } else if file_type.is_file() && entry.metadata()?.len() <= MAX_POINTER_LEN {
+            if let Some(pointer) = Pointer::parse(&fs::read(entry.path())?) {
+                pointers.push((entry.path(), pointer));
+            }
+        }
+    }
+    Ok(())
+}
+
+fn hex(bytes: &[u8]) -> String {
+    bytes.iter().map(|b| format!("{:02x}", b)).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_pointer_roundtrip() {
+        let pointer = Pointer {
+            sha256: "ab".repeat(32),
+            size: 42,
+        };
+        assert_eq!(Pointer::parse(&pointer.to_bytes()), Some(pointer));
+        assert_eq!(Pointer::parse(b"int main(void);\n"), None);
+        assert_eq!(Pointer::parse(format!("{}\nsha256 xyz\nsize 1\n", POINTER_MAGIC).as_bytes()), None);
+    }
+
+    #[test]
+    fn test_store_read_and_hydrate() {
+        let temp_dir = TempDir::new().unwrap();
+        let objects_dir = temp_dir.path().join(OBJECTS_DIR);
+        let c_dir = temp_dir.path().join("default").join("c");
+        fs::create_dir_all(c_dir.join("src")).unwrap();
+        let output = c_dir.join("src").join("big.c2rust");
+        let content = "int table[] = {1, 2, 3};\n".repeat(100);
+        fs::write(&output, &content).unwrap();
+
+        let pointer = store(&objects_dir, &output).unwrap();
+        assert_eq!(pointer.size, content.len() as u64);
+        assert_eq!(store(&objects_dir, &output).unwrap(), pointer);
+
+        // A checked-out generation holds the pointer instead of the content
+        fs::write(&output, pointer.to_bytes()).unwrap();
+        assert_eq!(read(&objects_dir, &output).unwrap(), content.as_bytes());
+        assert_eq!(hydrate(&objects_dir, &c_dir).unwrap(), 1);
+        assert_eq!(fs::read_to_string(&output).unwrap(), content);
+        assert_eq!(hydrate(&objects_dir, &c_dir).unwrap(), 0);
+
+        assert_eq!(prune(&objects_dir, &HashSet::new()).unwrap(), 1);
+        fs::write(&output, pointer.to_bytes()).unwrap();
+        assert!(matches!(read(&objects_dir, &output), Err(Error::ObjectMissing(_))));
+        assert_eq!(hydrate(&objects_dir, &c_dir).unwrap(), 0);
+    }
+}
@@ -0,0 +1,469 @@
+use crate::chunks;
+use crate::error::{Error, Result};
+use crate::file_selector;
+use crate::store::{Store, Transaction, HASH_PREFIX, TU_PREFIX};
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::fs::{self, File};
+use std::io::Read;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+
+/// Outputs of the last run, below `.c2rust/<feature>/`. libhook.so looks entries up
+/// by binary search, so lines are sorted by key: `<key>\t<hash>\t<mtime ns>` after
+/// an optional `# pipeline <id>` header naming the transform plugins applied.
+pub const OUTPUTS_FILE: &str = "outputs.list";
+/// Translation units added (`A`), modified (`M`) and removed (`D`) by the last run,
+/// below `.c2rust/<feature>/`; one `<status>\t<key>` line each
+pub const CHANGES_FILE: &str = "changes";
+
+const PIPELINE_HEADER: &str = "# pipeline ";
+/// Output file name suffix appended to the translation unit key
+const OUTPUT_SUFFIX: &str = "2rust";
+
+// 64-bit FNV-1a, shared with hook/hook.c
+const FNV_OFFSET: u64 = 0xcbf2_9ce4_8422_2325;
+const FNV_PRIME: u64 = 0x0000_0100_0000_01b3;
+
+/// Streaming hash of a preprocessed output, computed like libhook.so does while the
+/// compiler writes it
+#[derive(Debug, Clone, Copy)]
+pub struct ContentHash(u64);
+
+impl Default for ContentHash {
+    fn default() -> Self {
+        ContentHash(FNV_OFFSET)
+    }
+}
+
+impl ContentHash {
+    pub fn update(&mut self, data: &[u8]) {
+        for &byte in data {
+            self.0 = (self.0 ^ byte as u64).wrapping_mul(FNV_PRIME);
+        }
+    }
+
+    pub fn finish(self) -> u64 {
+        self.0
+    }
+}
+
+/// Hash a file the way libhook.so hashes the output it streams
+pub fn hash_file(path: &Path) -> Result<u64> {
+    let mut file = File::open(path)?;
+    let mut hash = ContentHash::default();
+    let mut buf = vec![0; 64 * 1024];
+    loop {
+        let n = file.read(&mut buf)?;
+        if n == 0 {
+            return Ok(hash.finish());
+        }
+        hash.update(&buf[..n]);
+    }
+}
+
+/// Modification time in nanoseconds, compared exactly by libhook.so
+pub fn mtime_ns(meta: &fs::Metadata) -> i64 {
+    meta.mtime() * 1_000_000_000 + meta.mtime_nsec()
+}
+
+/// Key of a preprocessed output: its path below `c_dir` without the `2rust` suffix,
+/// which is the `tu/` key of its translation unit
+pub fn output_key(c_dir: &Path, output: &Path) -> Option<String> {
+    let relative = output.strip_prefix(c_dir).ok()?.to_str()?;
+    relative.strip_suffix(OUTPUT_SUFFIX).map(str::to_string)
+}
+
+pub fn output_path(c_dir: &Path, key: &str) -> PathBuf {
+    c_dir.join(format!("{}{}", key, OUTPUT_SUFFIX))
+}
+
+/// One published output
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Entry {
+    /// Hash of the output as preprocessed, before transform plugins
+    pub hash: u64,
+    /// Modification time of the output file when it was published
+    pub mtime_ns: i64,
+}
+
+/// The outputs of a run, as saved to `outputs.list`
+#[derive(Debug, Default, PartialEq)]
+pub struct Outputs {
+    /// Identity of the transform plugins the outputs went through
+    pub pipeline: String,
+    pub entries: BTreeMap<String, Entry>,
+}
+
+impl Outputs {
+    /// Load the outputs of the last run; empty when there was none
+    pub fn load(feature_dir: &Path) -> Result<Outputs> {
+        let content = match fs::read_to_string(feature_dir.join(OUTPUTS_FILE)) {
+            Ok(content) => content,
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(Outputs::default()),
+            Err(e) => return Err(e.into()),
+        };
+
+        let mut outputs = Outputs::default();
+        for line in content.lines() {
+            if let Some(pipeline) = line.strip_prefix(PIPELINE_HEADER) {
+                outputs.pipeline = pipeline.to_string();
+                continue;
+            }
+            let mut fields = line.split('\t');
+            let (Some(key), Some(hash), Some(mtime)) = (fields.next(), fields.next(), fields.next())
+            else {
+                continue;
+            };
+            let (Ok(hash), Ok(mtime_ns)) = (u64::from_str_radix(hash, 16), mtime.parse()) else {
+                continue;
+            };
+            outputs.entries.insert(key.to_string(), Entry { hash, mtime_ns });
+        }
+        Ok(outputs)
+    }
+
+    /// Save atomically (write to a temporary file, then rename)
+    pub fn save(&self, feature_dir: &Path) -> Result<()> {
+        let mut content = format!("{}{}\n", PIPELINE_HEADER, self.pipeline);
+        for (key, entry) in &self.entries {
+            content.push_str(&format!("{}\t{:016x}\t{}\n", key, entry.hash, entry.mtime_ns));
+        }
+        let tmp_path = feature_dir.join(format!("{}.tmp", OUTPUTS_FILE));
+        fs::write(&tmp_path, content)?;
+        fs::rename(&tmp_path, feature_dir.join(OUTPUTS_FILE))?;
+        Ok(())
+    }
+
+    /// Whether `output` still holds what the last run published for `key` and a new
+    /// preprocessing result with `hash` would not change it
+    pub fn is_current(&self, key: &str, output: &Path, hash: u64) -> bool {
+        let Some(entry) = self.entries.get(key) else {
+            return false;
+        };
+        entry.hash == hash
+            && fs::metadata(output).is_ok_and(|meta| mtime_ns(&meta) == entry.mtime_ns)
+    }
+}
+
+/// Clean the feature directory for a tracking run: remove and recreate it, except
+/// for the outputs the last run published: libhook.so leaves those (and
+/// their mtimes) alone when they come out the same. Nothing is kept when the
+/// transform pipeline changed, since kept outputs hold the old plugins' results.
+/// Returns the number of outputs kept.
+pub fn clean_keeping_outputs(feature_dir: &Path, pipeline: &str) -> Result<usize> {
+    let previous = Outputs::load(feature_dir)?;
+    let c_dir = feature_dir.join("c");
+    let keep: HashSet<PathBuf> = if previous.pipeline == pipeline {
+        previous.entries.keys().map(|key| output_path(&c_dir, key)).collect()
+    } else {
+        HashSet::new()
+    };
+
+    let failed = |path: &Path, e: std::io::Error| {
+        Error::CommandExecutionFailed(format!("Failed to remove {}: {}", path.display(), e))
+    };
+    let mut kept = 0;
+    if feature_dir.exists() {
+        for entry in fs::read_dir(feature_dir)? {
+            let entry = entry?;
+            let path = entry.path();
+            if path == c_dir && entry.file_type()?.is_dir() {
+                kept = prune(&c_dir, &keep).map_err(|e| failed(&c_dir, e))?;
+            } else if entry.file_name() == OUTPUTS_FILE {
+                // Still needed to tell modified outputs from added ones
+            } else if entry.file_type()?.is_dir() {
+                fs::remove_dir_all(&path).map_err(|e| failed(&path, e))?;
+            } else {
+                fs::remove_file(&path).map_err(|e| failed(&path, e))?;
+            }
+        }
+    }
+
+    fs::create_dir_all(feature_dir).map_err(|e| {
+        Error::CommandExecutionFailed(format!(
+            "Failed to create feature directory {}: {}",
+            feature_dir.display(),
+            e
+        ))
+    })?;
+    Ok(kept)
+}
+
+/// Remove every file below `dir` not in `keep` (or the chunk index of one), then
+/// the directories left empty
+fn prune(dir: &Path, keep: &HashSet<PathBuf>) -> std::io::Result<usize> {
+    let mut kept = 0;
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let path = entry.path();
+        let indexed = path
+            .to_str()
+            .and_then(|p| p.strip_suffix(chunks::INDEX_SUFFIX))
+            .map(PathBuf::from);
+        if entry.file_type()?.is_dir() {
+            kept += prune(&path, keep)?;
+        } else if keep.contains(&path) {
+            kept += 1;
+        } else if indexed.is_some_and(|output| keep.contains(&output)) {
+            // Still describes the kept output
+        } else {
+            fs::remove_file(&path)?;
+        }
+    }
+    if kept == 0 {
+        fs::remove_dir(dir)?;
+    }
+    Ok(kept)
+}
+
+/// Remove kept outputs of translation units this run did not compile.
+/// Returns the number of outputs removed.
+pub fn remove_stale(store: &Store, c_dir: &Path) -> Result<usize> {
+    let compiled: HashSet<&str> = store.scan(TU_PREFIX).into_iter().map(|(key, _)| key).collect();
+    let mut removed = 0;
+    for file in file_selector::collect_preprocessed_files(c_dir)? {
+        match output_key(c_dir, &file.path) {
+            Some(key) if compiled.contains(key.as_str()) => {}
+            _ => {
+                fs::remove_file(&file.path)?;
+                removed += 1;
+            }
+        }
+    }
+    Ok(removed)
+}
+
+/// Content hashes recorded for this run's outputs
+pub fn recorded_hashes(store: &Store) -> HashMap<&str, u64> {
+    store
+        .scan(HASH_PREFIX)
+        .into_iter()
+        .filter_map(|(key, value)| {
+            let hash = u64::from_str_radix(std::str::from_utf8(value).ok()?, 16).ok()?;
+            Some((key, hash))
+        })
+        .collect()
+}
+
+/// Record the hash of an output preprocessed by c2rust-build
+pub fn record_hash(txn: &mut Transaction, key: &str, hash: u64) {
+    txn.put(format!("{}{}", HASH_PREFIX, key), format!("{:016x}", hash));
+}
+
+/// Outputs left untouched by this run: they already hold the transformed result
+pub fn unchanged(feature_dir: &Path, store: &Store) -> Result<HashSet<PathBuf>> {
+    let previous = Outputs::load(feature_dir)?;
+    let c_dir = feature_dir.join("c");
+    Ok(recorded_hashes(store)
+        .into_iter()
+        .map(|(key, hash)| (output_path(&c_dir, key), key, hash))
+        .filter(|(path, key, hash)| previous.is_current(key, path, *hash))
+        .map(|(path, _, _)| path)
+        .collect())
+}
+
+/// Translation units whose output changed in a run
+#[derive(Debug, Default, PartialEq)]
+pub struct Changes {
+    pub added: Vec<String>,
+    pub modified: Vec<String>,
+    pub removed: Vec<String>,
+}
+
+/// Compare the outputs now present with those of the last run: write the change set
+/// to `changes` and the present outputs to `outputs.list`. Outputs without a
+/// recorded hash count as modified and are left out of `outputs.list`, so the next
+/// run writes them again.
+pub fn finish(feature_dir: &Path, pipeline: &str) -> Result<Changes> {
+    let c_dir = feature_dir.join("c");
+    let previous = Outputs::load(feature_dir)?;
+    let store = Store::open(feature_dir)?;
+    let hashes = recorded_hashes(&store);
+
+    let mut current = Outputs {
+        pipeline: pipeline.to_string(),
+        entries: BTreeMap::new(),
+    };
+    let mut present = HashSet::new();
+    let mut changes = Changes::default();
+    for file in file_selector::collect_preprocessed_files(&c_dir)? {
+        let Some(key) = output_key(&c_dir, &file.path) else {
+            continue;
+        };
+        let mtime_ns = mtime_ns(&fs::metadata(&file.path)?);
+        let hash = hashes.get(key.as_str()).copied();
+        match (previous.entries.get(&key), hash) {
+            (None, _) => changes.added.push(key.clone()),
+            (Some(entry), Some(hash))
+                if previous.pipeline == pipeline && *entry == (Entry { hash, mtime_ns }) => {}
+            _ => changes.modified.push(key.clone()),
+        }
+        if let Some(hash) = hash {
+            current.entries.insert(key.clone(), Entry { hash, mtime_ns });
+        }
+        present.insert(key);
+    }
+    changes.removed = previous
+        .entries
+        .keys()
+        .filter(|key| !present.contains(*key))
+        .cloned()
+        .collect();
+    changes.added.sort();
+    changes.modified.sort();
+
+    let mut content = String::new();
+    for (status, keys) in [("A", &changes.added), ("M", &changes.modified), ("D", &changes.removed)] {
+        for key in keys {
+            content.push_str(&format!("{}\t{}\n", status, key));
+        }
+    }
+    fs::write(feature_dir.join(CHANGES_FILE), content)?;
+    current.save(feature_dir)?;
+    Ok(changes)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    fn write_output(c_dir: &Path, key: &str, content: &str) -> PathBuf {
+        let path = output_path(c_dir, key);
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        fs::write(&path, content).unwrap();
+        path
+    }
+
+    fn record(feature_dir: &Path, entries: &[(&str, &str)]) {
+        let mut txn = Transaction::default();
+        for (key, content) in entries {
+            txn.put(format!("{}{}", TU_PREFIX, key), "");
+            let mut hash = ContentHash::default();
+            hash.update(content.as_bytes());
+            record_hash(&mut txn, key, hash.finish());
+        }
+        Store::open(feature_dir).unwrap().commit(txn).unwrap();
+    }
+
+    #[test]
+    fn test_content_hash_matches_fnv1a() {
+        // Reference values of 64-bit FNV-1a
+        assert_eq!(ContentHash::default().finish(), 0xcbf29ce484222325);
+        let mut hash = ContentHash::default();
+        hash.update(b"a");
+        assert_eq!(hash.finish(), 0xaf63dc4c8601ec8c);
+
+        let temp_dir = TempDir::new().unwrap();
+        let path = temp_dir.path().join("f");
+        fs::write(&path, "foobar").unwrap();
+        assert_eq!(hash_file(&path).unwrap(), 0x85944171f73967e8);
+    }
+
+    #[test]
+    fn test_outputs_roundtrip_sorted() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut outputs = Outputs {
+            pipeline: "none".to_string(),
+            entries: BTreeMap::new(),
+        };
+        outputs.entries.insert("src/b.c".to_string(), Entry { hash: 2, mtime_ns: 20 });
+        outputs.entries.insert("lib/a.c".to_string(), Entry { hash: 1, mtime_ns: 10 });
+        outputs.save(temp_dir.path()).unwrap();
+
+        let content = fs::read_to_string(temp_dir.path().join(OUTPUTS_FILE)).unwrap();
+        assert_eq!(
+            content,
+            "# pipeline none\nlib/a.c\t0000000000000001\t10\nsrc/b.c\t0000000000000002\t20\n"
+        );
+        assert_eq!(Outputs::load(temp_dir.path()).unwrap(), outputs);
+        assert_eq!(Outputs::load(&temp_dir.path().join("missing")).unwrap(), Outputs::default());
+    }
+
+    #[test]
+    fn test_clean_keeps_published_outputs() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        let c_dir = feature_dir.join("c");
+        let kept = write_output(&c_dir, "src/a.c", "a");
+        let dropped = write_output(&c_dir, "old/b.c", "b");
+        fs::write(c_dir.join("src").join("a.c2rust.opts"), "").unwrap();
+        fs::write(chunks::index_path(&kept), "").unwrap();
+        fs::write(feature_dir.join("state.log"), "").unwrap();
+        let mut outputs = Outputs {
+            pipeline: "none".to_string(),
+            entries: BTreeMap::new(),
+        };
+        outputs.entries.insert("src/a.c".to_string(), Entry { hash: 1, mtime_ns: 1 });
+        outputs.save(&feature_dir).unwrap();
+
+        assert_eq!(clean_keeping_outputs(&feature_dir, "none").unwrap(), 1);
+        assert!(kept.exists() && chunks::index_path(&kept).exists());
+        assert!(!dropped.exists() && !c_dir.join("old").exists());
+        assert!(!c_dir.join("src").join("a.c2rust.opts").exists());
+        assert!(!feature_dir.join("state.log").exists());
+        assert!(feature_dir.join(OUTPUTS_FILE).exists());
+
+        // A different transform pipeline keeps nothing
+        assert_eq!(clean_keeping_outputs(&feature_dir, "other").unwrap(), 0);
+        assert!(!kept.exists());
+        assert!(feature_dir.is_dir());
+    }
+
+    #[test]
+    fn test_finish_reports_changes() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        let c_dir = feature_dir.join("c");
+        write_output(&c_dir, "src/a.c", "a");
+        write_output(&c_dir, "src/b.c", "b");
+        write_output(&c_dir, "src/c.c", "c");
+        record(&feature_dir, &[("src/a.c", "a"), ("src/b.c", "b"), ("src/c.c", "c")]);
+
+        let changes = finish(&feature_dir, "none").unwrap();
+        assert_eq!(changes.added, vec!["src/a.c", "src/b.c", "src/c.c"]);
+
+        // Next run: a kept, b rewritten with new content, c gone, d new
+        clean_keeping_outputs(&feature_dir, "none").unwrap();
+        record(&feature_dir, &[("src/a.c", "a"), ("src/b.c", "b2"), ("src/d.c", "d")]);
+        write_output(&c_dir, "src/b.c", "b2");
+        write_output(&c_dir, "src/d.c", "d");
+        fs::remove_file(output_path(&c_dir, "src/c.c")).unwrap();
+
+        let store = Store::open(&feature_dir).unwrap();
+        assert_eq!(
+            unchanged(&feature_dir, &store).unwrap(),
+            [output_path(&c_dir, "src/a.c")].into()
+        );
+
+        let changes = finish(&feature_dir, "none").unwrap();
+        assert_eq!(
+            changes,
+            Changes {
+                added: vec!["src/d.c".to_string()],
+                modified: vec!["src/b.c".to_string()],
+                removed: vec!["src/c.c".to_string()],
+            }
+        );
+        assert_eq!(
+            fs::read_to_string(feature_dir.join(CHANGES_FILE)).unwrap(),
+            "A\tsrc/d.c\nM\tsrc/b.c\nD\tsrc/c.c\n"
+        );
+        assert_eq!(Outputs::load(&feature_dir).unwrap().entries.len(), 3);
+    }
+
+    #[test]
+    fn test_remove_stale_outputs() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("default");
+        let c_dir = feature_dir.join("c");
+        let compiled = write_output(&c_dir, "src/a.c", "a");
+        let stale = write_output(&c_dir, "src/gone.c", "x");
+        record(&feature_dir, &[("src/a.c", "a")]);
+
+        let store = Store::open(&feature_dir).unwrap();
+        assert_eq!(remove_stale(&store, &c_dir).unwrap(), 1);
+        assert!(compiled.exists());
+        assert!(!stale.exists());
+    }
+}
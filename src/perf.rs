@@ -0,0 +1,408 @@
+use crate::error::{Error, Result};
+use crate::heap_profile;
+use crate::lock;
+use serde::{Deserialize, Serialize};
+use std::fs::{self, OpenOptions};
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::time::{Instant, SystemTime, UNIX_EPOCH};
+
+/// Append-only performance history below `.c2rust/`, one JSON record per line
+pub const HISTORY_FILE: &str = "perf_history.jsonl";
+
+/// Defaults of `perf check`
+pub const DEFAULT_WINDOW: usize = 10;
+pub const DEFAULT_THRESHOLD: f64 = 1.5;
+
+/// Fewest baseline runs `perf check` needs before it judges a run
+const MIN_BASELINE: usize = 3;
+/// Scale of the median absolute deviation to a standard deviation for normal data
+const MAD_SCALE: f64 = 1.4826;
+
+/// Timing and volume metrics of one tracking run
+#[derive(Debug, Default, Clone, Serialize, Deserialize, PartialEq)]
+pub struct RunRecord {
+    /// Unix timestamp of the end of the run
+    pub timestamp: u64,
+    pub feature: String,
+    pub total_seconds: f64,
+    /// Wall-clock seconds per phase, in run order
+    pub phases: Vec<(String, f64)>,
+    pub translation_units: usize,
+    pub preprocessed_bytes: u64,
+    #[serde(default)]
+    pub deferred_files: usize,
+    /// Preprocessing time relative to compile time measured by libhook.so, in
+    /// percent; only measured when an overhead budget is set
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub hook_overhead_percent: Option<f64>,
+    /// Share of transform plugin invocations answered from the cache
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub transform_cache_hit_rate: Option<f64>,
+}
+
+/// Measures the phases of a tracking run; entering a phase also tags the heap
+/// profile's allocations with it
+pub struct RunTimer {
+    start: Instant,
+    current: Option<(&'static str, Instant)>,
+    pub record: RunRecord,
+}
+
+impl RunTimer {
+    pub fn start(feature: &str) -> RunTimer {
+        RunTimer {
+            start: Instant::now(),
+            current: None,
+            record: RunRecord {
+                feature: feature.to_string(),
+                ..RunRecord::default()
+            },
+        }
+    }
+
+    /// End the current phase, if any, and start phase `name`
+    pub fn enter(&mut self, name: &'static str) {
+        self.end_phase();
+        self.current = Some((name, Instant::now()));
+        heap_profile::enter(name);
+    }
+
+    /// A phase entered more than once (e.g. once per subproject) accumulates its time
+    fn end_phase(&mut self) {
+        if let Some((name, start)) = self.current.take() {
+            let seconds = start.elapsed().as_secs_f64();
+            match self.record.phases.iter_mut().find(|(phase, _)| phase == name) {
+                Some((_, total)) => *total += seconds,
+                None => self.record.phases.push((name.to_string(), seconds)),
+            }
+        }
+    }
+
+    pub fn finish(mut self) -> RunRecord {
+        self.end_phase();
+        self.record.total_seconds = self.start.elapsed().as_secs_f64();
+        self.record.timestamp = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map(|d| d.as_secs())
+            .unwrap_or(0);
+        self.record
+    }
+}
+
+fn history_path(project_root: &Path) -> PathBuf {
+    project_root.join(".c2rust").join(HISTORY_FILE)
+}
+
+/// Append a run to the history. Concurrent runs of other features append under an
+/// exclusive lock, so records never interleave.
+pub fn append(project_root: &Path, record: &RunRecord) -> Result<()> {
+    let path = history_path(project_root);
+    let mut line = serde_json::to_string(record)?;
+    line.push('\n');
+
+    let mut file = OpenOptions::new().create(true).append(true).open(&path)?;
+    lock::flock(&file, libc::LOCK_EX, &path)?;
+    file.write_all(line.as_bytes())?;
+    Ok(())
+}
+
+/// Read the history of one feature, oldest first. Unparsable lines are skipped.
+pub fn load(project_root: &Path, feature: &str) -> Result<Vec<RunRecord>> {
+    let content = match fs::read_to_string(history_path(project_root)) {
+        Ok(content) => content,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(Vec::new()),
+        Err(e) => return Err(e.into()),
+    };
+    Ok(content
+        .lines()
+        .filter_map(|line| serde_json::from_str::<RunRecord>(line).ok())
+        .filter(|record| record.feature == feature)
+        .collect())
+}
+
+/// Read the preprocessing overhead of the whole build accumulated by libhook.so in
+/// `overhead.state`: two u64 nanosecond counters, the sample count and level of the
+/// current degradation window (reset on every degradation), then the u64 preprocess
+/// and compile totals read here
+pub fn read_hook_overhead(feature_dir: &Path) -> Option<f64> {
+    let state = fs::read(feature_dir.join("overhead.state")).ok()?;
+    let preprocess_ns = u64::from_ne_bytes(state.get(24..32)?.try_into().ok()?);
+    let compile_ns = u64::from_ne_bytes(state.get(32..40)?.try_into().ok()?);
+    (compile_ns > 0).then(|| preprocess_ns as f64 * 100.0 / compile_ns as f64)
+}
+
+/// Total size of the preprocessed files below `c_dir`
+pub fn preprocessed_bytes(c_dir: &Path) -> Result<u64> {
+    let mut total = 0;
+    let entries = match fs::read_dir(c_dir) {
+        Ok(entries) => entries,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(0),
+        Err(e) => return Err(e.into()),
+    };
+    for entry in entries {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        let path = entry.path();
+        if file_type.is_dir() {
+            total += preprocessed_bytes(&path)?;
+        } else if file_type.is_file()
+            && path.extension().is_some_and(|ext| ext == "c2rust" || ext == "i")
+        {
+            total += entry.metadata()?.len();
+        }
+    }
+    Ok(total)
+}
+
+/// Verdict on one metric of the latest run
+#[derive(Debug, Clone, PartialEq)]
+pub struct MetricCheck {
+    pub name: String,
+    pub latest: f64,
+    pub median: f64,
+    pub mad: f64,
+    pub regressed: bool,
+}
+
+/// Compare the latest run against the median of up to `window` runs before it.
+///
+/// Every metric is "lower is better". A metric regresses when it is at least
+/// `threshold` times its baseline median *and* more than three robust standard
+/// deviations (scaled MAD) above it, which keeps noisy short phases quiet; tiny
+/// absolute changes (below `min_delta`) never count. Returns `None` when there is
+/// too little history to judge.
+pub fn check(history: &[RunRecord], window: usize, threshold: f64) -> Option<Vec<MetricCheck>> {
+    let (latest, earlier) = history.split_last()?;
+    let baseline = &earlier[earlier.len().saturating_sub(window)..];
+    if baseline.len() < MIN_BASELINE {
+        return None;
+    }
+
+    let mut checks = Vec::new();
+    let mut compare = |name: String, latest: f64, values: Vec<f64>, min_delta: f64| {
+        if values.len() < MIN_BASELINE {
+            return;
+        }
+        let median = median(&values);
+        let mad = median_abs_deviation(&values, median);
+        let delta = latest - median;
+        let regressed = delta >= min_delta
+            && latest >= median * threshold
+            && delta > 3.0 * MAD_SCALE * mad;
+        checks.push(MetricCheck {
+            name,
+            latest,
+            median,
+            mad,
+            regressed,
+        });
+    };
+
+    compare(
+        "total_seconds".to_string(),
+        latest.total_seconds,
+        baseline.iter().map(|r| r.total_seconds).collect(),
+        0.1,
+    );
+    for (phase, seconds) in &latest.phases {
+        let values = baseline
+            .iter()
+            .filter_map(|r| r.phases.iter().find(|(p, _)| p == phase).map(|(_, s)| *s))
+            .collect();
+        compare(format!("phase.{}", phase), *seconds, values, 0.1);
+    }
+    if let Some(overhead) = latest.hook_overhead_percent {
+        compare(
+            "hook_overhead_percent".to_string(),
+            overhead,
+            baseline.iter().filter_map(|r| r.hook_overhead_percent).collect(),
+            1.0,
+        );
+    }
+    if let Some(hit_rate) = latest.transform_cache_hit_rate {
+        // Compare misses so that every metric is "lower is better"
+        compare(
+            "transform_cache_miss_rate".to_string(),
+            1.0 - hit_rate,
+            baseline
+                .iter()
+                .filter_map(|r| r.transform_cache_hit_rate.map(|h| 1.0 - h))
+                .collect(),
+            0.05,
+        );
+    }
+    Some(checks)
+}
+
+/// Median translation unit count of the runs before the latest one in the window;
+/// used to point out that the workload itself changed
+pub fn baseline_translation_units(history: &[RunRecord], window: usize) -> Option<f64> {
+    let (_, earlier) = history.split_last()?;
+    let baseline = &earlier[earlier.len().saturating_sub(window)..];
+    (!baseline.is_empty())
+        .then(|| median(&baseline.iter().map(|r| r.translation_units as f64).collect::<Vec<_>>()))
+}
+
+fn median(values: &[f64]) -> f64 {
+    let mut sorted = values.to_vec();
+    sorted.sort_by(|a, b| a.total_cmp(b));
+    let mid = sorted.len() / 2;
+    if sorted.len() % 2 == 0 {
+        (sorted[mid - 1] + sorted[mid]) / 2.0
+    } else {
+        sorted[mid]
+    }
+}
+
+fn median_abs_deviation(values: &[f64], median_value: f64) -> f64 {
+    let deviations: Vec<f64> = values.iter().map(|v| (v - median_value).abs()).collect();
+    median(&deviations)
+}
+
+/// `perf check`: print the comparison and fail on a regression
+pub fn run_check(project_root: &Path, feature: &str, window: usize, threshold: f64) -> Result<()> {
+    let history = load(project_root, feature)?;
+    let Some(checks) = check(&history, window, threshold) else {
+        println!(
+            "Not enough history for feature '{}': {} run(s) recorded, {} needed",
+            feature,
+            history.len(),
+            MIN_BASELINE + 1
+        );
+        return Ok(());
+    };
+
+    let latest = history.last().expect("check() needs a latest run");
+    let baseline = history.len().saturating_sub(1).min(window);
+    println!(
+        "Comparing the latest run of feature '{}' against the {} run(s) before it",
+        feature, baseline
+    );
+    if let Some(units) = baseline_translation_units(&history, window) {
+        let ratio = latest.translation_units as f64 / units.max(1.0);
+        if !(0.9..=1.1).contains(&ratio) {
+            println!(
+                "Note: the workload changed: {} translation unit(s), baseline median {:.0}",
+                latest.translation_units, units
+            );
+        }
+    }
+
+    println!(
+        "{:<32} {:>12} {:>12} {:>10} {:>8}",
+        "metric", "latest", "median", "mad", "ratio"
+    );
+    let mut regressions = Vec::new();
+    for check in &checks {
+        let ratio = if check.median > 0.0 {
+            format!("{:.2}x", check.latest / check.median)
+        } else {
+            "-".to_string()
+        };
+        println!(
+            "{:<32} {:>12.3} {:>12.3} {:>10.3} {:>8}{}",
+            check.name,
+            check.latest,
+            check.median,
+            check.mad,
+            ratio,
+            if check.regressed { "  REGRESSION" } else { "" }
+        );
+        if check.regressed {
+            regressions.push(check.name.as_str());
+        }
+    }
+
+    if regressions.is_empty() {
+        println!("No significant regression.");
+        Ok(())
+    } else {
+        Err(Error::PerfRegression(regressions.join(", ")))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    fn run(total: f64, build: f64) -> RunRecord {
+        RunRecord {
+            feature: "default".to_string(),
+            total_seconds: total,
+            phases: vec![("build".to_string(), build), ("select".to_string(), 0.01)],
+            translation_units: 100,
+            ..RunRecord::default()
+        }
+    }
+
+    #[test]
+    fn test_append_and_load_per_feature() {
+        let temp_dir = TempDir::new().unwrap();
+        fs::create_dir_all(temp_dir.path().join(".c2rust")).unwrap();
+
+        append(temp_dir.path(), &run(10.0, 9.0)).unwrap();
+        let mut other = run(1.0, 1.0);
+        other.feature = "other".to_string();
+        append(temp_dir.path(), &other).unwrap();
+        append(temp_dir.path(), &run(11.0, 10.0)).unwrap();
+
+        let history = load(temp_dir.path(), "default").unwrap();
+        assert_eq!(history.len(), 2);
+        assert_eq!(history[1].total_seconds, 11.0);
+        assert!(load(temp_dir.path(), "missing").unwrap().is_empty());
+    }
+
+    #[test]
+    fn test_check_flags_slowdown() {
+        let mut history: Vec<RunRecord> = [10.0, 10.4, 9.8, 10.1, 10.2]
+            .iter()
+            .map(|&t| run(t, t - 1.0))
+            .collect();
+        history.push(run(21.0, 20.0));
+
+        let checks = check(&history, DEFAULT_WINDOW, DEFAULT_THRESHOLD).unwrap();
+        let total = checks.iter().find(|c| c.name == "total_seconds").unwrap();
+        assert!(total.regressed);
+        assert_eq!(total.median, 10.1);
+        assert!(checks.iter().find(|c| c.name == "phase.build").unwrap().regressed);
+        // Short phases stay quiet
+        assert!(!checks.iter().find(|c| c.name == "phase.select").unwrap().regressed);
+    }
+
+    #[test]
+    fn test_check_tolerates_noise() {
+        let mut history: Vec<RunRecord> = [10.0, 14.0, 9.0, 13.0, 10.0]
+            .iter()
+            .map(|&t| run(t, t - 1.0))
+            .collect();
+        history.push(run(14.0, 13.0));
+
+        let checks = check(&history, DEFAULT_WINDOW, DEFAULT_THRESHOLD).unwrap();
+        assert!(checks.iter().all(|c| !c.regressed));
+    }
+
+    #[test]
+    fn test_check_needs_history() {
+        let history = vec![run(10.0, 9.0), run(10.0, 9.0), run(30.0, 29.0)];
+        assert!(check(&history, DEFAULT_WINDOW, DEFAULT_THRESHOLD).is_none());
+        assert!(check(&[], DEFAULT_WINDOW, DEFAULT_THRESHOLD).is_none());
+    }
+
+    #[test]
+    fn test_read_hook_overhead() {
+        let temp_dir = TempDir::new().unwrap();
+        assert_eq!(read_hook_overhead(temp_dir.path()), None);
+
+        // A degradation reset the window to 250/1000; the totals cover the whole build
+        let mut state = Vec::new();
+        state.extend_from_slice(&250u64.to_ne_bytes());
+        state.extend_from_slice(&1000u64.to_ne_bytes());
+        state.extend_from_slice(&[0; 8]);
+        state.extend_from_slice(&600u64.to_ne_bytes());
+        state.extend_from_slice(&2000u64.to_ne_bytes());
+        fs::write(temp_dir.path().join("overhead.state"), state).unwrap();
+        assert_eq!(read_hook_overhead(temp_dir.path()), Some(30.0));
+    }
+}
@@ -0,0 +1,293 @@
+use crate::error::{Error, Result};
+use crate::events::EventSink;
+use crate::outputs::{self, Outputs};
+use crate::parallel;
+use crate::priority::Priority;
+use crate::store::{Store, Transaction};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+/// A compilation whose preprocessing is run by c2rust-build instead of libhook.so
+#[derive(Debug, Clone, PartialEq)]
+pub struct PreprocessJob {
+    /// Working directory of the original compiler invocation
+    pub cwd: PathBuf,
+    /// Compiler used by the original invocation
+    pub compiler: String,
+    /// Absolute path of the C source file
+    pub source: PathBuf,
+    /// Preprocessed output path (`.c2rust`); options are stored next to it in `.opts`
+    pub output: PathBuf,
+}
+
+impl PreprocessJob {
+    /// Path of the options file written by libhook.so for this output
+    pub fn options_path(&self) -> PathBuf {
+        let mut path = self.output.clone().into_os_string();
+        path.push(".opts");
+        PathBuf::from(path)
+    }
+
+    /// Run `<cc> -E -C <source> -o <output> -P <options>` like libhook.so does
+    pub fn run(&self) -> Result<()> {
+        self.run_to(&self.output, None, &Priority::default())
+    }
+
+    /// Preprocess next to the output and publish the result only if it differs from
+    /// what the last run published for `key`, leaving an unchanged output and its
+    /// mtime alone. Returns the hash of the result; a failure removes the old output.
+    pub fn run_if_changed(&self, previous: &Outputs, key: &str, priority: &Priority) -> Result<u64> {
+        let mut part = self.output.clone().into_os_string();
+        part.push(".part");
+        let part = PathBuf::from(part);
+
+        let result = self.run_to(&part, None, priority).and_then(|()| {
+            let hash = outputs::hash_file(&part)?;
+            if previous.is_current(key, &self.output, hash) {
+                fs::remove_file(&part)?;
+            } else {
+                fs::rename(&part, &self.output)?;
+            }
+            Ok(hash)
+        });
+        if result.is_err() {
+            let _ = fs::remove_file(&part);
+            let _ = fs::remove_file(&self.output);
+        }
+        result
+    }
+
+    /// Like `run`, but write the preprocessed file to `output` and, if given, the
+    /// Makefile-style list of files the source includes to `depfile` (`-MD -MF`),
+    /// running the compiler under `priority`
+    pub fn run_to(&self, output: &Path, depfile: Option<&Path>, priority: &Priority) -> Result<()> {
+        let options = match fs::read_to_string(self.options_path()) {
+            Ok(content) => parse_options(&content),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => Vec::new(),
+            Err(e) => return Err(e.into()),
+        };
+
+        // A relative compiler path refers to the original working directory
+        let compiler = if self.compiler.contains('/') {
+            self.cwd.join(&self.compiler)
+        } else {
+            PathBuf::from(&self.compiler)
+        };
+
+        let mut command = Command::new(&compiler);
+        command
+            .arg("-E")
+            .arg("-C")
+            .arg(&self.source)
+            .arg("-o")
+            .arg(output)
+            .arg("-P")
+            .args(&options)
+            .current_dir(&self.cwd);
+        if let Some(depfile) = depfile {
+            command.arg("-MD").arg("-MF").arg(depfile).arg("-MT").arg("tu");
+        }
+        priority.configure(&mut command);
+        let output = command
+            .output()
+            .map_err(|e| {
+                Error::CommandExecutionFailed(format!(
+                    "Failed to execute {}: {}",
+                    compiler.display(),
+                    e
+                ))
+            })?;
+
+        if !output.status.success() {
+            return Err(Error::CommandExecutionFailed(format!(
+                "Preprocessing {} failed: {}",
+                self.source.display(),
+                String::from_utf8_lossy(&output.stderr).trim()
+            )));
+        }
+
+        Ok(())
+    }
+}
+
+/// Parse an `.opts` file written by libhook.so: every argument is written as `"<arg>" `
+pub fn parse_options(content: &str) -> Vec<String> {
+    let content = content.trim();
+    let Some(inner) = content
+        .strip_prefix('"')
+        .and_then(|rest| rest.strip_suffix('"'))
+    else {
+        return Vec::new();
+    };
+    inner.split("\" \"").map(|arg| arg.to_string()).collect()
+}
+
+/// Read compilations recorded in `<feature_dir>/deferred.list` by libhook.so.
+/// Each line is `<cwd>\t<compiler>\t<source>\t<output>`.
+pub fn read_deferred(feature_dir: &Path) -> Result<Vec<PreprocessJob>> {
+    let content = match fs::read_to_string(feature_dir.join("deferred.list")) {
+        Ok(content) => content,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(Vec::new()),
+        Err(e) => return Err(e.into()),
+    };
+
+    let jobs = content
+        .lines()
+        .filter_map(|line| {
+            let mut fields = line.split('\t');
+            Some(PreprocessJob {
+                cwd: PathBuf::from(fields.next()?),
+                compiler: fields.next()?.to_string(),
+                source: PathBuf::from(fields.next()?),
+                output: PathBuf::from(fields.next()?),
+            })
+        })
+        .collect();
+
+    Ok(jobs)
+}
+
+/// Preprocess the compilations deferred by libhook.so on a parallel pool, under the
+/// same priority policy as preprocessing inside the hook.
+/// Failures are reported as warnings, like failed preprocessing inside the hook.
+/// Each output is published to `events` as soon as it is in place.
+/// Returns the number of files preprocessed successfully.
+pub fn run_deferred(
+    feature_dir: &Path,
+    priority: &Priority,
+    events: Option<&EventSink>,
+) -> Result<usize> {
+    let jobs = read_deferred(feature_dir)?;
+    if jobs.is_empty() {
+        return Ok(0);
+    }
+
+    println!("Preprocessing {} deferred file(s)...", jobs.len());
+    // Outputs in deferred.list are absolute, and so are the paths in events
+    let c_dir = feature_dir.canonicalize()?.join("c");
+    let previous = Outputs::load(feature_dir)?;
+    let results = parallel::map(&jobs, parallel::default_jobs(), |job| {
+        match outputs::output_key(&c_dir, &job.output) {
+            Some(key) => {
+                let hash = job.run_if_changed(&previous, &key, priority)?;
+                if let Some(events) = events {
+                    let feature_dir = c_dir.parent().expect("c_dir is below the feature");
+                    events.tu(feature_dir, &key, &job.output, hash);
+                }
+                Ok(Some((key, hash)))
+            }
+            None => job.run_to(&job.output, None, priority).map(|()| None),
+        }
+    });
+
+    let mut succeeded = 0;
+    let mut txn = Transaction::default();
+    for (job, result) in jobs.iter().zip(results) {
+        match result {
+            Ok(hash) => {
+                if let Some((key, hash)) = hash {
+                    outputs::record_hash(&mut txn, &key, hash);
+                }
+                succeeded += 1;
+            }
+            Err(e) => eprintln!("Warning: {}: {}", job.source.display(), e),
+        }
+    }
+    Store::open(feature_dir)?.commit(txn)?;
+
+    Ok(succeeded)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_parse_options() {
+        assert_eq!(
+            parse_options("\"-I\" \"include\" \"-DFOO=1\" \"-std=c99\" "),
+            vec!["-I", "include", "-DFOO=1", "-std=c99"]
+        );
+        assert!(parse_options("").is_empty());
+        assert_eq!(parse_options("\"-DX\" "), vec!["-DX"]);
+    }
+
+    #[test]
+    fn test_read_deferred() {
+        let temp_dir = TempDir::new().unwrap();
+        fs::write(
+            temp_dir.path().join("deferred.list"),
+            "/proj/build\tgcc\t/proj/src/a.c\t/proj/.c2rust/default/c/src/a.c2rust\n\
+             malformed line\n",
+        )
+        .unwrap();
+
+        let jobs = read_deferred(temp_dir.path()).unwrap();
+        assert_eq!(
+            jobs,
+            vec![PreprocessJob {
+                cwd: PathBuf::from("/proj/build"),
+                compiler: "gcc".to_string(),
+                source: PathBuf::from("/proj/src/a.c"),
+                output: PathBuf::from("/proj/.c2rust/default/c/src/a.c2rust"),
+            }]
+        );
+        assert_eq!(
+            jobs[0].options_path(),
+            PathBuf::from("/proj/.c2rust/default/c/src/a.c2rust.opts")
+        );
+    }
+
+    #[test]
+    fn test_read_deferred_missing_file() {
+        let temp_dir = TempDir::new().unwrap();
+        assert!(read_deferred(temp_dir.path()).unwrap().is_empty());
+        assert_eq!(run_deferred(temp_dir.path(), &Priority::default(), None).unwrap(), 0);
+    }
+
+    #[test]
+    fn test_run_reports_missing_compiler() {
+        let temp_dir = TempDir::new().unwrap();
+        let job = PreprocessJob {
+            cwd: temp_dir.path().to_path_buf(),
+            compiler: "/nonexistent/cc".to_string(),
+            source: temp_dir.path().join("a.c"),
+            output: temp_dir.path().join("a.c2rust"),
+        };
+        assert!(job.run().is_err());
+    }
+
+    #[test]
+    fn test_run_if_changed_keeps_unchanged_output() {
+        let temp_dir = TempDir::new().unwrap();
+        let c_dir = temp_dir.path().join("c");
+        fs::create_dir_all(&c_dir).unwrap();
+        fs::write(temp_dir.path().join("a.c"), "int a;\n").unwrap();
+        let job = PreprocessJob {
+            cwd: temp_dir.path().to_path_buf(),
+            compiler: "cc".to_string(),
+            source: temp_dir.path().join("a.c"),
+            output: c_dir.join("a.c2rust"),
+        };
+
+        let hash = job.run_if_changed(&Outputs::default(), "a.c", &Priority::default()).unwrap();
+        assert_eq!(hash, outputs::hash_file(&job.output).unwrap());
+
+        // Published (after transforming) with this hash and not touched since: left alone
+        fs::write(&job.output, "transformed").unwrap();
+        let mtime_ns = outputs::mtime_ns(&fs::metadata(&job.output).unwrap());
+        let mut previous = Outputs::default();
+        previous
+            .entries
+            .insert("a.c".to_string(), outputs::Entry { hash, mtime_ns });
+        assert_eq!(job.run_if_changed(&previous, "a.c", &Priority::default()).unwrap(), hash);
+        assert_eq!(fs::read_to_string(&job.output).unwrap(), "transformed");
+
+        // A failure removes the old output
+        fs::remove_file(temp_dir.path().join("a.c")).unwrap();
+        assert!(job.run_if_changed(&previous, "a.c", &Priority::default()).is_err());
+        assert!(!job.output.exists());
+    }
+}
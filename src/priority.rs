@@ -0,0 +1,174 @@
+use clap::ValueEnum;
+use std::io;
+use std::os::unix::process::CommandExt;
+use std::process::Command;
+use std::str::FromStr;
+
+// linux/ioprio.h
+const IOPRIO_WHO_PROCESS: libc::c_int = 1;
+const IOPRIO_CLASS_SHIFT: libc::c_int = 13;
+const IOPRIO_CLASS_BE: libc::c_int = 2;
+const IOPRIO_CLASS_IDLE: libc::c_int = 3;
+/// Lowest level within the best-effort class
+const IOPRIO_BE_LOWEST: libc::c_int = 7;
+
+/// CPU scheduling policy of preprocessing processes
+#[derive(Debug, Clone, Copy, PartialEq, ValueEnum)]
+pub enum Sched {
+    /// SCHED_IDLE: runs only on CPUs nothing else wants
+    Idle,
+    /// SCHED_BATCH: never preempts interactive or compiling processes on wakeup
+    Batch,
+}
+
+/// I/O scheduling class of preprocessing processes
+#[derive(Debug, Clone, Copy, PartialEq, ValueEnum)]
+pub enum IoClass {
+    /// Disk time only when no other process needs the disk
+    Idle,
+    /// Best-effort class at its lowest level
+    BestEffort,
+}
+
+/// CPUs given as a list of numbers and ranges, as for `taskset -c` (`0-3,6`)
+#[derive(Debug, Clone, PartialEq)]
+pub struct CpuList(pub Vec<usize>);
+
+impl FromStr for CpuList {
+    type Err = String;
+
+    fn from_str(s: &str) -> std::result::Result<CpuList, String> {
+        let mut cpus = Vec::new();
+        for part in s.split(',') {
+            let parse = |n: &str| {
+                n.trim()
+                    .parse::<usize>()
+                    .map_err(|_| format!("invalid CPU '{}' in '{}'", n, s))
+            };
+            match part.split_once('-') {
+                Some((first, last)) => {
+                    let (first, last) = (parse(first)?, parse(last)?);
+                    if first > last {
+                        return Err(format!("invalid CPU range '{}'", part));
+                    }
+                    cpus.extend(first..=last);
+                }
+                None => cpus.push(parse(part)?),
+            }
+        }
+        if let Some(&cpu) = cpus.iter().find(|&&cpu| cpu >= libc::CPU_SETSIZE as usize) {
+            return Err(format!("CPU {} is out of range", cpu));
+        }
+        cpus.sort_unstable();
+        cpus.dedup();
+        Ok(CpuList(cpus))
+    }
+}
+
+/// Priority policy of preprocessing work nothing waits on: the staging drainer
+/// running alongside the build and the preprocessing of deferred compilations.
+/// The preprocessing libhook.so runs next to each compilation keeps the
+/// compiler's priority, since the compilation waits for it; lowering it would
+/// stretch the build's critical path.
+#[derive(Debug, Default, Clone, PartialEq)]
+pub struct Priority {
+    pub nice: Option<i32>,
+    pub sched: Option<Sched>,
+    pub io: Option<IoClass>,
+    pub cpus: Option<CpuList>,
+}
+
+impl Priority {
+    pub fn is_default(&self) -> bool {
+        *self == Priority::default()
+    }
+
+    /// Apply the policy to processes started by `command`. Settings the system
+    /// refuses (such as a nice level below the current one) are left out; they never
+    /// keep the process from starting.
+    pub fn configure(&self, command: &mut Command) {
+        if self.is_default() {
+            return;
+        }
+        let priority = self.clone();
+        // SAFETY: only raw system calls between fork and exec, no allocation
+        unsafe {
+            command.pre_exec(move || {
+                let _ = priority.apply_to_current_thread();
+                Ok(())
+            });
+        }
+    }
+
+    /// Apply the policy to the calling thread; processes it starts inherit it. Nice
+    /// levels cannot be lowered again without privileges, so this is meant for
+    /// threads and processes that only do preprocessing work. Every setting is
+    /// tried; the first refusal is returned.
+    pub fn apply_to_current_thread(&self) -> io::Result<()> {
+        let mut result = Ok(());
+        let mut apply = |ret: libc::c_int| {
+            if ret == -1 && result.is_ok() {
+                result = Err(io::Error::last_os_error());
+            }
+        };
+        // SAFETY: plain system calls on the calling thread (id 0)
+        unsafe {
+            if let Some(nice) = self.nice {
+                apply(libc::setpriority(libc::PRIO_PROCESS, 0, nice));
+            }
+            if let Some(sched) = self.sched {
+                let policy = match sched {
+                    Sched::Idle => libc::SCHED_IDLE,
+                    Sched::Batch => libc::SCHED_BATCH,
+                };
+                let param = libc::sched_param { sched_priority: 0 };
+                apply(libc::sched_setscheduler(0, policy, &param));
+            }
+            if let Some(io) = self.io {
+                let value = match io {
+                    IoClass::Idle => IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT,
+                    IoClass::BestEffort => {
+                        (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | IOPRIO_BE_LOWEST
+                    }
+                };
+                apply(libc::syscall(libc::SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) as libc::c_int);
+            }
+            if let Some(CpuList(cpus)) = &self.cpus {
+                let mut set: libc::cpu_set_t = std::mem::zeroed();
+                for &cpu in cpus {
+                    libc::CPU_SET(cpu, &mut set);
+                }
+                apply(libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set));
+            }
+        }
+        result
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cpu_list() {
+        assert_eq!("0-2,5,1".parse::<CpuList>().unwrap(), CpuList(vec![0, 1, 2, 5]));
+        assert!("3-1".parse::<CpuList>().is_err());
+        assert!("a".parse::<CpuList>().is_err());
+        assert!("100000".parse::<CpuList>().is_err());
+    }
+
+    #[test]
+    fn test_configure_applies_to_child() {
+        let priority = Priority {
+            nice: Some(19),
+            sched: Some(Sched::Batch),
+            ..Priority::default()
+        };
+        let mut command = Command::new("sh");
+        // Fields 19 (nice) and 41 (policy) of /proc/<pid>/stat; comm is "sh"
+        command.arg("-c").arg("cut -d' ' -f19,41 /proc/$$/stat");
+        priority.configure(&mut command);
+        let output = command.output().unwrap();
+        assert_eq!(String::from_utf8_lossy(&output.stdout).trim(), "19 3");
+    }
+}
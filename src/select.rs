@@ -0,0 +1,281 @@
+use crate::chunks;
+use crate::config_helper;
+use crate::error::Result;
+use crate::file_selector::{self, PreprocessedFileInfo};
+use crate::manifest::Manifest;
+use crate::objects;
+use crate::outputs::{self, Outputs};
+use crate::parallel;
+use crate::preprocess::PreprocessJob;
+use crate::store::{self, Store, TuRecord, SELECTED_PREFIX, TU_PREFIX};
+use crate::target_selector;
+use crate::transform::{self, Plugin};
+use std::collections::{HashMap, HashSet};
+use std::fs;
+use std::path::{Path, PathBuf};
+
+/// Outcome of a re-selection
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct SelectStats {
+    /// Files preprocessed because they joined the selection
+    pub added: usize,
+    /// Files that joined the selection but could not be preprocessed
+    pub failed: usize,
+    /// Files deleted because they left the selection
+    pub removed: usize,
+}
+
+/// Change the target and file selection of a tracked feature without rebuilding.
+///
+/// Every translation unit recorded in the store is offered, not only the files
+/// that survived the previous selection, with the current selection checked.
+/// Files joining the selection are preprocessed again from their recorded
+/// invocation (and run through the feature's transform plugins) in parallel;
+/// files leaving it are deleted with their chunk index. Files kept are left
+/// untouched; files joining get a chunk index as the build would have written. The
+/// feature's change set (`changes`) is rewritten to describe the re-selection.
+/// Outputs held as pointers to `.c2rust/.objects` are hydrated first.
+pub fn run(project_root: &Path, feature: &str, no_interactive: bool) -> Result<SelectStats> {
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    let c_dir = feature_dir.join("c");
+    let store = Store::open(&feature_dir)?;
+
+    let selected_target =
+        target_selector::process_and_select_target(project_root, feature, no_interactive)?;
+
+    let jobs = recorded_jobs(&store, &c_dir);
+    // Pointer files of a checked-out generation get their content back before use
+    objects::hydrate(&objects::objects_dir(project_root), &c_dir)?;
+    let present = file_selector::collect_preprocessed_files(&c_dir)?;
+    let candidates = candidates(&jobs, &present, &c_dir);
+    let previous: HashSet<PathBuf> = if store.scan(SELECTED_PREFIX).is_empty() {
+        present.iter().map(|file| file.path.clone()).collect()
+    } else {
+        store
+            .scan(SELECTED_PREFIX)
+            .into_iter()
+            .map(|(path, _)| PathBuf::from(path))
+            .collect()
+    };
+
+    let mut selected = file_selector::select_files_interactive(
+        candidates,
+        &c_dir,
+        no_interactive,
+        selected_target.as_deref(),
+        &previous,
+    )?;
+    let mut stats = SelectStats::default();
+    if selected.is_empty() {
+        println!("No files selected; the selection is unchanged.");
+        return Ok(stats);
+    }
+
+    let manifest = Manifest::load(&feature_dir)?.unwrap_or_default();
+    let plugins = manifest
+        .transforms
+        .iter()
+        .map(|spec| Plugin::parse(spec))
+        .collect::<Result<Vec<_>>>()?;
+    let present_paths: HashSet<&PathBuf> = present.iter().map(|file| &file.path).collect();
+    let added: Vec<&PreprocessJob> = selected
+        .iter()
+        .filter(|path| !present_paths.contains(path))
+        .filter_map(|path| jobs.get(path))
+        .collect();
+
+    if !added.is_empty() {
+        println!("Preprocessing {} newly selected file(s)...", added.len());
+        let results = parallel::map(&added, parallel::default_jobs(), |job| {
+            preprocess_added(project_root, job, &plugins)
+        });
+
+        let mut failed = HashSet::new();
+        let mut txn = store::Transaction::default();
+        for (job, result) in added.iter().zip(results) {
+            match result {
+                Ok(hash) => {
+                    if let Some(key) = outputs::output_key(&c_dir, &job.output) {
+                        outputs::record_hash(&mut txn, &key, hash);
+                    }
+                    stats.added += 1;
+                }
+                Err(e) => {
+                    eprintln!("Warning: {}: {}", job.source.display(), e);
+                    failed.insert(job.output.clone());
+                }
+            }
+        }
+        Store::open(&feature_dir)?.commit(txn)?;
+        stats.failed = failed.len();
+        selected.retain(|path| !failed.contains(path));
+    }
+
+    file_selector::save_selected_files(&selected, feature, project_root)?;
+    let kept: HashSet<&PathBuf> = selected.iter().collect();
+    stats.removed = present
+        .iter()
+        .filter(|file| !kept.contains(&file.path))
+        .count();
+    file_selector::cleanup_unselected_files(&present, &selected, &c_dir)?;
+    // Newly selected files get the chunk index of the build; kept files keep theirs
+    let kept_present: HashSet<PathBuf> = present
+        .iter()
+        .map(|file| file.path.clone())
+        .filter(|path| kept.contains(path))
+        .collect();
+    chunks::refresh(
+        &c_dir,
+        manifest.chunk_index,
+        &Store::open(&feature_dir)?,
+        &kept_present,
+        !plugins.is_empty(),
+    )?;
+    // The change set now describes this re-selection; added files went through the
+    // transform plugins of the build, so the pipeline stays the same
+    outputs::finish(&feature_dir, &Outputs::load(&feature_dir)?.pipeline)?;
+
+    if let Some(target) = &selected_target {
+        config_helper::transaction(project_root, || {
+            config_helper::save_target(target, Some(feature), project_root)
+        })?;
+        let mut txn = store::Transaction::default();
+        txn.put(format!("{}build.target", store::CONFIG_PREFIX), target.as_str());
+        Store::open(&feature_dir)?.commit(txn)?;
+    }
+
+    Ok(stats)
+}
+
+/// The recorded compilation of every translation unit, keyed by its output path
+fn recorded_jobs(store: &Store, c_dir: &Path) -> HashMap<PathBuf, PreprocessJob> {
+    store
+        .scan(TU_PREFIX)
+        .into_iter()
+        .filter_map(|(key, value)| {
+            let tu = TuRecord::parse(value)?;
+            let output = c_dir.join(format!("{}2rust", key));
+            Some((
+                output.clone(),
+                PreprocessJob {
+                    cwd: tu.cwd,
+                    compiler: tu.compiler,
+                    source: tu.source,
+                    output,
+                },
+            ))
+        })
+        .collect()
+}
+
+/// Files offered for selection: the outputs of all recorded translation units and
+/// any other preprocessed file present, sorted like `collect_preprocessed_files`
+fn candidates(
+    jobs: &HashMap<PathBuf, PreprocessJob>,
+    present: &[PreprocessedFileInfo],
+    c_dir: &Path,
+) -> Vec<PreprocessedFileInfo> {
+    let mut files = present.to_vec();
+    let present_paths: HashSet<&PathBuf> = present.iter().map(|file| &file.path).collect();
+    for path in jobs.keys().filter(|path| !present_paths.contains(path)) {
+        if let Ok(relative) = path.strip_prefix(c_dir) {
+            files.push(PreprocessedFileInfo {
+                path: path.clone(),
+                display_name: relative.display().to_string(),
+            });
+        }
+    }
+    files.sort_by(|a, b| a.display_name.cmp(&b.display_name));
+    files
+}
+
+/// Preprocess a newly selected file from its recorded invocation and transform it.
+/// Returns the hash of the output before transforming.
+fn preprocess_added(project_root: &Path, job: &PreprocessJob, plugins: &[Plugin]) -> Result<u64> {
+    if let Some(parent) = job.output.parent() {
+        fs::create_dir_all(parent)?;
+    }
+    let result = job.run().and_then(|()| {
+        let hash = outputs::hash_file(&job.output)?;
+        transform::transform_in_place(project_root, &job.output, plugins)?;
+        Ok(hash)
+    });
+    if result.is_err() {
+        let _ = fs::remove_file(&job.output);
+    }
+    result
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::store::Transaction;
+    use tempfile::TempDir;
+
+    fn record_units(feature_dir: &Path, root: &Path, sources: &[&str]) {
+        let mut store = Store::open(feature_dir).unwrap();
+        let mut txn = Transaction::default();
+        let r = root.display();
+        for source in sources {
+            txn.put(
+                format!("{}src/{}", TU_PREFIX, source),
+                format!("{r}\tcc\t{r}/src/{source}\t"),
+            );
+        }
+        store.commit(txn).unwrap();
+    }
+
+    #[test]
+    fn test_candidates_include_dropped_units() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path();
+        let feature_dir = root.join(".c2rust").join("default");
+        let c_dir = feature_dir.join("c");
+        fs::create_dir_all(c_dir.join("src")).unwrap();
+        fs::write(c_dir.join("src").join("b.c2rust"), "int b;\n").unwrap();
+        record_units(&feature_dir, root, &["a.c", "b.c"]);
+
+        let store = Store::open(&feature_dir).unwrap();
+        let jobs = recorded_jobs(&store, &c_dir);
+        let job = &jobs[&c_dir.join("src").join("a.c2rust")];
+        assert_eq!(job.source, root.join("src").join("a.c"));
+        assert_eq!(job.compiler, "cc");
+
+        let present = file_selector::collect_preprocessed_files(&c_dir).unwrap();
+        let names: Vec<String> = candidates(&jobs, &present, &c_dir)
+            .into_iter()
+            .map(|file| file.display_name)
+            .collect();
+        assert_eq!(names, vec!["src/a.c2rust", "src/b.c2rust"]);
+    }
+
+    #[test]
+    fn test_run_preprocesses_only_added_files() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path().canonicalize().unwrap();
+        let feature_dir = root.join(".c2rust").join("default");
+        let c_dir = feature_dir.join("c");
+        fs::create_dir_all(root.join("src")).unwrap();
+        fs::create_dir_all(c_dir.join("src")).unwrap();
+        fs::write(root.join("src").join("a.c"), "int a;\n").unwrap();
+        fs::write(root.join("src").join("b.c"), "int b;\n").unwrap();
+        // b.c survived the previous selection; a kept file is not preprocessed again
+        fs::write(c_dir.join("src").join("b.c2rust"), "kept\n").unwrap();
+        record_units(&feature_dir, &root, &["a.c", "b.c"]);
+
+        let stats = run(&root, "default", true).unwrap();
+        assert_eq!(stats, SelectStats { added: 1, failed: 0, removed: 0 });
+        let a = fs::read_to_string(c_dir.join("src").join("a.c2rust")).unwrap();
+        assert!(a.contains("int a;"));
+        assert_eq!(
+            fs::read_to_string(c_dir.join("src").join("b.c2rust")).unwrap(),
+            "kept\n"
+        );
+
+        let store = Store::open(&feature_dir).unwrap();
+        assert_eq!(store.scan(SELECTED_PREFIX).len(), 2);
+        assert_eq!(store.scan(store::HASH_PREFIX).len(), 1);
+        let changes = fs::read_to_string(feature_dir.join(outputs::CHANGES_FILE)).unwrap();
+        assert!(changes.contains("A\tsrc/a.c\n"));
+    }
+}
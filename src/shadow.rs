@@ -0,0 +1,381 @@
+use crate::error::{Error, Result};
+use crate::outputs;
+use crate::parallel;
+use crate::store::{Store, Transaction, TU_PREFIX};
+use crate::transform::CACHE_DIR;
+use std::fs::{self, File, FileTimes};
+use std::io;
+use std::os::fd::AsRawFd;
+use std::path::{Path, PathBuf};
+
+/// Directory below `.c2rust/.cache` holding one shadow tree per feature
+const SHADOW_DIR: &str = "shadow";
+
+/// Build outputs left out of the shadow tree, so the tracked build compiles every
+/// translation unit while the developer's own objects stay untouched
+const OBJECT_EXTENSIONS: &[&str] = &["o", "obj", "lo"];
+
+/// Files in which CMake and autotools record the absolute paths a build directory
+/// was configured for
+const CONFIGURED_FILES: &[&str] = &["CMakeCache.txt", "config.status"];
+
+/// Outcome of cloning the project
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct CloneStats {
+    /// Files shared with the project through a reflink
+    pub reflinked: usize,
+    /// Files copied because the filesystem does not support reflinks
+    pub copied: usize,
+    /// Object files left out
+    pub skipped: usize,
+}
+
+/// A copy-on-write clone of the project in which the tracked build runs.
+///
+/// Files are cloned with FICLONE where the filesystem supports it (btrfs, XFS,
+/// bcachefs), which shares data blocks with the project, and copied otherwise.
+/// Modification times are preserved so the build tool sees the same up-to-date
+/// state, except for object files, which are left out. The tree is removed on drop.
+pub struct ShadowTree {
+    project_root: PathBuf,
+    root: PathBuf,
+}
+
+impl ShadowTree {
+    /// Clone `project_root` (canonical) into `.c2rust/.cache/shadow/<feature>`,
+    /// leaving out `.c2rust`, `.git` directories and object files
+    pub fn create(project_root: &Path, feature: &str) -> Result<(ShadowTree, CloneStats)> {
+        let root = project_root
+            .join(".c2rust")
+            .join(CACHE_DIR)
+            .join(SHADOW_DIR)
+            .join(feature.replace('%', "%25").replace('/', "%2F"));
+        if root.exists() {
+            // Left over from an interrupted run of this feature
+            fs::remove_dir_all(&root)?;
+        }
+        fs::create_dir_all(&root)?;
+        let shadow = ShadowTree {
+            project_root: project_root.to_path_buf(),
+            root,
+        };
+
+        let mut files = Vec::new();
+        let mut stats = CloneStats::default();
+        shadow.clone_dir(Path::new(""), &mut files, &mut stats)?;
+
+        let results = parallel::map(&files, parallel::default_jobs(), |relative| {
+            clone_file(&project_root.join(relative), &shadow.root.join(relative))
+        });
+        for result in results {
+            if result? {
+                stats.reflinked += 1;
+            } else {
+                stats.copied += 1;
+            }
+        }
+
+        Ok((shadow, stats))
+    }
+
+    /// Root of the shadow tree
+    pub fn root(&self) -> &Path {
+        &self.root
+    }
+
+    /// Map a directory of the project to the same directory in the shadow tree
+    pub fn map_dir(&self, dir: &Path) -> PathBuf {
+        match dir.strip_prefix(&self.project_root) {
+            Ok(relative) => self.root.join(relative),
+            Err(_) => dir.to_path_buf(),
+        }
+    }
+
+    /// Refuse a build directory configured by CMake or autotools for the real tree:
+    /// its cached absolute paths would still point there from the shadow tree, and
+    /// the tracked build would compile, and write to, the developer's tree
+    pub fn check_build_dir(project_root: &Path, build_dir: &Path) -> Result<()> {
+        let root = project_root.to_string_lossy();
+        for name in CONFIGURED_FILES {
+            let path = build_dir.join(name);
+            let content = match fs::read(&path) {
+                Ok(content) => content,
+                Err(e) if e.kind() == io::ErrorKind::NotFound => continue,
+                Err(e) => return Err(e.into()),
+            };
+            if find(&content, root.as_bytes()).is_some() {
+                return Err(Error::CommandExecutionFailed(format!(
+                    "{} records absolute paths of {}, which a shadow build would still use; \
+                     configure a build directory with relative paths or run without --shadow",
+                    path.display(),
+                    root
+                )));
+            }
+        }
+        Ok(())
+    }
+
+    /// Rewrite paths into the shadow tree recorded by libhook.so (compile
+    /// directories, sources, include paths) to the project root: the `tu/` records
+    /// in the store, `deferred.list` and the outputs themselves (`__FILE__`
+    /// expansions, line markers). Outputs keep their recorded hash, which is that of
+    /// the output as preprocessed, so unchanged outputs are still recognised by the
+    /// next shadow build. Returns the number of records rewritten.
+    pub fn remap_outputs(&self, store: &mut Store, feature_dir: &Path) -> Result<usize> {
+        let shadow_root = self.root.to_string_lossy().into_owned();
+        let project_root = self.project_root.to_string_lossy().into_owned();
+
+        let mut txn = Transaction::default();
+        let mut remapped = 0;
+        for (key, value) in store.scan(TU_PREFIX) {
+            let value = String::from_utf8_lossy(value);
+            if value.contains(shadow_root.as_str()) {
+                txn.put(
+                    format!("{}{}", TU_PREFIX, key),
+                    value.replace(shadow_root.as_str(), &project_root),
+                );
+                remapped += 1;
+            }
+        }
+        if !txn.is_empty() {
+            store.commit(txn)?;
+        }
+
+        let deferred = feature_dir.join("deferred.list");
+        match fs::read_to_string(&deferred) {
+            Ok(content) => fs::write(&deferred, content.replace(shadow_root.as_str(), &project_root))?,
+            Err(e) if e.kind() == io::ErrorKind::NotFound => {}
+            Err(e) => return Err(e.into()),
+        }
+
+        let c_dir = feature_dir.join("c");
+        let outputs: Vec<PathBuf> = store
+            .scan(TU_PREFIX)
+            .into_iter()
+            .map(|(key, _)| outputs::output_path(&c_dir, key))
+            .collect();
+        let results = parallel::map(&outputs, parallel::default_jobs(), |output| {
+            remap_file(output, shadow_root.as_bytes(), project_root.as_bytes())
+        });
+        for result in results {
+            result?;
+        }
+
+        Ok(remapped)
+    }
+
+    /// Create the directories and symlinks below `relative` and collect the files to clone
+    fn clone_dir(
+        &self,
+        relative: &Path,
+        files: &mut Vec<PathBuf>,
+        stats: &mut CloneStats,
+    ) -> Result<()> {
+        for entry in fs::read_dir(self.project_root.join(relative))? {
+            let entry = entry?;
+            let name = entry.file_name();
+            let path = relative.join(&name);
+            let file_type = entry.file_type()?;
+
+            if file_type.is_dir() {
+                if name == ".git" || (relative.as_os_str().is_empty() && name == ".c2rust") {
+                    continue;
+                }
+                fs::create_dir(self.root.join(&path))?;
+                self.clone_dir(&path, files, stats)?;
+            } else if file_type.is_symlink() {
+                // Relative links resolve inside the shadow tree; absolute ones keep
+                // pointing at their original target
+                std::os::unix::fs::symlink(fs::read_link(entry.path())?, self.root.join(&path))?;
+            } else if file_type.is_file() {
+                let is_object = Path::new(&name)
+                    .extension()
+                    .is_some_and(|ext| OBJECT_EXTENSIONS.iter().any(|o| ext == *o));
+                if is_object {
+                    stats.skipped += 1;
+                } else {
+                    files.push(path);
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+impl Drop for ShadowTree {
+    fn drop(&mut self) {
+        if let Err(e) = fs::remove_dir_all(&self.root) {
+            eprintln!(
+                "Warning: failed to remove shadow tree {}: {}",
+                self.root.display(),
+                e
+            );
+        }
+    }
+}
+
+/// Clone one file, preserving permissions and timestamps.
+/// Returns whether the data was shared through a reflink.
+fn clone_file(source: &Path, target: &Path) -> Result<bool> {
+    let mut input = File::open(source)?;
+    let meta = input.metadata()?;
+    let mut output = File::create(target)?;
+
+    let reflinked = unsafe { libc::ioctl(output.as_raw_fd(), libc::FICLONE, input.as_raw_fd()) } == 0;
+    if !reflinked {
+        io::copy(&mut input, &mut output)?;
+    }
+
+    output.set_permissions(meta.permissions())?;
+    output.set_times(
+        FileTimes::new()
+            .set_accessed(meta.accessed()?)
+            .set_modified(meta.modified()?),
+    )?;
+    Ok(reflinked)
+}
+
+/// Position of the first occurrence of `needle` in `data`
+fn find(data: &[u8], needle: &[u8]) -> Option<usize> {
+    data.windows(needle.len()).position(|window| window == needle)
+}
+
+/// Replace every occurrence of `from` in the file at `path` through a temporary
+/// file; a missing file or one without `from` is left alone
+fn remap_file(path: &Path, from: &[u8], to: &[u8]) -> Result<()> {
+    let data = match fs::read(path) {
+        Ok(data) => data,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e.into()),
+    };
+    let Some(mut pos) = find(&data, from) else {
+        return Ok(());
+    };
+    let mut remapped = Vec::with_capacity(data.len());
+    let mut rest = &data[..];
+    loop {
+        remapped.extend_from_slice(&rest[..pos]);
+        remapped.extend_from_slice(to);
+        rest = &rest[pos + from.len()..];
+        match find(rest, from) {
+            Some(next) => pos = next,
+            None => break,
+        }
+    }
+    remapped.extend_from_slice(rest);
+
+    let mut tmp = path.as_os_str().to_owned();
+    tmp.push(".remap");
+    let tmp = PathBuf::from(tmp);
+    fs::write(&tmp, remapped)?;
+    fs::rename(&tmp, path)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::{Duration, SystemTime};
+    use tempfile::TempDir;
+
+    fn setup() -> (TempDir, PathBuf) {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path().canonicalize().unwrap();
+        fs::create_dir_all(root.join("src")).unwrap();
+        fs::create_dir_all(root.join(".git")).unwrap();
+        fs::create_dir_all(root.join(".c2rust").join("default")).unwrap();
+        fs::write(root.join("Makefile"), "all:\n").unwrap();
+        fs::write(root.join("src").join("a.c"), "int a;\n").unwrap();
+        fs::write(root.join("src").join("a.o"), "object").unwrap();
+        fs::write(root.join(".git").join("HEAD"), "ref").unwrap();
+        std::os::unix::fs::symlink("a.c", root.join("src").join("link.c")).unwrap();
+        (temp_dir, root)
+    }
+
+    #[test]
+    fn test_create_clones_sources_without_objects() {
+        let (_temp_dir, root) = setup();
+        let old = SystemTime::UNIX_EPOCH + Duration::from_secs(1_000_000);
+        File::options()
+            .write(true)
+            .open(root.join("src").join("a.c"))
+            .unwrap()
+            .set_modified(old)
+            .unwrap();
+
+        let (shadow, stats) = ShadowTree::create(&root, "arm/debug").unwrap();
+        let shadow_root = shadow.root().to_path_buf();
+        assert!(shadow_root.starts_with(root.join(".c2rust").join(CACHE_DIR)));
+        assert_eq!(stats.reflinked + stats.copied, 2);
+        assert_eq!(stats.skipped, 1);
+
+        let a = shadow_root.join("src").join("a.c");
+        assert_eq!(fs::read_to_string(&a).unwrap(), "int a;\n");
+        assert_eq!(fs::metadata(&a).unwrap().modified().unwrap(), old);
+        assert!(!shadow_root.join("src").join("a.o").exists());
+        assert!(!shadow_root.join(".git").exists());
+        assert!(!shadow_root.join(".c2rust").exists());
+        assert_eq!(
+            fs::read_link(shadow_root.join("src").join("link.c")).unwrap(),
+            Path::new("a.c")
+        );
+        assert_eq!(shadow.map_dir(&root.join("src")), shadow_root.join("src"));
+
+        drop(shadow);
+        assert!(!shadow_root.exists());
+        // The project itself is untouched
+        assert!(root.join("src").join("a.o").exists());
+    }
+
+    #[test]
+    fn test_check_build_dir() {
+        let (_temp_dir, root) = setup();
+        let build_dir = root.join("build");
+        fs::create_dir_all(&build_dir).unwrap();
+        assert!(ShadowTree::check_build_dir(&root, &build_dir).is_ok());
+        fs::write(
+            build_dir.join("CMakeCache.txt"),
+            format!("CMAKE_HOME_DIRECTORY:INTERNAL={}\n", root.display()),
+        )
+        .unwrap();
+        assert!(ShadowTree::check_build_dir(&root, &build_dir).is_err());
+    }
+
+    #[test]
+    fn test_remap_outputs() {
+        let (_temp_dir, root) = setup();
+        let feature_dir = root.join(".c2rust").join("default");
+        let (shadow, _) = ShadowTree::create(&root, "default").unwrap();
+        let s = shadow.root().display().to_string();
+        let r = root.display().to_string();
+
+        let mut store = Store::open(&feature_dir).unwrap();
+        let mut txn = Transaction::default();
+        txn.put(
+            "tu/src/a.c",
+            format!("{s}/src\tgcc\t{s}/src/a.c\t\"-I{s}/include\" \"-DX=1\" "),
+        );
+        store.commit(txn).unwrap();
+        fs::write(
+            feature_dir.join("deferred.list"),
+            format!("{s}/src\tgcc\t{s}/src/a.c\t{}/c/src/a.c2rust\n", feature_dir.display()),
+        )
+        .unwrap();
+        let output = feature_dir.join("c").join("src").join("a.c2rust");
+        fs::create_dir_all(output.parent().unwrap()).unwrap();
+        fs::write(&output, format!("const char* f = \"{s}/src/a.c\";\n# 1 \"{s}/src/a.h\"\n")).unwrap();
+
+        assert_eq!(shadow.remap_outputs(&mut store, &feature_dir).unwrap(), 1);
+        assert_eq!(
+            fs::read_to_string(&output).unwrap(),
+            format!("const char* f = \"{r}/src/a.c\";\n# 1 \"{r}/src/a.h\"\n")
+        );
+        assert_eq!(
+            store.scan(TU_PREFIX)[0].1,
+            format!("{r}/src\tgcc\t{r}/src/a.c\t\"-I{r}/include\" \"-DX=1\" ").as_bytes()
+        );
+        assert!(fs::read_to_string(feature_dir.join("deferred.list"))
+            .unwrap()
+            .starts_with(&format!("{r}/src\tgcc\t{r}/src/a.c\t")));
+    }
+}
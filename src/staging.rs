@@ -0,0 +1,334 @@
+use crate::error::Result;
+use crate::events::EventSink;
+use crate::outputs;
+use crate::priority::Priority;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::Duration;
+
+/// Default staging base directory
+pub const DEFAULT_STAGING_DIR: &str = "/dev/shm";
+/// Default memory cap of the staging area in MiB
+pub const DEFAULT_STAGING_CAP_MB: u64 = 1024;
+
+/// Marker telling libhook.so to write directly to the feature directory
+const FULL_MARKER: &str = "FULL";
+/// Suffix of outputs libhook.so is still writing
+const PARTIAL_SUFFIX: &str = ".part";
+const DRAIN_INTERVAL: Duration = Duration::from_millis(200);
+
+/// Totals of a staged build
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct DrainStats {
+    pub files: usize,
+    pub bytes: u64,
+    /// Largest backlog seen in the staging area, in bytes
+    pub peak_bytes: u64,
+    /// Times the cap was reached and hooked processes fell back to direct writes
+    pub cap_reached: usize,
+}
+
+/// A staging area on tmpfs that hooked processes write their preprocessed outputs to.
+///
+/// libhook.so writes `<dir>/c/<path>.c2rust.part` and renames it once complete.
+/// A drainer thread moves completed outputs to the feature directory in batches,
+/// off the build's critical path. When the backlog exceeds the cap it creates
+/// `<dir>/FULL`, and the hook writes directly to the feature directory until the
+/// backlog has drained below three quarters of the cap. A pass that fails to move
+/// outputs creates the marker as well; the drainer keeps retrying.
+pub struct Staging {
+    dir: PathBuf,
+    stop: Arc<AtomicBool>,
+    drainer: Option<JoinHandle<Result<DrainStats>>>,
+}
+
+impl Staging {
+    /// Create the staging area and start the drainer, which runs under `priority`
+    /// like the preprocessing that fills the area and publishes each output it
+    /// moves to `events`
+    pub fn start(
+        base: &Path,
+        feature: &str,
+        feature_dir: &Path,
+        cap_bytes: u64,
+        priority: &Priority,
+        events: Option<EventSink>,
+    ) -> Result<Staging> {
+        let dir = base.join(format!(
+            "c2rust-{}-{}",
+            std::process::id(),
+            feature.replace('/', "-")
+        ));
+        fs::create_dir_all(dir.join("c"))?;
+
+        let stop = Arc::new(AtomicBool::new(false));
+        let drainer = {
+            let dir = dir.clone();
+            let feature_dir = feature_dir.to_path_buf();
+            let stop = Arc::clone(&stop);
+            let priority = priority.clone();
+            std::thread::spawn(move || {
+                if let Err(e) = priority.apply_to_current_thread() {
+                    eprintln!("Warning: Failed to lower the staging drainer's priority: {}", e);
+                }
+                let mut stats = DrainStats::default();
+                let mut full = false;
+                let mut failing = false;
+                while !stop.load(Ordering::Relaxed) {
+                    let result =
+                        drain(&dir, &feature_dir, cap_bytes, events.as_ref(), &mut full, &mut stats);
+                    if let Err(e) = result {
+                        // Keep draining, but send libhook.so to the feature directory
+                        // until a pass succeeds, so tmpfs cannot fill up meanwhile
+                        if !failing {
+                            eprintln!("Warning: Failed to drain the staging area: {}", e);
+                        }
+                        failing = true;
+                        if !full && fs::write(dir.join(FULL_MARKER), "").is_ok() {
+                            full = true;
+                        }
+                    } else {
+                        failing = false;
+                    }
+                    std::thread::sleep(DRAIN_INTERVAL);
+                }
+                drain(&dir, &feature_dir, cap_bytes, events.as_ref(), &mut full, &mut stats)?;
+                Ok(stats)
+            })
+        };
+
+        Ok(Staging {
+            dir,
+            stop,
+            drainer: Some(drainer),
+        })
+    }
+
+    /// Directory passed to libhook.so in C2RUST_STAGING_DIR
+    pub fn dir(&self) -> &Path {
+        &self.dir
+    }
+
+    /// Stop the drainer after moving everything that is left, and remove the staging area.
+    /// Must be called once no hooked process is running anymore.
+    pub fn finish(mut self) -> Result<DrainStats> {
+        self.stop.store(true, Ordering::Relaxed);
+        let stats = match self.drainer.take().map(|drainer| drainer.join()) {
+            Some(Ok(result)) => result,
+            Some(Err(_)) => Err(crate::error::Error::CommandExecutionFailed(
+                "staging drainer panicked".to_string(),
+            )),
+            None => Ok(DrainStats::default()),
+        };
+        fs::remove_dir_all(&self.dir)?;
+        stats
+    }
+}
+
+impl Drop for Staging {
+    fn drop(&mut self) {
+        if self.drainer.is_some() {
+            self.stop.store(true, Ordering::Relaxed);
+            let _ = fs::remove_dir_all(&self.dir);
+        }
+    }
+}
+
+/// One pass of the drainer: move every completed output and update the cap marker
+fn drain(
+    dir: &Path,
+    feature_dir: &Path,
+    cap_bytes: u64,
+    events: Option<&EventSink>,
+    full: &mut bool,
+    stats: &mut DrainStats,
+) -> Result<()> {
+    let mut completed = Vec::new();
+    let mut backlog = 0;
+    collect(&dir.join("c"), Path::new(""), &mut completed, &mut backlog)?;
+    stats.peak_bytes = stats.peak_bytes.max(backlog);
+
+    let marker = dir.join(FULL_MARKER);
+    if !*full && backlog > cap_bytes {
+        fs::write(&marker, "")?;
+        *full = true;
+        stats.cap_reached += 1;
+    }
+
+    for (relative, size) in completed {
+        let source = dir.join("c").join(&relative);
+        let target = feature_dir.join("c").join(&relative);
+        if let Some(parent) = target.parent() {
+            fs::create_dir_all(parent)?;
+        }
+        // tmpfs is a different filesystem, so this is usually a copy
+        if fs::rename(&source, &target).is_err() {
+            fs::copy(&source, &target)?;
+            fs::remove_file(&source)?;
+        }
+        if let Some(events) = events {
+            publish(events, feature_dir, &target);
+        }
+        stats.files += 1;
+        stats.bytes += size;
+        backlog -= size;
+    }
+
+    if *full && backlog < cap_bytes / 4 * 3 {
+        let _ = fs::remove_file(&marker);
+        *full = false;
+    }
+    Ok(())
+}
+
+/// The output is in place in the feature directory: hand it to consumers. Best
+/// effort like the events themselves; the drainer keeps moving outputs.
+fn publish(events: &EventSink, feature_dir: &Path, target: &Path) {
+    let c_dir = feature_dir.join("c");
+    if let Some(key) = outputs::output_key(&c_dir, target) {
+        match outputs::hash_file(target) {
+            Ok(hash) => events.tu(feature_dir, &key, target, hash),
+            Err(e) => eprintln!(
+                "Warning: Failed to publish event for {}: {}",
+                target.display(),
+                e
+            ),
+        }
+    }
+}
+
+/// Collect completed outputs below `dir`; `backlog` also counts partial outputs
+fn collect(
+    dir: &Path,
+    relative: &Path,
+    completed: &mut Vec<(PathBuf, u64)>,
+    backlog: &mut u64,
+) -> Result<()> {
+    let entries = match fs::read_dir(dir) {
+        Ok(entries) => entries,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e.into()),
+    };
+    for entry in entries {
+        let entry = entry?;
+        let file_type = entry.file_type()?;
+        let relative = relative.join(entry.file_name());
+        if file_type.is_dir() {
+            collect(&entry.path(), &relative, completed, backlog)?;
+        } else if file_type.is_file() {
+            // The file may be moved by a concurrent rename; skip it this pass
+            let Ok(meta) = entry.metadata() else {
+                continue;
+            };
+            *backlog += meta.len();
+            if !entry.file_name().to_string_lossy().ends_with(PARTIAL_SUFFIX) {
+                completed.push((relative, meta.len()));
+            }
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_drain_moves_completed_outputs() {
+        let temp_dir = TempDir::new().unwrap();
+        let staging = temp_dir.path().join("staging");
+        let feature_dir = temp_dir.path().join("feature");
+        fs::create_dir_all(staging.join("c").join("src")).unwrap();
+        fs::write(staging.join("c").join("src").join("a.c2rust"), "int a;\n").unwrap();
+        fs::write(staging.join("c").join("src").join("b.c2rust.part"), "int").unwrap();
+
+        let mut full = false;
+        let mut stats = DrainStats::default();
+        drain(&staging, &feature_dir, 1 << 20, None, &mut full, &mut stats).unwrap();
+
+        assert_eq!(
+            fs::read_to_string(feature_dir.join("c").join("src").join("a.c2rust")).unwrap(),
+            "int a;\n"
+        );
+        assert!(!staging.join("c").join("src").join("a.c2rust").exists());
+        assert!(staging.join("c").join("src").join("b.c2rust.part").exists());
+        assert_eq!(stats.files, 1);
+        assert_eq!(stats.bytes, 7);
+    }
+
+    #[test]
+    fn test_cap_marker_hysteresis() {
+        let temp_dir = TempDir::new().unwrap();
+        let staging = temp_dir.path().join("staging");
+        let feature_dir = temp_dir.path().join("feature");
+        fs::create_dir_all(staging.join("c")).unwrap();
+        fs::write(staging.join("c").join("big.c2rust.part"), vec![b'x'; 100]).unwrap();
+
+        let mut full = false;
+        let mut stats = DrainStats::default();
+        drain(&staging, &feature_dir, 64, None, &mut full, &mut stats).unwrap();
+        assert!(full);
+        assert!(staging.join(FULL_MARKER).exists());
+        assert_eq!(stats.cap_reached, 1);
+
+        // The in-flight output completes and is drained: the marker goes away
+        fs::rename(
+            staging.join("c").join("big.c2rust.part"),
+            staging.join("c").join("big.c2rust"),
+        )
+        .unwrap();
+        drain(&staging, &feature_dir, 64, None, &mut full, &mut stats).unwrap();
+        assert!(!full);
+        assert!(!staging.join(FULL_MARKER).exists());
+    }
+
+    #[test]
+    fn test_drain_failure_sends_hook_to_feature_directory() {
+        let temp_dir = TempDir::new().unwrap();
+        // Outputs cannot be moved: the feature's c/ is a file
+        let feature_dir = temp_dir.path().join("feature");
+        fs::create_dir_all(&feature_dir).unwrap();
+        fs::write(feature_dir.join("c"), "").unwrap();
+        let staging = Staging::start(
+            temp_dir.path(),
+            "default",
+            &feature_dir,
+            1 << 20,
+            &Priority::default(),
+            None,
+        )
+        .unwrap();
+        let dir = staging.dir().to_path_buf();
+        fs::create_dir_all(dir.join("c").join("src")).unwrap();
+        fs::write(dir.join("c").join("src").join("a.c2rust"), "int a;\n").unwrap();
+
+        std::thread::sleep(DRAIN_INTERVAL * 3);
+        assert!(dir.join(FULL_MARKER).exists());
+        assert!(staging.finish().is_err());
+    }
+
+    #[test]
+    fn test_finish_drains_and_removes_staging() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path().join("feature");
+        let staging = Staging::start(
+            temp_dir.path(),
+            "arm/debug",
+            &feature_dir,
+            1 << 20,
+            &Priority::default(),
+            None,
+        ).unwrap();
+        let dir = staging.dir().to_path_buf();
+        fs::write(dir.join("c").join("late.c2rust"), "int late;\n").unwrap();
+
+        let stats = staging.finish().unwrap();
+        assert_eq!(stats.files, 1);
+        assert!(feature_dir.join("c").join("late.c2rust").exists());
+        assert!(!dir.exists());
+    }
+}
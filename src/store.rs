@@ -0,0 +1,572 @@
+use crate::error::Result;
+use crate::lock;
+use std::collections::BTreeMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::Write;
+use std::os::unix::fs::{FileExt, MetadataExt};
+use std::path::{Path, PathBuf};
+
+/// Transaction log holding the feature state, below `.c2rust/<feature>/`
+pub const STORE_FILE: &str = "state.log";
+
+/// Link outputs recorded by libhook.so, value is empty
+pub const TARGET_PREFIX: &str = "target/";
+/// Compiled translation units recorded by libhook.so, keyed by source path relative
+/// to the project root; value is `cwd \t compiler \t source \t options`
+pub const TU_PREFIX: &str = "tu/";
+/// Files each translation unit includes, recorded by `c2rust-build watch`; keyed
+/// like `tu/`, value is one absolute path per line
+pub const DEPS_PREFIX: &str = "deps/";
+/// Hash of each translation unit's preprocessed output before transform plugins,
+/// recorded by libhook.so (or c2rust-build when it preprocesses); keyed like `tu/`,
+/// value is 16 hex digits
+pub const HASH_PREFIX: &str = "hash/";
+/// Files selected for translation, value is empty
+pub const SELECTED_PREFIX: &str = "selected/";
+/// Values written to c2rust-config for this feature
+pub const CONFIG_PREFIX: &str = "config/";
+
+// Record layout (little endian), shared with hook/hook.c:
+//   magic u32 | payload length u32 | crc32(payload) u32 | payload
+// The payload is a sequence of operations:
+//   op u8 | key length u32 | key | value length u32 | value
+const RECORD_MAGIC: u32 = 0x5352_3243; // "C2RS"
+const HEADER_LEN: usize = 12;
+const OP_PUT: u8 = 1;
+const OP_DELETE: u8 = 2;
+
+#[derive(Debug, Clone)]
+struct Value {
+    data: Vec<u8>,
+    /// Order of the last write, so exports keep the order things were recorded in
+    seq: u64,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+enum Op {
+    Put(String, Vec<u8>),
+    Delete(String),
+}
+
+/// A group of writes committed atomically
+#[derive(Debug, Default)]
+pub struct Transaction {
+    ops: Vec<Op>,
+}
+
+impl Transaction {
+    pub fn put(&mut self, key: impl Into<String>, value: impl Into<Vec<u8>>) -> &mut Self {
+        self.ops.push(Op::Put(key.into(), value.into()));
+        self
+    }
+
+    pub fn delete(&mut self, key: impl Into<String>) -> &mut Self {
+        self.ops.push(Op::Delete(key.into()));
+        self
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.ops.is_empty()
+    }
+}
+
+/// Embedded key-value store for the state of one feature.
+///
+/// The store is an append-only log of checksummed transaction records. Writers (the
+/// driver and every hooked compiler or linker) append whole records while holding an
+/// exclusive flock on the log; readers take no lock and replay every complete record.
+/// A record torn by a writer that was killed or ran out of space is skipped: readers
+/// resynchronize at the next record with a valid magic and checksum, so records
+/// hooked processes appended after it stay visible. An incomplete record at the end
+/// (one still being written) is read again on the next refresh.
+#[derive(Debug)]
+pub struct Store {
+    path: PathBuf,
+    entries: BTreeMap<String, Value>,
+    next_seq: u64,
+    /// End of the last valid record replayed
+    valid_len: u64,
+    /// Inode of the replayed log, to notice compaction by another process
+    ino: u64,
+}
+
+impl Store {
+    /// Open the store of a feature and replay its log; a missing log is an empty store
+    pub fn open(feature_dir: &Path) -> Result<Store> {
+        let mut store = Store {
+            path: feature_dir.join(STORE_FILE),
+            entries: BTreeMap::new(),
+            next_seq: 0,
+            valid_len: 0,
+            ino: 0,
+        };
+        store.refresh()?;
+        Ok(store)
+    }
+
+    /// Replay transactions committed since the last read
+    pub fn refresh(&mut self) -> Result<()> {
+        match File::open(&self.path) {
+            Ok(file) => self.replay(&file),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => Ok(()),
+            Err(e) => Err(e.into()),
+        }
+    }
+
+    pub fn get(&self, key: &str) -> Option<&[u8]> {
+        self.entries.get(key).map(|v| v.data.as_slice())
+    }
+
+    /// Entries whose key starts with `prefix`, in the order they were written.
+    /// Keys are returned without the prefix.
+    pub fn scan(&self, prefix: &str) -> Vec<(&str, &[u8])> {
+        let mut found: Vec<(&str, &Value)> = self
+            .entries
+            .range(prefix.to_string()..)
+            .take_while(|(key, _)| key.starts_with(prefix))
+            .map(|(key, value)| (&key[prefix.len()..], value))
+            .collect();
+        found.sort_by_key(|(_, value)| value.seq);
+        found
+            .into_iter()
+            .map(|(key, value)| (key, value.data.as_slice()))
+            .collect()
+    }
+
+    /// Append `txn` as one record. Transactions committed by other processes since
+    /// the last read are replayed first.
+    pub fn commit(&mut self, txn: Transaction) -> Result<()> {
+        if txn.is_empty() {
+            return Ok(());
+        }
+
+        let file = self.open_locked()?;
+        self.replay(&file)?;
+
+        // Only garbage follows the last valid record: a torn tail, which the lock
+        // guarantees no writer is still completing
+        if file.metadata()?.len() > self.valid_len {
+            eprintln!(
+                "Warning: discarding incomplete record at the end of {}",
+                self.path.display()
+            );
+            file.set_len(self.valid_len)?;
+        }
+
+        let record = encode_record(&txn.ops);
+        (&file).write_all(&record)?;
+        file.sync_data()?;
+
+        self.valid_len += record.len() as u64;
+        self.apply(txn.ops);
+        Ok(())
+    }
+
+    /// Rewrite the log as a single record holding the current state
+    pub fn compact(&mut self) -> Result<()> {
+        let file = self.open_locked()?;
+        self.replay(&file)?;
+
+        let mut live: Vec<(&String, &Value)> = self.entries.iter().collect();
+        live.sort_by_key(|(_, value)| value.seq);
+        let ops: Vec<Op> = live
+            .into_iter()
+            .map(|(key, value)| Op::Put(key.clone(), value.data.clone()))
+            .collect();
+
+        let tmp_path = self.path.with_extension("log.tmp");
+        let mut tmp = File::create(&tmp_path)?;
+        let record = if ops.is_empty() {
+            Vec::new()
+        } else {
+            encode_record(&ops)
+        };
+        tmp.write_all(&record)?;
+        tmp.sync_all()?;
+        fs::rename(&tmp_path, &self.path)?;
+
+        // Writers waiting on the old log notice the inode change and reopen
+        drop(file);
+        self.entries.clear();
+        self.next_seq = 0;
+        self.valid_len = 0;
+        self.ino = 0;
+        self.refresh()
+    }
+
+    /// Regenerate the legacy per-feature files from the store:
+    /// `c/targets.list`, the `.c2rust.opts` file of every translation unit and
+    /// `selected_files.json` (once a selection has been made).
+    pub fn export_legacy(&self, feature_dir: &Path) -> Result<()> {
+        let c_dir = feature_dir.join("c");
+
+        let targets = self.scan(TARGET_PREFIX);
+        if !targets.is_empty() {
+            fs::create_dir_all(&c_dir)?;
+            let content: String = targets
+                .iter()
+                .map(|(target, _)| format!("{}\n", target))
+                .collect();
+            fs::write(c_dir.join("targets.list"), content)?;
+        }
+
+        for (source, value) in self.scan(TU_PREFIX) {
+            let Some(tu) = TuRecord::parse(value) else {
+                eprintln!("Warning: malformed translation unit record for {}", source);
+                continue;
+            };
+            let opts_path = c_dir.join(format!("{}2rust.opts", source));
+            if let Some(parent) = opts_path.parent() {
+                fs::create_dir_all(parent)?;
+            }
+            fs::write(opts_path, tu.options)?;
+        }
+
+        if self.entries.keys().any(|k| k.starts_with(SELECTED_PREFIX)) {
+            self.export_selected_files(feature_dir)?;
+        }
+
+        Ok(())
+    }
+
+    /// Write `selected_files.json` from the `selected/` entries
+    pub fn export_selected_files(&self, feature_dir: &Path) -> Result<()> {
+        let selected: Vec<&str> = self
+            .scan(SELECTED_PREFIX)
+            .into_iter()
+            .map(|(path, _)| path)
+            .collect();
+        fs::create_dir_all(feature_dir)?;
+        let json = serde_json::to_string_pretty(&selected)?;
+        fs::write(feature_dir.join("selected_files.json"), json)?;
+        Ok(())
+    }
+
+    /// Open the log for appending and take the writer lock. Retries if the log was
+    /// replaced by a compaction while waiting for the lock.
+    fn open_locked(&self) -> Result<File> {
+        loop {
+            let file = OpenOptions::new()
+                .create(true)
+                .append(true)
+                .read(true)
+                .open(&self.path)?;
+            lock::flock(&file, libc::LOCK_EX, &self.path)?;
+
+            match fs::metadata(&self.path) {
+                Ok(meta) if meta.ino() == file.metadata()?.ino() => return Ok(file),
+                Ok(_) => continue,
+                Err(e) if e.kind() == std::io::ErrorKind::NotFound => continue,
+                Err(e) => return Err(e.into()),
+            }
+        }
+    }
+
+    fn replay(&mut self, file: &File) -> Result<()> {
+        let meta = file.metadata()?;
+        if meta.ino() != self.ino {
+            self.entries.clear();
+            self.next_seq = 0;
+            self.valid_len = 0;
+            self.ino = meta.ino();
+        }
+        if meta.len() <= self.valid_len {
+            return Ok(());
+        }
+
+        let mut data = vec![0u8; (meta.len() - self.valid_len) as usize];
+        file.read_exact_at(&mut data, self.valid_len)?;
+
+        let mut pos = 0;
+        let mut end = 0;
+        while pos < data.len() {
+            if let Some((ops, len)) = decode_record(&data[pos..]) {
+                self.apply(ops);
+                pos += len;
+                end = pos;
+                continue;
+            }
+            let Some(next) = find_record(&data[pos + 1..]) else {
+                break;
+            };
+            eprintln!(
+                "Warning: skipping {} corrupt byte(s) in {}",
+                next + 1,
+                self.path.display()
+            );
+            pos += next + 1;
+        }
+        self.valid_len += end as u64;
+        Ok(())
+    }
+
+    fn apply(&mut self, ops: Vec<Op>) {
+        for op in ops {
+            match op {
+                Op::Put(key, data) => {
+                    let seq = self.next_seq;
+                    self.next_seq += 1;
+                    self.entries.insert(key, Value { data, seq });
+                }
+                Op::Delete(key) => {
+                    self.entries.remove(&key);
+                }
+            }
+        }
+    }
+}
+
+/// A compiled translation unit as recorded by libhook.so
+#[derive(Debug, Clone, PartialEq)]
+pub struct TuRecord {
+    pub cwd: PathBuf,
+    pub compiler: String,
+    pub source: PathBuf,
+    /// Preprocessing options in the `.opts` format: `"-Ia" "-DB" `
+    pub options: String,
+}
+
+impl TuRecord {
+    pub fn parse(value: &[u8]) -> Option<TuRecord> {
+        let value = std::str::from_utf8(value).ok()?;
+        let mut fields = value.splitn(4, '\t');
+        Some(TuRecord {
+            cwd: PathBuf::from(fields.next()?),
+            compiler: fields.next()?.to_string(),
+            source: PathBuf::from(fields.next()?),
+            options: fields.next()?.to_string(),
+        })
+    }
+}
+
+fn encode_record(ops: &[Op]) -> Vec<u8> {
+    let mut payload = Vec::new();
+    for op in ops {
+        let (code, key, value) = match op {
+            Op::Put(key, value) => (OP_PUT, key, value.as_slice()),
+            Op::Delete(key) => (OP_DELETE, key, &[][..]),
+        };
+        payload.push(code);
+        payload.extend_from_slice(&(key.len() as u32).to_le_bytes());
+        payload.extend_from_slice(key.as_bytes());
+        payload.extend_from_slice(&(value.len() as u32).to_le_bytes());
+        payload.extend_from_slice(value);
+    }
+
+    let mut record = Vec::with_capacity(HEADER_LEN + payload.len());
+    record.extend_from_slice(&RECORD_MAGIC.to_le_bytes());
+    record.extend_from_slice(&(payload.len() as u32).to_le_bytes());
+    record.extend_from_slice(&crc32fast::hash(&payload).to_le_bytes());
+    record.extend_from_slice(&payload);
+    record
+}
+
+/// Decode the record at the start of `data`; `None` if it is incomplete or corrupt
+fn decode_record(data: &[u8]) -> Option<(Vec<Op>, usize)> {
+    let header = data.get(..HEADER_LEN)?;
+    let u32_at = |bytes: &[u8], at: usize| -> Option<u32> {
+        Some(u32::from_le_bytes(bytes.get(at..at + 4)?.try_into().ok()?))
+    };
+    if u32_at(header, 0)? != RECORD_MAGIC {
+        return None;
+    }
+    let len = u32_at(header, 4)? as usize;
+    let payload = data.get(HEADER_LEN..HEADER_LEN + len)?;
+    if crc32fast::hash(payload) != u32_at(header, 8)? {
+        return None;
+    }
+
+    let mut ops = Vec::new();
+    let mut pos = 0;
+    while pos < payload.len() {
+        let code = payload[pos];
+        let key_len = u32_at(payload, pos + 1)? as usize;
+        let key = payload.get(pos + 5..pos + 5 + key_len)?;
+        pos += 5 + key_len;
+        let value_len = u32_at(payload, pos)? as usize;
+        let value = payload.get(pos + 4..pos + 4 + value_len)?;
+        pos += 4 + value_len;
+
+        let key = String::from_utf8(key.to_vec()).ok()?;
+        ops.push(match code {
+            OP_PUT => Op::Put(key, value.to_vec()),
+            OP_DELETE => Op::Delete(key),
+            _ => return None,
+        });
+    }
+    Some((ops, HEADER_LEN + len))
+}
+
+/// Offset of the first complete, valid record in `data`
+fn find_record(data: &[u8]) -> Option<usize> {
+    let magic = RECORD_MAGIC.to_le_bytes();
+    data.windows(magic.len())
+        .enumerate()
+        .filter(|(_, window)| *window == magic)
+        .map(|(at, _)| at)
+        .find(|&at| decode_record(&data[at..]).is_some())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    #[test]
+    fn test_commit_and_reopen() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut store = Store::open(temp_dir.path()).unwrap();
+        assert!(store.get("a").is_none());
+
+        let mut txn = Transaction::default();
+        txn.put("a", "1").put("b", "2").delete("b");
+        store.commit(txn).unwrap();
+
+        let reopened = Store::open(temp_dir.path()).unwrap();
+        assert_eq!(reopened.get("a"), Some(&b"1"[..]));
+        assert!(reopened.get("b").is_none());
+    }
+
+    #[test]
+    fn test_scan_keeps_write_order() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut store = Store::open(temp_dir.path()).unwrap();
+        let mut txn = Transaction::default();
+        txn.put("target/zlib", "").put("target/app", "").put("tu/x.c", "");
+        store.commit(txn).unwrap();
+
+        let targets: Vec<&str> = store.scan(TARGET_PREFIX).into_iter().map(|(k, _)| k).collect();
+        assert_eq!(targets, vec!["zlib", "app"]);
+    }
+
+    #[test]
+    fn test_sees_commits_from_other_writers() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut first = Store::open(temp_dir.path()).unwrap();
+        let mut second = Store::open(temp_dir.path()).unwrap();
+
+        let mut txn = Transaction::default();
+        txn.put("a", "1");
+        first.commit(txn).unwrap();
+        let mut txn = Transaction::default();
+        txn.put("b", "2");
+        second.commit(txn).unwrap();
+
+        assert_eq!(second.get("a"), Some(&b"1"[..]));
+        first.refresh().unwrap();
+        assert_eq!(first.get("b"), Some(&b"2"[..]));
+    }
+
+    #[test]
+    fn test_torn_tail_is_ignored_and_truncated() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut store = Store::open(temp_dir.path()).unwrap();
+        let mut txn = Transaction::default();
+        txn.put("a", "1");
+        store.commit(txn).unwrap();
+
+        // Simulate a writer killed halfway through its record
+        let log = temp_dir.path().join(STORE_FILE);
+        let torn = encode_record(&[Op::Put("b".to_string(), b"2".to_vec())]);
+        let mut file = OpenOptions::new().append(true).open(&log).unwrap();
+        file.write_all(&torn[..torn.len() - 1]).unwrap();
+
+        let mut reader = Store::open(temp_dir.path()).unwrap();
+        assert!(reader.get("b").is_none());
+
+        let mut txn = Transaction::default();
+        txn.put("c", "3");
+        reader.commit(txn).unwrap();
+        let reopened = Store::open(temp_dir.path()).unwrap();
+        assert_eq!(reopened.get("a"), Some(&b"1"[..]));
+        assert_eq!(reopened.get("c"), Some(&b"3"[..]));
+    }
+
+    #[test]
+    fn test_records_after_torn_record_survive() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut store = Store::open(temp_dir.path()).unwrap();
+        let mut txn = Transaction::default();
+        txn.put("a", "1");
+        store.commit(txn).unwrap();
+
+        // A writer killed mid-record, then a hooked process appending after it
+        let log = temp_dir.path().join(STORE_FILE);
+        let torn = encode_record(&[Op::Put("b".to_string(), b"2".to_vec())]);
+        let appended = encode_record(&[Op::Put("tu/c.c".to_string(), b"3".to_vec())]);
+        let mut file = OpenOptions::new().append(true).open(&log).unwrap();
+        file.write_all(&torn[..torn.len() - 1]).unwrap();
+        file.write_all(&appended).unwrap();
+
+        store.refresh().unwrap();
+        assert!(store.get("b").is_none());
+        assert_eq!(store.get("tu/c.c"), Some(&b"3"[..]));
+
+        let mut txn = Transaction::default();
+        txn.put("d", "4");
+        store.commit(txn).unwrap();
+        let reopened = Store::open(temp_dir.path()).unwrap();
+        assert_eq!(reopened.get("a"), Some(&b"1"[..]));
+        assert_eq!(reopened.get("tu/c.c"), Some(&b"3"[..]));
+        assert_eq!(reopened.get("d"), Some(&b"4"[..]));
+    }
+
+    #[test]
+    fn test_compact_preserves_state() {
+        let temp_dir = TempDir::new().unwrap();
+        let mut store = Store::open(temp_dir.path()).unwrap();
+        for i in 0..10 {
+            let mut txn = Transaction::default();
+            txn.put("k", i.to_string()).put(format!("n{}", i), "");
+            store.commit(txn).unwrap();
+        }
+        let log = temp_dir.path().join(STORE_FILE);
+        let before = fs::metadata(&log).unwrap().len();
+
+        store.compact().unwrap();
+        assert!(fs::metadata(&log).unwrap().len() < before);
+        let reopened = Store::open(temp_dir.path()).unwrap();
+        assert_eq!(reopened.get("k"), Some(&b"9"[..]));
+        assert_eq!(reopened.scan("n").len(), 10);
+    }
+
+    #[test]
+    fn test_export_legacy() {
+        let temp_dir = TempDir::new().unwrap();
+        let feature_dir = temp_dir.path();
+        let mut store = Store::open(feature_dir).unwrap();
+        let mut txn = Transaction::default();
+        txn.put("target/app", "")
+            .put("target/libfoo.a", "")
+            .put("tu/src/main.c", "/proj\tgcc\t/proj/src/main.c\t\"-Iinclude\" ")
+            .put("selected/src/main.c2rust", "");
+        store.commit(txn).unwrap();
+
+        store.export_legacy(feature_dir).unwrap();
+
+        assert_eq!(
+            fs::read_to_string(feature_dir.join("c").join("targets.list")).unwrap(),
+            "app\nlibfoo.a\n"
+        );
+        assert_eq!(
+            fs::read_to_string(feature_dir.join("c").join("src").join("main.c2rust.opts"))
+                .unwrap(),
+            "\"-Iinclude\" "
+        );
+        let selected: Vec<String> = serde_json::from_str(
+            &fs::read_to_string(feature_dir.join("selected_files.json")).unwrap(),
+        )
+        .unwrap();
+        assert_eq!(selected, vec!["src/main.c2rust"]);
+    }
+
+    #[test]
+    fn test_parse_tu_record() {
+        let tu = TuRecord::parse(b"/proj/build\tcc\t/proj/a.c\t\"-DX=1\" ").unwrap();
+        assert_eq!(tu.cwd, PathBuf::from("/proj/build"));
+        assert_eq!(tu.compiler, "cc");
+        assert_eq!(tu.source, PathBuf::from("/proj/a.c"));
+        assert_eq!(tu.options, "\"-DX=1\" ");
+        assert!(TuRecord::parse(b"missing\tfields").is_none());
+    }
+}
@@ -1,7 +1,41 @@
+use crate::chunks::CHUNK_INDEX_ENV;
+use crate::cpu_profile::{self, CpuSampler};
 use crate::error::{Error, Result};
+use crate::events::{EventSink, EVENTS_ENV};
+use crate::lock;
+use crate::preprocess;
+use crate::priority::Priority;
+use crate::shadow::ShadowTree;
+use crate::staging::Staging;
+use crate::store::Store;
+use std::fs;
+use std::os::unix::fs::PermissionsExt;
 use std::path::{Path, PathBuf};
 use std::process::{Command, Stdio};
 
+/// Optional behaviour of a tracked build
+#[derive(Debug, Default, Clone)]
+pub struct TrackOptions {
+    /// Sample the build's process tree and report a CPU breakdown per process role
+    pub cpu_profile: bool,
+    /// Maximum preprocessing overhead in percent of compile time before libhook.so degrades
+    pub overhead_budget: Option<u32>,
+    /// Staging base directory on tmpfs and its memory cap in bytes
+    pub staging: Option<(PathBuf, u64)>,
+    /// Run the build in a copy-on-write shadow tree instead of the project itself
+    pub shadow: bool,
+    /// Further project roots (each with its own `.c2rust`) tracked by the same build;
+    /// their feature directories must have been cleaned like the main one
+    pub subprojects: Vec<PathBuf>,
+    /// CPU and I/O priority of the staging drainer and deferred preprocessing; the
+    /// hook's own preprocessing keeps the compiler's, as the compilation waits on it
+    pub priority: Priority,
+    /// Minimum size in bytes of outputs libhook.so writes a chunk index for
+    pub chunk_index: Option<u64>,
+    /// Publish each translation unit once its output is in place
+    pub events: Option<EventSink>,
+}
+
 /// Get the hook library path from environment variable
 pub fn get_hook_library_path() -> Result<PathBuf> {
     std::env::var("C2RUST_HOOK_LIB")
@@ -12,14 +46,68 @@ pub fn get_hook_library_path() -> Result<PathBuf> {
 /// Verify that hook library exists and is accessible
 pub fn verify_hook_library() -> Result<()> {
     let hook_lib = get_hook_library_path()?;
+    let hook_lib = hook_lib.to_string_lossy();
 
-    if !hook_lib.exists() {
+    // `$LIB` depends on the distribution's library layout and cannot be resolved
+    // here; ld.so reports a missing object itself
+    if hook_lib.contains("$LIB") || hook_lib.contains("${LIB}") {
+        return Ok(());
+    }
+    if !Path::new(&expand_platform(&hook_lib, &native_platform())).exists() {
         return Err(Error::HookLibraryNotFound);
     }
 
     Ok(())
 }
 
+/// Dynamic string token expanded by ld.so to the platform of each process
+/// (`x86_64`, `i686`, `aarch64`, ...)
+const PLATFORM_TOKEN: &str = "$PLATFORM";
+
+/// The platform the kernel reports for this process (AT_PLATFORM). ld.so
+/// substitutes it for `$PLATFORM`, except that glibc uses CPU names such as
+/// `haswell` on x86, which `hook/Makefile` links to the `x86_64` build.
+fn native_platform() -> String {
+    let platform = unsafe { libc::getauxval(libc::AT_PLATFORM) } as *const libc::c_char;
+    if platform.is_null() {
+        return std::env::consts::ARCH.to_string();
+    }
+    unsafe { std::ffi::CStr::from_ptr(platform) }
+        .to_string_lossy()
+        .into_owned()
+}
+
+fn expand_platform(path: &str, platform: &str) -> String {
+    path.replace("${PLATFORM}", platform)
+        .replace(PLATFORM_TOKEN, platform)
+}
+
+/// Directory next to `libhook.so` holding one build per ABI, see `hook/Makefile`
+const ABI_DIR: &str = "abi";
+
+/// The `LD_PRELOAD` value for `hook_lib`.
+///
+/// `hook/Makefile` builds one library per ABI into `abi/<platform>/libhook.so`
+/// next to `libhook.so`. When such a build exists for this process's platform, the
+/// path is turned into `<dir>/abi/$PLATFORM/libhook.so`, so ld.so picks the
+/// matching build in every process, including 32-bit helpers and `-m32`
+/// toolchains, instead of failing to load a 64-bit object there. Paths already
+/// containing `$PLATFORM` or `$LIB` are used as given.
+pub fn preload_path(hook_lib: &Path, platform: &str) -> PathBuf {
+    if hook_lib.to_string_lossy().contains('$') {
+        return hook_lib.to_path_buf();
+    }
+    let (Some(dir), Some(name)) = (hook_lib.parent(), hook_lib.file_name()) else {
+        return hook_lib.to_path_buf();
+    };
+    let abi_dir = dir.join(ABI_DIR);
+    if abi_dir.join(platform).join(name).is_file() {
+        abi_dir.join(PLATFORM_TOKEN).join(name)
+    } else {
+        hook_lib.to_path_buf()
+    }
+}
+
 /// Track build process by executing with hook library
 /// Returns a list of detected compilers
 pub fn track_build(
@@ -27,9 +115,10 @@ pub fn track_build(
     command: &[String],
     project_root: &Path,
     feature: &str,
+    options: &TrackOptions,
 ) -> Result<Vec<String>> {
-    let hook_lib = get_hook_library_path()?;
-    let compilers = execute_with_hook(build_dir, command, project_root, feature, &hook_lib)?;
+    let hook_lib = preload_path(&get_hook_library_path()?, &native_platform());
+    let compilers = execute_with_hook(build_dir, command, project_root, feature, &hook_lib, options)?;
     Ok(compilers)
 }
 
@@ -40,8 +129,9 @@ fn execute_with_hook(
     project_root: &Path,
     feature: &str,
     hook_lib: &Path,
+    options: &TrackOptions,
 ) -> Result<Vec<String>> {
-    // Feature directory is guaranteed to exist after clean_feature_directory is called
+    // Feature directory is guaranteed to exist after outputs::clean_keeping_outputs is called
     let feature_dir = project_root.join(".c2rust").join(feature);
 
     let program = &command[0];
@@ -50,6 +140,30 @@ fn execute_with_hook(
     let abs_project_root = project_root.canonicalize()?;
     let abs_feature_dir = feature_dir.canonicalize()?;
 
+    // In a shadow tree libhook.so sees the shadow root as the project root; the paths
+    // it records are mapped back once the build is done
+    let shadow = if options.shadow {
+        ShadowTree::check_build_dir(&abs_project_root, &build_dir.canonicalize()?)?;
+        let (shadow, stats) = ShadowTree::create(&abs_project_root, feature)?;
+        println!(
+            "Created shadow tree {} ({} file(s) reflinked, {} copied, {} object file(s) left out)",
+            shadow.root().display(),
+            stats.reflinked,
+            stats.copied,
+            stats.skipped
+        );
+        Some(shadow)
+    } else {
+        None
+    };
+    let (build_dir, abs_project_root) = match &shadow {
+        Some(shadow) => (
+            shadow.map_dir(&build_dir.canonicalize()?),
+            shadow.root().to_path_buf(),
+        ),
+        None => (build_dir.to_path_buf(), abs_project_root),
+    };
+
     println!("Executing command: {} {}", program, args.join(" "));
     println!("In directory: {}", build_dir.display());
     println!();
@@ -57,10 +171,19 @@ fn execute_with_hook(
     println!("  LD_PRELOAD={}", hook_lib.display());
     println!("  C2RUST_PROJECT_ROOT={}", abs_project_root.display());
     println!("  C2RUST_FEATURE_ROOT={}", abs_feature_dir.display());
+    if let Some(budget) = options.overhead_budget {
+        println!("  C2RUST_OVERHEAD_BUDGET={}", budget);
+    }
+    if let Some(min_bytes) = options.chunk_index {
+        println!("  {}={}", CHUNK_INDEX_ENV, min_bytes);
+    }
+    if let Some(events) = &options.events {
+        println!("  {}={}", EVENTS_ENV, events.path().display());
+    }
     println!();
     println!("Full command:");
     println!(
-        "  LD_PRELOAD={} C2RUST_PROJECT_ROOT={} C2RUST_FEATURE_ROOT={} {} {}",
+        "  LD_PRELOAD='{}' C2RUST_PROJECT_ROOT={} C2RUST_FEATURE_ROOT={} {} {}",
         hook_lib.display(),
         abs_project_root.display(),
         abs_feature_dir.display(),
@@ -69,12 +192,66 @@ fn execute_with_hook(
     );
     println!();
 
-    let mut child = Command::new(program)
+    // Roots table for libhook.so; kept open until the build is done
+    let mut feature_dirs = vec![feature_dir.clone()];
+    let projects_table = if options.subprojects.is_empty() {
+        None
+    } else {
+        let mut projects = vec![(abs_project_root.clone(), abs_feature_dir.clone())];
+        for root in &options.subprojects {
+            let root = root.canonicalize()?;
+            let dir = root.join(".c2rust").join(feature).canonicalize()?;
+            feature_dirs.push(dir.clone());
+            projects.push((root, dir));
+        }
+        let table = ProjectsTable::write(&abs_project_root, feature, &projects)?;
+        println!(
+            "Tracking {} project root(s) via C2RUST_PROJECT_ROOTS",
+            projects.len()
+        );
+        println!();
+        Some(table)
+    };
+
+    let mut build = Command::new(program);
+    if let Some(table) = &projects_table {
+        build.env("C2RUST_PROJECT_ROOTS", &table.path);
+    }
+    build
         .args(args)
-        .current_dir(build_dir)
+        .current_dir(&build_dir)
         .env("LD_PRELOAD", hook_lib)
         .env("C2RUST_PROJECT_ROOT", &abs_project_root)
-        .env("C2RUST_FEATURE_ROOT", &abs_feature_dir)
+        .env("C2RUST_FEATURE_ROOT", &abs_feature_dir);
+    if let Some(budget) = options.overhead_budget {
+        build.env("C2RUST_OVERHEAD_BUDGET", budget.to_string());
+    }
+    if let Some(min_bytes) = options.chunk_index {
+        build.env(CHUNK_INDEX_ENV, min_bytes.to_string());
+    }
+    if let Some(events) = &options.events {
+        build.env(EVENTS_ENV, events.path());
+    }
+
+    let staging = match &options.staging {
+        Some((base, cap_bytes)) => {
+            let staging = Staging::start(
+                base,
+                feature,
+                &abs_feature_dir,
+                *cap_bytes,
+                &options.priority,
+                options.events.clone(),
+            )?;
+            println!("  C2RUST_STAGING_DIR={}", staging.dir().display());
+            println!();
+            build.env("C2RUST_STAGING_DIR", staging.dir());
+            Some(staging)
+        }
+        None => None,
+    };
+
+    let mut child = build
         .stdout(Stdio::inherit())
         .stderr(Stdio::inherit())
         .spawn()
@@ -82,10 +259,28 @@ fn execute_with_hook(
             Error::CommandExecutionFailed(format!("Failed to execute build command: {}", e))
         })?;
 
+    let sampler = options.cpu_profile.then(|| CpuSampler::start(child.id()));
+
     let status = child.wait().map_err(|e| {
         Error::CommandExecutionFailed(format!("Failed to wait for build command: {}", e))
     })?;
 
+    if let Some(sampler) = sampler {
+        cpu_profile::report(&sampler.finish(), &feature_dir);
+    }
+
+    // Everything below reads the preprocessed files, so the staging area must be empty
+    if let Some(staging) = staging {
+        let stats = staging.finish()?;
+        println!(
+            "Staged {} file(s), {:.1} MiB (peak backlog {:.1} MiB, cap reached {} time(s))",
+            stats.files,
+            stats.bytes as f64 / (1024.0 * 1024.0),
+            stats.peak_bytes as f64 / (1024.0 * 1024.0),
+            stats.cap_reached
+        );
+    }
+
     println!();
     if let Some(code) = status.code() {
         println!("Exit code: {}", code);
@@ -98,6 +293,25 @@ fn execute_with_hook(
         )));
     }
 
+    drop(projects_table);
+
+    for feature_dir in &feature_dirs {
+        // The hook records targets and compile options in the feature's store; regenerate
+        // targets.list and the .opts files, which deferred preprocessing reads as well
+        let mut store = Store::open(feature_dir)?;
+        store.compact()?;
+        store.export_legacy(feature_dir)?;
+
+        // Compilations deferred by the hook to stay within the overhead budget
+        preprocess::run_deferred(feature_dir, &options.priority, options.events.as_ref())?;
+
+        if let Some(shadow) = &shadow {
+            shadow.remap_outputs(&mut store, feature_dir)?;
+            store.compact()?;
+            store.export_legacy(feature_dir)?;
+        }
+    }
+
     // Note: Compiler detection has been removed in this version.
     // The build command typically invokes build tools (make, cmake, ninja)
     // rather than compilers directly, making detection from the command unreliable.
@@ -108,6 +322,54 @@ fn execute_with_hook(
     Ok(Vec::new())
 }
 
+/// The project roots table read by libhook.so: one
+/// `<project root>\t<feature directory>` line per project, longest root first, so
+/// the first root that prefixes a path is its innermost project. A world-readable
+/// regular file in `.c2rust/.locks`, which every hooked process can open by path
+/// whatever its PID namespace or user; removed when the build is done.
+struct ProjectsTable {
+    path: PathBuf,
+}
+
+impl ProjectsTable {
+    fn write(
+        project_root: &Path,
+        feature: &str,
+        projects: &[(PathBuf, PathBuf)],
+    ) -> Result<ProjectsTable> {
+        let mut projects = projects.to_vec();
+        projects.sort_by(|a, b| {
+            b.0.as_os_str()
+                .len()
+                .cmp(&a.0.as_os_str().len())
+                .then_with(|| a.0.cmp(&b.0))
+        });
+
+        let dir = lock::locks_dir(project_root);
+        fs::create_dir_all(&dir)?;
+        let path = dir.join(format!(
+            "projects-{}.{}",
+            feature.replace('%', "%25").replace('/', "%2F"),
+            std::process::id()
+        ));
+        let tmp = path.with_extension(format!("{}.tmp", std::process::id()));
+        let content: String = projects
+            .iter()
+            .map(|(root, feature_dir)| format!("{}\t{}\n", root.display(), feature_dir.display()))
+            .collect();
+        fs::write(&tmp, content)?;
+        fs::set_permissions(&tmp, fs::Permissions::from_mode(0o644))?;
+        fs::rename(&tmp, &path)?;
+        Ok(ProjectsTable { path })
+    }
+}
+
+impl Drop for ProjectsTable {
+    fn drop(&mut self) {
+        let _ = fs::remove_file(&self.path);
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -156,4 +418,71 @@ mod tests {
 
         std::env::remove_var("C2RUST_HOOK_LIB");
     }
+
+    #[test]
+    fn test_preload_path_uses_platform_builds() {
+        let temp_dir = tempfile::TempDir::new().unwrap();
+        let hook_lib = temp_dir.path().join("libhook.so");
+        std::fs::write(&hook_lib, "").unwrap();
+
+        // Only the single build: used as is
+        assert_eq!(preload_path(&hook_lib, "x86_64"), hook_lib);
+
+        let abi_dir = temp_dir.path().join("abi");
+        std::fs::create_dir_all(abi_dir.join("x86_64")).unwrap();
+        std::fs::write(abi_dir.join("x86_64").join("libhook.so"), "").unwrap();
+        assert_eq!(
+            preload_path(&hook_lib, "x86_64"),
+            abi_dir.join("$PLATFORM").join("libhook.so")
+        );
+        // No build for this process's platform
+        assert_eq!(preload_path(&hook_lib, "aarch64"), hook_lib);
+
+        let explicit = PathBuf::from("/opt/c2rust/$LIB/libhook.so");
+        assert_eq!(preload_path(&explicit, "x86_64"), explicit);
+    }
+
+    #[test]
+    #[serial_test::serial]
+    fn test_verify_hook_library_expands_platform() {
+        let temp_dir = tempfile::TempDir::new().unwrap();
+        let platform_dir = temp_dir.path().join(native_platform());
+        std::fs::create_dir_all(&platform_dir).unwrap();
+        std::fs::write(platform_dir.join("libhook.so"), "").unwrap();
+
+        std::env::set_var(
+            "C2RUST_HOOK_LIB",
+            temp_dir.path().join("$PLATFORM").join("libhook.so"),
+        );
+        assert!(verify_hook_library().is_ok());
+        std::env::set_var(
+            "C2RUST_HOOK_LIB",
+            temp_dir.path().join("${PLATFORM}").join("missing.so"),
+        );
+        assert!(verify_hook_library().is_err());
+
+        std::env::remove_var("C2RUST_HOOK_LIB");
+    }
+
+    #[test]
+    fn test_projects_table_lists_innermost_roots_first() {
+        let projects = vec![
+            (PathBuf::from("/mono"), PathBuf::from("/mono/.c2rust/default")),
+            (PathBuf::from("/mono/libs/a"), PathBuf::from("/mono/libs/a/.c2rust/default")),
+            (PathBuf::from("/mono/app"), PathBuf::from("/mono/app/.c2rust/default")),
+        ];
+        let temp_dir = tempfile::TempDir::new().unwrap();
+        let table = ProjectsTable::write(temp_dir.path(), "a/b", &projects).unwrap();
+        assert!(table.path.starts_with(lock::locks_dir(temp_dir.path())));
+        let content = std::fs::read_to_string(&table.path).unwrap();
+        assert_eq!(
+            content,
+            "/mono/libs/a\t/mono/libs/a/.c2rust/default\n\
+             /mono/app\t/mono/app/.c2rust/default\n\
+             /mono\t/mono/.c2rust/default\n"
+        );
+        let path = table.path.clone();
+        drop(table);
+        assert!(!path.exists());
+    }
 }
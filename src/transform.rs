@@ -0,0 +1,378 @@
+use crate::cache;
+use crate::error::{Error, Result};
+use crate::file_selector;
+use crate::parallel;
+use sha2::{Digest, Sha256};
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+
+/// Shared cache directory below `.c2rust`, never committed
+pub const CACHE_DIR: &str = ".cache";
+
+/// An executable transform plugin.
+///
+/// A plugin reads one preprocessed file on stdin and writes the transformed file to
+/// stdout; a non-zero exit status leaves the file unchanged. stdin and stdout are
+/// connected to files, so large outputs stream through without being buffered.
+/// The output must depend only on the input content, since results are cached by
+/// input hash and plugin identity.
+#[derive(Debug, Clone)]
+pub struct Plugin {
+    /// The plugin as given on the command line
+    pub spec: String,
+    program: PathBuf,
+    args: Vec<String>,
+    /// Hash of the plugin executable and its arguments; changes with the plugin version
+    id: String,
+}
+
+impl Plugin {
+    /// Parse a plugin specification: an executable followed by whitespace-separated
+    /// arguments. Executables without a '/' are looked up in PATH.
+    pub fn parse(spec: &str) -> Result<Plugin> {
+        let mut words = spec.split_whitespace();
+        let name = words
+            .next()
+            .ok_or_else(|| Error::TransformFailed("empty transform plugin".to_string()))?;
+        let args: Vec<String> = words.map(str::to_string).collect();
+
+        let program = resolve_program(name).ok_or_else(|| {
+            Error::TransformFailed(format!("transform plugin '{}' not found", name))
+        })?;
+
+        let mut hasher = Sha256::new();
+        io::copy(&mut File::open(&program)?, &mut hasher)?;
+        for arg in &args {
+            hasher.update([0]);
+            hasher.update(arg.as_bytes());
+        }
+
+        Ok(Plugin {
+            spec: spec.to_string(),
+            program,
+            args,
+            id: hex(&hasher.finalize()),
+        })
+    }
+
+    fn run(&self, input: &Path, output: &Path) -> Result<()> {
+        let result = Command::new(&self.program)
+            .args(&self.args)
+            .stdin(Stdio::from(File::open(input)?))
+            .stdout(Stdio::from(File::create(output)?))
+            .stderr(Stdio::piped())
+            .output()
+            .map_err(|e| Error::TransformFailed(format!("{}: {}", self.spec, e)))?;
+
+        if !result.status.success() {
+            return Err(Error::TransformFailed(format!(
+                "{} exited with {}: {}",
+                self.spec,
+                result.status,
+                String::from_utf8_lossy(&result.stderr).trim()
+            )));
+        }
+        Ok(())
+    }
+}
+
+/// Outcome of a transform pass
+#[derive(Debug, Default, Clone, Copy, PartialEq)]
+pub struct TransformStats {
+    pub files: usize,
+    /// Plugin invocations answered from the cache
+    pub cached: usize,
+    /// Plugin invocations executed
+    pub executed: usize,
+    /// Files left unchanged because a plugin failed
+    pub failed: usize,
+}
+
+/// Identity of a plugin pipeline: changes with the plugins, their order and versions
+pub fn pipeline_id(plugins: &[Plugin]) -> String {
+    if plugins.is_empty() {
+        return "none".to_string();
+    }
+    let mut hasher = Sha256::new();
+    for plugin in plugins {
+        hasher.update(plugin.id.as_bytes());
+    }
+    hex(&hasher.finalize())
+}
+
+/// Run every preprocessed file below `c_dir` through `plugins`, in order, on a
+/// pool of worker threads. Each file is transformed in place; files in `unchanged`
+/// were left alone by this run and already hold the pipeline's result.
+pub fn run_pipeline(
+    project_root: &Path,
+    c_dir: &Path,
+    plugins: &[Plugin],
+    unchanged: &HashSet<PathBuf>,
+) -> Result<TransformStats> {
+    let mut stats = TransformStats::default();
+    if plugins.is_empty() {
+        return Ok(stats);
+    }
+
+    let cache_dir = cache_dir(project_root);
+    fs::create_dir_all(&cache_dir)?;
+    let _cache_lock = cache::read_lock(project_root)?;
+
+    let mut files = file_selector::collect_preprocessed_files(c_dir)?;
+    files.retain(|file| !unchanged.contains(&file.path));
+    let results = parallel::map(&files, parallel::default_jobs(), |file| {
+        let mut keys = Vec::new();
+        let result = transform_file(&file.path, plugins, &cache_dir, &mut keys);
+        (result, keys)
+    });
+
+    stats.files = files.len();
+    let mut used = Vec::new();
+    for (file, (result, keys)) in files.iter().zip(results) {
+        used.extend(keys);
+        match result {
+            Ok((cached, executed)) => {
+                stats.cached += cached;
+                stats.executed += executed;
+            }
+            Err(e) => {
+                eprintln!("Warning: transform of {} failed: {}", file.display_name, e);
+                stats.failed += 1;
+            }
+        }
+    }
+    stamp_cache_entries(&cache_dir, &used);
+    Ok(stats)
+}
+
+/// Run a single preprocessed file through `plugins`, in place. Returns the number
+/// of cached and executed plugin invocations.
+pub fn transform_in_place(project_root: &Path, path: &Path, plugins: &[Plugin]) -> Result<(usize, usize)> {
+    if plugins.is_empty() {
+        return Ok((0, 0));
+    }
+    let cache_dir = cache_dir(project_root);
+    fs::create_dir_all(&cache_dir)?;
+    let _cache_lock = cache::read_lock(project_root)?;
+    let mut keys = Vec::new();
+    let result = transform_file(path, plugins, &cache_dir, &mut keys);
+    stamp_cache_entries(&cache_dir, &keys);
+    result
+}
+
+/// `.c2rust/.cache/transform` of a project
+pub fn cache_dir(project_root: &Path) -> PathBuf {
+    project_root.join(".c2rust").join(CACHE_DIR).join("transform")
+}
+
+/// Best-effort like cache inserts: a lost stamp only makes the entries look older
+fn stamp_cache_entries(cache_dir: &Path, keys: &[String]) {
+    if let Err(e) = cache::record_access(cache_dir, keys) {
+        eprintln!("Warning: Failed to record transform cache use: {}", e);
+    }
+}
+
+/// Transform one file; returns the number of cached and executed plugin invocations.
+/// The keys of the cache entries read or inserted are pushed to `keys`.
+fn transform_file(
+    path: &Path,
+    plugins: &[Plugin],
+    cache_dir: &Path,
+    keys: &mut Vec<String>,
+) -> Result<(usize, usize)> {
+    let stage_path = |i: usize| {
+        let mut name = path.as_os_str().to_owned();
+        name.push(format!(".transform{}", i));
+        PathBuf::from(name)
+    };
+
+    let mut cached = 0;
+    let mut executed = 0;
+    let mut input = path.to_path_buf();
+
+    let result = (|| {
+        for (i, plugin) in plugins.iter().enumerate() {
+            let output = stage_path(i);
+            let key = cache_key(&input, plugin)?;
+            let cache_entry = cache::entry_path(cache_dir, &key);
+
+            if fs::copy(&cache_entry, &output).is_ok() {
+                cached += 1;
+            } else {
+                plugin.run(&input, &output)?;
+                executed += 1;
+                insert_into_cache(&output, &cache_entry);
+            }
+            keys.push(key);
+
+            if input != path {
+                fs::remove_file(&input)?;
+            }
+            input = output;
+        }
+        fs::rename(&input, path)?;
+        Ok(())
+    })();
+
+    if result.is_err() {
+        for i in 0..plugins.len() {
+            let _ = fs::remove_file(stage_path(i));
+        }
+    }
+    result.map(|()| (cached, executed))
+}
+
+fn cache_key(input: &Path, plugin: &Plugin) -> Result<String> {
+    let mut hasher = Sha256::new();
+    io::copy(&mut File::open(input)?, &mut hasher)?;
+    hasher.update(plugin.id.as_bytes());
+    Ok(hex(&hasher.finalize()))
+}
+
+/// Best-effort: a failure to cache only costs a rerun next time.
+/// Entries are written to a temporary file and renamed, so concurrent runs never
+/// observe a partial entry.
+fn insert_into_cache(output: &Path, cache_entry: &Path) {
+    let Some(parent) = cache_entry.parent() else {
+        return;
+    };
+    let tmp = cache_entry.with_extension(format!("tmp{}", std::process::id()));
+    let inserted = fs::create_dir_all(parent)
+        .and_then(|()| fs::copy(output, &tmp))
+        .and_then(|_| fs::rename(&tmp, cache_entry));
+    if inserted.is_err() {
+        let _ = fs::remove_file(&tmp);
+    }
+}
+
+pub fn resolve_program(name: &str) -> Option<PathBuf> {
+    if name.contains('/') {
+        let path = PathBuf::from(name);
+        return path.is_file().then(|| path.canonicalize().unwrap_or(path));
+    }
+    std::env::var_os("PATH").and_then(|paths| {
+        std::env::split_paths(&paths)
+            .map(|dir| dir.join(name))
+            .find(|candidate| candidate.is_file())
+    })
+}
+
+fn hex(bytes: &[u8]) -> String {
+    bytes.iter().map(|b| format!("{:02x}", b)).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::os::unix::fs::PermissionsExt;
+    use tempfile::TempDir;
+
+    fn write_plugin(dir: &Path, name: &str, script: &str) -> String {
+        let path = dir.join(name);
+        fs::write(&path, format!("#!/bin/sh\n{}\n", script)).unwrap();
+        fs::set_permissions(&path, fs::Permissions::from_mode(0o755)).unwrap();
+        path.display().to_string()
+    }
+
+    fn setup(temp_dir: &TempDir) -> PathBuf {
+        let c_dir = temp_dir.path().join(".c2rust").join("default").join("c");
+        fs::create_dir_all(c_dir.join("src")).unwrap();
+        fs::write(c_dir.join("src").join("a.c2rust"), "#pragma once\nint a;\n").unwrap();
+        fs::write(c_dir.join("b.c2rust"), "int b;\n").unwrap();
+        c_dir
+    }
+
+    #[test]
+    fn test_pipeline_runs_plugins_in_order() {
+        let temp_dir = TempDir::new().unwrap();
+        let c_dir = setup(&temp_dir);
+        let plugins = vec![
+            Plugin::parse(&write_plugin(temp_dir.path(), "strip", "grep -v '^#pragma'")).unwrap(),
+            Plugin::parse(&format!(
+                "{} /*generated*/",
+                write_plugin(temp_dir.path(), "prepend", "echo \"$1\"; cat")
+            ))
+            .unwrap(),
+        ];
+
+        let stats = run_pipeline(temp_dir.path(), &c_dir, &plugins, &HashSet::new()).unwrap();
+        assert_eq!(
+            stats,
+            TransformStats {
+                files: 2,
+                cached: 0,
+                executed: 4,
+                failed: 0
+            }
+        );
+        assert_eq!(
+            fs::read_to_string(c_dir.join("src").join("a.c2rust")).unwrap(),
+            "/*generated*/\nint a;\n"
+        );
+        assert!(!c_dir.join("src").join("a.c2rust.transform0").exists());
+    }
+
+    #[test]
+    fn test_pipeline_results_are_cached() {
+        let temp_dir = TempDir::new().unwrap();
+        let c_dir = setup(&temp_dir);
+        let plugin =
+            Plugin::parse(&write_plugin(temp_dir.path(), "upper", "tr a-z A-Z")).unwrap();
+
+        run_pipeline(temp_dir.path(), &c_dir, std::slice::from_ref(&plugin), &HashSet::new()).unwrap();
+        let first = fs::read_to_string(c_dir.join("b.c2rust")).unwrap();
+
+        // Same inputs again: every result comes from the cache
+        fs::write(c_dir.join("b.c2rust"), "int b;\n").unwrap();
+        fs::write(c_dir.join("src").join("a.c2rust"), "#pragma once\nint a;\n").unwrap();
+        let stats = run_pipeline(temp_dir.path(), &c_dir, &[plugin], &HashSet::new()).unwrap();
+        assert_eq!(stats.cached, 2);
+        assert_eq!(stats.executed, 0);
+        assert_eq!(fs::read_to_string(c_dir.join("b.c2rust")).unwrap(), first);
+
+        // A new plugin version invalidates the cache
+        let plugin =
+            Plugin::parse(&write_plugin(temp_dir.path(), "upper", "tr a-z A-Z; echo")).unwrap();
+        fs::write(c_dir.join("b.c2rust"), "int b;\n").unwrap();
+        let stats = run_pipeline(temp_dir.path(), &c_dir, &[plugin], &HashSet::new()).unwrap();
+        assert_eq!(stats.executed, 2);
+    }
+
+    #[test]
+    fn test_pipeline_skips_unchanged_files() {
+        let temp_dir = TempDir::new().unwrap();
+        let c_dir = setup(&temp_dir);
+        let plugin =
+            Plugin::parse(&write_plugin(temp_dir.path(), "upper", "tr a-z A-Z")).unwrap();
+        assert_ne!(pipeline_id(std::slice::from_ref(&plugin)), pipeline_id(&[]));
+
+        let unchanged: HashSet<PathBuf> = [c_dir.join("b.c2rust")].into();
+        let stats = run_pipeline(temp_dir.path(), &c_dir, &[plugin], &unchanged).unwrap();
+        assert_eq!(stats.files, 1);
+        assert_eq!(fs::read_to_string(c_dir.join("b.c2rust")).unwrap(), "int b;\n");
+    }
+
+    #[test]
+    fn test_failing_plugin_leaves_file_unchanged() {
+        let temp_dir = TempDir::new().unwrap();
+        let c_dir = setup(&temp_dir);
+        let plugin = Plugin::parse(&write_plugin(temp_dir.path(), "fail", "exit 3")).unwrap();
+
+        let stats = run_pipeline(temp_dir.path(), &c_dir, &[plugin], &HashSet::new()).unwrap();
+        assert_eq!(stats.failed, 2);
+        assert_eq!(fs::read_to_string(c_dir.join("b.c2rust")).unwrap(), "int b;\n");
+        assert!(!c_dir.join("b.c2rust.transform0").exists());
+    }
+
+    #[test]
+    fn test_parse_missing_plugin() {
+        assert!(matches!(
+            Plugin::parse("/nonexistent/plugin --flag"),
+            Err(Error::TransformFailed(_))
+        ));
+        assert!(Plugin::parse("   ").is_err());
+    }
+}
@@ -0,0 +1,345 @@
+use crate::error::Result;
+use crate::outputs;
+use crate::parallel;
+use crate::preprocess;
+use crate::store::{Store, TuRecord, TU_PREFIX};
+use crate::transform::{self, CACHE_DIR};
+use sha2::{Digest, Sha256};
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+/// Full diagnostics of the last validation, below `.c2rust/<feature>/`
+pub const VALIDATION_LOG: &str = "validation.log";
+/// Diagnostic lines shown per failed file; the rest is in the log
+const SHOWN_LINES: usize = 5;
+
+/// A selected output and the compilation it came from
+struct Unit {
+    key: String,
+    output: PathBuf,
+    record: TuRecord,
+}
+
+/// A selected output the original compiler rejects
+#[derive(Debug)]
+pub struct Failure {
+    pub key: String,
+    pub output: PathBuf,
+    /// The compilation as libhook.so recorded it
+    pub invocation: String,
+    pub diagnostics: String,
+}
+
+#[derive(Debug, Default)]
+pub struct ValidateStats {
+    pub checked: usize,
+    /// Outputs that passed in an earlier run with the same content and compiler
+    pub cached: usize,
+    pub failures: Vec<Failure>,
+}
+
+/// Check every selected output below `feature_dir/c` with
+/// `<compiler> -fsyntax-only -x cpp-output`, using the compiler (gcc, clang, ...)
+/// and language options (`-std=`, `-f...`) of the compilation that produced it,
+/// on a pool of `jobs` threads. Outputs that passed before are skipped: passes are
+/// remembered in `.c2rust/.cache/validate/<feature>.list` by a hash of the output,
+/// the compiler binary and the options. Failures are written to `validation.log`.
+pub fn validate(project_root: &Path, feature: &str, jobs: usize) -> Result<ValidateStats> {
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    let c_dir = feature_dir.join("c");
+    let store = Store::open(&feature_dir)?;
+    let units: Vec<Unit> = store
+        .scan(TU_PREFIX)
+        .into_iter()
+        .filter_map(|(key, value)| {
+            let output = outputs::output_path(&c_dir, key);
+            Some(Unit {
+                key: key.to_string(),
+                record: TuRecord::parse(value)?,
+                output,
+            })
+        })
+        .filter(|unit| unit.output.is_file())
+        .collect();
+
+    let list = passed_list(project_root, feature);
+    let passed_before = load_passed(&list)?;
+    let results = parallel::map(&units, jobs, |unit| -> Result<_> {
+        let key = cache_key(unit)?;
+        let cached = passed_before.contains(&key);
+        let diagnostics = if cached { None } else { check(unit) };
+        Ok((key, diagnostics, cached))
+    });
+
+    let mut stats = ValidateStats::default();
+    let mut passed = Vec::new();
+    for (unit, result) in units.iter().zip(results) {
+        let (key, diagnostics, cached) = result?;
+        stats.checked += 1;
+        stats.cached += cached as usize;
+        match diagnostics {
+            None => passed.push(key),
+            Some(diagnostics) => stats.failures.push(Failure {
+                key: unit.key.clone(),
+                output: unit.output.clone(),
+                invocation: invocation(&unit.record),
+                diagnostics,
+            }),
+        }
+    }
+
+    save_passed(&list, &mut passed)?;
+    write_log(&feature_dir, &stats.failures)?;
+    Ok(stats)
+}
+
+/// Print failures with the compilation each output came from
+pub fn report(feature: &str, stats: &ValidateStats) {
+    for failure in &stats.failures {
+        eprintln!("\n{}: {}", failure.key, failure.output.display());
+        eprintln!("  recorded compilation: {}", failure.invocation);
+        let lines: Vec<&str> = failure.diagnostics.lines().collect();
+        for line in lines.iter().take(SHOWN_LINES) {
+            eprintln!("    {}", line);
+        }
+        if lines.len() > SHOWN_LINES {
+            eprintln!("    ... ({} more line(s))", lines.len() - SHOWN_LINES);
+        }
+    }
+    if !stats.failures.is_empty() {
+        eprintln!("\nFull diagnostics: .c2rust/{}/{}", feature, VALIDATION_LOG);
+    }
+}
+
+/// Target and ABI options followed by a separate value
+const TARGET_OPTIONS: &[&str] = &["-target", "--target", "-isysroot", "--sysroot", "-mllvm"];
+
+/// `-f` options that load code, write further files or change what the compiler
+/// does; never passed on
+const SKIPPED_F_OPTIONS: &[&str] = &["-fplugin", "-fdump-", "-fsyntax-only"];
+
+/// Options of a recorded compilation that change how C is parsed: the standard and
+/// dialect (`-std=`, `-f...`) and the target and ABI (`-m32`, `-march=`, `-target`,
+/// `--sysroot`, ...), which fix type sizes. Include paths and macros are already
+/// applied to a preprocessed output.
+fn language_options(record: &TuRecord) -> Vec<String> {
+    let mut options = Vec::new();
+    let mut recorded = preprocess::parse_options(&record.options).into_iter();
+    while let Some(option) = recorded.next() {
+        if TARGET_OPTIONS.contains(&option.as_str()) {
+            if let Some(value) = recorded.next() {
+                options.push(option);
+                options.push(value);
+            }
+        } else if option.starts_with("-std=")
+            || option.starts_with("-m")
+            || option.starts_with("--target=")
+            || option.starts_with("-isysroot")
+            || option.starts_with("--sysroot=")
+            || (option.starts_with("-f")
+                && !SKIPPED_F_OPTIONS.iter().any(|skipped| option.starts_with(skipped)))
+        {
+            options.push(option);
+        }
+    }
+    options
+}
+
+/// A relative compiler path refers to the original working directory
+fn compiler_path(record: &TuRecord) -> PathBuf {
+    if record.compiler.contains('/') {
+        record.cwd.join(&record.compiler)
+    } else {
+        PathBuf::from(&record.compiler)
+    }
+}
+
+/// Run the compiler over the output; `None` when it accepts it
+fn check(unit: &Unit) -> Option<String> {
+    let compiler = compiler_path(&unit.record);
+    let output = Command::new(&compiler)
+        .arg("-fsyntax-only")
+        .arg("-x")
+        .arg("cpp-output")
+        .args(language_options(&unit.record))
+        .arg(&unit.output)
+        .current_dir(&unit.record.cwd)
+        .output();
+    match output {
+        Ok(output) if output.status.success() => None,
+        Ok(output) => Some(String::from_utf8_lossy(&output.stderr).trim().to_string()),
+        Err(e) => Some(format!("Failed to execute {}: {}", compiler.display(), e)),
+    }
+}
+
+/// Hash of the output, the identity of the compiler binary (path, size and mtime,
+/// so an upgraded compiler checks again) and the options it runs with
+fn cache_key(unit: &Unit) -> Result<String> {
+    let mut hasher = Sha256::new();
+    io::copy(&mut File::open(&unit.output)?, &mut hasher)?;
+    let compiler = compiler_path(&unit.record);
+    let resolved = transform::resolve_program(&compiler.to_string_lossy());
+    hasher.update(compiler.to_string_lossy().as_bytes());
+    if let Some(meta) = resolved.and_then(|path| fs::metadata(path).ok()) {
+        hasher.update(format!("\0{}\0{}", meta.len(), meta.mtime()).as_bytes());
+    }
+    for option in language_options(&unit.record) {
+        hasher.update(b"\0");
+        hasher.update(option.as_bytes());
+    }
+    Ok(hasher
+        .finalize()
+        .iter()
+        .map(|b| format!("{:02x}", b))
+        .collect())
+}
+
+/// `invocation` of a record: where and how the translation unit was compiled
+fn invocation(record: &TuRecord) -> String {
+    let mut command = vec![record.compiler.clone()];
+    command.extend(preprocess::parse_options(&record.options));
+    command.push(record.source.display().to_string());
+    format!("cd {} && {}", record.cwd.display(), command.join(" "))
+}
+
+fn passed_list(project_root: &Path, feature: &str) -> PathBuf {
+    project_root
+        .join(".c2rust")
+        .join(CACHE_DIR)
+        .join("validate")
+        .join(format!("{}.list", feature.replace('%', "%25").replace('/', "%2F")))
+}
+
+fn load_passed(list: &Path) -> Result<HashSet<String>> {
+    match fs::read_to_string(list) {
+        Ok(content) => Ok(content.lines().map(str::to_string).collect()),
+        Err(e) if e.kind() == io::ErrorKind::NotFound => Ok(HashSet::new()),
+        Err(e) => Err(e.into()),
+    }
+}
+
+/// Replace the list with this run's passes, so it never outgrows the feature
+fn save_passed(list: &Path, passed: &mut Vec<String>) -> Result<()> {
+    passed.sort();
+    let parent = list.parent().expect("the list is below the cache directory");
+    fs::create_dir_all(parent)?;
+    let tmp = list.with_extension(format!("tmp{}", std::process::id()));
+    let mut content = passed.join("\n");
+    content.push('\n');
+    fs::write(&tmp, content)?;
+    fs::rename(&tmp, list)?;
+    Ok(())
+}
+
+fn write_log(feature_dir: &Path, failures: &[Failure]) -> Result<()> {
+    let path = feature_dir.join(VALIDATION_LOG);
+    if failures.is_empty() {
+        return match fs::remove_file(&path) {
+            Err(e) if e.kind() != io::ErrorKind::NotFound => Err(e.into()),
+            _ => Ok(()),
+        };
+    }
+    let mut content = String::new();
+    for failure in failures {
+        content.push_str(&format!(
+            "== {}\n{}\n{}\n\n",
+            failure.key, failure.invocation, failure.diagnostics
+        ));
+    }
+    fs::write(path, content)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::store::Transaction;
+    use tempfile::TempDir;
+
+    fn record(feature_dir: &Path, project_root: &Path, key: &str, content: &str) {
+        let c_dir = feature_dir.join("c");
+        let output = outputs::output_path(&c_dir, key);
+        fs::create_dir_all(output.parent().unwrap()).unwrap();
+        fs::write(&output, content).unwrap();
+        let mut store = Store::open(feature_dir).unwrap();
+        let mut txn = Transaction::default();
+        txn.put(
+            format!("{}{}", TU_PREFIX, key),
+            format!(
+                "{}\tcc\t{}\t\"-DX=1\" \"-std=c99\" ",
+                project_root.display(),
+                project_root.join(key).display()
+            ),
+        );
+        store.commit(txn).unwrap();
+    }
+
+    #[test]
+    fn test_validate_reports_and_caches() {
+        let temp_dir = TempDir::new().unwrap();
+        let project_root = temp_dir.path();
+        let feature_dir = project_root.join(".c2rust").join("default");
+        fs::create_dir_all(&feature_dir).unwrap();
+        record(&feature_dir, project_root, "src/good.c", "int good(void) { return 1; }\n");
+        record(&feature_dir, project_root, "src/bad.c", "int bad(void) { return 1 }\n");
+
+        let stats = validate(project_root, "default", 2).unwrap();
+        assert_eq!((stats.checked, stats.cached), (2, 0));
+        assert_eq!(stats.failures.len(), 1);
+        let failure = &stats.failures[0];
+        assert_eq!(failure.key, "src/bad.c");
+        assert!(failure.invocation.contains("cc -DX=1 -std=c99"));
+        assert!(failure.invocation.ends_with("src/bad.c"));
+        assert!(!failure.diagnostics.is_empty());
+        assert!(feature_dir.join(VALIDATION_LOG).exists());
+
+        // The pass is cached; the failure is checked again
+        let stats = validate(project_root, "default", 2).unwrap();
+        assert_eq!((stats.checked, stats.cached, stats.failures.len()), (2, 1, 1));
+
+        fs::write(
+            feature_dir.join("c").join("src").join("bad.c2rust"),
+            "int bad(void) { return 1; }\n",
+        )
+        .unwrap();
+        let stats = validate(project_root, "default", 2).unwrap();
+        assert!(stats.failures.is_empty());
+        assert!(!feature_dir.join(VALIDATION_LOG).exists());
+    }
+
+    #[test]
+    fn test_language_options_keep_target_and_abi() {
+        let record = TuRecord {
+            cwd: PathBuf::from("/src"),
+            compiler: "cc".to_string(),
+            source: PathBuf::from("/src/a.c"),
+            options: "\"-I\" \"include\" \"-DX=1\" \"-m32\" \"-march=armv7-a\" \"-target\" \
+                      \"arm-linux-gnueabihf\" \"--sysroot=/opt/sysroot\" \"-funsigned-char\" \
+                      \"-fplugin=./check.so\" \"-std=c11\" "
+                .to_string(),
+        };
+        assert_eq!(
+            language_options(&record),
+            [
+                "-m32",
+                "-march=armv7-a",
+                "-target",
+                "arm-linux-gnueabihf",
+                "--sysroot=/opt/sysroot",
+                "-funsigned-char",
+                "-std=c11",
+            ]
+        );
+    }
+
+    #[test]
+    fn test_passed_list_keeps_features_apart() {
+        let root = Path::new("/project");
+        assert_ne!(passed_list(root, "a/b"), passed_list(root, "a-b"));
+        assert_ne!(passed_list(root, "a/b"), passed_list(root, "a%2Fb"));
+    }
+}
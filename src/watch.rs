@@ -0,0 +1,619 @@
+use crate::chunks;
+use crate::error::Result;
+use crate::lock;
+use crate::manifest::Manifest;
+use crate::objects;
+use crate::outputs;
+use crate::parallel;
+use crate::preprocess::PreprocessJob;
+use crate::priority::Priority;
+use crate::store::{Store, Transaction, TuRecord, DEPS_PREFIX, TU_PREFIX};
+use crate::transform::{self, Plugin};
+use std::collections::{HashMap, HashSet};
+use std::ffi::{CString, OsStr};
+use std::fs;
+use std::io;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+use std::os::unix::ffi::OsStrExt;
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// Quiet period after the last change before a batch is refreshed, so a save that
+/// touches several files (or an editor's write-and-rename) is handled once
+const DEBOUNCE: Duration = Duration::from_millis(200);
+/// Upper bound on how long a stream of changes can postpone a refresh
+const MAX_DELAY: Duration = Duration::from_secs(2);
+
+/// Events that mean a watched file has new content. IN_ATTRIB makes `touch` force a
+/// refresh, like it forces a rebuild.
+const WATCH_MASK: u32 = libc::IN_CLOSE_WRITE | libc::IN_MOVED_TO | libc::IN_ATTRIB;
+
+/// A recorded translation unit whose preprocessed output is kept fresh
+#[derive(Debug, Clone, PartialEq)]
+struct Unit {
+    /// Source path relative to the project root, as keyed in the store
+    key: String,
+    job: PreprocessJob,
+    /// Files the source includes (and the source itself); empty until indexed
+    deps: Vec<PathBuf>,
+}
+
+impl Unit {
+    /// Whether the output is older than the source or one of the files it includes.
+    /// Units that have not been indexed yet are stale.
+    fn is_stale(&self) -> bool {
+        let Ok(output_time) = fs::metadata(&self.job.output).and_then(|m| m.modified()) else {
+            return true;
+        };
+        if self.deps.is_empty() {
+            return true;
+        }
+        self.deps.iter().any(|dep| {
+            fs::metadata(dep)
+                .and_then(|m| m.modified())
+                .map_or(true, |time| time > output_time)
+        })
+    }
+
+    /// Files to watch: the dependencies inside the project, or the source alone
+    /// before indexing. System headers are not watched.
+    fn watched_files<'a>(&'a self, project_root: &'a Path) -> impl Iterator<Item = &'a Path> {
+        let fallback = self.deps.is_empty().then_some(self.job.source.as_path());
+        self.deps
+            .iter()
+            .map(PathBuf::as_path)
+            .chain(fallback)
+            .filter(move |path| {
+                path.starts_with(project_root) && !path.starts_with(project_root.join(".c2rust"))
+            })
+    }
+}
+
+/// Keep the preprocessed files of `feature` up to date with their sources.
+///
+/// Replays the compilations recorded by libhook.so for the translation units that
+/// are still present below `c/`, first for those that changed since the build (or
+/// the last watch), then whenever inotify reports a change to a source or to a
+/// header it includes. Every refreshed file is preprocessed and transformed to a
+/// temporary path and renamed into place, and the manifest is replaced atomically,
+/// so readers never see partial output. The feature lock is held during a refresh
+/// only, so a full build can run in between. With `once`, returns after catching up.
+pub fn run(project_root: &Path, feature: &str, once: bool) -> Result<()> {
+    let feature_dir = project_root.join(".c2rust").join(feature);
+    let c_dir = feature_dir.join("c");
+    let lock_path = lock::feature_lock_path(project_root, feature);
+    let what = format!("feature '{}'", feature);
+
+    let mut store = Store::open(&feature_dir)?;
+    let mut inotify = Inotify::new()?;
+
+    let (units, plugins) = {
+        let _lock = lock::FileLock::acquire(&lock_path, &what)?;
+        store.refresh()?;
+        objects::hydrate(&objects::objects_dir(project_root), &c_dir)?;
+        (load_units(&store, &c_dir), load_plugins(&feature_dir)?)
+    };
+    if units.is_empty() {
+        println!(
+            "No preprocessed files to watch in {}; run `c2rust-build build` first",
+            c_dir.display()
+        );
+        return Ok(());
+    }
+    watch_units(&mut inotify, project_root, &units)?;
+
+    let stale: Vec<usize> = (0..units.len()).filter(|&i| units[i].is_stale()).collect();
+    if !stale.is_empty() {
+        println!("Catching up on {} translation unit(s)...", stale.len());
+        let _lock = lock::FileLock::acquire(&lock_path, &what)?;
+        refresh_batch(project_root, &feature_dir, &mut store, &mut inotify, &plugins, |units| {
+            units.iter().enumerate().filter(|(_, u)| u.is_stale()).map(|(i, _)| i).collect()
+        })?;
+    }
+    if once {
+        return Ok(());
+    }
+
+    println!(
+        "Watching {} translation unit(s) of feature '{}' ({} directories); press Ctrl-C to stop",
+        units.len(),
+        feature,
+        inotify.dirs.len()
+    );
+    loop {
+        let changes = inotify.wait_for_changes()?;
+        let _lock = lock::FileLock::acquire(&lock_path, &what)?;
+        refresh_batch(project_root, &feature_dir, &mut store, &mut inotify, &plugins, |units| {
+            match &changes {
+                // The kernel dropped events: fall back to comparing timestamps
+                Changes::Overflow => units
+                    .iter()
+                    .enumerate()
+                    .filter(|(_, u)| u.is_stale())
+                    .map(|(i, _)| i)
+                    .collect(),
+                Changes::Paths(paths) => affected_units(units, paths),
+            }
+        })?;
+    }
+}
+
+/// Reload the units from the store (a build may have run since the last batch),
+/// refresh those chosen by `select`, and record the outcome
+fn refresh_batch(
+    project_root: &Path,
+    feature_dir: &Path,
+    store: &mut Store,
+    inotify: &mut Inotify,
+    plugins: &[Plugin],
+    select: impl FnOnce(&[Unit]) -> Vec<usize>,
+) -> Result<()> {
+    store.refresh()?;
+    let mut units = load_units(store, &feature_dir.join("c"));
+    let selected = select(&units);
+    if selected.is_empty() {
+        return Ok(());
+    }
+
+    let start = Instant::now();
+    let results = parallel::map(&selected, parallel::default_jobs(), |&i| {
+        refresh_unit(project_root, &units[i], plugins)
+    });
+
+    let mut txn = Transaction::default();
+    let mut refreshed = 0;
+    for (&i, result) in selected.iter().zip(results) {
+        match result {
+            Ok((deps, hash)) => {
+                let value: Vec<String> = deps.iter().map(|d| d.display().to_string()).collect();
+                txn.put(format!("{}{}", DEPS_PREFIX, units[i].key), value.join("\n"));
+                outputs::record_hash(&mut txn, &units[i].key, hash);
+                units[i].deps = deps;
+                refreshed += 1;
+            }
+            Err(e) => eprintln!("Warning: {}: {}", units[i].job.source.display(), e),
+        }
+    }
+    if !txn.is_empty() {
+        store.commit(txn)?;
+    }
+    // Headers included for the first time are watched from now on
+    watch_units(inotify, project_root, &units)?;
+
+    if refreshed > 0 {
+        if let Some(mut manifest) = Manifest::load(feature_dir)? {
+            manifest.refreshed_files += refreshed;
+            manifest.last_refresh = Some(
+                SystemTime::now()
+                    .duration_since(UNIX_EPOCH)
+                    .map(|d| d.as_secs())
+                    .unwrap_or(0),
+            );
+            manifest.save(feature_dir)?;
+        }
+    }
+    println!(
+        "Refreshed {} of {} translation unit(s) in {} ms",
+        refreshed,
+        selected.len(),
+        start.elapsed().as_millis()
+    );
+    Ok(())
+}
+
+/// Preprocess and transform one unit next to its output, then rename it into place.
+/// Returns the files the source includes and the hash of the output before
+/// transforming, which the next build compares its output with.
+fn refresh_unit(
+    project_root: &Path,
+    unit: &Unit,
+    plugins: &[Plugin],
+) -> Result<(Vec<PathBuf>, u64)> {
+    let sibling = |suffix: &str| {
+        let mut path = unit.job.output.clone().into_os_string();
+        path.push(suffix);
+        PathBuf::from(path)
+    };
+    let tmp = sibling(".watch");
+    let depfile = sibling(".watch.d");
+
+    let result = (|| {
+        unit.job.run_to(&tmp, Some(&depfile), &Priority::default())?;
+        let deps = parse_depfile(&fs::read_to_string(&depfile)?, &unit.job.cwd);
+        let hash = outputs::hash_file(&tmp)?;
+        transform::transform_in_place(project_root, &tmp, plugins)?;
+        fs::rename(&tmp, &unit.job.output)?;
+        chunks::update_existing(&unit.job.output)?;
+        Ok((deps, hash))
+    })();
+
+    let _ = fs::remove_file(&depfile);
+    if result.is_err() {
+        let _ = fs::remove_file(&tmp);
+    }
+    result
+}
+
+/// The recorded translation units whose preprocessed output still exists below
+/// `c_dir` (files dropped by the selection are not brought back)
+fn load_units(store: &Store, c_dir: &Path) -> Vec<Unit> {
+    let deps: HashMap<&str, &[u8]> = store.scan(DEPS_PREFIX).into_iter().collect();
+
+    store
+        .scan(TU_PREFIX)
+        .into_iter()
+        .filter_map(|(key, value)| {
+            let tu = TuRecord::parse(value)?;
+            let output = c_dir.join(format!("{}2rust", key));
+            if !output.is_file() {
+                return None;
+            }
+            let deps = deps
+                .get(key)
+                .map(|value| {
+                    String::from_utf8_lossy(value)
+                        .lines()
+                        .filter(|line| !line.is_empty())
+                        .map(PathBuf::from)
+                        .collect()
+                })
+                .unwrap_or_default();
+            Some(Unit {
+                key: key.to_string(),
+                job: PreprocessJob {
+                    cwd: tu.cwd,
+                    compiler: tu.compiler,
+                    source: tu.source,
+                    output,
+                },
+                deps,
+            })
+        })
+        .collect()
+}
+
+/// The transform plugins the feature was built with, from its manifest
+fn load_plugins(feature_dir: &Path) -> Result<Vec<Plugin>> {
+    match Manifest::load(feature_dir)? {
+        Some(manifest) => manifest.transforms.iter().map(|spec| Plugin::parse(spec)).collect(),
+        None => Ok(Vec::new()),
+    }
+}
+
+/// Indices of the units that include one of `changed`, or whose source changed
+fn affected_units(units: &[Unit], changed: &HashSet<PathBuf>) -> Vec<usize> {
+    units
+        .iter()
+        .enumerate()
+        .filter(|(_, unit)| {
+            changed.contains(&unit.job.source) || unit.deps.iter().any(|dep| changed.contains(dep))
+        })
+        .map(|(i, _)| i)
+        .collect()
+}
+
+fn watch_units(inotify: &mut Inotify, project_root: &Path, units: &[Unit]) -> Result<()> {
+    for unit in units {
+        for file in unit.watched_files(project_root) {
+            if let Some(dir) = file.parent() {
+                inotify.watch(dir)?;
+            }
+        }
+    }
+    Ok(())
+}
+
+/// Parse a Makefile-style dependency file written with `-MD -MF`. Relative paths
+/// are resolved against the compiler's working directory and canonicalized, to
+/// match the paths inotify reports for the watched directories.
+fn parse_depfile(content: &str, cwd: &Path) -> Vec<PathBuf> {
+    let content = content.replace("\\\n", " ");
+    let mut deps = Vec::new();
+    for line in content.lines() {
+        // `-MT tu` makes the target name known; `-MP` style phony targets have no
+        // prerequisites and are skipped the same way
+        let Some((_, prerequisites)) = line.split_once(": ") else {
+            continue;
+        };
+        let mut current = String::new();
+        let mut chars = prerequisites.chars().peekable();
+        while let Some(c) = chars.next() {
+            match c {
+                '\\' if chars.peek() == Some(&' ') => current.push(chars.next().unwrap()),
+                '$' if chars.peek() == Some(&'$') => current.push(chars.next().unwrap()),
+                c if c.is_whitespace() => {
+                    if !current.is_empty() {
+                        deps.push(std::mem::take(&mut current));
+                    }
+                }
+                c => current.push(c),
+            }
+        }
+        if !current.is_empty() {
+            deps.push(current);
+        }
+    }
+
+    let mut seen = HashSet::new();
+    deps.into_iter()
+        .map(|dep| {
+            let path = cwd.join(dep);
+            fs::canonicalize(&path).unwrap_or(path)
+        })
+        .filter(|path| seen.insert(path.clone()))
+        .collect()
+}
+
+/// Result of waiting for changes
+#[derive(Debug, PartialEq)]
+enum Changes {
+    Paths(HashSet<PathBuf>),
+    /// The event queue overflowed; any watched file may have changed
+    Overflow,
+}
+
+/// Directory watches on an inotify instance. Directories are watched rather than
+/// files so that editors replacing a file through a rename are noticed.
+struct Inotify {
+    fd: OwnedFd,
+    /// Watch descriptor -> watched directory
+    dirs: HashMap<i32, PathBuf>,
+    watched: HashSet<PathBuf>,
+}
+
+impl Inotify {
+    fn new() -> Result<Inotify> {
+        let fd = unsafe { libc::inotify_init1(libc::IN_CLOEXEC | libc::IN_NONBLOCK) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error().into());
+        }
+        Ok(Inotify {
+            fd: unsafe { OwnedFd::from_raw_fd(fd) },
+            dirs: HashMap::new(),
+            watched: HashSet::new(),
+        })
+    }
+
+    /// Watch `dir` unless already watched; a directory that vanished is skipped
+    fn watch(&mut self, dir: &Path) -> Result<()> {
+        if self.watched.contains(dir) {
+            return Ok(());
+        }
+        let path = CString::new(dir.as_os_str().as_bytes())
+            .map_err(|e| io::Error::new(io::ErrorKind::InvalidInput, e))?;
+        let wd = unsafe { libc::inotify_add_watch(self.fd.as_raw_fd(), path.as_ptr(), WATCH_MASK) };
+        if wd < 0 {
+            let err = io::Error::last_os_error();
+            if err.kind() == io::ErrorKind::NotFound {
+                return Ok(());
+            }
+            return Err(err.into());
+        }
+        self.dirs.insert(wd, dir.to_path_buf());
+        self.watched.insert(dir.to_path_buf());
+        Ok(())
+    }
+
+    /// Block until something changes, then collect changes until none arrived for
+    /// `DEBOUNCE` (or for at most `MAX_DELAY`)
+    fn wait_for_changes(&mut self) -> Result<Changes> {
+        let mut paths = HashSet::new();
+        let mut overflow = false;
+        let mut deadline: Option<Instant> = None;
+
+        loop {
+            let timeout = match deadline {
+                None => None,
+                Some(deadline) => {
+                    let now = Instant::now();
+                    if now >= deadline {
+                        break;
+                    }
+                    Some(DEBOUNCE.min(deadline - now))
+                }
+            };
+            if !self.poll(timeout)? {
+                // Quiet for a full debounce period
+                if !paths.is_empty() || overflow {
+                    break;
+                }
+                continue;
+            }
+            overflow |= self.read_events(&mut paths)?;
+            if deadline.is_none() && (!paths.is_empty() || overflow) {
+                deadline = Some(Instant::now() + MAX_DELAY);
+            }
+        }
+
+        Ok(if overflow {
+            Changes::Overflow
+        } else {
+            Changes::Paths(paths)
+        })
+    }
+
+    /// Wait until events are readable; `None` waits indefinitely
+    fn poll(&self, timeout: Option<Duration>) -> Result<bool> {
+        let mut pfd = libc::pollfd {
+            fd: self.fd.as_raw_fd(),
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let timeout = timeout.map_or(-1, |t| t.as_millis().min(i32::MAX as u128) as i32);
+        loop {
+            let ready = unsafe { libc::poll(&mut pfd, 1, timeout) };
+            if ready >= 0 {
+                return Ok(ready > 0);
+            }
+            let err = io::Error::last_os_error();
+            if err.kind() != io::ErrorKind::Interrupted {
+                return Err(err.into());
+            }
+        }
+    }
+
+    /// Drain the pending events into `paths`; returns whether the queue overflowed
+    fn read_events(&mut self, paths: &mut HashSet<PathBuf>) -> Result<bool> {
+        let mut buffer = [0u8; 64 * 1024];
+        let mut overflow = false;
+        loop {
+            let n = unsafe {
+                libc::read(
+                    self.fd.as_raw_fd(),
+                    buffer.as_mut_ptr() as *mut libc::c_void,
+                    buffer.len(),
+                )
+            };
+            if n < 0 {
+                let err = io::Error::last_os_error();
+                match err.kind() {
+                    io::ErrorKind::WouldBlock => return Ok(overflow),
+                    io::ErrorKind::Interrupted => continue,
+                    _ => return Err(err.into()),
+                }
+            }
+            for (wd, mask, name) in parse_events(&buffer[..n as usize]) {
+                if mask & libc::IN_Q_OVERFLOW != 0 {
+                    overflow = true;
+                } else if mask & libc::IN_IGNORED != 0 {
+                    // The directory was removed; watch it again if it comes back
+                    if let Some(dir) = self.dirs.remove(&wd) {
+                        self.watched.remove(&dir);
+                    }
+                } else if let (Some(dir), Some(name)) = (self.dirs.get(&wd), name) {
+                    paths.insert(dir.join(name));
+                }
+            }
+        }
+    }
+}
+
+/// Split a buffer read from an inotify descriptor into `(wd, mask, name)` events
+fn parse_events(buffer: &[u8]) -> Vec<(i32, u32, Option<&OsStr>)> {
+    const HEADER: usize = std::mem::size_of::<libc::inotify_event>();
+    let mut events = Vec::new();
+    let mut pos = 0;
+    while pos + HEADER <= buffer.len() {
+        let event: libc::inotify_event =
+            unsafe { std::ptr::read_unaligned(buffer[pos..].as_ptr() as *const libc::inotify_event) };
+        let name_start = pos + HEADER;
+        let name_end = (name_start + event.len as usize).min(buffer.len());
+        // The name is padded with NULs
+        let name = &buffer[name_start..name_end];
+        let name = &name[..name.iter().position(|&b| b == 0).unwrap_or(name.len())];
+        events.push((
+            event.wd,
+            event.mask,
+            (!name.is_empty()).then(|| OsStr::from_bytes(name)),
+        ));
+        pos = name_end;
+    }
+    events
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tempfile::TempDir;
+
+    fn unit(root: &Path, name: &str, deps: &[&str]) -> Unit {
+        Unit {
+            key: format!("src/{}", name),
+            job: PreprocessJob {
+                cwd: root.to_path_buf(),
+                compiler: "cc".to_string(),
+                source: root.join("src").join(name),
+                output: root.join(".c2rust/default/c/src").join(format!("{}2rust", name)),
+            },
+            deps: deps.iter().map(|d| root.join(d)).collect(),
+        }
+    }
+
+    #[test]
+    fn test_parse_depfile() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path().canonicalize().unwrap();
+        fs::create_dir_all(root.join("include")).unwrap();
+        fs::write(root.join("a.c"), "").unwrap();
+        fs::write(root.join("include").join("a b.h"), "").unwrap();
+
+        let content = "tu: a.c include/a\\ b.h \\\n /usr/include/stdio.h \\\n  include/../a.c\n\
+                       include/a\\ b.h:\n";
+        assert_eq!(
+            parse_depfile(content, &root),
+            vec![
+                root.join("a.c"),
+                root.join("include").join("a b.h"),
+                PathBuf::from("/usr/include/stdio.h"),
+            ]
+        );
+        assert!(parse_depfile("", &root).is_empty());
+    }
+
+    #[test]
+    fn test_affected_units_and_watched_files() {
+        let root = PathBuf::from("/proj");
+        let units = vec![
+            unit(&root, "a.c", &["src/a.c", "include/common.h", "/usr/include/stdio.h"]),
+            unit(&root, "b.c", &["src/b.c", "include/b.h"]),
+            unit(&root, "c.c", &[]),
+        ];
+
+        let changed: HashSet<PathBuf> = [root.join("include/common.h")].into();
+        assert_eq!(affected_units(&units, &changed), vec![0]);
+        let changed: HashSet<PathBuf> = [root.join("src/c.c"), root.join("include/b.h")].into();
+        assert_eq!(affected_units(&units, &changed), vec![1, 2]);
+
+        // System headers are not watched; unindexed units watch their source
+        let watched: Vec<&Path> = units[0].watched_files(&root).collect();
+        assert_eq!(watched, vec![root.join("src/a.c"), root.join("include/common.h")]);
+        let watched: Vec<&Path> = units[2].watched_files(&root).collect();
+        assert_eq!(watched, vec![root.join("src/c.c")]);
+    }
+
+    #[test]
+    fn test_load_units_skips_unselected_outputs() {
+        let temp_dir = TempDir::new().unwrap();
+        let root = temp_dir.path();
+        let feature_dir = root.join(".c2rust").join("default");
+        let c_dir = feature_dir.join("c");
+        fs::create_dir_all(c_dir.join("src")).unwrap();
+        fs::write(c_dir.join("src").join("a.c2rust"), "int a;\n").unwrap();
+
+        let mut store = Store::open(&feature_dir).unwrap();
+        let mut txn = Transaction::default();
+        let r = root.display();
+        txn.put("tu/src/a.c", format!("{r}\tgcc\t{r}/src/a.c\t\"-DA\" "));
+        txn.put("tu/src/b.c", format!("{r}\tgcc\t{r}/src/b.c\t\"-DB\" "));
+        txn.put("deps/src/a.c", format!("{r}/src/a.c\n{r}/src/a.h"));
+        store.commit(txn).unwrap();
+
+        let units = load_units(&store, &c_dir);
+        assert_eq!(units.len(), 1);
+        assert_eq!(units[0].key, "src/a.c");
+        assert_eq!(units[0].job.output, c_dir.join("src").join("a.c2rust"));
+        assert_eq!(units[0].deps, vec![root.join("src/a.c"), root.join("src/a.h")]);
+        // The dependencies do not exist, so the output counts as stale
+        assert!(units[0].is_stale());
+    }
+
+    #[test]
+    fn test_inotify_reports_writes_and_renames() {
+        let temp_dir = TempDir::new().unwrap();
+        let dir = temp_dir.path().canonicalize().unwrap();
+        let mut inotify = Inotify::new().unwrap();
+        inotify.watch(&dir).unwrap();
+        inotify.watch(&dir.join("missing")).unwrap();
+        assert_eq!(inotify.dirs.len(), 1);
+
+        fs::write(dir.join("a.h"), "#define A 1\n").unwrap();
+        fs::write(dir.join("b.h.tmp"), "#define B 1\n").unwrap();
+        fs::rename(dir.join("b.h.tmp"), dir.join("b.h")).unwrap();
+
+        let Changes::Paths(paths) = inotify.wait_for_changes().unwrap() else {
+            panic!("unexpected overflow");
+        };
+        assert!(paths.contains(&dir.join("a.h")));
+        assert!(paths.contains(&dir.join("b.h")));
+    }
+}
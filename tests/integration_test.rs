@@ -284,3 +284,38 @@ fn test_target_selection_integration() {
     assert_eq!(lines[1], "lib/libfoo.a");
     assert_eq!(lines[2], "lib/libbar.so");
 }
+
+#[test]
+fn test_export_import_roundtrip() {
+    let source = TempDir::new().unwrap();
+    let feature_dir = source.path().join(".c2rust").join("default").join("c");
+    fs::create_dir_all(feature_dir.join("src")).unwrap();
+    fs::write(feature_dir.join("targets.list"), "app\n").unwrap();
+    fs::write(feature_dir.join("src").join("main.c.c2rust"), "int main;\n").unwrap();
+
+    let bundle = source.path().join("default.c2rb");
+    let mut cmd = Command::new(assert_cmd::cargo::cargo_bin!("c2rust-build"));
+    cmd.arg("export")
+        .arg("-o")
+        .arg(&bundle)
+        .current_dir(source.path());
+    cmd.assert()
+        .success()
+        .stdout(predicate::str::contains("Exported 2 file(s)"));
+
+    let destination = TempDir::new().unwrap();
+    let mut cmd = Command::new(assert_cmd::cargo::cargo_bin!("c2rust-build"));
+    cmd.arg("import").arg(&bundle).current_dir(destination.path());
+    cmd.assert()
+        .success()
+        .stdout(predicate::str::contains("Imported 2 file(s) into feature 'default'"));
+
+    let imported = destination
+        .path()
+        .join(".c2rust")
+        .join("default")
+        .join("c")
+        .join("src")
+        .join("main.c.c2rust");
+    assert_eq!(fs::read_to_string(imported).unwrap(), "int main;\n");
+}